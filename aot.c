@@ -0,0 +1,406 @@
+/**
+ * Ahead-of-time translator. Reads an assembled guest image, splits it into
+ * basic blocks at the targets of BEQ/BNE/BRN, and writes a C file with one
+ * function for the whole image (see aot.h for what the function does and
+ * what it leaves to the functional model). The output is compiled with the
+ * include directory on its path and linked against libprocessor:
+ *
+ *   ./aot -n guest -o guest.c guest.u
+ *   gcc -O2 -Iinclude -c guest.c
+ *
+ * Usage: aot [-s] [-b base] [-n name] [-o output] input
+ *
+ * -s reads assembly source instead of an image. The image is loaded at
+ * `base`, STARTING_OFFSET by default, and the function is called `name`.
+ */
+
+#include "processor.h"
+#include "assembler.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct aot_instr {
+	word_t pc;
+	struct instr in;			// operands reordered by instr_to_signal()
+	struct signal sig;
+	unsigned char translated;	// else left to functional_step()
+	unsigned char leader;		// starts a translated block
+	unsigned char branch;		// branch with a static target
+	word_t target;
+};
+
+// ==================
+//	    ANALYSIS
+// ==================
+
+/**
+ * Returns nonzero if the instruction reads `reg` as one of the operands its
+ * signal actually uses
+ */
+static int reads_reg(const struct aot_instr* ai, unsigned char reg) {
+	const struct instr* in = &ai->in;
+	const struct signal* sig = &ai->sig;
+	if (!in->imm_flag && in->src2 == reg) {
+		return 1;
+	}
+	if (sig->alu_op != ALU_PASS && in->src1 == reg) {
+		return 1;
+	}
+	if (sig->block && (in->dest == reg || in->src1 == reg)) {
+		return 1;
+	}
+	return sig->mem_write && !sig->vector && !sig->block && in->dest == reg;
+}
+
+/**
+ * Decodes the instruction at `pc` and decides whether it can be translated.
+ * Anything functional_step() would fault on, or that reaches the PC or flag
+ * in a way the translation does not model, is left to functional_step().
+ */
+static void analyze(const char* word, word_t pc, struct aot_instr* ai) {
+	*ai = (struct aot_instr) { .pc = pc, .in = read_be_instr((char*) word) };
+	struct instr* in = &ai->in;
+	if (in->opcode >= NUM_OPCODES || verify_reg(in->dest) || verify_reg(in->src1)
+			|| (!in->imm_flag && verify_reg(in->src2))) {
+		return;
+	}
+	ai->sig = instr_to_signal(in);
+	const struct signal* sig = &ai->sig;
+	if (!sig->valid || sig->halt || (sig->vector && in->dest + VECTOR_WORDS > PC) || reads_reg(ai, FLAG)) {
+		return;
+	}
+
+	if (sig->branch) {
+		// Only `OP pc, #offset`, which is what labels assemble to
+		if (in->src1 != PC || !in->imm_flag) {
+			return;
+		}
+		ai->branch = 1;
+		ai->target = pc + (word_t) in->src2;
+	} else if (sig->reg_write && (in->dest == PC || (in->dest == FLAG && in->opcode != CMP))) {
+		return;
+	}
+	ai->translated = 1;
+}
+
+/**
+ * Returns the index of the instruction at `pc`, or -1 if it is not one of
+ * the `n` instructions loaded at `base`
+ */
+static int instr_index(word_t pc, word_t base, int n) {
+	if (pc < base || (pc - base) % sizeof(struct instr)) {
+		return -1;
+	}
+	word_t index = (pc - base) / sizeof(struct instr);
+	return (index < (word_t) n) ? (int) index : -1;
+}
+
+static void find_leaders(struct aot_instr* instrs, int n, word_t base) {
+	for (int i = 0; i < n; i++) {
+		struct aot_instr* ai = &instrs[i];
+		if (!ai->translated) {
+			continue;
+		}
+		if (i == 0 || !instrs[i - 1].translated || instrs[i - 1].branch) {
+			ai->leader = 1;
+		}
+		int target = ai->branch ? instr_index(ai->target, base, n) : -1;
+		if (target >= 0 && instrs[target].translated) {
+			instrs[target].leader = 1;
+		}
+	}
+}
+
+// ==================
+//	    EMISSION
+// ==================
+
+static const char* operand(unsigned char reg, word_t pc, char* buf) {
+	if (reg == PC) {
+		sprintf(buf, "0x%xu", pc);
+	} else {
+		sprintf(buf, "r%d", reg);
+	}
+	return buf;
+}
+
+static const char* src2_operand(const struct instr* in, word_t pc, char* buf) {
+	if (in->imm_flag) {
+		sprintf(buf, "0x%xu", (word_t) in->src2);
+		return buf;
+	}
+	return operand(in->src2, pc, buf);
+}
+
+/**
+ * Writes the C expression alu_compute() would evaluate, as a word
+ */
+static void alu_expr(FILE* out, unsigned char alu_op, const char* a, const char* b) {
+	switch (alu_op) {
+		case ALU_PASS:	fprintf(out, "%s", b); break;
+		case ALU_ADD:	fprintf(out, "(word_t) (%s + %s)", a, b); break;
+		case ALU_SUB:	fprintf(out, "(word_t) (%s - %s)", a, b); break;
+		case ALU_AND:	fprintf(out, "(%s & %s)", a, b); break;
+		case ALU_OR:	fprintf(out, "(%s | %s)", a, b); break;
+		case ALU_XOR:	fprintf(out, "(%s ^ %s)", a, b); break;
+		case ALU_PADDB:	fprintf(out, "packed_add8(%s, %s)", a, b); break;
+		case ALU_PSUBB:	fprintf(out, "packed_sub8(%s, %s)", a, b); break;
+		case ALU_PADDH:	fprintf(out, "packed_add16(%s, %s)", a, b); break;
+		case ALU_PSUBH:	fprintf(out, "packed_sub16(%s, %s)", a, b); break;
+		case ALU_MUL:	fprintf(out, "(word_t) (%s * %s)", a, b); break;
+		case ALU_MULH:
+			fprintf(out, "(word_t) (((int64_t) (int32_t) %s * (int32_t) %s) >> 32)", a, b);
+			break;
+		case ALU_SHL:	fprintf(out, "(word_t) (%s << (%s & 31))", a, b); break;
+		case ALU_SHR:	fprintf(out, "(%s >> (%s & 31))", a, b); break;
+		case ALU_SAR:	fprintf(out, "(word_t) ((int32_t) %s >> (%s & 31))", a, b); break;
+		default:
+			fprintf(out, "(word_t) alu_compute(%s, %s, %s)", op_to_str(alu_op), a, b);
+	}
+}
+
+/**
+ * Writes the statements for a translated instruction, the `index`th of a
+ * block of `len`. Faults give back the rest of the block.
+ */
+static void emit_instr(FILE* out, const struct aot_instr* ai, int index, int len) {
+	const struct instr* in = &ai->in;
+	const struct signal* sig = &ai->sig;
+	word_t pc = ai->pc;
+	int undone = len - index;
+	char dest[16], a[16], b[16];
+	operand(in->dest, pc, dest);
+	operand(in->src1, pc, a);
+	src2_operand(in, pc, b);
+
+	// Only a register divisor can be zero at run time
+	if ((sig->alu_op == ALU_DIV || sig->alu_op == ALU_REM) && !(in->imm_flag && in->src2)) {
+		fprintf(out, "\tAOT_CHECK(verify_divisor(%s, %s), 0x%x, %d);\n", op_to_str(sig->alu_op), b, pc, undone);
+	}
+
+	if (sig->branch) {
+		fprintf(out, "\tif (");
+		if (in->opcode == BRN) {
+			fprintf(out, "1");
+		} else {
+			fprintf(out, "flag %s 0", (in->opcode == BEQ) ? "==" : "!=");
+		}
+		fprintf(out, ") ");
+	} else if (sig->block) {
+		fprintf(out, "\tAOT_CHECK(block_memory_op(data, %d, %s, %s, %s), 0x%x, %d);\n",
+				sig->mem_read, dest, a, b, pc, undone);
+		return;
+	} else if (sig->vector) {
+		fprintf(out, "\taddr_ = (word_t) (%s + %s);\n", a, b);
+		fprintf(out, "\tAOT_CHECK(verify_in_bounds(addr_) | verify_in_bounds(addr_ + %d), 0x%x, %d);\n",
+				(int) ((VECTOR_WORDS - 1) * sizeof(word_t)), pc, undone);
+		if (sig->mem_read) {
+			fprintf(out, "\tmemcpy(vec_, &data[addr_], sizeof(vec_));\n");
+			for (int i = 0; i < VECTOR_WORDS; i++) {
+				fprintf(out, "\tr%d = vec_[%d];\n", in->dest + i, i);
+			}
+		} else {
+			for (int i = 0; i < VECTOR_WORDS; i++) {
+				fprintf(out, "\tvec_[%d] = r%d;\n", i, in->dest + i);
+			}
+			fprintf(out, "\tmemcpy(&data[addr_], vec_, sizeof(vec_));\n");
+		}
+		return;
+	} else if (sig->mem_read) {
+		fprintf(out, "\tAOT_CHECK(load_word(&proc->devices, data, (word_t) (%s + %s), &value_), 0x%x, %d);\n",
+				a, b, pc, undone);
+		fprintf(out, "\t%s = value_;\n", dest);
+		return;
+	} else if (sig->mem_write) {
+		fprintf(out, "\tAOT_CHECK(store_word(&proc->devices, data, (word_t) (%s + %s), %s), 0x%x, %d);\n",
+				a, b, dest, pc, undone);
+		return;
+	} else if (in->dest == FLAG) {
+		fprintf(out, "\tflag = (int64_t) ");
+	} else {
+		fprintf(out, "\t%s = ", dest);
+	}
+
+	if (sig->branch) {
+		return;
+	}
+	alu_expr(out, sig->alu_op, a, b);
+	fprintf(out, ";\n");
+}
+
+/**
+ * Writes the jump taken by a branch, or out of a block into `target`
+ */
+static void emit_jump(FILE* out, const struct aot_instr* instrs, int n, word_t base, word_t target) {
+	int index = instr_index(target, base, n);
+	if (index >= 0 && instrs[index].leader) {
+		fprintf(out, "goto L_%04x;\n", target);
+	} else {
+		fprintf(out, "AOT_JUMP(0x%xu);\n", target);
+	}
+}
+
+static void emit_lower(FILE* out, const char* str) {
+	for (; *str; str++) {
+		fputc(tolower((unsigned char) *str), out);
+	}
+}
+
+static void emit_comment(FILE* out, const struct aot_instr* ai) {
+	fprintf(out, "\t// 0x%04x: ", ai->pc);
+	emit_lower(out, opcode_to_str(ai->in.opcode));
+	fprintf(out, "%s\n", ai->translated ? "" : " (interpreted)");
+}
+
+static void translate(FILE* out, const char* image, size_t size, word_t base,
+					  const char* name, const char* input) {
+	int n = size / sizeof(struct instr);
+	struct aot_instr* instrs = malloc((n + 1) * sizeof(struct aot_instr));
+	for (int i = 0; i < n; i++) {
+		analyze(image + i * sizeof(struct instr), base + i * sizeof(struct instr), &instrs[i]);
+	}
+	find_leaders(instrs, n, base);
+
+	fprintf(out, "// Translated from %s by aot. Do not edit.\n\n", input);
+	fprintf(out, "#include \"aot.h\"\n\n");
+	fprintf(out, "AOT_FUNCTION(%s) {\n", name);
+	fprintf(out, "\tAOT_PROLOGUE();\n\n");
+
+	fprintf(out, "dispatch:\n");
+	fprintf(out, "\tswitch (proc->regs[PC]) {\n");
+	for (int i = 0; i < n; i++) {
+		if (instrs[i].leader) {
+			fprintf(out, "\t\tcase 0x%x: goto L_%04x;\n", instrs[i].pc, instrs[i].pc);
+		}
+	}
+	fprintf(out, "\t\tdefault: goto interpret;\n");
+	fprintf(out, "\t}\n");
+
+	for (int i = 0; i < n; ) {
+		if (!instrs[i].translated) {
+			i++;
+			continue;
+		}
+		int len = 1;
+		while (i + len < n && instrs[i + len].translated && !instrs[i + len].leader
+				&& !instrs[i + len - 1].branch) {
+			len++;
+		}
+
+		fprintf(out, "\nL_%04x:\n", instrs[i].pc);
+		fprintf(out, "\tAOT_BLOCK(0x%x, %d);\n", instrs[i].pc, len);
+		for (int j = 0; j < len; j++) {
+			const struct aot_instr* ai = &instrs[i + j];
+			emit_comment(out, ai);
+			emit_instr(out, ai, j, len);
+			if (ai->branch) {
+				emit_jump(out, instrs, n, base, ai->target);
+			}
+		}
+
+		// Fall through into the next block, or leave for the interpreter
+		i += len;
+		word_t next = base + i * sizeof(struct instr);
+		if (i == n || !instrs[i].leader) {
+			fprintf(out, "\t");
+			emit_jump(out, instrs, n, base, next);
+		}
+	}
+
+	fprintf(out, "\n");
+	fprintf(out, "\tAOT_INTERPRETER()\n");
+	fprintf(out, "\tAOT_EPILOGUE()\n");
+	fprintf(out, "}\n");
+	free(instrs);
+}
+
+// ===============
+//		 DRIVER
+// ===============
+
+static char* read_file(const char* path, size_t* size) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char* buf = malloc(len + 1);
+	if (buf && fread(buf, 1, len, file) != (size_t) len) {
+		free(buf);
+		buf = NULL;
+	}
+	if (buf) {
+		buf[len] = '\0';
+		*size = len;
+	}
+	fclose(file);
+	return buf;
+}
+
+int main(int argc, char** argv) {
+	const char* usage = "usage: %s [-s] [-b base] [-n name] [-o output] input\n";
+	const char* name = "translated";
+	const char* output = NULL;
+	word_t base = STARTING_OFFSET;
+	int source = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "sb:n:o:")) != -1) {
+		switch (opt) {
+			case 's':
+				source = 1;
+				break;
+			case 'b':
+				base = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				name = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, usage, argv[0]);
+		return 2;
+	}
+
+	const char* input = argv[optind];
+	size_t size;
+	char* buf = read_file(input, &size);
+	if (!buf) {
+		perror(input);
+		return 1;
+	}
+	struct asm_result assembled = { 0 };
+	const char* image = buf;
+	if (source) {
+		if (assemble(buf, &assembled)) {
+			fprintf(stderr, "%s: assembly failed\n", input);
+			free(buf);
+			return 1;
+		}
+		image = (const char*) assembled.image;
+		size = assembled.size;
+	}
+
+	FILE* out = output ? fopen(output, "w") : stdout;
+	if (!out) {
+		perror(output);
+		return 1;
+	}
+	translate(out, image, size, base, name, input);
+	if (output) {
+		fclose(out);
+	}
+	free_asm_result(&assembled);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,124 @@
+#include "processor.h"
+#include "functional.h"
+#include "assembler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Written by `aot -s -n aot_program` from aot_test.s
+int aot_program(struct processor* proc, uint64_t count, uint64_t* executed);
+
+static char translated_data[MEM_SIZE];
+static char reference_data[MEM_SIZE];
+static struct ememory translated_memory = { .data = translated_data };
+static struct ememory reference_memory = { .data = reference_data };
+
+static struct asm_result image;
+
+static void load_image() {
+	FILE* file = fopen("aot_test.s", "rb");
+	assert(file);
+	static char source[1 << 16];
+	size_t len = fread(source, 1, sizeof(source) - 1, file);
+	fclose(file);
+	source[len] = '\0';
+	assert(assemble(source, &image) == 0);
+}
+
+static struct processor new_program(struct ememory* memory) {
+	memset(memory->data, 0, MEM_SIZE);
+	memcpy(memory->data + STARTING_OFFSET, image.image, image.size);
+	struct processor proc = new_processor(memory);
+	proc.regs[PC] = STARTING_OFFSET;
+	return proc;
+}
+
+static void assert_same_state(struct processor* a, struct processor* b) {
+	assert(memcmp(a->regs, b->regs, sizeof(a->regs)) == 0);
+	assert(a->flag == b->flag);
+	assert(a->pipeline_ctrl.halted == b->pipeline_ctrl.halted);
+	assert(memcmp(a->memory->data, b->memory->data, MEM_SIZE) == 0);
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_matches_functional() {
+	struct processor translated = new_program(&translated_memory);
+	struct processor reference = new_program(&reference_memory);
+	uint64_t translated_count, reference_count;
+	assert(aot_program(&translated, 1000000, &translated_count) == HALTED);
+	assert(functional_run(&reference, 1000000, 0, &reference_count) == HALTED);
+	assert(translated_count == reference_count);
+	assert_same_state(&translated, &reference);
+
+	// The jump through a register skipped `mov r6, #99`
+	assert(translated.regs[R6] == 165);
+	assert(aot_program(&translated, 10, &translated_count) == HALTED);
+	assert(translated_count == 0);
+}
+
+void test_matches_pipeline() {
+	struct processor translated = new_program(&translated_memory);
+	struct processor reference = new_program(&reference_memory);
+	uint64_t executed;
+	assert(aot_program(&translated, 1000000, &executed) == HALTED);
+	struct stop_reason stop = run_for(&reference, 1000000);
+	assert(stop.reason == STOP_HALT);
+	assert(executed == stop.retired);
+	assert_same_state(&translated, &reference);
+}
+
+void test_budgets() {
+	// Every slice size stops on the same instruction as the functional model,
+	// including in the middle of translated blocks
+	for (uint64_t slice = 1; slice <= 17; slice++) {
+		struct processor translated = new_program(&translated_memory);
+		struct processor reference = new_program(&reference_memory);
+		int translated_status, reference_status;
+		do {
+			uint64_t translated_count, reference_count;
+			translated_status = aot_program(&translated, slice, &translated_count);
+			reference_status = functional_run(&reference, slice, 0, &reference_count);
+			assert(translated_status == reference_status);
+			assert(translated_count == reference_count);
+			assert_same_state(&translated, &reference);
+		} while (translated_status == 0);
+		assert(translated_status == HALTED);
+	}
+}
+
+void test_faults() {
+	word_t fault_pc = STARTING_OFFSET + image.size - 3 * sizeof(struct instr);
+	struct processor proc = new_program(&translated_memory);
+	uint64_t executed;
+
+	// The load faults, and nothing after it runs
+	proc.regs[PC] = fault_pc;
+	proc.regs[R1] = 12;
+	proc.regs[R6] = MEM_SIZE;
+	assert(aot_program(&proc, 100, &executed) == SEGFAULT);
+	assert(executed == 0 && proc.regs[PC] == fault_pc);
+
+	// Loads a zero, then the division faults
+	proc.regs[R6] = 16384;
+	assert(aot_program(&proc, 100, &executed) == INVALID_OP);
+	assert(executed == 1 && proc.regs[PC] == fault_pc + sizeof(struct instr));
+	assert(proc.regs[R0] == 0 && proc.regs[R1] == 12);
+
+	word_t divisor = 4;
+	memcpy(&translated_data[16384], &divisor, sizeof(word_t));
+	proc.regs[PC] = fault_pc;
+	assert(aot_program(&proc, 100, &executed) == HALTED);
+	assert(executed == 3 && proc.regs[R0] == 4 && proc.regs[R1] == 3);
+}
+
+int main() {
+	load_image();
+	test_matches_functional();
+	test_matches_pipeline();
+	test_budgets();
+	test_faults();
+	free_asm_result(&image);
+
+	printf("All tests passed.\n");
+}
@@ -0,0 +1,52 @@
+; Program for aot_test. Covers each kind of instruction the aot tool
+; translates, and each kind it leaves to the functional model.
+	mov r7, #16384
+	mov r1, #0
+	mov r2, #0
+@table				; table[i] = running sum of 3i/2 + 3i%2
+	mul r3, r1, #3
+	div r4, r3, #2
+	rem r5, r3, #2
+	add r2, r2, r4
+	add r2, r2, r5
+	shl r3, r1, #2
+	add r3, r3, r7
+	store r2, r3, #0
+	add r1, r1, #1
+	cmp r1, #32
+	bne table
+	vload r0, r7, #16
+	paddb r0, r0, r1
+	psubh r2, r3, r2
+	sar r0, r0, #1
+	shr r1, r1, #3
+	mulh r3, r2, r0
+	vstore r0, r7, #256
+	mov r4, #64
+	add r5, r7, #512
+	memcpy r5, r7, r4
+	mov r6, #165
+	memset r7, r6, #8
+	mov r5, #8		; jump over the next instruction through a register
+	brn pc, r5
+	mov r6, #99
+	sub r1, r1, #1
+	xor r2, r2, r1
+	or r3, r3, #7
+	and r4, r4, r2
+@count				; count r1 down to 0
+	sub r1, r1, #1
+	cmp r1, #0
+	beq done
+	brn count
+@done
+	load r4, r7, #24
+	psubb r4, r4, r2
+	paddh r4, r4, r3
+	bne fault		; never taken, but makes fault a block
+	halt
+	mov r6, #7		; never runs
+@fault				; entered by the test, faults unless r6 points at a nonzero word
+	load r0, r6, #0
+	div r1, r1, r0
+	halt
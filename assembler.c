@@ -0,0 +1,506 @@
+#include "assembler.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define INSTRUCTION_SIZE	4
+#define MACRO_KEYWORD		".macro"
+#define COMMENT_SYMBOL		';'
+#define MAX_PARTS			8
+
+// ===========================
+//		 STRING HELPERS
+// ===========================
+
+struct strbuf {
+	char* data;
+	size_t len;
+	size_t cap;
+};
+
+static void strbuf_append(struct strbuf* buf, const char* str, size_t len) {
+	if (buf->len + len + 1 > buf->cap) {
+		buf->cap = (buf->len + len + 1) * 2;
+		buf->data = realloc(buf->data, buf->cap);
+	}
+	memcpy(buf->data + buf->len, str, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+static char* copy_str(const char* str, size_t len) {
+	char* res = malloc(len + 1);
+	memcpy(res, str, len);
+	res[len] = '\0';
+	return res;
+}
+
+struct string_map {
+	char** keys;
+	char** values;
+	int len;
+};
+
+static const char* map_get(struct string_map* map, const char* key, size_t key_len) {
+	for (int i = 0; i < map->len; i++) {
+		if (strlen(map->keys[i]) == key_len && !strncmp(map->keys[i], key, key_len)) {
+			return map->values[i];
+		}
+	}
+	return NULL;
+}
+
+static void map_set(struct string_map* map, char* key, char* value) {
+	for (int i = 0; i < map->len; i++) {
+		if (!strcmp(map->keys[i], key)) {
+			free(map->keys[i]);
+			free(map->values[i]);
+			map->keys[i] = key;
+			map->values[i] = value;
+			return;
+		}
+	}
+	map->keys = realloc(map->keys, (map->len + 1) * sizeof(char*));
+	map->values = realloc(map->values, (map->len + 1) * sizeof(char*));
+	map->keys[map->len] = key;
+	map->values[map->len] = value;
+	map->len++;
+}
+
+static void map_free(struct string_map* map) {
+	for (int i = 0; i < map->len; i++) {
+		free(map->keys[i]);
+		free(map->values[i]);
+	}
+	free(map->keys);
+	free(map->values);
+}
+
+/**
+ * Calls `fn` on every token of a line split the way unuasm.py splits on 
+ * DELIMTER_SPLIT: runs of whitespace and single commas are tokens of their 
+ * own, and everything in between is a token. The results are concatenated.
+ */
+static char* map_tokens(const char* line, void (*fn)(struct strbuf*, const char*, size_t, void*), void* ctx) {
+	struct strbuf out = { 0 };
+	strbuf_append(&out, "", 0);
+	const char* p = line;
+	while (*p) {
+		const char* start = p;
+		if (isspace((unsigned char) *p)) {
+			while (*p && isspace((unsigned char) *p)) p++;
+		} else if (*p == ',') {
+			p++;
+		} else {
+			while (*p && !isspace((unsigned char) *p) && *p != ',') p++;
+		}
+		fn(&out, start, p - start, ctx);
+	}
+	return out.data;
+}
+
+/**
+ * Splits on whitespace, treating commas as whitespace when `commas` is set.
+ * Returns the number of parts found (up to MAX_PARTS are stored).
+ */
+static int split_parts(const char* line, int commas, const char** parts, size_t* lens) {
+	int n = 0;
+	const char* p = line;
+	while (*p) {
+		while (*p && (isspace((unsigned char) *p) || (commas && *p == ','))) p++;
+		if (!*p) {
+			break;
+		}
+		const char* start = p;
+		while (*p && !isspace((unsigned char) *p) && !(commas && *p == ',')) p++;
+		if (n < MAX_PARTS) {
+			parts[n] = start;
+			lens[n] = p - start;
+		}
+		n++;
+	}
+	return n;
+}
+
+static int token_is(const char* token, size_t len, const char* str) {
+	return strlen(str) == len && !strncmp(token, str, len);
+}
+
+// ===========================
+//		 SYNTAX PARSING
+// ===========================
+
+struct asm_state {
+	char** lines;
+	int num_lines;
+
+	struct string_map macros;
+	struct string_map loops;
+
+	struct asm_result* result;
+};
+
+static void add_diag(struct asm_state* state, int line, const char* fmt, ...) {
+	struct asm_result* result = state->result;
+	result->diags = realloc(result->diags, (result->num_diags + 1) * sizeof(struct asm_diag));
+	struct asm_diag* diag = &result->diags[result->num_diags++];
+	diag->line = line;
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(diag->message, ASM_DIAG_LEN, fmt, args);
+	va_end(args);
+}
+
+static void split_lines(struct asm_state* state, const char* source) {
+	const char* p = source;
+	while (*p) {
+		const char* end = strchr(p, '\n');
+		size_t len = end ? (size_t) (end - p) : strlen(p);
+		state->lines = realloc(state->lines, (state->num_lines + 1) * sizeof(char*));
+		state->lines[state->num_lines++] = copy_str(p, len);
+		p += len + (end ? 1 : 0);
+	}
+}
+
+static void substitute_macro(struct strbuf* out, const char* token, size_t len, void* ctx) {
+	struct string_map* macros = ctx;
+	const char* value;
+	if (len && token[0] == '#') {
+		value = map_get(macros, token + 1, len - 1);
+		strbuf_append(out, "#", 1);
+		if (value) {
+			strbuf_append(out, value, strlen(value));
+		} else {
+			strbuf_append(out, token + 1, len - 1);
+		}
+	} else if ((value = map_get(macros, token, len))) {
+		strbuf_append(out, value, strlen(value));
+	} else {
+		strbuf_append(out, token, len);
+	}
+}
+
+/**
+ * Mirrors resolve_macros(): strips comments and whitespace, records macro
+ * definitions, and substitutes known macros in a single pass
+ */
+static void resolve_macros(struct asm_state* state) {
+	for (int i = 0; i < state->num_lines; i++) {
+		char* line = state->lines[i];
+		char* comment = strchr(line, COMMENT_SYMBOL);
+		if (comment) {
+			*comment = '\0';
+		}
+
+		char* start = line;
+		while (*start && isspace((unsigned char) *start)) start++;
+		size_t len = strlen(start);
+		while (len && isspace((unsigned char) start[len - 1])) len--;
+		memmove(line, start, len);
+		line[len] = '\0';
+		if (!len) {
+			continue;
+		}
+
+		const char* parts[MAX_PARTS];
+		size_t lens[MAX_PARTS];
+		int n = split_parts(line, 0, parts, lens);
+		if (token_is(parts[0], lens[0], MACRO_KEYWORD)) {
+			if (n < 2) {
+				add_diag(state, i + 1, "missing macro name");
+			} else {
+				// Like split(maxsplit=2), the value is the rest of the line
+				const char* value = (n > 2) ? parts[2] : parts[1];
+				size_t value_len = (n > 2) ? strlen(parts[2]) : lens[1];
+				map_set(&state->macros, copy_str(parts[1], lens[1]), copy_str(value, value_len));
+			}
+		}
+
+		state->lines[i] = map_tokens(line, substitute_macro, &state->macros);
+		free(line);
+	}
+}
+
+static int lookup_opcode(const char* token, size_t len) {
+	for (int code = 0; code < NUM_OPCODES; code++) {
+		const char* name = opcode_to_str(code);
+		if (strlen(name) != len) {
+			continue;
+		}
+		size_t j = 0;
+		while (j < len && token[j] == tolower((unsigned char) name[j])) j++;
+		if (j == len) {
+			return code;
+		}
+	}
+	return -1;
+}
+
+static int lookup_reg(const char* token, size_t len) {
+	for (int reg = R0; reg <= PC; reg++) {
+		const char* name = reg_to_str(reg);
+		if (strlen(name) != len) {
+			continue;
+		}
+		size_t j = 0;
+		while (j < len && token[j] == tolower((unsigned char) name[j])) j++;
+		if (j == len) {
+			return reg;
+		}
+	}
+	return -1;
+}
+
+static int is_word_char(char c) {
+	return isalnum((unsigned char) c) || c == '_';
+}
+
+/**
+ * Mirrors gather_loops_and_instrs(): records label addresses and returns the
+ * indices of lines that start with a valid opcode
+ */
+static int gather_loops_and_instrs(struct asm_state* state, int* instrs) {
+	int num_instrs = 0;
+	for (int i = 0; i < state->num_lines; i++) {
+		const char* line = state->lines[i];
+		if (line[0] == '@' && is_word_char(line[1])) {
+			size_t len = 1;
+			while (is_word_char(line[len + 1])) len++;
+
+			char addr[16];
+			snprintf(addr, sizeof(addr), "%d", num_instrs * INSTRUCTION_SIZE);
+			map_set(&state->loops, copy_str(line + 1, len), copy_str(addr, strlen(addr)));
+			continue;
+		}
+
+		const char* parts[MAX_PARTS];
+		size_t lens[MAX_PARTS];
+		if (split_parts(line, 0, parts, lens) && lookup_opcode(parts[0], lens[0]) >= 0) {
+			instrs[num_instrs++] = i;
+		}
+	}
+	return num_instrs;
+}
+
+struct loop_ctx {
+	struct string_map* loops;
+	int index;
+};
+
+static void substitute_loop(struct strbuf* out, const char* token, size_t len, void* ctx) {
+	struct loop_ctx* loop = ctx;
+	const char* addr = map_get(loop->loops, token, len);
+	if (addr) {
+		char buf[32];
+		int n = snprintf(buf, sizeof(buf), "pc, #%d", -(loop->index * INSTRUCTION_SIZE - atoi(addr)));
+		strbuf_append(out, buf, n);
+	} else {
+		strbuf_append(out, token, len);
+	}
+}
+
+/**
+ * Mirrors resolve_loops(): replaces labels with PC-relative offsets
+ */
+static void resolve_loops(struct asm_state* state, int* instrs, int num_instrs) {
+	for (int i = 0; i < num_instrs; i++) {
+		char* line = state->lines[instrs[i]];
+		struct loop_ctx ctx = { &state->loops, i };
+		state->lines[instrs[i]] = map_tokens(line, substitute_loop, &ctx);
+		free(line);
+	}
+}
+
+// ================================
+//		 INSTRUCTION ASSEMBLY
+// ================================
+
+/**
+ * Parses an immediate like Python's int(). Only the low 16 bits are encoded,
+ * so the value is accumulated modulo 2^16.
+ */
+static int parse_imm(const char* token, size_t len, uint16_t* value) {
+	size_t i = 0;
+	int negative = 0;
+	if (i < len && (token[i] == '+' || token[i] == '-')) {
+		negative = (token[i] == '-');
+		i++;
+	}
+	if (i == len || !isdigit((unsigned char) token[i])) {
+		return -1;
+	}
+
+	uint16_t res = 0;
+	for (; i < len; i++) {
+		if (token[i] == '_' && i + 1 < len && isdigit((unsigned char) token[i + 1])) {
+			continue;
+		}
+		if (!isdigit((unsigned char) token[i])) {
+			return -1;
+		}
+		res = res * 10 + (token[i] - '0');
+	}
+	*value = negative ? -res : res;
+	return 0;
+}
+
+#define ASM_ERROR(...)						\
+	do {									\
+		snprintf(err, ASM_DIAG_LEN, __VA_ARGS__);	\
+		return -1;							\
+	} while (0)
+
+static int get_reg(const char* token, size_t len, int* reg, char* err) {
+	if ((*reg = lookup_reg(token, len)) < 0) {
+		ASM_ERROR("invalid register: \"%.*s\"", (int) len, token);
+	}
+	return 0;
+}
+
+static int get_imm(const char* token, size_t len, uint16_t* imm, char* err) {
+	if (!len || token[0] != '#') {
+		ASM_ERROR("expected immediate: \"%.*s\"", (int) len, token);
+	}
+	if (parse_imm(token + 1, len - 1, imm)) {
+		ASM_ERROR("invalid immediate: \"%.*s\"", (int) len - 1, token + 1);
+	}
+	return 0;
+}
+
+static int get_reg_or_imm(const char* token, size_t len, uint16_t* src2, int* imm_flag, char* err) {
+	if (token[0] == '#') {
+		*imm_flag = 1;
+		return get_imm(token, len, src2, err);
+	}
+	int reg;
+	*imm_flag = 0;
+	if (get_reg(token, len, &reg, err)) {
+		return -1;
+	}
+	*src2 = reg;
+	return 0;
+}
+
+/**
+ * Returns nonzero for opcodes written as `OP dest, src2`
+ */
+static int is_two_operand(int opcode) {
+	switch (opcode) {
+		case MOV:
+		case BRN:
+		case BNE:
+		case BEQ:
+		case CMP:
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Mirrors assemble_instruction(), writing the big-endian encoding to out
+ */
+static int assemble_instruction(const char* instr, unsigned char* out, char* err) {
+	const char* parts[MAX_PARTS];
+	size_t lens[MAX_PARTS];
+	int n = split_parts(instr, 1, parts, lens);
+	int opcode = n ? lookup_opcode(parts[0], lens[0]) : -1;
+	if (strlen(instr) < 3 || (n < 2 && opcode != HALT)) {
+		ASM_ERROR("not enough arguments");
+	}
+
+	int dest = 0, src1 = 0, imm_flag;
+	uint16_t src2 = 0;
+	if (opcode < 0) {
+		ASM_ERROR("invalid opcode in assembly stage: \"%.*s\"", (int) lens[0], parts[0]);
+	}
+	if (opcode != HALT && get_reg(parts[1], lens[1], &dest, err)) {
+		return -1;
+	}
+
+	if (opcode == HALT) {
+		if (n != 1) {
+			ASM_ERROR("invalid number of arguments for %.*s", (int) lens[0], parts[0]);
+		}
+		imm_flag = 1;
+	} else if (is_two_operand(opcode)) {
+		if (n != 3) {
+			ASM_ERROR("invalid number of arguments for %.*s", (int) lens[0], parts[0]);
+		}
+		if (get_reg_or_imm(parts[2], lens[2], &src2, &imm_flag, err)) {
+			return -1;
+		}
+	} else {
+		if (n != 3 && n != 4) {
+			ASM_ERROR("invalid number of arguments for %.*s", (int) lens[0], parts[0]);
+		} else if (n == 4) {
+			if (get_reg(parts[2], lens[2], &src1, err) 
+					|| get_reg_or_imm(parts[3], lens[3], &src2, &imm_flag, err)) {
+				return -1;
+			}
+		} else {
+			// If there's no third operand, it counts as 0, which is an 
+			// immediate
+			imm_flag = 1;
+		}
+	}
+
+	uint32_t result = (uint32_t) (opcode & 0x7F) << 25;
+	result |= (uint32_t) (imm_flag & 0x1) << 24;
+	result |= (uint32_t) (dest & 0xF) << 20;
+	result |= (uint32_t) (src1 & 0xF) << 16;
+	result |= src2;
+
+	out[0] = result >> 24;
+	out[1] = result >> 16;
+	out[2] = result >> 8;
+	out[3] = result;
+	return 0;
+}
+
+// ==============
+//		 API
+// ==============
+
+int assemble(const char* source, struct asm_result* result) {
+	*result = (struct asm_result) { 0 };
+	struct asm_state state = { .result = result };
+
+	split_lines(&state, source);
+	resolve_macros(&state);
+
+	int* instrs = malloc((state.num_lines + 1) * sizeof(int));
+	int num_instrs = gather_loops_and_instrs(&state, instrs);
+	resolve_loops(&state, instrs, num_instrs);
+
+	unsigned char* image = malloc(num_instrs * INSTRUCTION_SIZE + 1);
+	char err[ASM_DIAG_LEN];
+	for (int i = 0; i < num_instrs; i++) {
+		if (assemble_instruction(state.lines[instrs[i]], image + i * INSTRUCTION_SIZE, err)) {
+			add_diag(&state, instrs[i] + 1, "%s", err);
+		}
+	}
+
+	if (result->num_diags) {
+		free(image);
+	} else {
+		result->image = image;
+		result->size = num_instrs * INSTRUCTION_SIZE;
+	}
+
+	for (int i = 0; i < state.num_lines; i++) {
+		free(state.lines[i]);
+	}
+	free(state.lines);
+	free(instrs);
+	map_free(&state.macros);
+	map_free(&state.loops);
+	return result->num_diags;
+}
+
+void free_asm_result(struct asm_result* result) {
+	free(result->image);
+	free(result->diags);
+	*result = (struct asm_result) { 0 };
+}
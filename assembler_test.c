@@ -0,0 +1,54 @@
+#include "assembler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Expected images were produced by unuasm.py from the same source
+
+void test_assemble_program() {
+	const char* source = 
+		".macro COUNT 10\n"
+		"\tmov r1, #COUNT ; counter\n"
+		"@loop\n"
+		"\tsub r1, r1, #1\n"
+		"\tcmp r1, #0\n"
+		"\tbne loop\n"
+		"\tstore r1, r2, r3\n";
+	const unsigned char expected[] = {
+		0x01, 0x10, 0x00, 0x0a, 0x09, 0x11, 0x00, 0x01, 0x11, 0x10, 0x00, 0x00,
+		0x15, 0x80, 0xff, 0xf8, 0x04, 0x12, 0x00, 0x03
+	};
+
+	struct asm_result result;
+	assert(assemble(source, &result) == 0);
+	assert(result.size == sizeof(expected));
+	assert(memcmp(result.image, expected, sizeof(expected)) == 0);
+	free_asm_result(&result);
+}
+
+void test_assemble_immediates_truncate() {
+	struct asm_result result;
+	assert(assemble("mov r0, #-1\nmov r0, #70000", &result) == 0);
+	assert(result.image[2] == 0xff && result.image[3] == 0xff);
+	assert(result.image[6] == 0x11 && result.image[7] == 0x70);
+	free_asm_result(&result);
+}
+
+void test_assemble_diagnostics() {
+	struct asm_result result;
+	assert(assemble("mov r1, #2\nadd r9, r1, r2\nmov r1\n", &result) == 2);
+	assert(result.image == NULL);
+	assert(result.diags[0].line == 2);
+	assert(strcmp(result.diags[0].message, "invalid register: \"r9\"") == 0);
+	assert(result.diags[1].line == 3);
+	assert(strcmp(result.diags[1].message, "invalid number of arguments for mov") == 0);
+	free_asm_result(&result);
+}
+
+int main() {
+	test_assemble_program();
+	test_assemble_immediates_truncate();
+	test_assemble_diagnostics();
+
+	printf("All tests passed.\n");
+}
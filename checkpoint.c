@@ -0,0 +1,356 @@
+#include "checkpoint.h"
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "UNUCKPT"
+#define NUM_PAGES (MEM_SIZE / CHECKPOINT_PAGE_SIZE)
+
+// Worst case RLE output: one control byte per 128 literals
+#define RLE_BOUND (CHECKPOINT_PAGE_SIZE + CHECKPOINT_PAGE_SIZE / 128 + 1)
+
+// Runs shorter than this are stored as literals
+#define RLE_MIN_RUN		3
+#define RLE_MAX_RUN		(255 - 128 + RLE_MIN_RUN)
+#define RLE_MAX_LITERAL	128
+
+enum page_kind {
+	PAGE_ZERO = 0,
+	PAGE_RLE = 1,
+	PAGE_RAW = 2,
+};
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t state_size;
+	uint32_t mem_size;
+	uint32_t page_size;
+	uint32_t reserved;
+	uint64_t image_offset;		// raw checkpoints only
+};
+
+struct checkpoint_state {
+	word_t regs[NUM_REGS];
+	uint64_t flag;
+	struct latches latches[2];
+	unsigned char bank;
+	struct pipeline_ctrl pipeline_ctrl;
+	struct muldiv_unit muldiv;
+	struct pipeline_stats stats;
+	unsigned int features;
+	struct pipeline_shape shape;
+	uint16_t free_head;
+	uint8_t arena;
+	uint32_t mem_size;
+};
+
+// ==================
+//		 RLE
+// ==================
+
+/**
+ * Each control byte c is followed by either:
+ * - c < 128: c + 1 literal bytes
+ * - c >= 128: one byte repeated c - 128 + RLE_MIN_RUN times
+ */
+
+static size_t rle_encode(const unsigned char* in, size_t len, unsigned char* out) {
+	size_t i = 0, o = 0;
+	size_t literal_start = 0;
+	while (i < len) {
+		size_t run = 1;
+		while (i + run < len && in[i + run] == in[i] && run < RLE_MAX_RUN) {
+			run++;
+		}
+		if (run < RLE_MIN_RUN && i - literal_start < RLE_MAX_LITERAL) {
+			i++;
+			continue;
+		}
+
+		// Flush pending literals before a run, or when the literal is full
+		while (literal_start < i) {
+			size_t count = i - literal_start;
+			count = count > RLE_MAX_LITERAL ? RLE_MAX_LITERAL : count;
+			out[o++] = (unsigned char) (count - 1);
+			memcpy(out + o, in + literal_start, count);
+			o += count;
+			literal_start += count;
+		}
+		if (run >= RLE_MIN_RUN) {
+			out[o++] = (unsigned char) (run - RLE_MIN_RUN + 128);
+			out[o++] = in[i];
+			i += run;
+			literal_start = i;
+		}
+	}
+	while (literal_start < len) {
+		size_t count = len - literal_start;
+		count = count > RLE_MAX_LITERAL ? RLE_MAX_LITERAL : count;
+		out[o++] = (unsigned char) (count - 1);
+		memcpy(out + o, in + literal_start, count);
+		o += count;
+		literal_start += count;
+	}
+	return o;
+}
+
+/**
+ * @return	0 if `in` decodes to exactly `len` bytes, else CHECKPOINT_CORRUPT
+ */
+static int rle_decode(const unsigned char* in, size_t in_len, unsigned char* out, size_t len) {
+	size_t i = 0, o = 0;
+	while (i < in_len) {
+		unsigned char c = in[i++];
+		if (c < 128) {
+			size_t count = c + 1;
+			if (i + count > in_len || o + count > len) {
+				return CHECKPOINT_CORRUPT;
+			}
+			memcpy(out + o, in + i, count);
+			i += count;
+			o += count;
+		} else {
+			size_t count = c - 128 + RLE_MIN_RUN;
+			if (i >= in_len || o + count > len) {
+				return CHECKPOINT_CORRUPT;
+			}
+			memset(out + o, in[i++], count);
+			o += count;
+		}
+	}
+	return (o == len) ? 0 : CHECKPOINT_CORRUPT;
+}
+
+// =====================
+//		 HELPERS
+// =====================
+
+static int is_zero_page(const char* page) {
+	static const char zero[CHECKPOINT_PAGE_SIZE];
+	return !memcmp(page, zero, CHECKPOINT_PAGE_SIZE);
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align) {
+	return (value + align - 1) / align * align;
+}
+
+#define WRITE_OR_FAIL(FILE, PTR, SIZE)					\
+	if (fwrite(PTR, 1, SIZE, FILE) != (SIZE)) {			\
+		fclose(FILE);									\
+		return CHECKPOINT_IO_ERROR;						\
+	}
+
+#define READ_OR_FAIL(FILE, PTR, SIZE)					\
+	if (fread(PTR, 1, SIZE, FILE) != (SIZE)) {			\
+		fclose(FILE);									\
+		return CHECKPOINT_CORRUPT;						\
+	}
+
+// ========================
+//		 SAVE/RESTORE
+// ========================
+
+// Features whose state lives outside the processor, in what was attached.
+// A restored processor has nothing attached, so it runs without them.
+#define ATTACHED_FEATURES	(CONFIG_GUARD | CONFIG_PROFILE)
+
+int save_checkpoint(struct processor* proc, const char* path, int flags) {
+	if (proc->smt) {
+		return CHECKPOINT_UNSUPPORTED;
+	}
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		return CHECKPOINT_IO_ERROR;
+	}
+
+	// Zero the padding too, so identical states give identical files
+	struct checkpoint_state state;
+	memset(&state, 0, sizeof(state));
+	memcpy(state.regs, proc->regs, sizeof(state.regs));
+	state.flag = proc->flag;
+	memcpy(state.latches, proc->latches, sizeof(state.latches));
+	state.bank = proc->bank;
+	state.pipeline_ctrl = proc->pipeline_ctrl;
+	state.muldiv = proc->muldiv;
+	state.stats = proc->stats;
+	state.features = proc->features & ~ATTACHED_FEATURES;
+	state.shape = proc->shape;
+	state.free_head = proc->memory->free_head;
+	state.arena = proc->memory->arena;
+	state.mem_size = proc->memory->size;
+
+	struct checkpoint_header header = {
+		.magic = CHECKPOINT_MAGIC,
+		.version = CHECKPOINT_VERSION,
+		.flags = flags & CHECKPOINT_RAW,
+		.state_size = sizeof(state),
+		.mem_size = MEM_SIZE,
+		.page_size = CHECKPOINT_PAGE_SIZE,
+	};
+	if (flags & CHECKPOINT_RAW) {
+		header.image_offset = align_up(sizeof(header) + sizeof(state), sysconf(_SC_PAGESIZE));
+	}
+	WRITE_OR_FAIL(file, &header, sizeof(header));
+	WRITE_OR_FAIL(file, &state, sizeof(state));
+
+	const char* data = proc->memory->data;
+	if (flags & CHECKPOINT_RAW) {
+		// Only nonzero pages are written, the rest are left as holes
+		for (int i = 0; i < NUM_PAGES; i++) {
+			const char* page = data + i * CHECKPOINT_PAGE_SIZE;
+			if (is_zero_page(page)) {
+				continue;
+			}
+			if (fseek(file, header.image_offset + i * CHECKPOINT_PAGE_SIZE, SEEK_SET)) {
+				fclose(file);
+				return CHECKPOINT_IO_ERROR;
+			}
+			WRITE_OR_FAIL(file, page, CHECKPOINT_PAGE_SIZE);
+		}
+		if (fflush(file) || ftruncate(fileno(file), header.image_offset + MEM_SIZE)) {
+			fclose(file);
+			return CHECKPOINT_IO_ERROR;
+		}
+	} else {
+		unsigned char encoded[RLE_BOUND];
+		for (int i = 0; i < NUM_PAGES; i++) {
+			const char* page = data + i * CHECKPOINT_PAGE_SIZE;
+			unsigned char kind = PAGE_ZERO;
+			uint32_t len = 0;
+			const void* payload = NULL;
+			if (!is_zero_page(page)) {
+				len = rle_encode((const unsigned char*) page, CHECKPOINT_PAGE_SIZE, encoded);
+				kind = PAGE_RLE;
+				payload = encoded;
+				if (len >= CHECKPOINT_PAGE_SIZE) {
+					kind = PAGE_RAW;
+					len = CHECKPOINT_PAGE_SIZE;
+					payload = page;
+				}
+			}
+			WRITE_OR_FAIL(file, &kind, sizeof(kind));
+			if (kind != PAGE_ZERO) {
+				WRITE_OR_FAIL(file, &len, sizeof(len));
+				WRITE_OR_FAIL(file, payload, len);
+			}
+		}
+	}
+
+	if (fclose(file)) {
+		return CHECKPOINT_IO_ERROR;
+	}
+	return 0;
+}
+
+static int read_image(FILE* file, const struct checkpoint_header* header, char* data) {
+	if (header->flags & CHECKPOINT_RAW) {
+		if (fseek(file, header->image_offset, SEEK_SET)) {
+			return CHECKPOINT_CORRUPT;
+		}
+		return (fread(data, 1, MEM_SIZE, file) == MEM_SIZE) ? 0 : CHECKPOINT_CORRUPT;
+	}
+
+	unsigned char encoded[RLE_BOUND];
+	for (int i = 0; i < NUM_PAGES; i++) {
+		char* page = data + i * CHECKPOINT_PAGE_SIZE;
+		unsigned char kind;
+		uint32_t len;
+		if (fread(&kind, 1, sizeof(kind), file) != sizeof(kind)) {
+			return CHECKPOINT_CORRUPT;
+		}
+		if (kind == PAGE_ZERO) {
+			memset(page, 0, CHECKPOINT_PAGE_SIZE);
+			continue;
+		}
+		if (fread(&len, 1, sizeof(len), file) != sizeof(len) || len > RLE_BOUND) {
+			return CHECKPOINT_CORRUPT;
+		}
+		if (kind == PAGE_RAW) {
+			if (len != CHECKPOINT_PAGE_SIZE || fread(page, 1, len, file) != len) {
+				return CHECKPOINT_CORRUPT;
+			}
+		} else if (kind == PAGE_RLE) {
+			int err;
+			if (fread(encoded, 1, len, file) != len) {
+				return CHECKPOINT_CORRUPT;
+			}
+			if ((err = rle_decode(encoded, len, (unsigned char*) page, CHECKPOINT_PAGE_SIZE))) {
+				return err;
+			}
+		} else {
+			return CHECKPOINT_CORRUPT;
+		}
+	}
+	return 0;
+}
+
+int restore_checkpoint(struct processor* proc, struct ememory* memory, const char* path, int flags) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return CHECKPOINT_IO_ERROR;
+	}
+
+	struct checkpoint_header header;
+	struct checkpoint_state state;
+	READ_OR_FAIL(file, &header, sizeof(header));
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))) {
+		fclose(file);
+		return CHECKPOINT_BAD_MAGIC;
+	}
+	if (header.version != CHECKPOINT_VERSION) {
+		fclose(file);
+		return CHECKPOINT_BAD_VERSION;
+	}
+	if (header.state_size != sizeof(state) || header.mem_size != MEM_SIZE
+			|| header.page_size != CHECKPOINT_PAGE_SIZE) {
+		fclose(file);
+		return CHECKPOINT_BAD_LAYOUT;
+	}
+	READ_OR_FAIL(file, &state, sizeof(state));
+	struct processor restored;
+	if (new_processor_config(&restored, memory, state.features & ~ATTACHED_FEATURES)) {
+		fclose(file);
+		return CHECKPOINT_UNSUPPORTED;
+	}
+
+	// Map the image in place when possible, else fall back to reading it
+	int mapped = 0;
+	if ((flags & CHECKPOINT_MAP) && (header.flags & CHECKPOINT_RAW)
+			&& header.image_offset % sysconf(_SC_PAGESIZE) == 0) {
+		void* image = mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+						   fileno(file), header.image_offset);
+		if (image != MAP_FAILED) {
+			memory->data = image;
+			mapped = 1;
+		}
+	}
+	if (!mapped) {
+		int err = read_image(file, &header, memory->data);
+		if (err) {
+			fclose(file);
+			return err;
+		}
+	}
+	fclose(file);
+
+	memory->free_head = state.free_head;
+	memory->arena = state.arena;
+	memory->size = state.mem_size;
+	*proc = restored;
+	memcpy(proc->regs, state.regs, sizeof(state.regs));
+	proc->flag = state.flag;
+	memcpy(proc->latches, state.latches, sizeof(state.latches));
+	proc->bank = state.bank;
+	proc->pipeline_ctrl = state.pipeline_ctrl;
+	proc->muldiv = state.muldiv;
+	proc->stats = state.stats;
+	proc->shape = state.shape;
+	return 0;
+}
+
+void unmap_checkpoint(struct ememory* memory) {
+	munmap(memory->data, MEM_SIZE);
+	memory->data = NULL;
+}
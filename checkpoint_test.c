@@ -0,0 +1,193 @@
+#include "checkpoint.h"
+#include "test_fixture.h"
+#include "guard.h"
+#include "profile.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define CHECKPOINT_PATH "checkpoint_test.ckpt"
+
+// Sums 1..200 into r3, storing each partial sum at 0x4000, then spins
+static const char* program =
+	"\tmov r1, #0\n"
+	"\tmov r2, #200\n"
+	"\tmov r3, #0\n"
+	"\tmov r7, #16384\n"
+	"@loop\n"
+	"\tadd r1, r1, #1\n"
+	"\tadd r3, r3, r1\n"
+	"\tstore r3, r7, #0\n"
+	"\tmul r4, r3, r1\n"
+	"\tcmp r1, r2\n"
+	"\tbne loop\n"
+	"\tmov r5, #7\n"
+	"@end\n"
+	"\tbrn end\n";
+
+static struct processor load_program(struct ememory* memory) {
+	struct processor proc;
+	assert(load_source(&proc, memory, program, NULL) == 0);
+
+	// Some noise that compresses poorly
+	for (int i = 0; i < 3000; i++) {
+		memory->data[0x8000 + i] = (char) (i * 2654435761u >> 13);
+	}
+	return proc;
+}
+
+static void run_cycles(struct processor* proc, int cycles) {
+	for (int i = 0; i < cycles; i++) {
+		assert(clock_cycle(proc) == 0);
+	}
+}
+
+static void assert_same_state(struct processor* a, struct processor* b) {
+	assert(memcmp(a->regs, b->regs, sizeof(a->regs)) == 0);
+	assert(a->flag == b->flag);
+	assert(a->stats.cycles == b->stats.cycles);
+	assert(a->stats.retired == b->stats.retired);
+	assert(a->stats.stalls == b->stats.stalls);
+	assert(memcmp(a->memory->data, b->memory->data, MEM_SIZE) == 0);
+}
+
+/**
+ * Saves mid-run with the pipeline full, restores into a second processor, and
+ * checks that both continue identically
+ */
+static void check_resume(int save_flags, int restore_flags) {
+	char* data = malloc(MEM_SIZE);
+	char* restored_data = malloc(MEM_SIZE);
+	struct ememory memory = { .data = data };
+	struct ememory restored_memory = { .data = restored_data };
+
+	struct processor proc = load_program(&memory);
+	run_cycles(&proc, 301);
+	assert(save_checkpoint(&proc, CHECKPOINT_PATH, save_flags) == 0);
+
+	struct processor restored;
+	assert(restore_checkpoint(&restored, &restored_memory, CHECKPOINT_PATH, restore_flags) == 0);
+	assert(restored.memory == &restored_memory);
+	assert(restored_memory.free_head == memory.free_head && memory.free_head != STARTING_OFFSET);
+	assert_same_state(&proc, &restored);
+
+	run_cycles(&proc, 3000);
+	run_cycles(&restored, 3000);
+	assert_same_state(&proc, &restored);
+	assert(proc.regs[R3] == 20100 && proc.regs[R5] == 7);
+
+	if (restored_memory.data != restored_data) {
+		// Writes to a mapped image must not reach the file
+		unmap_checkpoint(&restored_memory);
+		restored_memory.data = restored_data;
+		assert(restore_checkpoint(&restored, &restored_memory, CHECKPOINT_PATH, 0) == 0);
+		assert(restored.regs[R5] == 0);
+	}
+
+	free(data);
+	free(restored_data);
+	unlink(CHECKPOINT_PATH);
+}
+
+void test_compressed_resume() {
+	check_resume(0, 0);
+}
+
+void test_raw_resume() {
+	check_resume(CHECKPOINT_RAW, 0);
+}
+
+void test_mapped_resume() {
+	check_resume(CHECKPOINT_RAW, CHECKPOINT_MAP);
+}
+
+void test_compressed_is_small() {
+	char* data = malloc(MEM_SIZE);
+	struct ememory memory = { .data = data };
+	struct processor proc = load_program(&memory);
+	assert(save_checkpoint(&proc, CHECKPOINT_PATH, 0) == 0);
+
+	FILE* file = fopen(CHECKPOINT_PATH, "rb");
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	assert(size < 3000 + 2 * (long) sizeof(struct processor));
+
+	free(data);
+	unlink(CHECKPOINT_PATH);
+}
+
+void test_rejects_bad_files() {
+	char* data = malloc(MEM_SIZE);
+	struct ememory memory = { .data = data };
+	struct processor proc = load_program(&memory);
+
+	assert(restore_checkpoint(&proc, &memory, "no_such_checkpoint", 0) == CHECKPOINT_IO_ERROR);
+
+	FILE* file = fopen(CHECKPOINT_PATH, "wb");
+	for (int i = 0; i < 16; i++) {
+		fputs("not a checkpoint file\n", file);
+	}
+	fclose(file);
+	assert(restore_checkpoint(&proc, &memory, CHECKPOINT_PATH, 0) == CHECKPOINT_BAD_MAGIC);
+
+	// Truncated image
+	assert(save_checkpoint(&proc, CHECKPOINT_PATH, 0) == 0);
+	assert(truncate(CHECKPOINT_PATH, 1000) == 0);
+	assert(restore_checkpoint(&proc, &memory, CHECKPOINT_PATH, 0) == CHECKPOINT_CORRUPT);
+
+	free(data);
+	unlink(CHECKPOINT_PATH);
+}
+
+void test_attachments_not_saved() {
+	// The restored processor runs the plain variant rather than one that
+	// reaches for a guard or profile it does not have
+	char* restored_data = malloc(MEM_SIZE);
+	struct ememory restored_memory = { .data = restored_data };
+	struct ememory guarded_memory = { 0 };
+	struct guard_memory guard;
+	assert(guard_memory_init(&guard, &guarded_memory) == 0);
+	struct processor proc = load_program(&guarded_memory);
+	assert(guard_attach(&guard, &proc) == 0);
+	run_cycles(&proc, 301);
+	assert(save_checkpoint(&proc, CHECKPOINT_PATH, 0) == 0);
+
+	struct processor restored;
+	assert(restore_checkpoint(&restored, &restored_memory, CHECKPOINT_PATH, 0) == 0);
+	assert(restored.features == 0 && !restored.guard);
+	run_cycles(&restored, 3000);
+	assert(restored.regs[R3] == 20100 && restored.regs[R5] == 7);
+	guard_detach(&guard, &proc);
+	guard_memory_free(&guard);
+
+	char* data = malloc(MEM_SIZE);
+	struct ememory memory = { .data = data };
+	struct profile profile;
+	proc = load_program(&memory);
+	assert(profile_attach(&profile, &proc) == 0);
+	run_cycles(&proc, 301);
+	assert(save_checkpoint(&proc, CHECKPOINT_PATH, 0) == 0);
+	profile_detach(&profile, &proc);
+
+	assert(restore_checkpoint(&restored, &restored_memory, CHECKPOINT_PATH, 0) == 0);
+	assert(restored.features == 0 && !restored.profile);
+	run_cycles(&restored, 3000);
+	assert(restored.regs[R3] == 20100 && restored.regs[R5] == 7);
+
+	free(data);
+	free(restored_data);
+	unlink(CHECKPOINT_PATH);
+}
+
+int main() {
+	test_compressed_resume();
+	test_raw_resume();
+	test_mapped_resume();
+	test_compressed_is_small();
+	test_rejects_bad_files();
+	test_attachments_not_saved();
+
+	printf("All tests passed.\n");
+}
@@ -0,0 +1,64 @@
+#include "console.h"
+#include <errno.h>
+#include <unistd.h>
+
+int console_flush(struct console* console) {
+	uint32_t written = 0;
+	while (written < console->fill) {
+		ssize_t n = write(console->fd, console->buffer + written, console->fill - written);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			// The guest cannot handle host errors, so the output is dropped
+			console->fill = 0;
+			return -1;
+		}
+		console->flushes++;
+		written += n;
+	}
+	console->fill = 0;
+	return 0;
+}
+
+static int console_read(struct device* dev, word_t offset, word_t* value) {
+	struct console* console = (struct console*) dev;
+	if (offset != CONSOLE_STATUS) {
+		return SEGFAULT;
+	}
+	*value = console->fill;
+	return 0;
+}
+
+static int console_write(struct device* dev, word_t offset, word_t value) {
+	struct console* console = (struct console*) dev;
+	if (offset == CONSOLE_STATUS) {
+		console_flush(console);
+		return 0;
+	}
+	if (offset != CONSOLE_DATA) {
+		return SEGFAULT;
+	}
+
+	char c = (char) value;
+	console->buffer[console->fill++] = c;
+	if (console->fill == CONSOLE_BUFFER_SIZE
+			|| (c == '\n' && console->policy == CONSOLE_FLUSH_LINE)) {
+		console_flush(console);
+	}
+	return 0;
+}
+
+void init_console(struct console* console, int fd, enum console_policy policy, word_t base) {
+	console->dev = (struct device) {
+		.name = "console",
+		.base = base,
+		.size = CONSOLE_SIZE,
+		.read = console_read,
+		.write = console_write,
+	};
+	console->fd = fd;
+	console->policy = policy;
+	console->fill = 0;
+	console->flushes = 0;
+}
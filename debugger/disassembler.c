@@ -15,6 +15,21 @@ void instr_to_str(struct instr* in, char* buf) {
 		case AND:
 		case OR:
 		case XOR:
+		case PADDB:
+		case PSUBB:
+		case PADDH:
+		case PSUBH:
+		case VLOAD:
+		case VSTORE:
+		case MEMCPY:
+		case MEMSET:
+		case MUL:
+		case MULH:
+		case DIV:
+		case REM:
+		case SHL:
+		case SHR:
+		case SAR:
 			sprintf(buf, "%s, %s, %s, %s", 
 				opcode_to_str(in->opcode), 
 				reg_to_str(in->dest),
@@ -39,6 +54,10 @@ void instr_to_str(struct instr* in, char* buf) {
 				reg_to_str(in->src2)
 			);
 			return;
+
+		case HALT:
+			sprintf(buf, "%s", opcode_to_str(in->opcode));
+			return;
 		
 		default: sprintf(buf, "INVALID OPCODE (%d)", in->opcode);
 	}
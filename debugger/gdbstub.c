@@ -0,0 +1,624 @@
+#include "gdbstub.h"
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Signal numbers as the protocol defines them, independent of the host
+#define GDB_SIGINT		2
+#define GDB_SIGILL		4
+#define GDB_SIGTRAP		5
+#define GDB_SIGFPE		8
+#define GDB_SIGSEGV		11
+
+#define GDB_INTERRUPT	0x03
+#define GDB_ESCAPE		0x7d
+
+struct gdb_stub {
+	struct processor* proc;
+	int fd;
+	int no_ack;
+	int stop_signal;				// reported by `?`
+	int done;
+	int result;
+
+	word_t breakpoints[GDB_MAX_BREAKPOINTS];
+	int num_breakpoints;
+
+	unsigned char rx[4096];
+	size_t rx_pos, rx_len;
+
+	char* packet;					// payload of the last packet, NUL terminated
+	size_t packet_len;
+	char* reply;					// reply[0] is kept free for the '$'
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// ==================
+//		 I/O
+// ==================
+
+static int read_byte(struct gdb_stub* stub) {
+	if (stub->rx_pos == stub->rx_len) {
+		ssize_t n;
+		do {
+			n = recv(stub->fd, stub->rx, sizeof(stub->rx), 0);
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0) {
+			return -1;
+		}
+		stub->rx_pos = 0;
+		stub->rx_len = n;
+	}
+	return stub->rx[stub->rx_pos++];
+}
+
+static int write_all(int fd, const char* buf, size_t len) {
+	while (len) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int hex_value(int c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * Reads the next packet into stub->packet, acknowledging it unless no-ack
+ * mode is on. Acks and ^C bytes between packets are skipped.
+ *
+ * @return	0 on success, else -1 if the connection failed
+ */
+static int receive_packet(struct gdb_stub* stub) {
+	while (1) {
+		int c;
+		while ((c = read_byte(stub)) != '$') {
+			if (c < 0) {
+				return -1;
+			}
+		}
+
+		size_t len = 0;
+		unsigned char sum = 0;
+		while ((c = read_byte(stub)) != '#') {
+			if (c < 0) {
+				return -1;
+			}
+			if (len < GDB_PACKET_SIZE) {
+				stub->packet[len] = c;
+			}
+			len++;
+			sum += c;
+		}
+		int hi = read_byte(stub);
+		int lo = read_byte(stub);
+		if (hi < 0 || lo < 0) {
+			return -1;
+		}
+
+		int ok = len <= GDB_PACKET_SIZE && hex_value(hi) * 16 + hex_value(lo) == sum;
+		if (!stub->no_ack && write_all(stub->fd, ok ? "+" : "-", 1)) {
+			return -1;
+		}
+		if (ok) {
+			stub->packet[len] = '\0';
+			stub->packet_len = len;
+			return 0;
+		}
+	}
+}
+
+/**
+ * Frames and sends the reply built in stub->reply + 1 up to `end`, resending
+ * until the client acknowledges it
+ */
+static int send_reply(struct gdb_stub* stub, char* end) {
+	unsigned char sum = 0;
+	for (char* p = stub->reply + 1; p < end; p++) {
+		sum += *p;
+	}
+	stub->reply[0] = '$';
+	*end++ = '#';
+	*end++ = hex_digits[sum >> 4];
+	*end++ = hex_digits[sum & 0xf];
+
+	while (1) {
+		if (write_all(stub->fd, stub->reply, end - stub->reply)) {
+			return -1;
+		}
+		if (stub->no_ack) {
+			return 0;
+		}
+		int c;
+		do {
+			c = read_byte(stub);
+		} while (c != '+' && c != '-' && c >= 0);
+		if (c != '-') {
+			return (c < 0) ? -1 : 0;
+		}
+	}
+}
+
+static int send_str(struct gdb_stub* stub, const char* str) {
+	size_t len = strlen(str);
+	memcpy(stub->reply + 1, str, len);
+	return send_reply(stub, stub->reply + 1 + len);
+}
+
+static char* put_hex(char* out, const unsigned char* bytes, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		*out++ = hex_digits[bytes[i] >> 4];
+		*out++ = hex_digits[bytes[i] & 0xf];
+	}
+	return out;
+}
+
+/**
+ * Parses a hex number at *p and advances past it
+ *
+ * @return	The number of digits read
+ */
+static int parse_hex(const char** p, uint64_t* value) {
+	int digits = 0;
+	*value = 0;
+	for (int d; (d = hex_value(**p)) >= 0; (*p)++, digits++) {
+		*value = (*value << 4) | d;
+	}
+	return digits;
+}
+
+/**
+ * Parses "addr,len" followed by `terminator`
+ */
+static int parse_range(const char** p, uint64_t* addr, uint64_t* len, char terminator) {
+	if (!parse_hex(p, addr) || *(*p)++ != ',' || !parse_hex(p, len) || **p != terminator) {
+		return -1;
+	}
+	(*p)++;
+	return 0;
+}
+
+static int valid_range(uint64_t addr, uint64_t len) {
+	return addr <= MEM_SIZE && len <= MEM_SIZE - addr;
+}
+
+// ==================
+//	   REGISTERS
+// ==================
+
+static size_t reg_size(int reg) {
+	return (reg == FLAG) ? sizeof(uint64_t) : sizeof(word_t);
+}
+
+static char* put_reg(char* out, struct processor* proc, int reg) {
+	uint64_t value = READ_REG(proc, reg);
+	unsigned char bytes[sizeof(uint64_t)];
+	for (size_t i = 0; i < reg_size(reg); i++) {
+		bytes[i] = value >> (8 * i);
+	}
+	return put_hex(out, bytes, reg_size(reg));
+}
+
+/**
+ * Parses a little endian register value at *p and advances past it
+ */
+static int parse_reg(const char** p, struct processor* proc, int reg) {
+	uint64_t value = 0;
+	for (size_t i = 0; i < reg_size(reg); i++) {
+		int hi = hex_value((*p)[0]);
+		int lo = (hi < 0) ? -1 : hex_value((*p)[1]);
+		if (lo < 0) {
+			return -1;
+		}
+		value |= (uint64_t) (hi * 16 + lo) << (8 * i);
+		*p += 2;
+	}
+	WRITE_REG(proc, reg, value);
+	return 0;
+}
+
+static const char* target_xml(void) {
+	static char xml[2048];
+	if (xml[0]) {
+		return xml;
+	}
+	char* out = xml;
+	out += sprintf(out, "<?xml version=\"1.0\"?>\n"
+						"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+						"<target version=\"1.0\">\n"
+						"<feature name=\"org.unu.core\">\n");
+	for (int reg = 0; reg < NUM_REGS; reg++) {
+		char name[8];
+		const char* str = reg_to_str(reg);
+		size_t i = 0;
+		for (; str[i] && i < sizeof(name) - 1; i++) {
+			name[i] = tolower((unsigned char) str[i]);
+		}
+		name[i] = '\0';
+		const char* type = (reg == PC) ? "code_ptr" : (reg == FLAG) ? "int64" : "uint32";
+		out += sprintf(out, "<reg name=\"%s\" bitsize=\"%zu\" type=\"%s\"/>\n",
+					   name, 8 * reg_size(reg), type);
+	}
+	sprintf(out, "</feature>\n</target>\n");
+	return xml;
+}
+
+// ==================
+//	   EXECUTION
+// ==================
+
+static int stop_signal(int status) {
+	switch (status) {
+		case 0:
+		case HALTED:		return GDB_SIGTRAP;
+		case SEGFAULT:		return GDB_SIGSEGV;
+		case INVALID_OP:	return GDB_SIGFPE;
+		default:			return GDB_SIGILL;
+	}
+}
+
+static int has_breakpoint(struct gdb_stub* stub, word_t pc) {
+	for (int i = 0; i < stub->num_breakpoints; i++) {
+		if (stub->breakpoints[i] == pc) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Checks for a ^C from the client without blocking
+ */
+static int interrupted(struct gdb_stub* stub) {
+	if (stub->rx_pos == stub->rx_len) {
+		struct pollfd pfd = { .fd = stub->fd, .events = POLLIN };
+		if (poll(&pfd, 1, 0) <= 0) {
+			return 0;
+		}
+	}
+	int c = read_byte(stub);
+	return c == GDB_INTERRUPT || c < 0;
+}
+
+/**
+ * After a fault, lets the older instructions still in flight finish, so that
+ * the registers are those of the faulting instruction. One of them may fault
+ * in turn, and is then the one reported.
+ */
+static int settle_fault(struct processor* proc, int status) {
+	int err;
+	while (status != HALTED && (err = drain_pipeline(proc))) {
+		status = err;
+	}
+	return status;
+}
+
+/**
+ * With the pipeline empty, fetches a single instruction and drains it
+ */
+static int step_instruction(struct processor* proc) {
+	int status = clock_cycle(proc);
+	if (!status) {
+		status = drain_pipeline(proc);
+	}
+	return status ? settle_fault(proc, status) : 0;
+}
+
+/**
+ * Steps or continues, leaving the pipeline drained
+ *
+ * @return	The signal to report
+ */
+static int resume(struct gdb_stub* stub, int single_step) {
+	struct processor* proc = stub->proc;
+
+	// Step first, so a breakpoint at the current PC does not stop us again
+	int status = step_instruction(proc);
+	if (status || single_step) {
+		return stop_signal(status);
+	}
+
+	for (uint64_t cycles = 1; ; cycles++) {
+		if (has_breakpoint(stub, proc->regs[PC])) {
+			if ((status = drain_pipeline(proc))) {
+				break;
+			}
+			if (has_breakpoint(stub, proc->regs[PC])) {
+				return GDB_SIGTRAP;
+			}
+		}
+		if (cycles % GDB_POLL_CYCLES == 0 && interrupted(stub)) {
+			status = drain_pipeline(proc);
+			return status ? stop_signal(settle_fault(proc, status)) : GDB_SIGINT;
+		}
+		if ((status = clock_cycle(proc))) {
+			break;
+		}
+	}
+	return stop_signal(settle_fault(proc, status));
+}
+
+// ==================
+//	    PACKETS
+// ==================
+
+static int send_stop(struct gdb_stub* stub) {
+	char buf[4];
+	snprintf(buf, sizeof(buf), "S%02x", stub->stop_signal);
+	return send_str(stub, buf);
+}
+
+static int handle_breakpoint(struct gdb_stub* stub, const char* p, int insert) {
+	uint64_t type, addr;
+	if (!parse_hex(&p, &type) || *p++ != ',' || !parse_hex(&p, &addr)) {
+		return send_str(stub, "E01");
+	}
+	if (type != 0) {
+		return send_str(stub, "");
+	}
+
+	for (int i = 0; i < stub->num_breakpoints; i++) {
+		if (stub->breakpoints[i] == addr) {
+			if (!insert) {
+				stub->breakpoints[i] = stub->breakpoints[--stub->num_breakpoints];
+			}
+			return send_str(stub, "OK");
+		}
+	}
+	if (!insert) {
+		return send_str(stub, "OK");
+	}
+	if (stub->num_breakpoints == GDB_MAX_BREAKPOINTS) {
+		return send_str(stub, "E02");
+	}
+	stub->breakpoints[stub->num_breakpoints++] = addr;
+	return send_str(stub, "OK");
+}
+
+static int handle_query(struct gdb_stub* stub, const char* p) {
+	if (!strncmp(p, "qSupported", 10)) {
+		char buf[96];
+		snprintf(buf, sizeof(buf), "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+",
+				 GDB_PACKET_SIZE);
+		return send_str(stub, buf);
+	}
+	if (!strcmp(p, "qAttached")) {
+		return send_str(stub, "1");
+	}
+	if (!strncmp(p, "qXfer:features:read:target.xml:", 31)) {
+		p += 31;
+		uint64_t offset, len;
+		if (parse_hex(&p, &offset) == 0 || *p++ != ',' || parse_hex(&p, &len) == 0) {
+			return send_str(stub, "E01");
+		}
+		const char* xml = target_xml();
+		size_t total = strlen(xml);
+		if (offset > total) {
+			offset = total;
+		}
+		if (len > total - offset) {
+			len = total - offset;
+		}
+		char* out = stub->reply + 1;
+		*out++ = (offset + len == total) ? 'l' : 'm';
+		memcpy(out, xml + offset, len);
+		return send_reply(stub, out + len);
+	}
+	if (!strcmp(p, "QStartNoAckMode")) {
+		int status = send_str(stub, "OK");
+		stub->no_ack = 1;
+		return status;
+	}
+	return send_str(stub, "");
+}
+
+/**
+ * Handles stub->packet, sending its reply
+ *
+ * @return	0 on success, else -1 if the connection failed
+ */
+static int handle_packet(struct gdb_stub* stub) {
+	struct processor* proc = stub->proc;
+	const char* p = stub->packet + 1;
+	char* out = stub->reply + 1;
+	uint64_t addr, len;
+
+	switch (stub->packet[0]) {
+		case '?':
+			return send_stop(stub);
+
+		case 'g':
+			for (int reg = 0; reg < NUM_REGS; reg++) {
+				out = put_reg(out, proc, reg);
+			}
+			return send_reply(stub, out);
+
+		case 'G':
+			for (int reg = 0; reg < NUM_REGS; reg++) {
+				if (parse_reg(&p, proc, reg)) {
+					return send_str(stub, "E01");
+				}
+			}
+			return send_str(stub, "OK");
+
+		case 'p':
+			if (!parse_hex(&p, &addr) || addr >= NUM_REGS) {
+				return send_str(stub, "E01");
+			}
+			return send_reply(stub, put_reg(out, proc, addr));
+
+		case 'P':
+			if (!parse_hex(&p, &addr) || addr >= NUM_REGS || *p++ != '='
+					|| parse_reg(&p, proc, addr)) {
+				return send_str(stub, "E01");
+			}
+			return send_str(stub, "OK");
+
+		case 'm':
+			if (parse_range(&p, &addr, &len, '\0') || !valid_range(addr, len)) {
+				return send_str(stub, "E01");
+			}
+			return send_reply(stub, put_hex(out, (unsigned char*) proc->memory->data + addr, len));
+
+		case 'M':
+			if (parse_range(&p, &addr, &len, ':') || !valid_range(addr, len)
+					|| strlen(p) != 2 * len) {
+				return send_str(stub, "E01");
+			}
+			for (uint64_t i = 0; i < len; i++) {
+				int hi = hex_value(p[2 * i]), lo = hex_value(p[2 * i + 1]);
+				if (hi < 0 || lo < 0) {
+					return send_str(stub, "E01");
+				}
+				proc->memory->data[addr + i] = hi * 16 + lo;
+			}
+			return send_str(stub, "OK");
+
+		case 'X': {
+			if (parse_range(&p, &addr, &len, ':') || !valid_range(addr, len)) {
+				return send_str(stub, "E01");
+			}
+			// Binary data, with '#', '$', '}' and '*' escaped as '}' c ^ 0x20
+			const char* end = stub->packet + stub->packet_len;
+			char* dest = proc->memory->data + addr;
+			uint64_t written = 0;
+			while (p < end && written < len) {
+				char c = *p++;
+				if (c == GDB_ESCAPE && p < end) {
+					c = *p++ ^ 0x20;
+				}
+				dest[written++] = c;
+			}
+			return send_str(stub, (written == len && p == end) ? "OK" : "E01");
+		}
+
+		case 'Z':
+		case 'z':
+			return handle_breakpoint(stub, p, stub->packet[0] == 'Z');
+
+		case 's':
+		case 'c':
+			if (parse_hex(&p, &addr)) {
+				proc->regs[PC] = addr;
+			}
+			stub->stop_signal = resume(stub, stub->packet[0] == 's');
+			return send_stop(stub);
+
+		case 'q':
+		case 'Q':
+			return handle_query(stub, stub->packet);
+
+		case 'H':
+			return send_str(stub, "OK");
+
+		case 'D':
+			stub->done = 1;
+			stub->result = GDB_DETACHED;
+			return send_str(stub, "OK");
+
+		case 'k':
+			stub->done = 1;
+			stub->result = GDB_KILLED;
+			return 0;
+
+		default:
+			return send_str(stub, "");
+	}
+}
+
+int gdb_serve(struct processor* proc, int fd) {
+	struct gdb_stub stub = {
+		.proc = proc,
+		.fd = fd,
+		.stop_signal = GDB_SIGTRAP,
+		.packet = malloc(GDB_PACKET_SIZE + 1),
+		.reply = malloc(GDB_PACKET_SIZE + 4),
+	};
+	if (stub.packet && stub.reply) {
+		int status = drain_pipeline(proc);
+		if (status) {
+			stub.stop_signal = stop_signal(status);
+		}
+		while (!stub.done && receive_packet(&stub) == 0 && handle_packet(&stub) == 0)
+			;
+	}
+	free(stub.packet);
+	free(stub.reply);
+	return stub.done ? stub.result : GDB_IO_ERROR;
+}
+
+// ==================
+//	    SOCKETS
+// ==================
+
+static int serve_listener(struct processor* proc, int listener) {
+	int fd = accept(listener, NULL, NULL);
+	close(listener);
+	if (fd < 0) {
+		return GDB_IO_ERROR;
+	}
+	// Replies are small and latency bound. This fails harmlessly on Unix sockets.
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	int result = gdb_serve(proc, fd);
+	close(fd);
+	return result;
+}
+
+int gdb_serve_tcp(struct processor* proc, uint16_t port) {
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return GDB_IO_ERROR;
+	}
+	int one = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (bind(listener, (struct sockaddr*) &addr, sizeof(addr)) || listen(listener, 1)) {
+		close(listener);
+		return GDB_IO_ERROR;
+	}
+	return serve_listener(proc, listener);
+}
+
+int gdb_serve_unix(struct processor* proc, const char* path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return GDB_IO_ERROR;
+	}
+	strcpy(addr.sun_path, path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		return GDB_IO_ERROR;
+	}
+	unlink(path);
+	if (bind(listener, (struct sockaddr*) &addr, sizeof(addr)) || listen(listener, 1)) {
+		close(listener);
+		return GDB_IO_ERROR;
+	}
+	int result = serve_listener(proc, listener);
+	unlink(path);
+	return result;
+}
@@ -0,0 +1,188 @@
+/**
+ * Trades pipeline depth against CPI. Runs a few kernels, each once through
+ * the functional model with an in-order timing model per pipeline preset,
+ * and estimates the cycle time of each from a logic delay per stage
+ * group: a group's delay is split evenly over its stages, the slowest stage
+ * plus the latch overhead sets the clock, and performance is relative to the
+ * classic pipeline.
+ *
+ * Usage: depth_study [fetch decode execute memory writeback latch]
+ *
+ * Delays are in picoseconds. EX2 and AG stages share the execute delay, IF2
+ * stages the fetch delay.
+ */
+
+#include "timing.h"
+#include "assembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_PRESETS	16
+
+struct workload {
+	const char* name;
+	const char* source;
+};
+
+static const struct workload workloads[] = {
+	{ "alu",
+		"\tmov r1, #0\n"
+		"\tmov r2, #2000\n"
+		"@loop\n"
+		"\tadd r3, r3, #1\n"
+		"\tadd r3, r3, r1\n"
+		"\txor r4, r3, #5\n"
+		"\tadd r1, r1, #1\n"
+		"\tcmp r1, r2\n"
+		"\tbne loop\n"
+		"\tmov r6, #1\n" },
+	{ "memory",
+		"\tmov r1, #0\n"
+		"\tmov r2, #2000\n"
+		"\tmov r7, #16384\n"
+		"@loop\n"
+		"\tload r3, r7, #0\n"
+		"\tadd r3, r3, r1\n"
+		"\tstore r3, r7, #4\n"
+		"\tadd r1, r1, #1\n"
+		"\tcmp r1, r2\n"
+		"\tbne loop\n"
+		"\tmov r6, #1\n" },
+	{ "branchy",
+		"\tmov r1, #0\n"
+		"\tmov r2, #500\n"
+		"@outer\n"
+		"\tmov r4, #3\n"
+		"@inner\n"
+		"\tsub r4, r4, #1\n"
+		"\tcmp r4, #0\n"
+		"\tbne inner\n"
+		"\tadd r1, r1, #1\n"
+		"\tcmp r1, r2\n"
+		"\tbne outer\n"
+		"\tmov r6, #1\n" },
+	{ "muldiv",
+		"\tmov r1, #1\n"
+		"\tmov r2, #1000\n"
+		"\tmov r3, #7\n"
+		"@loop\n"
+		"\tmul r4, r1, r3\n"
+		"\tdiv r5, r4, #3\n"
+		"\tadd r1, r1, #1\n"
+		"\tcmp r1, r2\n"
+		"\tbne loop\n"
+		"\tmov r6, #1\n" },
+};
+
+#define NUM_WORKLOADS	(int) (sizeof(workloads) / sizeof(workloads[0]))
+
+enum { FETCH, DECODE, EXECUTE, MEMORY, WRITE_BACK, LATCH, NUM_DELAYS };
+
+static char data[MEM_SIZE];
+static struct asm_result images[NUM_WORKLOADS];
+
+/**
+ * Runs `image` once, timing it on every preset, and stores each preset's CPI
+ */
+static int run_cpi(const struct asm_result* image, double* cpi) {
+	if (num_pipeline_presets > MAX_PRESETS) {
+		return -1;
+	}
+	memset(data, 0, MEM_SIZE);
+	memcpy(data + STARTING_OFFSET, image->image, image->size);
+	struct ememory memory = { .data = data };
+	struct processor proc = new_processor(&memory);
+	proc.regs[PC] = STARTING_OFFSET;
+
+	struct inorder_timing timings[MAX_PRESETS];
+	struct timing_model* models[MAX_PRESETS];
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const struct pipeline_preset* preset = &pipeline_presets[p];
+		struct pipeline_shape shape;
+		compile_pipeline_shape(preset->stages, preset->depth, &shape);
+		init_inorder_timing(&timings[p], preset->name, &shape);
+		models[p] = &timings[p].model;
+	}
+
+	uint64_t executed;
+	if (timing_run(&proc, UINT64_MAX, STARTING_OFFSET + image->size, models,
+				   num_pipeline_presets, &executed)) {
+		return -1;
+	}
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		cpi[p] = (double) models[p]->stats.cycles / models[p]->stats.retired;
+	}
+	return 0;
+}
+
+static double cycle_time(const struct pipeline_shape* shape, const double* delays) {
+	double stages[] = {
+		delays[FETCH] / (1 + shape->if_extra),
+		delays[DECODE],
+		delays[EXECUTE] / (1 + shape->ex_extra + shape->ag_extra),
+		delays[MEMORY],
+		delays[WRITE_BACK],
+	};
+	double slowest = 0;
+	for (unsigned int i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+		if (stages[i] > slowest) {
+			slowest = stages[i];
+		}
+	}
+	return slowest + delays[LATCH];
+}
+
+int main(int argc, char** argv) {
+	double delays[NUM_DELAYS] = { 350, 200, 350, 250, 150, 40 };
+	if (argc > 1 && argc != NUM_DELAYS + 1) {
+		fprintf(stderr, "usage: %s [fetch decode execute memory writeback latch]\n", argv[0]);
+		return 2;
+	}
+	for (int i = 1; i < argc; i++) {
+		delays[i - 1] = atof(argv[i]);
+	}
+
+	// One functional run per workload times it on every preset
+	static double cpis[NUM_WORKLOADS][MAX_PRESETS];
+	for (int i = 0; i < NUM_WORKLOADS; i++) {
+		if (assemble(workloads[i].source, &images[i])) {
+			fprintf(stderr, "%s: assembly failed\n", workloads[i].name);
+			return 1;
+		}
+		if (run_cpi(&images[i], cpis[i])) {
+			fprintf(stderr, "%s: run failed\n", workloads[i].name);
+			return 1;
+		}
+	}
+
+	printf("%-14s %5s %7s", "preset", "depth", "penalty");
+	for (int i = 0; i < NUM_WORKLOADS; i++) {
+		printf(" %8s", workloads[i].name);
+	}
+	printf(" %8s %9s %8s\n", "mean CPI", "cycle ps", "speedup");
+
+	double baseline = 0;
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const struct pipeline_preset* preset = &pipeline_presets[p];
+		struct pipeline_shape shape;
+		compile_pipeline_shape(preset->stages, preset->depth, &shape);
+		printf("%-14s %5d %7d", preset->name, pipeline_depth(&shape), branch_penalty(&shape));
+
+		double total = 0;
+		for (int i = 0; i < NUM_WORKLOADS; i++) {
+			printf(" %8.3f", cpis[i][p]);
+			total += cpis[i][p];
+		}
+		double mean = total / NUM_WORKLOADS;
+		double time = mean * cycle_time(&shape, delays);
+		if (p == 0) {
+			baseline = time;
+		}
+		printf(" %8.3f %9.0f %7.2fx\n", mean, cycle_time(&shape, delays), baseline / time);
+	}
+
+	for (int i = 0; i < NUM_WORKLOADS; i++) {
+		free_asm_result(&images[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+#include "device.h"
+
+int attach_device(struct device_table* table, struct device* dev) {
+	if (table->count == MAX_DEVICES || dev->size == 0) {
+		return -1;
+	}
+	for (int i = 0; i < table->count; i++) {
+		struct device* other = table->devices[i];
+		if (dev->base < other->base + other->size && other->base < dev->base + dev->size) {
+			return -1;
+		}
+	}
+	table->devices[table->count++] = dev;
+	return 0;
+}
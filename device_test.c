@@ -0,0 +1,262 @@
+#include "processor.h"
+#include "functional.h"
+#include "test_fixture.h"
+#include "console.h"
+#include "dma.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+
+/**
+ * Runs until the program sets r5 to 7
+ */
+static void run_until_done(struct processor* proc, int functional) {
+	for (int i = 0; i < 1000000 && proc->regs[R5] != 7; i++) {
+		assert((functional ? functional_step(proc) : clock_cycle(proc)) == 0);
+	}
+	assert(proc->regs[R5] == 7);
+}
+
+static struct processor run_program(const char* source, struct device* dev, int functional) {
+	struct processor proc;
+	assert(load_source(&proc, &memory, source, NULL) == 0);
+	assert(attach_device(&proc.devices, dev) == 0);
+	run_until_done(&proc, functional);
+	return proc;
+}
+
+static int temp_file(char* path) {
+	strcpy(path, "/tmp/device_test.XXXXXX");
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	return fd;
+}
+
+static size_t read_file(const char* path, char* buf, size_t size) {
+	FILE* file = fopen(path, "rb");
+	size_t n = fread(buf, 1, size, file);
+	fclose(file);
+	return n;
+}
+
+/* ------------------- Console ------------------- */
+
+// Prints "ok\n" then "x", and loads the buffer fill into r3
+static const char* hello =
+	"\tmov r0, #0\n"
+	"\tmov r1, #111\n"
+	"\tstore r1, r0, #0\n"
+	"\tmov r1, #107\n"
+	"\tstore r1, r0, #0\n"
+	"\tmov r1, #10\n"
+	"\tstore r1, r0, #0\n"
+	"\tmov r1, #120\n"
+	"\tstore r1, r0, #0\n"
+	"\tload r3, r0, #4\n"
+	"\tmov r5, #7\n";
+
+void check_console_line(int functional) {
+	char path[32], buf[16];
+	int fd = temp_file(path);
+	struct console console;
+	init_console(&console, fd, CONSOLE_FLUSH_LINE, CONSOLE_BASE);
+
+	struct processor proc = run_program(hello, &console.dev, functional);
+	assert(proc.regs[R3] == 1);
+	assert(console.flushes == 1);
+	assert(read_file(path, buf, sizeof(buf)) == 3 && memcmp(buf, "ok\n", 3) == 0);
+
+	assert(console_flush(&console) == 0);
+	assert(read_file(path, buf, sizeof(buf)) == 4 && memcmp(buf, "ok\nx", 4) == 0);
+
+	close(fd);
+	unlink(path);
+}
+
+void test_console_line() {
+	check_console_line(0);
+}
+
+void test_console_line_functional() {
+	check_console_line(1);
+}
+
+void test_console_batches() {
+	const char* source =
+		"\tmov r0, #0\n"
+		"\tmov r1, #97\n"
+		"\tmov r2, #5000\n"
+		"@loop\n"
+		"\tstore r1, r0, #0\n"
+		"\tsub r2, r2, #1\n"
+		"\tcmp r2, #0\n"
+		"\tbne loop\n"
+		"\tmov r5, #7\n";
+	char path[32];
+	static char buf[8192];
+	int fd = temp_file(path);
+	struct console console;
+	init_console(&console, fd, CONSOLE_FLUSH_FULL, CONSOLE_BASE);
+
+	run_program(source, &console.dev, 0);
+	assert(console.flushes == 1);
+	assert(console.fill == 5000 - CONSOLE_BUFFER_SIZE);
+	assert(console_flush(&console) == 0);
+	assert(console.flushes == 2);
+	assert(read_file(path, buf, sizeof(buf)) == 5000);
+
+	close(fd);
+	unlink(path);
+}
+
+void test_attach_rejects_overlap() {
+	struct device_table table = { 0 };
+	struct console a, b;
+	init_console(&a, 1, CONSOLE_FLUSH_LINE, 0x0);
+	init_console(&b, 1, CONSOLE_FLUSH_LINE, 0x4);
+	assert(attach_device(&table, &a.dev) == 0);
+	assert(attach_device(&table, &b.dev) == -1);
+	b.dev.base = CONSOLE_SIZE;
+	assert(attach_device(&table, &b.dev) == 0);
+	assert(find_device(&table, 0x4) == &a.dev);
+	assert(find_device(&table, CONSOLE_SIZE + 4) == &b.dev);
+	assert(find_device(&table, 2 * CONSOLE_SIZE) == NULL);
+}
+
+/* ------------------- DMA ------------------- */
+
+// Starts a transfer of r1 bytes from file slot 0 at offset 4 into the eptr in
+// r6, computes while it runs, then polls. Leaves the status in r3 and the 
+// count in r4.
+static const char* dma_program =
+	"\tmov r0, #1\n"
+	"\tshl r0, r0, #16\n"
+	"\tmov r2, #0\n"
+	"\tstore r2, r0, #0\n"
+	"\tmov r2, #4\n"
+	"\tstore r2, r0, #4\n"
+	"\tstore r1, r0, #8\n"
+	"\tstore r6, r0, #12\n"
+	"\tstore r2, r0, #16\n"
+	"\tmov r2, #0\n"
+	"\tmov r7, #0\n"
+	"@compute\n"
+	"\tadd r7, r7, #3\n"
+	"\tadd r2, r2, #1\n"
+	"\tcmp r2, #50\n"
+	"\tbne compute\n"
+	"@poll\n"
+	"\tload r3, r0, #20\n"
+	"\tcmp r3, #1\n"
+	"\tbeq poll\n"
+	"\tload r4, r0, #24\n"
+	"\tmov r5, #7\n";
+
+static word_t eptr_word(struct eptr ptr) {
+	return ptr.ptr | (word_t) ptr.size << 16;
+}
+
+/**
+ * Runs dma_program over a temp file holding 2048 bytes counting up from 0
+ */
+static struct processor run_dma(word_t length, int free_dest, struct eptr* dest) {
+	char path[32];
+	int fd = temp_file(path);
+	static char contents[2048];
+	for (unsigned int i = 0; i < sizeof(contents); i++) {
+		contents[i] = (char) i;
+	}
+	assert(write(fd, contents, sizeof(contents)) == sizeof(contents));
+
+	struct processor proc;
+	assert(load_source(&proc, &memory, dma_program, NULL) == 0);
+	*dest = emalloc(&memory, 1024);
+	assert(!is_null(*dest));
+	if (free_dest) {
+		efree(&memory, *dest);
+	}
+
+	struct dma dma;
+	assert(init_dma(&dma, &memory, DMA_BASE) == 0);
+	assert(dma_register_file(&dma, 0, fd) == 0);
+	assert(attach_device(&proc.devices, &dma.dev) == 0);
+	proc.regs[R1] = length;
+	proc.regs[R6] = eptr_word(*dest);
+
+	run_until_done(&proc, 0);
+	assert(proc.regs[R7] == 150);
+	dma_shutdown(&dma);
+	close(fd);
+	unlink(path);
+	return proc;
+}
+
+void test_dma_transfer() {
+	struct eptr dest;
+	struct processor proc = run_dma(1000, 0, &dest);
+	assert(proc.regs[R3] == DMA_DONE);
+	assert(proc.regs[R4] == 1000);
+	for (int i = 0; i < 1000; i++) {
+		assert(data[dest.ptr + i] == (char) (i + 4));
+	}
+	assert(data[dest.ptr + 1000] == 0);
+}
+
+void test_dma_short_read() {
+	// Exactly fills the destination
+	struct eptr dest;
+	struct processor proc = run_dma(1024, 0, &dest);
+	assert(proc.regs[R3] == DMA_DONE);
+	assert(proc.regs[R4] == 1024);
+
+	// A 6 byte file leaves only 2 bytes after offset 4
+	char path[32];
+	int fd = temp_file(path);
+	assert(write(fd, "abcdef", 6) == 6);
+	struct processor short_proc;
+	assert(load_source(&short_proc, &memory, dma_program, NULL) == 0);
+	dest = emalloc(&memory, 64);
+	struct dma dma;
+	assert(init_dma(&dma, &memory, DMA_BASE) == 0);
+	dma_register_file(&dma, 0, fd);
+	attach_device(&short_proc.devices, &dma.dev);
+	short_proc.regs[R1] = 64;
+	short_proc.regs[R6] = eptr_word(dest);
+	run_until_done(&short_proc, 0);
+	assert(short_proc.regs[R3] == DMA_DONE);
+	assert(short_proc.regs[R4] == 2);
+	assert(memcmp(data + dest.ptr, "ef", 2) == 0);
+	dma_shutdown(&dma);
+	close(fd);
+	unlink(path);
+}
+
+void test_dma_bounds() {
+	struct eptr dest;
+
+	// Longer than the destination eptr
+	struct processor proc = run_dma(1025, 0, &dest);
+	assert(proc.regs[R3] == DMA_ERROR);
+	assert(proc.regs[R4] == 0);
+
+	// Destination is not allocated
+	proc = run_dma(16, 1, &dest);
+	assert(proc.regs[R3] == DMA_ERROR);
+	assert(data[dest.ptr + 8] == 0);
+}
+
+int main() {
+	test_console_line();
+	test_console_line_functional();
+	test_console_batches();
+	test_attach_rejects_overlap();
+	test_dma_transfer();
+	test_dma_short_read();
+	test_dma_bounds();
+
+	printf("All tests passed.\n");
+}
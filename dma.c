@@ -0,0 +1,145 @@
+#include "dma.h"
+#include <errno.h>
+#include <unistd.h>
+
+/**
+ * Runs on the I/O thread. Each transfer is a series of pread() calls straight
+ * into guest memory.
+ */
+static void* dma_worker(void* arg) {
+	struct dma* dma = arg;
+	pthread_mutex_lock(&dma->lock);
+	while (1) {
+		while (!dma->pending && !dma->stop) {
+			pthread_cond_wait(&dma->wake, &dma->lock);
+		}
+		if (!dma->pending) {
+			break;
+		}
+		dma->pending = 0;
+		pthread_mutex_unlock(&dma->lock);
+
+		char* dest = dma->memory->data + dma->job_dest;
+		word_t done = 0;
+		unsigned int status = DMA_DONE;
+		while (done < dma->job_length) {
+			ssize_t n = pread(dma->job_fd, dest + done, dma->job_length - done,
+							  (off_t) dma->job_offset + done);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n < 0) {
+				status = DMA_ERROR;
+				break;
+			}
+			if (n == 0) {
+				break;
+			}
+			done += n;
+		}
+		atomic_store(&dma->count, done);
+		atomic_store(&dma->status, status);
+
+		pthread_mutex_lock(&dma->lock);
+	}
+	pthread_mutex_unlock(&dma->lock);
+	return NULL;
+}
+
+static int start_transfer(struct dma* dma) {
+	if (atomic_load(&dma->status) == DMA_BUSY) {
+		return 0;
+	}
+
+	struct eptr dest = { .ptr = dma->dest & 0xFFFF, .size = dma->dest >> 16 };
+	int fd = (dma->file < DMA_MAX_FILES) ? dma->files[dma->file] : -1;
+	if (fd < 0 || dma->length > dest.size
+			|| !is_allocated(dma->memory, dest.ptr, dma->length)) {
+		atomic_store(&dma->count, 0);
+		atomic_store(&dma->status, DMA_ERROR);
+		return 0;
+	}
+
+	pthread_mutex_lock(&dma->lock);
+	dma->job_fd = fd;
+	dma->job_offset = dma->offset;
+	dma->job_length = dma->length;
+	dma->job_dest = dest.ptr;
+	dma->pending = 1;
+	atomic_store(&dma->status, DMA_BUSY);
+	pthread_cond_signal(&dma->wake);
+	pthread_mutex_unlock(&dma->lock);
+	return 0;
+}
+
+static int dma_read(struct device* dev, word_t offset, word_t* value) {
+	struct dma* dma = (struct dma*) dev;
+	switch (offset) {
+		case DMA_FILE:		*value = dma->file; 	break;
+		case DMA_OFFSET:	*value = dma->offset; 	break;
+		case DMA_LENGTH:	*value = dma->length; 	break;
+		case DMA_DEST:		*value = dma->dest; 	break;
+		case DMA_STATUS:	*value = atomic_load(&dma->status); break;
+		case DMA_COUNT:		*value = atomic_load(&dma->count); 	break;
+		default:
+			return SEGFAULT;
+	}
+	return 0;
+}
+
+static int dma_write(struct device* dev, word_t offset, word_t value) {
+	struct dma* dma = (struct dma*) dev;
+	switch (offset) {
+		case DMA_FILE:		dma->file = value; 		break;
+		case DMA_OFFSET:	dma->offset = value; 	break;
+		case DMA_LENGTH:	dma->length = value; 	break;
+		case DMA_DEST:		dma->dest = value; 		break;
+		case DMA_DOORBELL:	return start_transfer(dma);
+		default:
+			return SEGFAULT;
+	}
+	return 0;
+}
+
+int init_dma(struct dma* dma, struct ememory* memory, word_t base) {
+	memset(dma, 0, sizeof(*dma));
+	dma->dev = (struct device) {
+		.name = "dma",
+		.base = base,
+		.size = DMA_SIZE,
+		.read = dma_read,
+		.write = dma_write,
+	};
+	dma->memory = memory;
+	for (int i = 0; i < DMA_MAX_FILES; i++) {
+		dma->files[i] = -1;
+	}
+	atomic_init(&dma->status, DMA_IDLE);
+	atomic_init(&dma->count, 0);
+	pthread_mutex_init(&dma->lock, NULL);
+	pthread_cond_init(&dma->wake, NULL);
+	if (pthread_create(&dma->worker, NULL, dma_worker, dma)) {
+		pthread_mutex_destroy(&dma->lock);
+		pthread_cond_destroy(&dma->wake);
+		return -1;
+	}
+	return 0;
+}
+
+int dma_register_file(struct dma* dma, int slot, int fd) {
+	if (slot < 0 || slot >= DMA_MAX_FILES) {
+		return -1;
+	}
+	dma->files[slot] = fd;
+	return 0;
+}
+
+void dma_shutdown(struct dma* dma) {
+	pthread_mutex_lock(&dma->lock);
+	dma->stop = 1;
+	pthread_cond_signal(&dma->wake);
+	pthread_mutex_unlock(&dma->lock);
+	pthread_join(dma->worker, NULL);
+	pthread_mutex_destroy(&dma->lock);
+	pthread_cond_destroy(&dma->wake);
+}
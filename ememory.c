@@ -34,12 +34,17 @@ static void read_header(char* data, uint16_t* size, uint16_t* next, uint16_t off
 void init_ememory(struct ememory* memory, int size) {
 	write_header(memory->data, size - STARTING_OFFSET, 0, STARTING_OFFSET);
 	memory->free_head = STARTING_OFFSET;
+	memory->arena = 0;
+	memory->size = size;
 }
 
 struct eptr emalloc(struct ememory* memory, uint16_t request) {
 	if (request == 0) {
 		return ENULL;
 	}
+	if (memory->arena) {
+		return arena_alloc(memory, request, 1);
+	}
 	struct eptr res;
 	char* data = memory->data;
 	uint16_t block_size, next;
@@ -165,6 +170,9 @@ static int free_at_tail(struct ememory *memory, struct eptr ptr,
  * Free a block at ptr in a free list of memory blocks
  */
 int efree(struct ememory* memory, struct eptr ptr) {
+	if (memory->arena) {
+		return 0;
+	}
 	char* data = memory->data;
 	uint16_t curr_size, curr_next, next_size, next_next;
 	uint16_t curr = memory->free_head;
@@ -191,6 +199,109 @@ int efree(struct ememory* memory, struct eptr ptr) {
 	return free_at_tail(memory, ptr, curr, curr_size);
 } 
 
+int is_allocated(struct ememory* memory, uint32_t addr, uint32_t len) {
+	if (addr < STARTING_OFFSET || addr > MEM_SIZE || len > MEM_SIZE - addr) {
+		return 0;
+	}
+	uint16_t size, next;
+	uint16_t curr = memory->free_head;
+	while (curr) {
+		read_header(memory->data, &size, &next, curr);
+		if (addr < (uint32_t) curr + size && curr < addr + len) {
+			return 0;
+		}
+		// The list is kept in address order. Anything else means the guest
+		// has overwritten a header, and the range cannot be trusted.
+		if (next && next <= curr) {
+			return 0;
+		}
+		curr = next;
+	}
+	return 1;
+}
+
+void free_list_stats(struct ememory* memory, struct free_stats* stats) {
+	*stats = (struct free_stats) { 0 };
+	uint16_t size, next;
+	uint16_t curr = memory->free_head;
+	while (curr) {
+		read_header(memory->data, &size, &next, curr);
+		stats->blocks++;
+		stats->bytes += size;
+		stats->largest = (size > stats->largest) ? size : stats->largest;
+		// Stop at a header the guest has overwritten, as in is_allocated()
+		if (next && next <= curr) {
+			break;
+		}
+		curr = next;
+	}
+}
+
+int emalloc_batch(struct ememory* memory, const uint16_t* sizes, int n, struct eptr* out) {
+	arena_mark_t mark = arena_mark(memory);
+	for (int i = 0; i < n; i++) {
+		out[i] = emalloc(memory, sizes[i]);
+		if (is_null(out[i])) {
+			if (memory->arena) {
+				arena_release(memory, mark);
+			} else {
+				while (i--) {
+					efree(memory, out[i]);
+				}
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* ------------------- Arena mode ------------------- */
+
+void init_arena(struct ememory* memory, int size) {
+	init_ememory(memory, size);
+	memory->arena = 1;
+}
+
+arena_mark_t arena_mark(struct ememory* memory) {
+	return memory->free_head ? memory->free_head : memory->size;
+}
+
+struct eptr arena_alloc(struct ememory* memory, uint16_t request, uint16_t align) {
+	uint32_t top = arena_mark(memory);
+	uint32_t start = (top + align - 1) & ~(uint32_t) (align - 1);
+	uint32_t end = start + request;
+	if (request == 0 || end > memory->size) {
+		return ENULL;
+	}
+
+	// Same rule as emalloc(): a leftover too small for a header and one byte
+	// is handed out with the block
+	if (memory->size - end <= HEADER_SIZE) {
+		end = memory->size;
+		memory->free_head = 0;
+	} else {
+		write_header(memory->data, memory->size - end, 0, end);
+		memory->free_head = end;
+	}
+	return (struct eptr) { .ptr = start, .size = end - start };
+}
+
+int arena_release(struct ememory* memory, arena_mark_t mark) {
+	if (mark < STARTING_OFFSET || mark > arena_mark(memory)) {
+		return -1;
+	}
+	if (mark == memory->size) {
+		return 0;
+	}
+	write_header(memory->data, memory->size - mark, 0, mark);
+	memory->free_head = mark;
+	return 0;
+}
+
+void arena_reset(struct ememory* memory) {
+	arena_release(memory, STARTING_OFFSET);
+}
+
 // In the future, implement the function below. This will allow us to simplify 
 // our free logic to  mark block as free -> merge, rather than doing it all at 
 // once.
@@ -0,0 +1,94 @@
+/**
+ * Allocation throughput of the concurrent ememory mode. Each thread repeatedly
+ * allocates a handful of small blocks and frees them again, once through a
+ * single global lock around emalloc()/efree() and once through its own
+ * ememory_cache.
+ *
+ * Usage: ememory_bench [max_threads] [ops_per_thread]
+ */
+
+#include "ememory_cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LIVE_BLOCKS		8
+
+static char data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct shared_ememory shared;
+static long ops_per_thread;
+
+static const uint16_t sizes[LIVE_BLOCKS] = { 16, 24, 32, 48, 64, 16, 100, 128 };
+
+static void* locked_worker(void* arg) {
+	(void) arg;
+	struct eptr live[LIVE_BLOCKS];
+	for (long i = 0; i < ops_per_thread; i += LIVE_BLOCKS) {
+		for (int j = 0; j < LIVE_BLOCKS; j++) {
+			pthread_mutex_lock(&shared.lock);
+			live[j] = emalloc(&memory, sizes[j]);
+			pthread_mutex_unlock(&shared.lock);
+		}
+		for (int j = 0; j < LIVE_BLOCKS; j++) {
+			pthread_mutex_lock(&shared.lock);
+			efree(&memory, live[j]);
+			pthread_mutex_unlock(&shared.lock);
+		}
+	}
+	return NULL;
+}
+
+static void* cached_worker(void* arg) {
+	(void) arg;
+	struct ememory_cache cache;
+	init_ememory_cache(&cache, &shared);
+	struct eptr live[LIVE_BLOCKS];
+	for (long i = 0; i < ops_per_thread; i += LIVE_BLOCKS) {
+		for (int j = 0; j < LIVE_BLOCKS; j++) {
+			live[j] = emalloc_cached(&cache, sizes[j]);
+		}
+		for (int j = 0; j < LIVE_BLOCKS; j++) {
+			efree_cached(&cache, live[j]);
+		}
+	}
+	flush_ememory_cache(&cache);
+	return NULL;
+}
+
+/**
+ * Returns allocations (plus frees) per second with `n` threads
+ */
+static double run(void* (*worker)(void*), int n) {
+	pthread_t threads[n];
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < n; i++) {
+		pthread_create(&threads[i], NULL, worker, NULL);
+	}
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return 2.0 * n * ops_per_thread / secs;
+}
+
+int main(int argc, char** argv) {
+	int max_threads = (argc > 1) ? atoi(argv[1]) : 8;
+	ops_per_thread = (argc > 2) ? atol(argv[2]) : 2000000;
+
+	init_ememory(&memory, MEM_SIZE);
+	init_shared_ememory(&shared, &memory);
+
+	printf("threads     locked (Mops/s)   cached (Mops/s)\n");
+	for (int n = 1; n <= max_threads; n *= 2) {
+		double locked = run(locked_worker, n);
+		double cached = run(cached_worker, n);
+		printf("%7d  %16.1f  %16.1f\n", n, locked / 1e6, cached / 1e6);
+	}
+
+	destroy_shared_ememory(&shared);
+	return 0;
+}
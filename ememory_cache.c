@@ -0,0 +1,115 @@
+#include "ememory_cache.h"
+
+/**
+ * Returns the size class serving `size`, or -1 if it is too large to cache
+ */
+static int size_class(uint16_t size) {
+	int class = 0;
+	uint16_t class_size = EMEMORY_CACHE_MIN;
+	while (class_size < size) {
+		if (++class == EMEMORY_CACHE_CLASSES) {
+			return -1;
+		}
+		class_size <<= 1;
+	}
+	return class;
+}
+
+static inline uint16_t class_size(int class) {
+	return EMEMORY_CACHE_MIN << class;
+}
+
+void init_shared_ememory(struct shared_ememory* shared, struct ememory* memory) {
+	shared->memory = memory;
+	pthread_mutex_init(&shared->lock, NULL);
+}
+
+void destroy_shared_ememory(struct shared_ememory* shared) {
+	pthread_mutex_destroy(&shared->lock);
+}
+
+void init_ememory_cache(struct ememory_cache* cache, struct shared_ememory* shared) {
+	memset(cache, 0, sizeof(*cache));
+	cache->shared = shared;
+}
+
+/**
+ * Moves up to EMEMORY_CACHE_BATCH blocks of a class from the central list into
+ * its bin, taking the lock once
+ */
+static void refill(struct ememory_cache* cache, int class) {
+	struct shared_ememory* shared = cache->shared;
+	int* count = &cache->counts[class];
+	pthread_mutex_lock(&shared->lock);
+	while (*count < EMEMORY_CACHE_BATCH) {
+		struct eptr ptr = emalloc(shared->memory, class_size(class));
+		if (is_null(ptr)) {
+			break;
+		}
+		cache->bins[class][(*count)++] = ptr;
+	}
+	pthread_mutex_unlock(&shared->lock);
+}
+
+/**
+ * Returns the oldest `n` blocks of a bin to the central list, taking the lock
+ * once
+ */
+static void drain(struct ememory_cache* cache, int class, int n) {
+	struct shared_ememory* shared = cache->shared;
+	struct eptr* bin = cache->bins[class];
+	pthread_mutex_lock(&shared->lock);
+	for (int i = 0; i < n; i++) {
+		efree(shared->memory, bin[i]);
+	}
+	pthread_mutex_unlock(&shared->lock);
+	cache->counts[class] -= n;
+	memmove(bin, bin + n, cache->counts[class] * sizeof(struct eptr));
+}
+
+struct eptr emalloc_cached(struct ememory_cache* cache, uint16_t size) {
+	if (size == 0) {
+		return ENULL;
+	}
+	int class = size_class(size);
+	if (class < 0) {
+		pthread_mutex_lock(&cache->shared->lock);
+		struct eptr ptr = emalloc(cache->shared->memory, size);
+		pthread_mutex_unlock(&cache->shared->lock);
+		return ptr;
+	}
+
+	if (cache->counts[class] == 0) {
+		refill(cache, class);
+		if (cache->counts[class] == 0) {
+			return ENULL;
+		}
+	}
+	return cache->bins[class][--cache->counts[class]];
+}
+
+int efree_cached(struct ememory_cache* cache, struct eptr ptr) {
+	// Only blocks of exactly a class size are cached. emalloc() may hand out
+	// a slightly larger block, which goes back to the central list.
+	int class = size_class(ptr.size);
+	if (class < 0 || ptr.size != class_size(class)) {
+		pthread_mutex_lock(&cache->shared->lock);
+		int res = efree(cache->shared->memory, ptr);
+		pthread_mutex_unlock(&cache->shared->lock);
+		return res;
+	}
+
+	if (cache->counts[class] == EMEMORY_CACHE_DEPTH) {
+		drain(cache, class, EMEMORY_CACHE_DEPTH / 2);
+	}
+	cache->bins[class][cache->counts[class]++] = ptr;
+	return 0;
+}
+
+void flush_ememory_cache(struct ememory_cache* cache) {
+	for (int class = 0; class < EMEMORY_CACHE_CLASSES; class++) {
+		if (cache->counts[class]) {
+			drain(cache, class, cache->counts[class]);
+		}
+	}
+}
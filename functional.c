@@ -0,0 +1,181 @@
+#include "functional.h"
+#include "pipeline.h"
+#include "simd.h"
+
+static inline word_t read_operand(struct processor* proc, unsigned char reg, word_t pc) {
+	if (reg == PC) {
+		return pc;
+	}
+	return READ_REG(proc, reg);
+}
+
+/**
+ * Lists the registers an instruction reads and writes. The PC is left out,
+ * since its value is known from the instruction's address.
+ */
+static void fill_record(struct retire_record* record, word_t pc, const struct instr* in, 
+						const struct signal* sig, word_t addr, word_t len, int taken) {
+	*record = (struct retire_record) { 
+		.pc = pc, 
+		.in = *in, 
+		.sig = *sig, 
+		.addr = addr, 
+		.len = len, 
+		.taken = taken 
+	};
+	if (sig->halt) {
+		return;
+	}
+	if (in->opcode != MOV && in->src1 != PC) {
+		record->srcs[record->num_srcs++] = in->src1;
+	}
+	if (!in->imm_flag && in->src2 != PC) {
+		record->srcs[record->num_srcs++] = in->src2;
+	}
+	if (sig->mem_write) {
+		int count = sig->vector ? VECTOR_WORDS : 1;
+		for (int i = 0; i < count; i++) {
+			if (in->dest + i != PC) {
+				record->srcs[record->num_srcs++] = in->dest + i;
+			}
+		}
+	}
+	if (sig->reg_write) {
+		record->dest = in->dest;
+		record->num_dests = sig->vector ? VECTOR_WORDS : 1;
+	}
+}
+
+/**
+ * Executes one instruction, describing it in `record` unless that is NULL. 
+ * Inlined into both callers, so functional_step() pays nothing for records.
+ */
+static inline __attribute__((always_inline)) int step(struct processor* proc, 
+													  struct retire_record* record) {
+	char* data = proc->memory->data;
+	word_t pc = proc->regs[PC];
+	int err;
+
+	if (proc->pipeline_ctrl.halted) {
+		return HALTED;
+	}
+	if ((err = verify_in_bounds(pc))) {
+		return err;
+	}
+
+	struct instr in = read_be_instr(data + pc);
+	if (in.opcode >= NUM_OPCODES) {
+		return INVALID_OPCODE;
+	}
+	if ((err = verify_reg(in.dest)) || (err = verify_reg(in.src1))) {
+		return err;
+	}
+
+	struct signal sig = instr_to_signal(&in);
+	if (!sig.valid) {
+		return INVALID_OPCODE;
+	}
+	if (sig.halt) {
+		proc->regs[PC] = pc + sizeof(struct instr);
+		proc->pipeline_ctrl.halt = 1;
+		proc->pipeline_ctrl.halted = 1;
+		if (record) {
+			fill_record(record, pc, &in, &sig, 0, 0, 0);
+		}
+		return HALTED;
+	}
+	if (sig.vector && in.dest + VECTOR_WORDS > PC) {
+		return INVALID_REG;
+	}
+
+	word_t dest_data = read_operand(proc, in.dest, pc);
+	word_t src1_data = read_operand(proc, in.src1, pc);
+	word_t src2_data;
+	if (in.imm_flag) {
+		src2_data = in.src2;
+	} else {
+		if ((err = verify_reg(in.src2))) {
+			return err;
+		}
+		src2_data = read_operand(proc, in.src2, pc);
+	}
+
+	if ((err = verify_divisor(sig.alu_op, src2_data))) {
+		return err;
+	}
+	int64_t alu_result = alu_compute(sig.alu_op, src1_data, src2_data);
+	word_t next_pc = pc + sizeof(struct instr);
+	int taken = sig.branch && evaluate_cmp(proc->flag, in.opcode);
+	if (taken) {
+		next_pc = alu_result;
+	}
+
+	word_t mem_result = 0;
+	if (sig.block) {
+		if ((err = block_memory_op(data, sig.mem_read, dest_data, src1_data, alu_result))) {
+			return err;
+		}
+	} else if (sig.vector) {
+		word_t last = alu_result + (VECTOR_WORDS - 1) * sizeof(word_t);
+		if ((err = verify_in_bounds(alu_result)) || (err = verify_in_bounds(last))) {
+			return err;
+		}
+		if (sig.mem_read) {
+			vector_copy(&proc->regs[in.dest], &data[alu_result]);
+		} else {
+			vector_copy(&data[alu_result], &proc->regs[in.dest]);
+		}
+		proc->regs[PC] = next_pc;
+		if (record) {
+			fill_record(record, pc, &in, &sig, alu_result, 0, 0);
+		}
+		return 0;
+	} else if (sig.mem_read) {
+		if ((err = load_word(&proc->devices, data, alu_result, &mem_result))) {
+			return err;
+		}
+	} else if (sig.mem_write) {
+		if ((err = store_word(&proc->devices, data, alu_result, dest_data))) {
+			return err;
+		}
+	}
+
+	proc->regs[PC] = next_pc;
+	if (sig.reg_write) {
+		WRITE_REG(proc, in.dest, sig.wb_src ? mem_result : alu_result);
+	}
+	if (record) {
+		if (sig.block) {
+			fill_record(record, pc, &in, &sig, dest_data, alu_result, 0);
+		} else {
+			fill_record(record, pc, &in, &sig, alu_result, 0, taken);
+		}
+	}
+	return 0;
+}
+
+int functional_step(struct processor* proc) {
+	return step(proc, NULL);
+}
+
+int functional_step_record(struct processor* proc, struct retire_record* record) {
+	return step(proc, record);
+}
+
+int functional_run(struct processor* proc, uint64_t count, word_t pc_marker, 
+				   uint64_t* executed) {
+	int status = 0;
+	uint64_t i = 0;
+	while (i < count) {
+		if (pc_marker && proc->regs[PC] == pc_marker) {
+			break;
+		}
+		if ((status = functional_step(proc))) {
+			i += (status == HALTED);
+			break;
+		}
+		i++;
+	}
+	*executed = i;
+	return status;
+}
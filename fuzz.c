@@ -0,0 +1,630 @@
+#include "processor.h"
+#include "pipeline.h"
+#include "timing.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * DETAILS:
+ * 
+ * Lockstep co-simulation of the pipeline against a reference ISA model.
+ * 
+ * Random programs are generated from the OPCODES table and run through 
+ * clock_cycle() (the loop behind run()). Every time the pipeline retires an 
+ * instruction, the reference model executes one instruction and the retired
+ * PC, registers, and flag are compared. Memory is compared once the program 
+ * finishes, since stores happen in MEM before the older instruction retires.
+ * 
+ * The reference model never looks at the encoded image, so decoding bugs in
+ * the pipeline are caught too. The program is then replayed through the 
+ * in-order timing model, which must finish in the same cycle. Failing programs are shrunk before they are
+ * printed in unuasm.py syntax.
+ * 
+ * Programs only branch forwards and only access memory through BASE_REG, 
+ * which holds DATA_BASE and is never written, so every program terminates by
+ * falling off its end without faulting.
+ * 
+ * Usage: ./fuzz [-n programs] [-j threads] [-s seed] [-l max length]
+ */
+
+#define DATA_BASE 		0x8000
+#define DATA_SIZE 		256
+#define BASE_REG 		R7
+#define MAX_PROGRAM 	256
+#define MAX_REPORTS		4
+
+struct fuzz_instr {
+	unsigned char opcode;
+	unsigned char imm_flag;
+	unsigned char dest;
+	unsigned char src1;
+	int16_t src2;
+};
+
+// `or r0, r0, #0` has no architectural effect
+#define FUZZ_NOP (struct fuzz_instr) { .opcode = OR, .imm_flag = 1 }
+
+struct fuzz_program {
+	struct fuzz_instr code[MAX_PROGRAM];
+	int len;
+	word_t init_regs[BASE_REG];
+	unsigned char init_data[DATA_SIZE];
+};
+
+struct fuzz_ctx {
+	char* memory;
+	char* ref_memory;
+	char* timing_memory;
+	const struct pipeline_preset* preset;
+	char report[256];
+};
+
+// ==========================
+//		 RANDOM PROGRAMS
+// ==========================
+
+static uint64_t next_random(uint64_t* state) {
+	// splitmix64
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static unsigned int rand_below(uint64_t* rng, unsigned int bound) {
+	return next_random(rng) % bound;
+}
+
+static unsigned char random_dest(uint64_t* rng) {
+	return rand_below(rng, BASE_REG);
+}
+
+static unsigned char random_src(uint64_t* rng) {
+	return rand_below(rng, PC + 1);
+}
+
+static int16_t random_imm(uint64_t* rng) {
+	// Favour small values so comparisons are sometimes equal
+	return rand_below(rng, 2) ? (int16_t) (rand_below(rng, 9) - 4) : (int16_t) next_random(rng);
+}
+
+static void random_src2(uint64_t* rng, struct fuzz_instr* in) {
+	in->imm_flag = rand_below(rng, 2);
+	in->src2 = in->imm_flag ? random_imm(rng) : random_src(rng);
+}
+
+static struct fuzz_instr random_instr(uint64_t* rng, int index, int len) {
+	struct fuzz_instr in = { .opcode = rand_below(rng, NUM_OPCODES) };
+	switch (in.opcode) {
+		case MOV:
+			in.dest = random_dest(rng);
+			random_src2(rng, &in);
+			break;
+		case LOAD:
+		case STORE:
+			in.dest = (in.opcode == LOAD) ? random_dest(rng) : random_src(rng);
+			in.src1 = BASE_REG;
+			in.imm_flag = 1;
+			in.src2 = rand_below(rng, DATA_SIZE - sizeof(word_t) + 1);
+			break;
+		case VLOAD:
+		case VSTORE:
+			// The loaded registers must not include BASE_REG
+			in.dest = rand_below(rng, (in.opcode == VLOAD ? BASE_REG : PC) - VECTOR_WORDS + 1);
+			in.src1 = BASE_REG;
+			in.imm_flag = 1;
+			in.src2 = rand_below(rng, DATA_SIZE - VECTOR_WORDS * sizeof(word_t) + 1);
+			break;
+		case MEMCPY:
+		case MEMSET:
+			// Destination and source addresses both come from BASE_REG, the
+			// fill byte from any register
+			in.dest = BASE_REG;
+			in.src1 = (in.opcode == MEMCPY) ? BASE_REG : random_src(rng);
+			in.imm_flag = 1;
+			in.src2 = rand_below(rng, DATA_SIZE + 1);
+			break;
+		case DIV:
+		case REM:
+			// Mostly nonzero immediate divisors, so few programs end at a 
+			// division by zero
+			in.dest = random_dest(rng);
+			in.src1 = random_src(rng);
+			random_src2(rng, &in);
+			if (rand_below(rng, 4) && (!in.imm_flag || in.src2 == 0)) {
+				in.imm_flag = 1;
+				in.src2 = (int16_t) (next_random(rng) | 1);
+			}
+			break;
+		case CMP:
+			in.dest = random_src(rng);
+			random_src2(rng, &in);
+			break;
+		case BEQ:
+		case BNE:
+		case BRN:
+			// Forward branch to any later instruction, or just past the end
+			in.dest = PC;
+			in.imm_flag = 1;
+			in.src2 = (1 + rand_below(rng, len - index)) * sizeof(struct instr);
+			break;
+		case HALT:
+			// Rare, since it ends the program
+			if (rand_below(rng, 8)) {
+				in = FUZZ_NOP;
+			} else {
+				in.imm_flag = 1;
+			}
+			break;
+		default:
+			in.dest = random_dest(rng);
+			in.src1 = random_src(rng);
+			random_src2(rng, &in);
+	}
+	return in;
+}
+
+static void random_program(uint64_t seed, int max_len, struct fuzz_program* prog) {
+	uint64_t rng = seed;
+	prog->len = 1 + rand_below(&rng, max_len);
+	for (int i = 0; i < prog->len; i++) {
+		prog->code[i] = random_instr(&rng, i, prog->len);
+	}
+	for (int i = 0; i < BASE_REG; i++) {
+		prog->init_regs[i] = rand_below(&rng, 2) ? (word_t) next_random(&rng) : rand_below(&rng, 4);
+	}
+	for (int i = 0; i < DATA_SIZE; i++) {
+		prog->init_data[i] = next_random(&rng);
+	}
+}
+
+static void encode(struct fuzz_instr* in, char* out) {
+	uint32_t word = (uint32_t) (in->opcode & 0x7F) << 25;
+	word |= (uint32_t) (in->imm_flag & 0x1) << 24;
+	word |= (uint32_t) (in->dest & 0xF) << 20;
+	word |= (uint32_t) (in->src1 & 0xF) << 16;
+	word |= (uint16_t) in->src2;
+	out[0] = word >> 24;
+	out[1] = word >> 16;
+	out[2] = word >> 8;
+	out[3] = word;
+}
+
+// ==============================
+//		 REFERENCE ISA MODEL
+// ==============================
+
+struct ref_state {
+	word_t regs[NUM_REGS];
+	int64_t flag;
+	char* memory;
+	int halted;
+};
+
+static word_t ref_read(struct ref_state* ref, unsigned char reg, word_t pc) {
+	return (reg == PC) ? pc : ref->regs[reg];
+}
+
+/**
+ * Executes one instruction. Returns 1 on success, 0 once the PC has left the
+ * program, or the (negative) pipeline error code the instruction raises.
+ */
+static int ref_step(struct ref_state* ref, struct fuzz_program* prog) {
+	word_t pc = ref->regs[PC];
+	word_t index = (pc - STARTING_OFFSET) / sizeof(struct instr);
+	if (pc < STARTING_OFFSET || index >= (word_t) prog->len) {
+		return 0;
+	}
+
+	struct fuzz_instr* in = &prog->code[index];
+	word_t dest = ref_read(ref, in->dest, pc);
+	word_t src1 = ref_read(ref, in->src1, pc);
+	word_t src2 = in->imm_flag ? (word_t) (int32_t) in->src2 : ref_read(ref, in->src2, pc);
+	word_t next_pc = pc + sizeof(struct instr);
+
+	switch (in->opcode) {
+		case MOV:	ref->regs[in->dest] = src2; break;
+		case ADD:	ref->regs[in->dest] = src1 + src2; break;
+		case SUB:	ref->regs[in->dest] = src1 - src2; break;
+		case AND:	ref->regs[in->dest] = src1 & src2; break;
+		case OR:	ref->regs[in->dest] = src1 | src2; break;
+		case XOR:	ref->regs[in->dest] = src1 ^ src2; break;
+		case CMP:	ref->flag = (word_t) (dest - src2); break;
+		case LOAD:	
+			memcpy(&ref->regs[in->dest], ref->memory + src1 + src2, sizeof(word_t)); 
+			break;
+		case STORE:	
+			memcpy(ref->memory + src1 + src2, &dest, sizeof(word_t)); 
+			break;
+		case BEQ:	if (ref->flag == 0) next_pc = dest + src2; break;
+		case BNE:	if (ref->flag != 0) next_pc = dest + src2; break;
+		case BRN:	next_pc = dest + src2; break;
+		case HALT:	ref->halted = 1; break;
+		case MUL:	ref->regs[in->dest] = src1 * src2; break;
+		case MULH:	
+			ref->regs[in->dest] = (word_t) ((int64_t) (int32_t) src1 * (int64_t) (int32_t) src2 >> 32); 
+			break;
+		case DIV:
+		case REM:
+			if (src2 == 0) {
+				return INVALID_OP;
+			}
+			if (src1 == 0x80000000u && src2 == 0xFFFFFFFFu) {
+				ref->regs[in->dest] = (in->opcode == DIV) ? src1 : 0;
+			} else if (in->opcode == DIV) {
+				ref->regs[in->dest] = (word_t) ((int32_t) src1 / (int32_t) src2);
+			} else {
+				ref->regs[in->dest] = (word_t) ((int32_t) src1 % (int32_t) src2);
+			}
+			break;
+		case SHL:	ref->regs[in->dest] = src1 << (src2 % 32); break;
+		case SHR:	ref->regs[in->dest] = src1 >> (src2 % 32); break;
+		case SAR:	
+			// Sign-fill by hand rather than relying on the host's signed shift
+			ref->regs[in->dest] = src1 >> (src2 % 32);
+			if ((src1 & 0x80000000u) && src2 % 32) {
+				ref->regs[in->dest] |= ~(0xFFFFFFFFu >> (src2 % 32));
+			}
+			break;
+		case MEMCPY:
+			memmove(ref->memory + dest, ref->memory + src1, src2);
+			break;
+		case MEMSET:
+			memset(ref->memory + dest, (unsigned char) src1, src2);
+			break;
+		case VLOAD:
+			memcpy(&ref->regs[in->dest], ref->memory + src1 + src2, VECTOR_WORDS * sizeof(word_t));
+			break;
+		case VSTORE:
+			memcpy(ref->memory + src1 + src2, &ref->regs[in->dest], VECTOR_WORDS * sizeof(word_t));
+			break;
+		case PADDB:
+		case PSUBB:
+		case PADDH:
+		case PSUBH: {
+			// Lane by lane, independently of the host implementation
+			int lane_bits = (in->opcode == PADDB || in->opcode == PSUBB) ? 8 : 16;
+			word_t mask = (1u << lane_bits) - 1, res = 0;
+			for (int shift = 0; shift < 32; shift += lane_bits) {
+				word_t a = (src1 >> shift) & mask, b = (src2 >> shift) & mask;
+				word_t lane = (in->opcode == PADDB || in->opcode == PADDH) ? a + b : a - b;
+				res |= (lane & mask) << shift;
+			}
+			ref->regs[in->dest] = res;
+			break;
+		}
+	}
+	ref->regs[PC] = next_pc;
+	return 1;
+}
+
+// =======================
+//		 CO-SIMULATION
+// =======================
+
+#define MISMATCH(...) 									\
+	do {												\
+		snprintf(ctx->report, sizeof(ctx->report), __VA_ARGS__);	\
+		return 1;										\
+	} while (0)
+
+/**
+ * Runs a program through both models in lockstep
+ * 
+ * @return	0 if both models agree, else 1 with a description in ctx->report
+ */
+static struct processor load_program(struct fuzz_program* prog, struct ememory* memory) {
+	memset(memory->data, 0, MEM_SIZE);
+	for (int i = 0; i < prog->len; i++) {
+		encode(&prog->code[i], memory->data + STARTING_OFFSET + i * sizeof(struct instr));
+	}
+	memcpy(memory->data + DATA_BASE, prog->init_data, DATA_SIZE);
+
+	struct processor proc = new_processor(memory);
+	memcpy(proc.regs, prog->init_regs, sizeof(prog->init_regs));
+	proc.regs[BASE_REG] = DATA_BASE;
+	proc.regs[PC] = STARTING_OFFSET;
+	return proc;
+}
+
+/**
+ * Runs the instructions the pipeline retired through the in-order timing 
+ * model of the same shape
+ */
+static int check_timing(struct fuzz_program* prog, struct fuzz_ctx* ctx, struct processor* pipeline) {
+	struct ememory memory = { .data = ctx->timing_memory };
+	struct processor proc = load_program(prog, &memory);
+	struct inorder_timing timing;
+	init_inorder_timing(&timing, ctx->preset->name, &pipeline->shape);
+	struct timing_model* models[] = { &timing.model };
+	uint64_t executed;
+	timing_run(&proc, pipeline->stats.retired, 0, models, 1, &executed);
+	if (timing.model.stats.cycles != pipeline->stats.cycles) {
+		MISMATCH("timing model finished in cycle %llu, pipeline in cycle %llu", 
+				 (unsigned long long) timing.model.stats.cycles, 
+				 (unsigned long long) pipeline->stats.cycles);
+	}
+	return 0;
+}
+
+static int cosimulate(struct fuzz_program* prog, struct fuzz_ctx* ctx) {
+	struct ememory memory = { .data = ctx->memory };
+	struct processor proc = load_program(prog, &memory);
+	set_pipeline_shape(&proc, ctx->preset->stages, ctx->preset->depth);
+	memcpy(ctx->ref_memory, ctx->memory, MEM_SIZE);
+	struct ref_state ref = { .memory = ctx->ref_memory };
+	memcpy(ref.regs, proc.regs, sizeof(ref.regs));
+
+	int depth = pipeline_depth(&proc.shape);
+	uint64_t max_cycles = (11 + depth + DIV_LATENCY) * (uint64_t) prog->len + 64;
+	while (1) {
+		word_t retiring_pc = current_latches(&proc)->mem_stage.dbg.pc;
+		uint64_t retired = proc.stats.retired;
+
+		int status = clock_cycle(&proc);
+		if (status && status != HALTED) {
+			// The faulting instruction may still have older instructions in 
+			// flight, so the reference must raise the same error within the 
+			// next few instructions
+			int ref_status = 1;
+			for (int i = 0; i < depth - 1 && ref_status == 1 && !ref.halted; i++) {
+				ref_status = ref_step(&ref, prog);
+			}
+			if (ref_status != status) {
+				MISMATCH("pipeline error %s at cycle %llu", pipeline_err_to_string(status), 
+						 (unsigned long long) proc.stats.cycles);
+			}
+			return 0;
+		}
+		if (proc.stats.cycles > max_cycles) {
+			MISMATCH("pipeline did not finish within %llu cycles", (unsigned long long) max_cycles);
+		}
+		if (proc.stats.retired == retired) {
+			continue;
+		}
+
+		word_t expected_pc = ref.regs[PC];
+		int ref_status = ref_step(&ref, prog);
+		if (ref_status == 0) {
+			MISMATCH("pipeline retired 0x%x after the program ended", retiring_pc);
+		} else if (ref_status < 0) {
+			MISMATCH("pipeline retired 0x%x, expected %s", retiring_pc, 
+					 pipeline_err_to_string(ref_status));
+		}
+		if (retiring_pc != expected_pc) {
+			MISMATCH("retired 0x%x, expected 0x%x", retiring_pc, expected_pc);
+		}
+		for (int reg = R0; reg < PC; reg++) {
+			if (proc.regs[reg] != ref.regs[reg]) {
+				MISMATCH("after 0x%x: %s = 0x%x, expected 0x%x", retiring_pc, 
+						 reg_to_str(reg), proc.regs[reg], ref.regs[reg]);
+			}
+		}
+		if ((int64_t) proc.flag != ref.flag) {
+			MISMATCH("after 0x%x: FLAG = %lld, expected %lld", retiring_pc, 
+					 (long long) proc.flag, (long long) ref.flag);
+		}
+		if (ref.halted != (status == HALTED)) {
+			MISMATCH("pipeline %s at 0x%x", ref.halted ? "did not halt" : "halted", retiring_pc);
+		}
+		if (ref.halted) {
+			if (proc.regs[PC] != ref.regs[PC]) {
+				MISMATCH("halted with PC = 0x%x, expected 0x%x", proc.regs[PC], ref.regs[PC]);
+			}
+			break;
+		}
+
+		word_t pc = ref.regs[PC];
+		if (pc < STARTING_OFFSET || pc >= STARTING_OFFSET + prog->len * sizeof(struct instr)) {
+			break;
+		}
+	}
+
+	if (memcmp(ctx->memory + DATA_BASE, ctx->ref_memory + DATA_BASE, DATA_SIZE)) {
+		MISMATCH("data memory differs at the end of the program");
+	}
+	return check_timing(prog, ctx, &proc);
+}
+
+// =================
+//		 SHRINKING
+// =================
+
+/**
+ * Removes instruction `index`, retargeting branches that jump over it
+ */
+static void remove_instr(struct fuzz_program* prog, int index) {
+	for (int i = 0; i < index; i++) {
+		struct fuzz_instr* in = &prog->code[i];
+		if (in->dest == PC && in->imm_flag && (in->opcode == BEQ || in->opcode == BNE || in->opcode == BRN)) {
+			int target = i + in->src2 / (int) sizeof(struct instr);
+			if (target > index) {
+				in->src2 -= sizeof(struct instr);
+			}
+		}
+	}
+	memmove(&prog->code[index], &prog->code[index + 1], (prog->len - index - 1) * sizeof(struct fuzz_instr));
+	prog->len--;
+}
+
+static int is_nop(struct fuzz_instr* in) {
+	return !memcmp(in, &FUZZ_NOP, sizeof(struct fuzz_instr));
+}
+
+/**
+ * Greedily replaces instructions with NOPs, then removes them, for as long as
+ * the program keeps failing
+ */
+static void shrink(struct fuzz_program* prog, struct fuzz_ctx* ctx) {
+	struct fuzz_program* candidate = malloc(sizeof(struct fuzz_program));
+	int progress = 1;
+	while (progress) {
+		progress = 0;
+		for (int i = 0; i < prog->len; i++) {
+			if (is_nop(&prog->code[i])) {
+				continue;
+			}
+			*candidate = *prog;
+			candidate->code[i] = FUZZ_NOP;
+			if (cosimulate(candidate, ctx)) {
+				*prog = *candidate;
+				progress = 1;
+			}
+		}
+		for (int i = prog->len - 1; i >= 0 && prog->len > 1; i--) {
+			*candidate = *prog;
+			remove_instr(candidate, i);
+			if (cosimulate(candidate, ctx)) {
+				*prog = *candidate;
+				progress = 1;
+			}
+		}
+	}
+	free(candidate);
+	cosimulate(prog, ctx);
+}
+
+static void lower(const char* str, char* buf) {
+	while ((*buf++ = tolower((unsigned char) *str++)));
+}
+
+static void print_operand(unsigned char imm_flag, int16_t src2) {
+	char reg[8];
+	if (imm_flag) {
+		printf("#%d", src2);
+	} else {
+		lower(reg_to_str(src2), reg);
+		printf("%s", reg);
+	}
+}
+
+static void print_program(struct fuzz_program* prog) {
+	char op[16], dest[8], src1[8];
+	for (int i = 0; i < BASE_REG; i++) {
+		printf("\t; %s = 0x%x\n", reg_to_str(i), prog->init_regs[i]);
+	}
+	for (int i = 0; i < prog->len; i++) {
+		struct fuzz_instr* in = &prog->code[i];
+		lower(opcode_to_str(in->opcode), op);
+		lower(reg_to_str(in->dest), dest);
+		lower(reg_to_str(in->src1), src1);
+		if (in->opcode == HALT) {
+			printf("\t%s\t\t\t; 0x%lx\n", op, (unsigned long) (STARTING_OFFSET + i * sizeof(struct instr)));
+			continue;
+		}
+		printf("\t%s %s, ", op, dest);
+		if (in->opcode != MOV && in->opcode != CMP && in->opcode != BEQ 
+				&& in->opcode != BNE && in->opcode != BRN) {
+			printf("%s, ", src1);
+		}
+		print_operand(in->imm_flag, in->src2);
+		printf("\t; 0x%lx\n", (unsigned long) (STARTING_OFFSET + i * sizeof(struct instr)));
+	}
+}
+
+// ===============
+//		 DRIVER
+// ===============
+
+struct fuzz_options {
+	uint64_t programs;
+	uint64_t seed;
+	int max_len;
+	const struct pipeline_preset* preset;
+};
+
+static struct fuzz_options options = { .programs = 100000, .max_len = 64 };
+static uint64_t next_program;
+static uint64_t failures;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* fuzz_worker(void* arg) {
+	(void) arg;
+	struct fuzz_ctx ctx = { 
+		.memory = malloc(MEM_SIZE), 
+		.ref_memory = malloc(MEM_SIZE), 
+		.timing_memory = malloc(MEM_SIZE), 
+		.preset = options.preset 
+	};
+	struct fuzz_program* prog = malloc(sizeof(struct fuzz_program));
+
+	uint64_t index;
+	while ((index = __atomic_fetch_add(&next_program, 1, __ATOMIC_RELAXED)) < options.programs) {
+		uint64_t seed = options.seed ^ (index * 0xD1B54A32D192ED03ULL);
+		random_program(seed, options.max_len, prog);
+		if (!cosimulate(prog, &ctx)) {
+			continue;
+		}
+
+		uint64_t count = __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+		if (count > MAX_REPORTS) {
+			continue;
+		}
+		shrink(prog, &ctx);
+		pthread_mutex_lock(&report_lock);
+		printf("MISMATCH (program %llu): %s\n", (unsigned long long) index, ctx.report);
+		print_program(prog);
+		pthread_mutex_unlock(&report_lock);
+	}
+
+	free(prog);
+	free(ctx.memory);
+	free(ctx.ref_memory);
+	free(ctx.timing_memory);
+	return NULL;
+}
+
+int main(int argc, char** argv) {
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	options.seed = time(NULL);
+	options.preset = &pipeline_presets[0];
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:j:s:l:p:")) != -1) {
+		switch (opt) {
+			case 'n': options.programs = strtoull(optarg, NULL, 0); break;
+			case 'j': threads = strtol(optarg, NULL, 0); break;
+			case 's': options.seed = strtoull(optarg, NULL, 0); break;
+			case 'l': options.max_len = strtol(optarg, NULL, 0); break;
+			case 'p': 
+				if (!(options.preset = find_pipeline_preset(optarg))) {
+					fprintf(stderr, "unknown pipeline preset %s\n", optarg);
+					return 2;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n programs] [-j threads] [-s seed] [-l max length] [-p pipeline preset]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (options.max_len < 1 || options.max_len > MAX_PROGRAM) {
+		options.max_len = MAX_PROGRAM;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_t* workers = malloc(threads * sizeof(pthread_t));
+	for (long i = 0; i < threads; i++) {
+		pthread_create(&workers[i], NULL, fuzz_worker, NULL);
+	}
+	for (long i = 0; i < threads; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	free(workers);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("fuzz: %llu programs, %llu mismatches, seed %llu, %s pipeline, %ld threads, %.0f programs/s\n",
+		(unsigned long long) options.programs, (unsigned long long) failures, 
+		(unsigned long long) options.seed, options.preset->name, threads, options.programs / seconds);
+	return failures ? 1 : 0;
+}
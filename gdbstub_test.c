@@ -0,0 +1,203 @@
+#include "gdbstub.h"
+#include "assembler.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SOCKET_PATH "/tmp/gdbstub_test.sock"
+
+// Counts r1 up to 5. The bne falls through to 36, which the pipeline fetches
+// down the wrong path on every iteration.
+static const char* program =
+	"\tmov r1, #0\n"			// 16
+	"\tmov r2, #0\n"			// 20
+	"@loop\n"
+	"\tadd r1, r1, #1\n"		// 24
+	"\tcmp r1, #5\n"			// 28
+	"\tbne loop\n"				// 32
+	"\tmov r2, #9\n"			// 36
+	"\tmov r5, #7\n";			// 40
+
+static char data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct processor proc;
+static int serve_result;
+
+static void* server(void* arg) {
+	(void) arg;
+	serve_result = gdb_serve_unix(&proc, SOCKET_PATH);
+	return NULL;
+}
+
+static int connect_client() {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX, .sun_path = SOCKET_PATH };
+	for (int i = 0; i < 1000; i++) {
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+			return fd;
+		}
+		close(fd);
+		usleep(1000);
+	}
+	assert(0);
+}
+
+/* ------------------- Client ------------------- */
+
+static char reply[GDB_PACKET_SIZE + 1];
+
+static char read_char(int fd) {
+	char c;
+	assert(read(fd, &c, 1) == 1);
+	return c;
+}
+
+static void send_packet(int fd, const char* payload, size_t len) {
+	static char frame[GDB_PACKET_SIZE + 4];
+	unsigned char sum = 0;
+	frame[0] = '$';
+	for (size_t i = 0; i < len; i++) {
+		frame[1 + i] = payload[i];
+		sum += (unsigned char) payload[i];
+	}
+	sprintf(frame + 1 + len, "#%02x", sum);
+	assert(write(fd, frame, len + 4) == (ssize_t) len + 4);
+	assert(read_char(fd) == '+');
+}
+
+/**
+ * Sends `payload` and returns the payload of the reply
+ */
+static const char* transact(int fd, const char* payload) {
+	send_packet(fd, payload, strlen(payload));
+	while (read_char(fd) != '$')
+		;
+	size_t len = 0;
+	unsigned char sum = 0;
+	for (char c; (c = read_char(fd)) != '#'; len++) {
+		assert(len < GDB_PACKET_SIZE);
+		reply[len] = c;
+		sum += (unsigned char) c;
+	}
+	reply[len] = '\0';
+	char checksum[3] = { read_char(fd), read_char(fd), '\0' };
+	assert(strtoul(checksum, NULL, 16) == sum);
+	assert(write(fd, "+", 1) == 1);
+	return reply;
+}
+
+static word_t read_reg(int fd, int reg) {
+	char packet[8];
+	sprintf(packet, "p%x", reg);
+	const char* hex = transact(fd, packet);
+	assert(strlen(hex) == 8);
+	word_t value = 0;
+	for (int i = 3; i >= 0; i--) {
+		char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+		value = (value << 8) | strtoul(byte, NULL, 16);
+	}
+	return value;
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_registers(int fd) {
+	assert(strstr(transact(fd, "qSupported:swbreak+"), "PacketSize=") != NULL);
+	assert(strstr(transact(fd, "qXfer:features:read:target.xml:0,1000"), "name=\"flag\" bitsize=\"64\""));
+	assert(strcmp(transact(fd, "?"), "S05") == 0);
+
+	const char* regs = transact(fd, "g");
+	assert(strlen(regs) == 2 * (9 * sizeof(word_t) + sizeof(uint64_t)));
+	assert(strncmp(regs + 8 * 8, "10000000", 8) == 0);	// pc
+
+	assert(strcmp(transact(fd, "P3=78563412"), "OK") == 0);
+	assert(proc.regs[R3] == 0x12345678);
+	assert(read_reg(fd, R3) == 0x12345678);
+	assert(strcmp(transact(fd, "p20"), "E01") == 0);
+}
+
+void test_memory(int fd) {
+	// The whole image in one packet
+	const char* hex = transact(fd, "m0,10000");
+	assert(strlen(hex) == 2 * MEM_SIZE);
+	for (int i = 0; i < MEM_SIZE; i += 97) {
+		char byte[3] = { hex[2 * i], hex[2 * i + 1], '\0' };
+		assert((char) strtoul(byte, NULL, 16) == data[i]);
+	}
+	assert(strcmp(transact(fd, "m0,10001"), "E01") == 0);
+
+	assert(strcmp(transact(fd, "M8000,3:a1b2c3"), "OK") == 0);
+	assert(memcmp(data + 0x8000, "\xa1\xb2\xc3", 3) == 0);
+
+	// '#' and '}' go out escaped
+	const char binary[] = { 'X', '9', '0', '0', '0', ',', '3', ':', 0x01, 0x7d, '#' ^ 0x20, 0x7d, '}' ^ 0x20 };
+	send_packet(fd, binary, sizeof(binary));
+	while (read_char(fd) != '#')
+		;
+	read_char(fd);
+	read_char(fd);
+	assert(write(fd, "+", 1) == 1);
+	assert(memcmp(data + 0x9000, "\x01#}", 3) == 0);
+	assert(strcmp(transact(fd, "m9000,3"), "01237d") == 0);
+}
+
+void test_breakpoints(int fd) {
+	assert(strcmp(transact(fd, "Z0,18,4"), "OK") == 0);
+	assert(strcmp(transact(fd, "Z0,24,4"), "OK") == 0);
+
+	assert(strcmp(transact(fd, "c"), "S05") == 0);
+	assert(read_reg(fd, PC) == 24 && read_reg(fd, R1) == 0);
+	assert(strcmp(transact(fd, "c"), "S05") == 0);
+	assert(read_reg(fd, PC) == 24 && read_reg(fd, R1) == 1);
+
+	// 36 is fetched after every bne, but only reached once the loop exits
+	assert(strcmp(transact(fd, "z0,18,4"), "OK") == 0);
+	assert(strcmp(transact(fd, "c"), "S05") == 0);
+	assert(read_reg(fd, PC) == 36 && read_reg(fd, R1) == 5);
+	assert(read_reg(fd, R2) == 0);
+}
+
+void test_step(int fd) {
+	uint64_t retired = proc.stats.retired;
+	assert(strcmp(transact(fd, "s"), "S05") == 0);
+	assert(read_reg(fd, PC) == 40 && read_reg(fd, R2) == 9);
+	assert(proc.stats.retired == retired + 1);
+
+	// Stepping onto a fault reports it, and stepping on once the PC is fixed
+	// carries on from there
+	assert(strcmp(transact(fd, "P8=00000100"), "OK") == 0);
+	assert(strcmp(transact(fd, "s"), "S0b") == 0);
+	assert(read_reg(fd, PC) == 0x10000);
+	assert(strcmp(transact(fd, "P8=24000000"), "OK") == 0);
+	assert(strcmp(transact(fd, "s"), "S05") == 0);
+	assert(read_reg(fd, PC) == 40 && read_reg(fd, R2) == 9);
+}
+
+int main() {
+	struct asm_result result;
+	assert(assemble(program, &result) == 0);
+	memcpy(data + STARTING_OFFSET, result.image, result.size);
+	free_asm_result(&result);
+	proc = new_processor(&memory);
+	proc.regs[PC] = STARTING_OFFSET;
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, server, NULL);
+	int fd = connect_client();
+
+	test_registers(fd);
+	test_memory(fd);
+	test_breakpoints(fd);
+	test_step(fd);
+
+	assert(write(fd, "$k#6b", 5) == 5);
+	pthread_join(thread, NULL);
+	assert(serve_result == GDB_KILLED);
+	close(fd);
+
+	printf("All tests passed.\n");
+}
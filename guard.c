@@ -0,0 +1,87 @@
+#include "guard.h"
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+__thread struct guard_memory* running_guard;
+
+static int handler_installed;
+static struct sigaction previous_action;
+
+static void guard_handler(int sig, siginfo_t* info, void* context) {
+	struct guard_memory* guard = running_guard;
+	char* addr = info->si_addr;
+	if (guard && addr >= guard->data && addr < guard->data + guard->size) {
+		running_guard = NULL;
+		siglongjmp(guard->env, 1);
+	}
+
+	// Not ours. Returning retries the access under the previous action.
+	(void) sig;
+	(void) context;
+	sigaction(SIGSEGV, &previous_action, NULL);
+	handler_installed = 0;
+}
+
+int guard_memory_init(struct guard_memory* guard, struct ememory* memory) {
+	long page = sysconf(_SC_PAGESIZE);
+	if (sizeof(void*) < 8 || page <= 0 || MEM_SIZE % page) {
+		return -1;
+	}
+
+	// Everything guest_ptr() can return, plus the rest of a vector
+	size_t size = ((uint64_t) 1 << 32) + 2 * page;
+	char* data = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (data == MAP_FAILED) {
+		return -1;
+	}
+	if (mprotect(data, MEM_SIZE, PROT_READ | PROT_WRITE)) {
+		munmap(data, size);
+		return -1;
+	}
+	*guard = (struct guard_memory) { .data = data, .size = size };
+	memory->data = data;
+	return 0;
+}
+
+void guard_memory_free(struct guard_memory* guard) {
+	munmap(guard->data, guard->size);
+	guard->data = NULL;
+}
+
+int guard_attach(struct guard_memory* guard, struct processor* proc) {
+	if (proc->memory->data != guard->data) {
+		return -1;
+	}
+	if (!handler_installed) {
+		// The handler jumps out without restoring the signal mask, so SIGSEGV
+		// must not be blocked while it runs
+		struct sigaction action = { 0 };
+		action.sa_sigaction = guard_handler;
+		action.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGSEGV, &action, &previous_action)) {
+			return -1;
+		}
+		handler_installed = 1;
+	}
+
+	// Only plain runs have a guarded variant
+	unsigned int features = proc->features;
+	if (set_processor_features(proc, features | CONFIG_GUARD)) {
+		return -1;
+	}
+	if (proc->features != (features | CONFIG_GUARD)) {
+		set_processor_features(proc, features);
+		return -1;
+	}
+	proc->guard = guard;
+	return 0;
+}
+
+void guard_detach(struct guard_memory* guard, struct processor* proc) {
+	(void) guard;
+	set_processor_features(proc, proc->features & ~CONFIG_GUARD);
+	proc->guard = NULL;
+}
@@ -0,0 +1,141 @@
+#include "guard.h"
+#include "profile.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char checked_data[MEM_SIZE + 64];	// room for accesses past the end
+static struct ememory checked_memory = { .data = checked_data };
+static struct ememory guarded_memory;
+static struct guard_memory guard;
+
+/**
+ * Runs `source` with r2 = `addr` against checked and guard memory, and checks
+ * that both stop the same way in the same state
+ */
+static int run_both(const char* source, word_t addr) {
+	struct processor checked;
+	assert(load_source(&checked, &checked_memory, source, NULL) == 0);
+	struct processor guarded;
+	assert(load_source(&guarded, &guarded_memory, source, NULL) == 0);
+	assert(guard_attach(&guard, &guarded) == 0);
+	checked.regs[R2] = guarded.regs[R2] = addr;
+
+	struct stop_reason checked_stop = run_for(&checked, 100);
+	struct stop_reason guarded_stop = run_for(&guarded, 100);
+	assert(checked_stop.reason == guarded_stop.reason);
+	assert(checked_stop.err_code == guarded_stop.err_code);
+	assert(checked_stop.cycles == guarded_stop.cycles);
+	assert(checked_stop.retired == guarded_stop.retired);
+	if (checked_stop.reason == STOP_ERROR) {
+		assert(!strcmp(checked.err.function_name, guarded.err.function_name));
+	}
+	assert(!memcmp(checked.regs, guarded.regs, sizeof(checked.regs)));
+	assert(!memcmp(&checked.stats, &guarded.stats, sizeof(checked.stats)));
+	assert(!memcmp(checked_data, guarded_memory.data, MEM_SIZE));
+	guard_detach(&guard, &guarded);
+	return guarded_stop.err_code;
+}
+
+/**
+ * Addresses around both bounds and the ends of the 32-bit range. Accesses
+ * that start in bounds but run past MEM_SIZE are left out; those fault only
+ * with guard memory.
+ */
+static void for_each_addr(word_t width, void (*test)(word_t addr)) {
+	for (word_t addr = 0; addr < 64; addr++) {
+		test(addr);
+	}
+	for (word_t addr = MEM_SIZE - 64; addr <= MEM_SIZE - width; addr++) {
+		test(addr);
+	}
+	for (word_t addr = MEM_SIZE; addr < MEM_SIZE + 64; addr++) {
+		test(addr);
+	}
+	for (word_t addr = 0xFFFFFFC0; addr != 0; addr++) {
+		test(addr);
+	}
+	test(0x80000000);
+}
+
+static word_t faults;
+
+static void test_load(word_t addr) {
+	faults += run_both("\tload r1, r2, #0\n\tadd r1, r1, #1\n\thalt\n", addr) == SEGFAULT;
+}
+
+static void test_store(word_t addr) {
+	faults += run_both("\tmov r1, #7\n\tstore r1, r2, #0\n\thalt\n", addr) == SEGFAULT;
+}
+
+static void test_vector(word_t addr) {
+	faults += run_both("\tvload r4, r2, #0\n\tvstore r4, r2, #0\n\thalt\n", addr) == SEGFAULT;
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_loads_and_stores() {
+	faults = 0;
+	for_each_addr(sizeof(word_t), test_load);
+	for_each_addr(sizeof(word_t), test_store);
+	assert(faults == 2 * (16 + 64 + 64 + 1));
+
+	faults = 0;
+	for_each_addr(VECTOR_WORDS * sizeof(word_t), test_vector);
+	assert(faults == 16 + 64 + 64 + 1);
+}
+
+void test_fetch() {
+	// Jumps to r2, which runs off into zeroed memory if it is in bounds
+	const char* source = "\tmov r1, #0\n\tbrn r2, #0\n";
+	word_t targets[] = { 0, 8, 12, 15, 16, 40, MEM_SIZE - 4, MEM_SIZE, 0xFFFFFFFC };
+	for (unsigned int i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+		word_t addr = targets[i];
+		int err = run_both(source, addr);
+		assert(err == SEGFAULT || (addr >= STARTING_OFFSET && addr < MEM_SIZE));
+	}
+}
+
+void test_past_the_end() {
+	// The one case that differs: a word starting in bounds and running past
+	// MEM_SIZE faults instead of reading past memory->data
+	struct processor proc;
+	assert(load_source(&proc, &guarded_memory, "\tload r1, r2, #0\n\thalt\n", NULL) == 0);
+	assert(guard_attach(&guard, &proc) == 0);
+	proc.regs[R2] = MEM_SIZE - 2;
+	struct stop_reason stop = run_for(&proc, 100);
+	assert(stop.reason == STOP_ERROR && stop.err_code == SEGFAULT);
+	assert(!strcmp(proc.err.function_name, "memory_access"));
+	guard_detach(&guard, &proc);
+}
+
+void test_attach() {
+	struct processor proc = new_processor(&checked_memory);
+	assert(guard_attach(&guard, &proc) == -1);
+
+	// No traced variant is guarded
+	assert(new_processor_config(&proc, &guarded_memory, CONFIG_TRACE) == 0);
+	assert(guard_attach(&guard, &proc) == -1);
+	assert(proc.features == CONFIG_TRACE && !proc.guard);
+	assert(new_processor_config(&proc, &guarded_memory, CONFIG_GUARD | CONFIG_SMT) == -1);
+
+	// Nor is any profiled one, and the guard stays
+	proc = new_processor(&guarded_memory);
+	assert(guard_attach(&guard, &proc) == 0);
+	struct profile profile;
+	assert(profile_attach(&profile, &proc) == -1);
+	assert(proc.features == CONFIG_GUARD && proc.guard && !proc.profile);
+	guard_detach(&guard, &proc);
+}
+
+int main() {
+	assert(guard_memory_init(&guard, &guarded_memory) == 0);
+	test_loads_and_stores();
+	test_fetch();
+	test_past_the_end();
+	test_attach();
+	guard_memory_free(&guard);
+
+	printf("All tests passed.\n");
+}
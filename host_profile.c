@@ -0,0 +1,108 @@
+/**
+ * Profiles the emulator on the host while it runs a guest program, and prints
+ * where host time goes per simulated instruction (see profile.h).
+ *
+ * The program is assembled from `file` and runs until its last instruction
+ * retires, the pipeline faults, or `-n` cycles have passed.
+ *
+ * Usage: host_profile [-p pipeline preset] [-n max cycles] file
+ */
+
+#include "profile.h"
+#include "assembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char data[MEM_SIZE];
+
+static char* read_file(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char* source = malloc(size + 1);
+	if (source && fread(source, 1, size, file) != (size_t) size) {
+		free(source);
+		source = NULL;
+	}
+	if (source) {
+		source[size] = '\0';
+	}
+	fclose(file);
+	return source;
+}
+
+int main(int argc, char** argv) {
+	const struct pipeline_preset* preset = &pipeline_presets[0];
+	uint64_t max_cycles = 100000000;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:n:")) != -1) {
+		switch (opt) {
+			case 'p':
+				preset = find_pipeline_preset(optarg);
+				if (!preset) {
+					fprintf(stderr, "unknown pipeline preset %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 'n':
+				max_cycles = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-p pipeline preset] [-n max cycles] file\n", argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-p pipeline preset] [-n max cycles] file\n", argv[0]);
+		return 2;
+	}
+
+	char* source = read_file(argv[optind]);
+	if (!source) {
+		perror(argv[optind]);
+		return 1;
+	}
+	struct asm_result image;
+	if (assemble(source, &image)) {
+		fprintf(stderr, "%s: assembly failed\n", argv[optind]);
+		free(source);
+		return 1;
+	}
+	free(source);
+	memcpy(data + STARTING_OFFSET, image.image, image.size);
+	word_t last_pc = STARTING_OFFSET + image.size - sizeof(word_t);
+	free_asm_result(&image);
+
+	struct ememory memory = { .data = data };
+	struct processor proc = new_processor(&memory);
+	set_pipeline_shape(&proc, preset->stages, preset->depth);
+	proc.regs[PC] = STARTING_OFFSET;
+
+	struct profile profile;
+	if (profile_attach(&profile, &proc)) {
+		fprintf(stderr, "could not attach the profiler\n");
+		return 1;
+	}
+	int status = 0;
+	while (proc.stats.cycles < max_cycles) {
+		word_t retiring_pc = current_latches(&proc)->mem_stage.dbg.pc;
+		uint64_t retired = proc.stats.retired;
+		status = clock_cycle(&proc);
+		if (status || (proc.stats.retired != retired && retiring_pc == last_pc)) {
+			break;
+		}
+	}
+	profile_detach(&profile, &proc);
+
+	if (status) {
+		printf("Stopped on %s at cycle %llu\n", pipeline_err_to_string(status),
+			   (unsigned long long) proc.stats.cycles);
+	}
+	print_profile(&profile);
+	return 0;
+}
@@ -0,0 +1,194 @@
+#include "idle.h"
+
+void idle_attach(struct idle_skip* idle, struct processor* proc) {
+	*idle = (struct idle_skip) { 0 };
+	proc->idle = idle;
+}
+
+void idle_detach(struct idle_skip* idle, struct processor* proc) {
+	(void) idle;
+	proc->idle = NULL;
+}
+
+/**
+ * Checks the instructions from `target` up to the first branch, which must
+ * branch straight back to `target`
+ *
+ * @return	The number of instructions including the branch, else 0 if the
+ * 			body may not be idle
+ */
+static int analyze_loop(struct processor* proc, word_t target) {
+	for (int i = 0; i < IDLE_MAX_BODY; i++) {
+		word_t addr = target + i * sizeof(struct instr);
+		if (verify_in_bounds(addr)) {
+			return 0;
+		}
+		struct instr in = read_be_instr(proc->memory->data + addr);
+		if (in.opcode >= NUM_OPCODES || in.dest >= NUM_REGS || in.src1 >= NUM_REGS) {
+			return 0;
+		}
+		struct signal sig = instr_to_signal(&in);
+		if (!sig.valid) {
+			return 0;
+		}
+		if (sig.branch) {
+			int back = in.imm_flag && in.src1 == PC && (word_t) (addr + in.src2) == target;
+			return back ? i + 1 : 0;
+		}
+		if (sig.halt || sig.mem_write || sig.vector || sig.block
+				|| (sig.reg_write && in.dest == PC)) {
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static inline uint64_t cycles_from(uint64_t cycle, uint64_t now) {
+	return (cycle > now) ? cycle - now : 0;
+}
+
+static void capture(struct processor* proc, struct idle_snapshot* snapshot) {
+	uint64_t now = proc->stats.cycles;
+	snapshot->regs_valid = 1;
+	snapshot->full = 1;
+	snapshot->age = 0;
+	memcpy(snapshot->regs, proc->regs, sizeof(snapshot->regs));
+	snapshot->flag = proc->flag;
+	snapshot->bank = proc->bank;
+	snapshot->latches = *current_latches(proc);
+	snapshot->ctrl = proc->pipeline_ctrl;
+	for (int i = 0; i < NUM_REGS; i++) {
+		snapshot->reg_ready[i] = cycles_from(proc->muldiv.reg_ready[i], now);
+	}
+	snapshot->div_free = cycles_from(proc->muldiv.div_free, now);
+	snapshot->stats = proc->stats;
+}
+
+/**
+ * Returns nonzero if everything but the registers, flag and stats is as in
+ * the snapshot
+ */
+static int same_state(struct processor* proc, const struct idle_snapshot* snapshot) {
+	uint64_t now = proc->stats.cycles;
+	const struct pipeline_ctrl* ctrl = &proc->pipeline_ctrl;
+	if (ctrl->flush != snapshot->ctrl.flush || ctrl->stall != snapshot->ctrl.stall
+			|| ctrl->drain != snapshot->ctrl.drain || ctrl->halt != snapshot->ctrl.halt
+			|| ctrl->halted != snapshot->ctrl.halted
+			|| ctrl->redirect_wait != snapshot->ctrl.redirect_wait
+			|| ctrl->mem_busy != snapshot->ctrl.mem_busy) {
+		return 0;
+	}
+	for (int i = 0; i < NUM_REGS; i++) {
+		if (cycles_from(proc->muldiv.reg_ready[i], now) != snapshot->reg_ready[i]) {
+			return 0;
+		}
+	}
+	return cycles_from(proc->muldiv.div_free, now) == snapshot->div_free
+		&& !memcmp(current_latches(proc), &snapshot->latches, sizeof(snapshot->latches));
+}
+
+/**
+ * Returns how many times `delta` can be added to `value` without passing
+ * `limit`
+ */
+static inline uint64_t fits(uint64_t value, uint64_t limit, uint64_t delta) {
+	return (limit > value) ? (limit - value) / delta : 0;
+}
+
+void idle_fast_forward(struct processor* proc, uint64_t end_cycles, uint64_t end_retired) {
+	struct idle_skip* idle = proc->idle;
+	struct stop_conditions* conds = &proc->stop_conditions;
+	if ((proc->features & (CONFIG_TRACE | CONFIG_PROFILE | CONFIG_SMT)) || conds->on_branch) {
+		return;
+	}
+
+	struct idle_snapshot* snapshot = &idle->snapshot;
+	word_t target = proc->regs[PC];
+	if (target != idle->loop) {
+		idle->loop = target;
+		idle->body = analyze_loop(proc, target);
+		idle->loop_ok = (idle->body != 0);
+		snapshot->regs_valid = 0;
+	}
+	if (!idle->loop_ok) {
+		return;
+	}
+
+	// Registers that change from one iteration to the next are the usual
+	// case, so those are checked first and everything else only once they
+	// stay put
+	if (!snapshot->regs_valid || snapshot->flag != proc->flag
+			|| memcmp(snapshot->regs, proc->regs, sizeof(snapshot->regs))) {
+		memcpy(snapshot->regs, proc->regs, sizeof(snapshot->regs));
+		snapshot->flag = proc->flag;
+		snapshot->regs_valid = 1;
+		snapshot->full = 0;
+		return;
+	}
+	if (!snapshot->full) {
+		capture(proc, snapshot);
+		return;
+	}
+
+	// The latch banks swap every cycle the pipeline moves, so an iteration
+	// can end in the other bank. Two of them then make up the period.
+	snapshot->age++;
+	if (proc->bank != snapshot->bank) {
+		if (snapshot->age > 1) {
+			capture(proc, snapshot);
+		}
+		return;
+	}
+
+	struct pipeline_stats delta = {
+		.cycles = proc->stats.cycles - snapshot->stats.cycles,
+		.retired = proc->stats.retired - snapshot->stats.retired,
+		.stalls = proc->stats.stalls - snapshot->stats.stalls,
+		.flushes = proc->stats.flushes - snapshot->stats.flushes,
+	};
+	if (!same_state(proc, snapshot) || delta.flushes != snapshot->age
+			|| delta.retired != (uint64_t) snapshot->age * idle->body) {
+		capture(proc, snapshot);
+		return;
+	}
+
+	// Whole periods only, ending before the budget runs out or a stop
+	// condition is due, so that the run stops where it would have anyway
+	uint64_t now = proc->stats.cycles;
+	uint64_t periods = fits(now, end_cycles, delta.cycles);
+	if (conds->count && conds->next_check != UINT64_MAX) {
+		uint64_t before_check = fits(now, conds->next_check - 1, delta.cycles);
+		periods = (before_check < periods) ? before_check : periods;
+	}
+	uint64_t before_budget = fits(proc->stats.retired, end_retired - 1, delta.retired);
+	periods = (before_budget < periods) ? before_budget : periods;
+	if (proc->devices.count && periods > IDLE_CHECK_CYCLES / delta.cycles) {
+		periods = IDLE_CHECK_CYCLES / delta.cycles;
+	}
+	if (!periods) {
+		capture(proc, snapshot);
+		return;
+	}
+
+	uint64_t cycles = periods * delta.cycles;
+	for (int i = 0; i < NUM_REGS; i++) {
+		if (proc->muldiv.reg_ready[i] > now) {
+			proc->muldiv.reg_ready[i] += cycles;
+		}
+	}
+	if (proc->muldiv.div_free > now) {
+		proc->muldiv.div_free += cycles;
+	}
+	proc->stats.cycles += cycles;
+	proc->stats.retired += periods * delta.retired;
+	proc->stats.stalls += periods * delta.stalls;
+	proc->stats.flushes += periods * delta.flushes;
+
+	idle->skips++;
+	idle->skipped_cycles += cycles;
+	idle->skipped_retired += periods * delta.retired;
+
+	// At least one more period runs for real before the next skip, which is
+	// where polled words are read again
+	capture(proc, snapshot);
+}
@@ -0,0 +1,183 @@
+#include "idle.h"
+#include "device.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char data[MEM_SIZE];
+static char reference_data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct ememory reference_memory = { .data = reference_data };
+
+#define POLLED		0x4000
+
+// Some work, then a BRN to itself
+static const char* spin =
+	"\tmov r1, #9\n"
+	"\tmul r2, r1, r1\n"
+	"\tstore r2, r1, #4000\n"
+	"@end\n"
+	"\tbrn end\n";
+
+// Polls a word, with a multiply in the loop, until it is nonzero
+static const char* poll =
+	"\tmov r2, #16384\n"
+	"\tmov r5, #3\n"
+	"@wait\n"
+	"\tload r1, r2, #0\n"
+	"\tmul r4, r5, #7\n"
+	"\tcmp r1, #0\n"
+	"\tbeq wait\n"
+	"\tadd r3, r1, r4\n"
+	"\thalt\n";
+
+// Polls a device's status word until it is nonzero
+static const char* poll_device =
+	"\tmov r2, #256\n"
+	"@wait\n"
+	"\tload r1, r2, #0\n"
+	"\tcmp r1, #0\n"
+	"\tbeq wait\n"
+	"\thalt\n";
+
+// Counts up, so never idle
+static const char* count =
+	"\tmov r1, #0\n"
+	"@loop\n"
+	"\tadd r1, r1, #1\n"
+	"\tcmp r1, #0\n"
+	"\tbne loop\n";
+
+static void assert_same(struct processor* fast, struct processor* full) {
+	assert(!memcmp(&fast->stats, &full->stats, sizeof(full->stats)));
+	assert(!memcmp(fast->regs, full->regs, sizeof(full->regs)));
+	assert(fast->flag == full->flag);
+	assert(!memcmp(current_latches(fast), current_latches(full), sizeof(struct latches)));
+	assert(!memcmp(data, reference_data, MEM_SIZE));
+}
+
+/**
+ * Stop condition that stores a nonzero word to the polled address
+ */
+static int release(struct processor* proc, void* arg) {
+	(void) arg;
+	word_t value = 5;
+	memcpy(proc->memory->data + POLLED, &value, sizeof(value));
+	return 0;
+}
+
+/**
+ * Device that reads as ready from its 1000th read on, standing in for a host
+ * that sets the status whenever it likes
+ */
+struct status_device {
+	struct device dev;
+	uint64_t reads;
+};
+
+static int read_status(struct device* dev, word_t offset, word_t* value) {
+	(void) offset;
+	struct status_device* status = (struct status_device*) dev;
+	*value = (++status->reads >= 1000);
+	return 0;
+}
+
+static int write_status(struct device* dev, word_t offset, word_t value) {
+	(void) dev, (void) offset, (void) value;
+	return 0;
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_spin() {
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const char* preset = pipeline_presets[p].name;
+		struct processor full;
+		assert(load_source(&full, &reference_memory, spin, preset) == 0);
+		struct processor fast;
+		assert(load_source(&fast, &memory, spin, preset) == 0);
+		struct idle_skip idle;
+		idle_attach(&idle, &fast);
+
+		// Budgets that end mid-iteration, run in pieces
+		uint64_t budgets[] = { 3, 1000003, 77, 5000000 };
+		for (unsigned int i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+			struct stop_reason full_stop = run_for(&full, budgets[i]);
+			struct stop_reason fast_stop = run_for(&fast, budgets[i]);
+			assert(!memcmp(&full_stop, &fast_stop, sizeof(full_stop)));
+			assert_same(&fast, &full);
+		}
+		struct stop_reason full_stop = step_instructions(&full, 123457);
+		struct stop_reason fast_stop = step_instructions(&fast, 123457);
+		assert(!memcmp(&full_stop, &fast_stop, sizeof(full_stop)));
+		assert_same(&fast, &full);
+		assert(idle.skips && idle.skipped_cycles > 5000000);
+	}
+}
+
+void test_poll() {
+	// A stop condition releases the loop. Nothing is skipped past its check,
+	// so the loop sees the word change in the same iteration.
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const char* preset = pipeline_presets[p].name;
+		struct processor full;
+		assert(load_source(&full, &reference_memory, poll, preset) == 0);
+		struct processor fast;
+		assert(load_source(&fast, &memory, poll, preset) == 0);
+		struct idle_skip idle;
+		idle_attach(&idle, &fast);
+		assert(add_stop_condition(&full, release, NULL, 2000001) == 0);
+		assert(add_stop_condition(&fast, release, NULL, 2000001) == 0);
+
+		struct stop_reason full_stop = run_for(&full, 10000000);
+		struct stop_reason fast_stop = run_for(&fast, 10000000);
+		assert(fast_stop.reason == STOP_HALT && fast.regs[R3] == 5 + 21);
+		assert(!memcmp(&full_stop, &fast_stop, sizeof(full_stop)));
+		assert_same(&fast, &full);
+		assert(idle.skipped_cycles > 1900000);
+	}
+}
+
+void test_device() {
+	// The loop is simulated again every IDLE_CHECK_CYCLES, and so sees the
+	// status change within that many cycles
+	struct status_device status = {
+		.dev = { "status", 0x100, 4, read_status, write_status },
+	};
+	struct processor proc;
+	assert(load_source(&proc, &memory, poll_device, "classic") == 0);
+	assert(attach_device(&proc.devices, &status.dev) == 0);
+	struct idle_skip idle;
+	idle_attach(&idle, &proc);
+	struct stop_reason stop = run_for(&proc, 100000000);
+	assert(stop.reason == STOP_HALT && proc.regs[R1] == 1);
+	assert(idle.skips && idle.skipped_cycles <= idle.skips * IDLE_CHECK_CYCLES);
+	assert(proc.stats.cycles - idle.skipped_cycles < 1000 * 10);
+}
+
+void test_not_idle() {
+	// Registers change every iteration
+	struct processor proc;
+	assert(load_source(&proc, &memory, count, "classic") == 0);
+	struct idle_skip idle;
+	idle_attach(&idle, &proc);
+	run_for(&proc, 100000);
+	assert(idle.skips == 0);
+
+	// A condition checked on every branch sees every iteration
+	assert(load_source(&proc, &memory, spin, "classic") == 0);
+	idle_attach(&idle, &proc);
+	assert(add_stop_condition(&proc, release, NULL, 0) == 0);
+	run_for(&proc, 100000);
+	assert(idle.skips == 0);
+}
+
+int main() {
+	test_spin();
+	test_poll();
+	test_device();
+	test_not_idle();
+
+	printf("All tests passed.\n");
+}
@@ -0,0 +1,129 @@
+#ifndef AOT
+#define AOT
+
+#include "processor.h"
+#include "functional.h"
+#include "simd.h"
+
+/**
+ * DETAILS:
+ *
+ * Support code for C translations of guest images, written by the aot tool.
+ * A translation is a single function
+ *
+ *   int NAME(struct processor* proc, uint64_t count, uint64_t* executed);
+ *
+ * which behaves exactly like functional_run(proc, count, 0, executed): it
+ * executes up to `count` instructions from proc->regs[PC] against the
+ * architectural state, stops early after a HALT or an error, and leaves the
+ * registers, flag, memory and PC as the functional model (and so run())
+ * would. Like the functional model, it needs an empty pipeline.
+ *
+ * Every basic block of the image becomes a labelled run of C statements over
+ * local copies of R0-R7 and the flag. Static branches jump straight to their
+ * target's label. Everything else is handed to functional_step() one
+ * instruction at a time: branches through registers, writes to the PC, uses
+ * of the flag other than by CMP and branches, HALT, invalid encodings, and
+ * any PC that is not the start of a translated block. Execution goes back to
+ * translated code as soon as the PC reaches the start of a block.
+ *
+ * The image must not change while a translation runs, since stores into it
+ * are not detected.
+ */
+
+#define AOT_FUNCTION(NAME) \
+	int NAME(struct processor* proc, uint64_t count, uint64_t* executed)
+
+#define AOT_LOAD_REGS()										\
+	do {													\
+		r0 = proc->regs[R0]; r1 = proc->regs[R1];			\
+		r2 = proc->regs[R2]; r3 = proc->regs[R3];			\
+		r4 = proc->regs[R4]; r5 = proc->regs[R5];			\
+		r6 = proc->regs[R6]; r7 = proc->regs[R7];			\
+		flag = proc->flag;									\
+	} while (0)
+
+#define AOT_STORE_REGS()									\
+	do {													\
+		proc->regs[R0] = r0; proc->regs[R1] = r1;			\
+		proc->regs[R2] = r2; proc->regs[R3] = r3;			\
+		proc->regs[R4] = r4; proc->regs[R5] = r5;			\
+		proc->regs[R6] = r6; proc->regs[R7] = r7;			\
+		proc->flag = flag;									\
+	} while (0)
+
+#define AOT_PROLOGUE()										\
+	char* data = proc->memory->data;						\
+	word_t r0, r1, r2, r3, r4, r5, r6, r7;					\
+	int64_t flag;											\
+	word_t addr_, value_, vec_[VECTOR_WORDS];				\
+	uint64_t done = 0;										\
+	int status = 0;											\
+	(void) data; (void) addr_; (void) value_; (void) vec_;	\
+	AOT_LOAD_REGS();										\
+	if (proc->pipeline_ctrl.halted) {						\
+		*executed = 0;										\
+		return HALTED;										\
+	}
+
+/**
+ * Leaves translated code for `TARGET`, which is not known to start a block
+ */
+#define AOT_JUMP(TARGET)									\
+	do {													\
+		proc->regs[PC] = (TARGET);							\
+		goto dispatch;										\
+	} while (0)
+
+/**
+ * Starts a block of `LEN` instructions at `ADDR`, unless fewer than `LEN`
+ * instructions are left to execute
+ */
+#define AOT_BLOCK(ADDR, LEN)								\
+	do {													\
+		if (count - done < (LEN)) {							\
+			proc->regs[PC] = (ADDR);						\
+			goto interpret;									\
+		}													\
+		done += (LEN);										\
+	} while (0)
+
+/**
+ * Stops on a nonzero error code from the instruction at `ADDR`, taking back
+ * the `UNDONE` instructions of its block that did not execute
+ */
+#define AOT_CHECK(EXPR, ADDR, UNDONE)						\
+	do {													\
+		if ((status = (EXPR))) {							\
+			done -= (UNDONE);								\
+			proc->regs[PC] = (ADDR);						\
+			goto out;										\
+		}													\
+	} while (0)
+
+/**
+ * Runs one instruction at proc->regs[PC] in the functional model, then
+ * dispatches on the new PC
+ */
+#define AOT_INTERPRETER()									\
+	interpret:												\
+		if (done == count) {								\
+			goto out;										\
+		}													\
+		AOT_STORE_REGS();									\
+		status = functional_step(proc);						\
+		AOT_LOAD_REGS();									\
+		if (status) {										\
+			done += (status == HALTED);						\
+			goto out;										\
+		}													\
+		done++;												\
+		goto dispatch;
+
+#define AOT_EPILOGUE()										\
+	out:													\
+		AOT_STORE_REGS();									\
+		*executed = done;									\
+		return status;
+
+#endif // AOT
@@ -0,0 +1,50 @@
+#ifndef ASSEMBLER
+#define ASSEMBLER
+
+#include <stddef.h>
+#include "instructions.h"
+
+/**
+ * DETAILS:
+ * 
+ * In-process version of unuasm.py. Source text uses the same syntax:
+ * - `;` starts a comment
+ * - `.macro NAME VALUE` defines a textual substitution for later lines 
+ * 	 (`#NAME` is substituted as an immediate)
+ * - `@label` marks the address of the next instruction, and a bare `label` 
+ * 	 operand becomes `pc, #offset`
+ * - `#` prefixes immediates
+ * 
+ * For valid programs, the encoded image is byte-for-byte identical to the 
+ * output of unuasm.py without -O or -s. On errors, no image is produced and
+ * one diagnostic is reported for every invalid line.
+ */
+
+#define ASM_DIAG_LEN	128
+
+struct asm_diag {
+	int line;
+	char message[ASM_DIAG_LEN];
+};
+
+struct asm_result {
+	unsigned char* image;
+	size_t size;
+
+	struct asm_diag* diags;
+	int num_diags;
+};
+
+/**
+ * Assembles NUL-terminated source text into big-endian encoded instructions
+ * 
+ * @return 	0 on success, else the number of diagnostics in result->diags
+ */
+int assemble(const char* source, struct asm_result* result);
+
+/**
+ * Frees the image and diagnostics of an assembled result
+ */
+void free_asm_result(struct asm_result* result);
+
+#endif // ASSEMBLER
@@ -0,0 +1,86 @@
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ *
+ * A checkpoint holds everything needed to resume a processor: registers,
+ * flag, both banks of pipeline latches, pipeline_ctrl, the multiply/divide
+ * scoreboard, stats, the selected configuration, ememory's free_head and the
+ * MEM_SIZE memory image.
+ *
+ * File layout:
+ *
+ * +++++++++++ +++++++++++++++++++ ++++++++++++++++++++++++++++++++++++++++
+ * | header  | | processor state | | memory image (compressed or raw)     |
+ * +++++++++++ +++++++++++++++++++ ++++++++++++++++++++++++++++++++++++++++
+ *
+ * The image is split into CHECKPOINT_PAGE_SIZE pages. By default, each page
+ * is stored as a one byte kind (zero, RLE or raw) followed by its encoded
+ * length and data, and zero pages store nothing else. With CHECKPOINT_RAW, the
+ * image is instead stored uncompressed at a host page aligned offset, with
+ * zero pages left as holes in a sparse file, so that it can be mapped
+ * directly on restore.
+ *
+ * Attached devices are host state and are not saved. Neither are the other
+ * threads of a processor with SMT attached, so it cannot be saved at all.
+ * The processor state is stored as the host's in-memory structs, so a
+ * checkpoint can only be restored by a build with the same struct layouts.
+ * The header records their size and restore refuses a mismatch.
+ */
+
+#define CHECKPOINT_VERSION		4
+#define CHECKPOINT_PAGE_SIZE	4096
+
+// Flags for save_checkpoint()
+#define CHECKPOINT_RAW			(1 << 0)	// store the image uncompressed and mappable
+
+// Flags for restore_checkpoint()
+#define CHECKPOINT_MAP			(1 << 0)	// map a raw image instead of reading it
+
+#define CHECKPOINT_ERRS(X) 				\
+	X(CHECKPOINT_IO_ERROR, 		-200)	\
+	X(CHECKPOINT_BAD_MAGIC, 	-201)	\
+	X(CHECKPOINT_BAD_VERSION, 	-202)	\
+	X(CHECKPOINT_BAD_LAYOUT, 	-203)	\
+	X(CHECKPOINT_CORRUPT, 		-204)	\
+	X(CHECKPOINT_UNSUPPORTED, 	-205)
+
+MACRO_TRACK(CHECKPOINT_ERRS)
+MACRO_DISPLAY(CHECKPOINT_ERRS, checkpoint_err_to_string)
+
+/**
+ * Writes the state of proc and its memory to the file at `path`, replacing
+ * it if it exists. The pipeline does not have to be drained.
+ *
+ * Returns CHECKPOINT_UNSUPPORTED for a processor with SMT attached. Guard
+ * memory and profiling are not saved, so the restored processor runs without
+ * them.
+ *
+ * @return	0 on success, else a CHECKPOINT_* error code
+ */
+int save_checkpoint(struct processor* proc, const char* path, int flags);
+
+/**
+ * Restores a checkpoint written by save_checkpoint() into proc. proc->memory
+ * is set to `memory`, whose free_head is restored as well.
+ *
+ * If the checkpoint is raw and CHECKPOINT_MAP is given, memory->data is
+ * replaced by a private copy-on-write mapping of the file, which must later be
+ * released with unmap_checkpoint(). Otherwise, the image is read into
+ * memory->data, which must hold MEM_SIZE bytes.
+ *
+ * Returns CHECKPOINT_UNSUPPORTED if no pipeline variant has the saved features.
+ *
+ * @return	0 on success, else a CHECKPOINT_* error code
+ */
+int restore_checkpoint(struct processor* proc, struct ememory* memory, const char* path, int flags);
+
+/**
+ * Releases a memory image mapped by restore_checkpoint()
+ */
+void unmap_checkpoint(struct ememory* memory);
+
+#endif // CHECKPOINT
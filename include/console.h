@@ -0,0 +1,56 @@
+#ifndef CONSOLE
+#define CONSOLE
+
+#include "device.h"
+#include <stdint.h>
+
+/**
+ * DETAILS:
+ *
+ * Memory-mapped output console. Registers, relative to the console's base:
+ *
+ * - CONSOLE_DATA (write): appends the low byte of the stored word
+ * - CONSOLE_STATUS (read): number of bytes waiting in the buffer
+ * - CONSOLE_STATUS (write): flushes the buffer
+ *
+ * Bytes are collected in a host-side buffer and written to the file
+ * descriptor with a single write() when the buffer fills, or also at every
+ * newline with CONSOLE_FLUSH_LINE. Call console_flush() once the guest is done
+ * to write out the rest.
+ */
+
+#define CONSOLE_BASE		0x0			// below STARTING_OFFSET by default
+#define CONSOLE_SIZE		0x8
+#define CONSOLE_DATA		0x0
+#define CONSOLE_STATUS		0x4
+
+#define CONSOLE_BUFFER_SIZE	4096
+
+enum console_policy {
+	CONSOLE_FLUSH_FULL,
+	CONSOLE_FLUSH_LINE,
+};
+
+struct console {
+	struct device dev;
+	int fd;
+	enum console_policy policy;
+	uint32_t fill;
+	uint64_t flushes;				// number of write() calls made
+	char buffer[CONSOLE_BUFFER_SIZE];
+};
+
+/**
+ * Initializes a console at `base` that writes to `fd`. Attach it with
+ * attach_device(&proc.devices, &console->dev).
+ */
+void init_console(struct console* console, int fd, enum console_policy policy, word_t base);
+
+/**
+ * Writes out any buffered bytes
+ *
+ * @return	0 on success, else -1
+ */
+int console_flush(struct console* console);
+
+#endif // CONSOLE
@@ -0,0 +1,96 @@
+#ifndef DEVICE
+#define DEVICE
+
+#include "pipeline.h"
+
+/**
+ * DETAILS:
+ *
+ * Devices claim a range of guest addresses. Word LOADs and STOREs to that
+ * range are routed to the device instead of memory, by both the pipeline and
+ * the functional model. The range may lie below STARTING_OFFSET, where memory
+ * itself cannot be accessed. Vector and block memory operations always go to
+ * memory.
+ *
+ * Callbacks see register values, not bytes: a word written by the guest
+ * arrives as the value it had in the register. Devices that take several
+ * fields in one word, such as an eptr, decode them with shifts and masks so
+ * that they do not depend on the host's byte order.
+ *
+ * A device is embedded as the first member of its own state struct, so its
+ * callbacks can cast the struct device* back to that struct.
+ */
+
+#define MAX_DEVICES		8
+
+struct device {
+	const char* name;
+	word_t base;
+	word_t size;
+
+	/**
+	 * Reads or writes the word at `offset` bytes into the device's range
+	 *
+	 * @return	0 on success, else a pipeline error code
+	 */
+	int (*read)(struct device* dev, word_t offset, word_t* value);
+	int (*write)(struct device* dev, word_t offset, word_t value);
+};
+
+struct device_table {
+	struct device* devices[MAX_DEVICES];
+	int count;
+};
+
+/**
+ * Adds a device to the table. The device must stay valid while attached.
+ *
+ * @return	0 on success, or -1 if the table is full or the range overlaps
+ * 			another device
+ */
+int attach_device(struct device_table* table, struct device* dev);
+
+static inline struct device* find_device(struct device_table* table, word_t addr) {
+	for (int i = 0; i < table->count; i++) {
+		struct device* dev = table->devices[i];
+		if (addr - dev->base < dev->size) {
+			return dev;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Loads the word at `addr` from a device or, if no device claims it, from
+ * memory.
+ *
+ * @return	0 on success, else a pipeline error code
+ */
+static inline int load_word(struct device_table* table, char* data, word_t addr, word_t* value) {
+	struct device* dev;
+	if (table->count && (dev = find_device(table, addr))) {
+		return dev->read(dev, addr - dev->base, value);
+	}
+	if (verify_in_bounds(addr)) {
+		return SEGFAULT;
+	}
+	memcpy(value, &data[addr], sizeof(word_t));
+	return 0;
+}
+
+/**
+ * Stores a word like load_word() loads one
+ */
+static inline int store_word(struct device_table* table, char* data, word_t addr, word_t value) {
+	struct device* dev;
+	if (table->count && (dev = find_device(table, addr))) {
+		return dev->write(dev, addr - dev->base, value);
+	}
+	if (verify_in_bounds(addr)) {
+		return SEGFAULT;
+	}
+	memcpy(&data[addr], &value, sizeof(word_t));
+	return 0;
+}
+
+#endif // DEVICE
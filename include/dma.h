@@ -0,0 +1,92 @@
+#ifndef DMA
+#define DMA
+
+#include "device.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * DETAILS:
+ *
+ * Memory-mapped DMA controller that reads host files into guest memory on a
+ * host I/O thread while the pipeline keeps running. Registers, relative to the
+ * controller's base:
+ *
+ * - DMA_FILE: slot of a file registered with dma_register_file()
+ * - DMA_OFFSET: offset into the file
+ * - DMA_LENGTH: number of bytes to read
+ * - DMA_DEST: destination eptr, with ptr in bits 0-15 and size in bits 16-31
+ *   of the word, whatever the host's byte order
+ * - DMA_DOORBELL (write): starts the transfer. Ignored while one is running.
+ * - DMA_STATUS (read): one of the DMA_* states below
+ * - DMA_COUNT (read): bytes transferred by the last completed transfer
+ *
+ * The destination range [ptr, ptr + length) must fit in the eptr and lie in
+ * memory allocated with emalloc(), otherwise the transfer ends immediately
+ * with DMA_ERROR. A read that hits end of file completes with a short count.
+ * The guest must not touch the destination until the status leaves DMA_BUSY.
+ */
+
+#define DMA_BASE			0x10000		// above MEM_SIZE, so no memory is shadowed
+#define DMA_SIZE			0x1C
+#define DMA_FILE			0x00
+#define DMA_OFFSET			0x04
+#define DMA_LENGTH			0x08
+#define DMA_DEST			0x0C
+#define DMA_DOORBELL		0x10
+#define DMA_STATUS			0x14
+#define DMA_COUNT			0x18
+
+#define DMA_MAX_FILES		8
+
+enum dma_status {
+	DMA_IDLE = 0,
+	DMA_BUSY = 1,
+	DMA_DONE = 2,
+	DMA_ERROR = 3,
+};
+
+struct dma {
+	struct device dev;
+	struct ememory* memory;
+	int files[DMA_MAX_FILES];
+
+	// Registers as last written by the guest
+	word_t file, offset, length, dest;
+
+	// Transfer handed to the worker, valid while status is DMA_BUSY
+	int job_fd;
+	word_t job_offset, job_length, job_dest;
+
+	atomic_uint status;
+	atomic_uint count;
+
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int pending;
+	int stop;
+};
+
+/**
+ * Initializes a DMA controller at `base` writing into `memory`, and starts
+ * its I/O thread
+ *
+ * @return	0 on success, else -1
+ */
+int init_dma(struct dma* dma, struct ememory* memory, word_t base);
+
+/**
+ * Makes a host file descriptor available to the guest as DMA_FILE `slot`
+ *
+ * @return	0 on success, else -1
+ */
+int dma_register_file(struct dma* dma, int slot, int fd);
+
+/**
+ * Waits for the running transfer, if any, and stops the I/O thread. Files are
+ * not closed.
+ */
+void dma_shutdown(struct dma* dma);
+
+#endif // DMA
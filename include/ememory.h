@@ -12,8 +12,13 @@
 struct ememory {
     char* data;
     uint16_t free_head;
+    uint8_t arena;          // set by init_arena()
+    uint32_t size;          // total size passed to init_ememory()
 };
 
+// Saved arena position, see arena_mark()
+typedef uint32_t arena_mark_t;
+
 // Null pointer for emulated memory
 #define ENULL (struct eptr) { 0 }
 
@@ -48,4 +53,73 @@ struct eptr emalloc(struct ememory* memory, uint16_t size);
  */
 int efree(struct ememory* memory, struct eptr ptr);
 
+/**
+ * Checks that [addr, addr + len) lies in allocated memory, i.e. between 
+ * STARTING_OFFSET and MEM_SIZE and outside every free block. Used to validate
+ * ranges handed to devices by the guest.
+ * 
+ * @return	1 if the whole range is allocated, else 0
+ */
+int is_allocated(struct ememory* memory, uint32_t addr, uint32_t len);
+
+// Summary of the free list, see free_list_stats()
+struct free_stats {
+    uint32_t blocks;
+    uint32_t bytes;         // headers included
+    uint32_t largest;
+};
+
+/**
+ * Walks the free list, for how fragmented free memory is. Reads only.
+ */
+void free_list_stats(struct ememory* memory, struct free_stats* stats);
+
+/**
+ * Allocates `n` blocks, storing them in `out`. Either every block is 
+ * allocated or none are.
+ * 
+ * @return	0 on success, else -1
+ */
+int emalloc_batch(struct ememory* memory, const uint16_t* sizes, int n, struct eptr* out);
+
+/**
+ * ARENA MODE:
+ * 
+ * An arena is ememory that only ever allocates from the start of its single
+ * free block, which is kept as a normal free list header so is_allocated() and
+ * checkpoints see the same layout. emalloc() becomes a bump allocation and 
+ * efree() does nothing; memory is reclaimed all at once with arena_release() 
+ * or arena_reset().
+ */
+
+/**
+ * Initializes emulated memory in arena mode
+ */
+void init_arena(struct ememory* memory, int size);
+
+/**
+ * Allocates `size` bytes at the next multiple of `align` (a power of two).
+ * Padding skipped for alignment stays allocated until the arena is released.
+ * 
+ * @return 	A valid eptr if allocation succeeds, else ENULL
+ */
+struct eptr arena_alloc(struct ememory* memory, uint16_t size, uint16_t align);
+
+/**
+ * Returns the current arena position
+ */
+arena_mark_t arena_mark(struct ememory* memory);
+
+/**
+ * Frees everything allocated since `mark` was taken
+ * 
+ * @return	0 on success, else -1 if `mark` lies past the current position
+ */
+int arena_release(struct ememory* memory, arena_mark_t mark);
+
+/**
+ * Frees the whole arena, leaving the same header as init_ememory()
+ */
+void arena_reset(struct ememory* memory);
+
 #endif // EMEMORY
@@ -0,0 +1,75 @@
+#ifndef EMEMORY_CACHE
+#define EMEMORY_CACHE
+
+#include "ememory.h"
+#include <pthread.h>
+
+/**
+ * DETAILS:
+ *
+ * Concurrent mode for ememory. Several host threads can allocate from one
+ * struct ememory through a shared_ememory, which guards the central free list
+ * (free_head and the in-memory headers) with a mutex. Each thread owns an
+ * ememory_cache holding free blocks of a few small size classes, so most
+ * small allocations and frees never touch the lock. An empty bin is refilled
+ * with EMEMORY_CACHE_BATCH blocks under a single lock, and a full bin returns
+ * half of its blocks the same way. Larger requests go straight to the central
+ * list.
+ *
+ * emalloc() and efree() are unchanged and take no lock. They must not be
+ * used on memory shared with other threads.
+ */
+
+#define EMEMORY_CACHE_CLASSES	4		// 16, 32, 64 and 128 bytes
+#define EMEMORY_CACHE_MIN		16
+#define EMEMORY_CACHE_MAX		(EMEMORY_CACHE_MIN << (EMEMORY_CACHE_CLASSES - 1))
+#define EMEMORY_CACHE_DEPTH		8		// blocks held per class
+#define EMEMORY_CACHE_BATCH		4		// blocks moved per refill or return
+
+struct shared_ememory {
+	struct ememory* memory;
+	pthread_mutex_t lock;
+};
+
+struct ememory_cache {
+	struct shared_ememory* shared;
+	struct eptr bins[EMEMORY_CACHE_CLASSES][EMEMORY_CACHE_DEPTH];
+	int counts[EMEMORY_CACHE_CLASSES];
+};
+
+/**
+ * Shares already initialized memory between threads
+ */
+void init_shared_ememory(struct shared_ememory* shared, struct ememory* memory);
+
+/**
+ * Releases the lock. Every cache must have been flushed first.
+ */
+void destroy_shared_ememory(struct shared_ememory* shared);
+
+/**
+ * Initializes an empty cache for the calling thread
+ */
+void init_ememory_cache(struct ememory_cache* cache, struct shared_ememory* shared);
+
+/**
+ * Thread-safe emalloc(). Requests up to EMEMORY_CACHE_MAX bytes are rounded up
+ * to their size class and served from the cache.
+ *
+ * @return	A valid eptr if allocation succeeds, else ENULL
+ */
+struct eptr emalloc_cached(struct ememory_cache* cache, uint16_t size);
+
+/**
+ * Thread-safe efree(). Blocks of a size class are kept in the cache. The eptr
+ * may come from any thread's cache.
+ */
+int efree_cached(struct ememory_cache* cache, struct eptr ptr);
+
+/**
+ * Returns every cached block to the central free list, e.g. before the
+ * owning thread exits
+ */
+void flush_ememory_cache(struct ememory_cache* cache);
+
+#endif // EMEMORY_CACHE
@@ -0,0 +1,66 @@
+#ifndef FUNCTIONAL
+#define FUNCTIONAL
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ * 
+ * The functional model executes one instruction at a time directly against
+ * the architectural state (registers, flag, and memory) of a processor, 
+ * without building any pipeline latches. It is used to fast-forward through
+ * regions of a program where timing is not needed.
+ * 
+ * The pipeline must be empty (see drain_pipeline()) before switching to the
+ * functional model, and the functional model always leaves the pipeline 
+ * empty, so control can be handed back to clock_cycle() at any point.
+ */
+
+#define MAX_RECORD_SRCS		(2 + VECTOR_WORDS)
+
+/**
+ * An executed instruction, as handed to timing models (see timing.h). 
+ * Register lists leave out the PC.
+ */
+struct retire_record {
+	word_t pc;
+	struct instr in;				// operands reordered by instr_to_signal()
+	struct signal sig;
+	word_t addr;					// memory address, or block destination
+	word_t len;						// block length
+	unsigned char taken;			// branch taken
+
+	unsigned char srcs[MAX_RECORD_SRCS];
+	unsigned char num_srcs;
+	unsigned char dest;				// first register written
+	unsigned char num_dests;
+};
+
+/**
+ * Executes the instruction at proc->regs[PC] and advances the PC. A HALT 
+ * halts the processor as it would in the pipeline, after which nothing runs
+ * until resume_processor().
+ * 
+ * @return	0 on success, HALTED if the instruction was a HALT, else the 
+ * 			pipeline error code describing the fault
+ */
+int functional_step(struct processor* proc);
+
+/**
+ * Like functional_step(), and also describes the instruction in `record` if
+ * it executed (including a HALT)
+ */
+int functional_step_record(struct processor* proc, struct retire_record* record);
+
+/**
+ * Executes up to `count` instructions, stopping early if the PC reaches 
+ * `pc_marker` (ignored when 0), after a HALT, or when an error occurs. The 
+ * number of executed instructions is written to `executed`.
+ * 
+ * @return	0 on success, HALTED after a HALT, else the pipeline error code
+ * 			describing the fault
+ */
+int functional_run(struct processor* proc, uint64_t count, word_t pc_marker, 
+				   uint64_t* executed);
+
+#endif // FUNCTIONAL
@@ -0,0 +1,64 @@
+#ifndef GDBSTUB
+#define GDBSTUB
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ *
+ * Server side of the GDB remote serial protocol, driving a struct processor.
+ * Supported packets:
+ *
+ * - ?, g, G, p, P: stop reason and registers (the REGISTERS set, in order;
+ *   FLAG is 64 bits wide, the rest 32, all little endian)
+ * - m, M, X: memory reads and writes against memory->data. Packets may be
+ *   large enough for the whole image, so one `m` reads all of memory.
+ * - Z0, z0: software breakpoints, checked at fetch
+ * - s, c: single-step one instruction, continue
+ * - qSupported, qXfer:features:read (target.xml), QStartNoAckMode, qAttached,
+ *   H, D, k. Anything else gets the empty "unsupported" reply.
+ *
+ * Whenever the stub is talking to the client the pipeline is drained, so
+ * proc->regs[PC] is the next instruction and memory is up to date. A step
+ * fetches one instruction and drains. Continue clocks the pipeline normally
+ * until the fetch PC hits a breakpoint, then drains and stops if the
+ * breakpoint is still next (it may have been fetched down a wrong path). The
+ * client can interrupt a continue with ^C.
+ *
+ * Pipeline errors are reported as signals: SIGSEGV for SEGFAULT, SIGFPE for
+ * INVALID_OP and SIGILL otherwise.
+ */
+
+#define GDB_PACKET_SIZE		(2 * MEM_SIZE + 64)		// fits an `m` reply for all memory
+#define GDB_MAX_BREAKPOINTS	64
+#define GDB_POLL_CYCLES		4096					// cycles between ^C checks
+
+enum gdb_result {
+	GDB_DETACHED = 0,
+	GDB_KILLED = 1,
+	GDB_IO_ERROR = -1,
+};
+
+/**
+ * Serves a client already connected on `fd` until it detaches or kills the
+ * target, or the connection fails. The pipeline is drained first. `fd` is not
+ * closed.
+ */
+int gdb_serve(struct processor* proc, int fd);
+
+/**
+ * Listens on 127.0.0.1:`port`, accepts one client and serves it
+ *
+ * @return	As gdb_serve(), or GDB_IO_ERROR if no client could be accepted
+ */
+int gdb_serve_tcp(struct processor* proc, uint16_t port);
+
+/**
+ * Listens on the Unix socket at `path`, accepts one client and serves it. The
+ * socket file is removed afterwards.
+ *
+ * @return	As gdb_serve(), or GDB_IO_ERROR if no client could be accepted
+ */
+int gdb_serve_unix(struct processor* proc, const char* path);
+
+#endif // GDBSTUB
@@ -0,0 +1,78 @@
+#ifndef GUARD
+#define GUARD
+
+#include "processor.h"
+#include <setjmp.h>
+
+/**
+ * DETAILS:
+ *
+ * Guard memory is a memory->data backend whose bounds are enforced by the
+ * host MMU instead of verify_in_bounds(). The MEM_SIZE bytes of guest memory
+ * are mapped read-write at the start of a reservation that covers the whole
+ * 32-bit address space past them, which is left inaccessible. Guest addresses
+ * are turned into host addresses by guest_ptr(), where those below
+ * STARTING_OFFSET wrap around to the top of that space, so every address the
+ * bounds checks reject lands in the inaccessible part.
+ *
+ * A processor with guard memory attached runs the CONFIG_GUARD variant of the
+ * pipeline, which fetches, loads and stores without bounds checks. A SIGSEGV
+ * on the reservation jumps back to the start of the cycle, where it is
+ * reported as the SEGFAULT the failed check would have raised, from the same
+ * stage. Loads and stores that hit a device, and block memory operations,
+ * are still checked as before.
+ *
+ * The one difference from the checks is an access that starts in bounds but
+ * runs past MEM_SIZE: the checks only look at the first byte of each word and
+ * so read or write past the end of memory->data, while guard memory faults.
+ */
+
+struct guard_memory {
+	char* data;					// guest memory, also memory->data
+	size_t size;				// bytes reserved from data
+	sigjmp_buf env;				// start of the running cycle
+	const char* stage;			// stage of the last guarded access
+};
+
+/**
+ * Guard memory of the cycle running on this thread, if its variant is 
+ * CONFIG_GUARD. Faults elsewhere are not the handler's to recover from.
+ */
+extern __thread struct guard_memory* running_guard;
+
+/**
+ * Maps guard memory and makes it `memory`'s data. Needs a 64-bit host and a
+ * MEM_SIZE that is a multiple of the page size.
+ *
+ * @return	0 on success, else -1
+ */
+int guard_memory_init(struct guard_memory* guard, struct ememory* memory);
+
+/**
+ * Unmaps guard memory. Any processor it is attached to must be detached.
+ */
+void guard_memory_free(struct guard_memory* guard);
+
+/**
+ * Installs the SIGSEGV handler, if not installed yet, and switches `proc`,
+ * whose memory must be `guard`'s, to the unchecked variant of the pipeline.
+ * Faults outside guard memory go to the handler that was installed before.
+ *
+ * @return	0 on success, else -1
+ */
+int guard_attach(struct guard_memory* guard, struct processor* proc);
+
+/**
+ * Switches `proc` back to the checked variant
+ */
+void guard_detach(struct guard_memory* guard, struct processor* proc);
+
+/**
+ * Returns the host address of guest `addr`. For addresses within bounds it is
+ * &data[addr]; others wrap past the end of guard memory.
+ */
+static inline char* guest_ptr(char* data, word_t addr) {
+	return data + STARTING_OFFSET + (word_t) (addr - STARTING_OFFSET);
+}
+
+#endif // GUARD
@@ -0,0 +1,94 @@
+#ifndef IDLE
+#define IDLE
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ *
+ * Fast-forwarding of idle loops by run_for() and step_instructions(). An idle
+ * loop is a short backward branch over instructions that only compute
+ * registers and load words: no stores, block or vector operations, HALTs or
+ * other branches, like a BRN to itself or a poll of a status word.
+ *
+ * Each time the loop's branch flushes, the registers, flag and the rest of
+ * the processor (latches, pipeline_ctrl and the scoreboard, relative to the
+ * current cycle) are compared with the last time. Once every iteration in
+ * between ran the whole body exactly once and all of that came out the same,
+ * the loop is provably in a steady state: the next iteration reads the same
+ * words and does exactly what the last one did, as long as memory does not
+ * change. Whole iterations are then skipped by advancing the stats and the
+ * scoreboard, so the counters end up exactly where a fully simulated run
+ * would have put them.
+ *
+ * Skipping stops short of the run's cycle and instruction budgets and of the
+ * next check of any stop condition with an interval, which may change
+ * memory, and the snapshot is dropped at every such check and at the start
+ * of every run, after which the steady state has to be shown again. With a
+ * condition checked on every branch, nothing is skipped. Without devices,
+ * nothing else can change memory, so a loop that will never exit is skipped
+ * up to the budget at once. With devices attached, which may change memory
+ * from the host at any time, at most IDLE_CHECK_CYCLES are skipped before an
+ * iteration is simulated again to poll for real. Device reads polled by the
+ * loop are assumed to have no side effects, since the skipped ones never
+ * happen.
+ *
+ * Only the default and guard variants fast-forward. Traced and profiled runs
+ * would lose output, and SMT threads interleave.
+ */
+
+#define IDLE_MAX_BODY		8			// instructions, including the branch
+#define IDLE_CHECK_CYCLES	(1 << 16)	// skipped between polls, with devices
+
+/**
+ * Processor state at the loop branch's last flush
+ */
+struct idle_snapshot {
+	unsigned char regs_valid;			// regs and flag are set
+	unsigned char full;					// so is everything below
+	unsigned int age;					// flushes of the loop since
+	word_t regs[NUM_REGS];
+	uint64_t flag;
+
+	unsigned char bank;
+	struct latches latches;				// the current bank
+	struct pipeline_ctrl ctrl;
+	uint64_t reg_ready[NUM_REGS];		// cycles from now, 0 if already ready
+	uint64_t div_free;
+	struct pipeline_stats stats;
+};
+
+struct idle_skip {
+	word_t loop;						// branch target of the loop analyzed last
+	int loop_ok;						// whether its body may be idle
+	int body;							// instructions in it
+	struct idle_snapshot snapshot;
+
+	uint64_t skips;
+	uint64_t skipped_cycles;
+	uint64_t skipped_retired;
+};
+
+/**
+ * Lets run_for() and step_instructions() fast-forward idle loops on `proc`
+ */
+void idle_attach(struct idle_skip* idle, struct processor* proc);
+
+void idle_detach(struct idle_skip* idle, struct processor* proc);
+
+/**
+ * Drops the snapshot, for when memory may have changed: at the start of a run
+ * and whenever stop conditions are checked
+ */
+static inline void idle_forget(struct idle_skip* idle) {
+	idle->snapshot.regs_valid = 0;
+}
+
+/**
+ * Called by the bounded runs after a cycle in which a taken branch flushed.
+ * Skips whole iterations of an idle loop, staying below `end_cycles` and
+ * `end_retired`.
+ */
+void idle_fast_forward(struct processor* proc, uint64_t end_cycles, uint64_t end_retired);
+
+#endif // IDLE
@@ -8,7 +8,8 @@
 // Constants:
 #define word_t 			uint32_t
 #define NUM_REGS		10
-#define NUM_OPCODES		12
+#define NUM_OPCODES		28
+#define VECTOR_WORDS	4			// words moved by VLOAD/VSTORE
 
 // Opcodes:
 #define OPCODES(X)		\
@@ -23,7 +24,23 @@
 	X(CMP, 		8)		\
 	X(BEQ, 		9)	 	\
 	X(BNE, 		10)	 	\
-	X(BRN, 		11)	 
+	X(BRN, 		11)	 	\
+	X(PADDB, 	12)	 	\
+	X(PSUBB, 	13)	 	\
+	X(PADDH, 	14)	 	\
+	X(PSUBH, 	15)	 	\
+	X(VLOAD, 	16)	 	\
+	X(VSTORE, 	17)	 	\
+	X(MEMCPY, 	18)	 	\
+	X(MEMSET, 	19)	 	\
+	X(MUL, 		20)	 	\
+	X(MULH, 	21)	 	\
+	X(DIV, 		22)	 	\
+	X(REM, 		23)	 	\
+	X(SHL, 		24)	 	\
+	X(SHR, 		25)	 	\
+	X(SAR, 		26)	 	\
+	X(HALT, 	27)
 
 MACRO_TRACK(OPCODES)
 MACRO_DISPLAY(OPCODES, opcode_to_str)
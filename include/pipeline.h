@@ -4,6 +4,7 @@
 #include "instructions.h"
 #include "macro_utils.h"
 #include "stages.h"
+#include "ememory.h"
 
 // Forward declare processor
 struct processor;
@@ -32,14 +33,126 @@ struct processor;
 MACRO_TRACK(PIPELINE_ERRS)
 MACRO_DISPLAY(PIPELINE_ERRS, pipeline_err_to_string)
 
-struct IF_stage fetch(struct processor* proc);
+/**
+ * Not an error. Returned by clock_cycle() in the cycle a HALT retires, and 
+ * without running a cycle until the processor is resumed, and by 
+ * functional_step() for a HALT.
+ */
+#define HALTED	1
+
+static inline char verify_reg(word_t value) {
+	if (value >= NUM_REGS) {
+		return INVALID_REG; 			
+	}
+	return 0;
+}
+
+static inline char verify_in_bounds(word_t value) {
+	if (value < STARTING_OFFSET || value >= MEM_SIZE) {
+		return SEGFAULT;
+	}
+	return 0;
+}
+
+/**
+ * Checks that [addr, addr + len) lies within the same bounds as 
+ * verify_in_bounds(). Empty ranges are always valid.
+ */
+static inline char verify_range(word_t addr, word_t len) {
+	if (len && (verify_in_bounds(addr) || len > MEM_SIZE - addr)) {
+		return SEGFAULT;
+	}
+	return 0;
+}
+
+/**
+ * Timing model for MEMCPY/MEMSET. The operation occupies the MEM stage for
+ * the setup cycles plus one cycle per BLOCK_BYTES_PER_CYCLE bytes moved, 
+ * while the younger stages hold.
+ */
+#define BLOCK_SETUP_CYCLES			2
+#define BLOCK_BYTES_PER_CYCLE		16
 
-struct ID_stage decode(struct processor* proc, struct IF_stage fetched);
+static inline word_t block_cycles(word_t len) {
+	return BLOCK_SETUP_CYCLES + (len + BLOCK_BYTES_PER_CYCLE - 1) / BLOCK_BYTES_PER_CYCLE;
+}
+
+/**
+ * Performs a MEMCPY (copy != 0) or MEMSET after checking both ranges. 
+ * Overlapping copies behave like memmove().
+ * 
+ * @return	0 on success, else SEGFAULT
+ */
+int block_memory_op(char* data, int copy, word_t dest, word_t src, word_t len);
+
+/**
+ * Returns nonzero for operations executed by the multiply/divide unit
+ */
+static inline int is_muldiv(unsigned char alu_op) {
+	return alu_op >= ALU_MUL && alu_op <= ALU_REM;
+}
+
+/**
+ * Checks the divisor of a DIV/REM. Other operations always pass.
+ */
+static inline char verify_divisor(unsigned char alu_op, word_t src2) {
+	if ((alu_op == ALU_DIV || alu_op == ALU_REM) && src2 == 0) {
+		return INVALID_OP;
+	}
+	return 0;
+}
+
+/**
+ * Decodes the big-endian instruction stored at buf
+ */
+struct instr read_be_instr(char* buf);
+
+/**
+ * Returns the control signals for an instruction. Note that this reorders the
+ * operands of CMP and branch instructions in place.
+ */
+struct signal instr_to_signal(struct instr* in);
+
+/**
+ * Computes the result of an ALU operation
+ */
+int64_t alu_compute(unsigned char alu_op, word_t src1, word_t src2);
+
+/**
+ * Returns nonzero if a branch of the given type is taken for the given flag
+ */
+char evaluate_cmp(int64_t flag, unsigned char branch_type);
+
+/**
+ * Optional pipeline features. Each configuration in PIPELINE_CONFIGS stamps
+ * out a clock_cycle_<name>() specialized at compile time for its feature set,
+ * so a configuration pays nothing for the features it leaves out. 
+ * new_processor_config() picks the variant once.
+ * 
+ * CONFIG_TRACE		prints hazards, branches and retired instructions
+ * CONFIG_PROFILE	reads host counters around every stage (see profile.h)
+ * CONFIG_GUARD		leaves bounds checks to guard memory (see guard.h)
+ * CONFIG_SMT		runs several hardware threads (see smt.h)
+ * 
+ * New features get a bit here and are tested as `config & CONFIG_<NAME>` in
+ * the stage handlers. Add a configuration for every combination that should
+ * run without the features it does not request.
+ */
+#define CONFIG_TRACE		(1u << 0)
+#define CONFIG_PROFILE		(1u << 1)
+#define CONFIG_GUARD		(1u << 2)
+#define CONFIG_SMT			(1u << 3)
 
-struct EX_stage execute(struct processor* proc, struct ID_stage decoded);
+#define PIPELINE_CONFIGS(X)								\
+	X(default, 			0)								\
+	X(trace, 			CONFIG_TRACE)					\
+	X(profile, 			CONFIG_PROFILE)					\
+	X(trace_profile, 	CONFIG_TRACE | CONFIG_PROFILE)	\
+	X(guard, 			CONFIG_GUARD)					\
+	X(smt, 				CONFIG_SMT)
 
-struct MEM_stage memory_access(struct processor* proc, struct EX_stage executed);
+#define DECLARE_CLOCK_CYCLE(NAME, FEATURES) int clock_cycle_##NAME(struct processor* proc);
 
-struct WB_stage write_back(struct processor* proc, struct MEM_stage accessed);
+PIPELINE_CONFIGS(DECLARE_CLOCK_CYCLE)
 
 #endif // PIPELINE
\ No newline at end of file
@@ -5,29 +5,248 @@
 #include "ememory.h"
 #include "stages.h"
 #include "pipeline.h"
+#include "device.h"
+
+struct profile;
+struct guard_memory;
+struct smt;
+struct idle_skip;
+struct processor;
+
+/**
+ * Why run_for() or step_instructions() returned
+ */
+#define STOP_REASONS(X)			\
+	X(STOP_BUDGET, 		0)		\
+	X(STOP_HALT, 		1)		\
+	X(STOP_ERROR, 		2)		\
+	X(STOP_CONDITION, 	3)
+
+MACRO_TRACK(STOP_REASONS)
+MACRO_DISPLAY(STOP_REASONS, stop_reason_to_str)
+
+struct stop_reason {
+	int reason;					// STOP_*
+	int err_code;				// pipeline error code, for STOP_ERROR
+	int condition;				// id of the stop condition, for STOP_CONDITION
+	uint64_t cycles;			// cycles run by the call
+	uint64_t retired;			// instructions retired by the call
+};
+
+#define MAX_STOP_CONDITIONS		8
+
+/**
+ * A host callback that ends a run by returning nonzero. Conditions are never
+ * checked inside a cycle: one with an interval is checked every `interval` 
+ * cycles, and one without at the end of every basic block, i.e. in cycles 
+ * where a taken branch redirects fetch.
+ */
+struct stop_condition {
+	int (*check)(struct processor* proc, void* arg);	// NULL for a free slot
+	void* arg;
+	uint64_t interval;
+	uint64_t next_check;		// cycle of the next check, with an interval
+};
+
+struct stop_conditions {
+	struct stop_condition slots[MAX_STOP_CONDITIONS];
+	int count;					// slots in use, including freed ones below
+	int on_branch;				// conditions without an interval
+	uint64_t next_check;		// earliest next_check of any condition
+};
 
 struct processor {
 	word_t regs[NUM_REGS];
 	struct ememory* memory;
 	uint64_t flag;
 
-	struct IF_stage if_stage;
-	struct ID_stage id_stage;
-	struct MEM_stage mem_stage;
-	struct EX_stage ex_stage;
+	struct latches latches[2];
+	unsigned char bank;				// index of the current bank in latches
 
 	struct pipeline_ctrl pipeline_ctrl;
+	struct pipeline_err err;
+
+	unsigned int features;					// CONFIG_* bits of the selected variant
+	int (*cycle)(struct processor* proc);	// specialized clock_cycle_<config>()
+	struct pipeline_shape shape;
+	struct profile* profile;				// set by profile_attach()
+	struct guard_memory* guard;				// set by guard_attach()
+	struct smt* smt;						// set by smt_attach()
+	struct idle_skip* idle;					// set by idle_attach()
+	struct muldiv_unit muldiv;
+	struct pipeline_stats stats;
+	struct device_table devices;
+	struct stop_conditions stop_conditions;
 };
 
 /**
- * Returns a new processor
+ * Returns the latches written at the end of the previous cycle
+ */
+static inline struct latches* current_latches(struct processor* proc) {
+	return &proc->latches[proc->bank];
+}
+
+/**
+ * Returns the latches being filled during the current cycle
+ */
+static inline struct latches* next_latches(struct processor* proc) {
+	return &proc->latches[proc->bank ^ 1];
+}
+
+/**
+ * Returns a new processor. The multiply/divide unit starts with MUL_LATENCY
+ * and DIV_LATENCY, which may be changed through proc.muldiv before running.
+ * 
+ * The default configuration has no optional features, unless PIPELINE_DEBUG 
+ * is defined, in which case it traces.
  */
 struct processor new_processor(struct ememory* memory);
 
+/**
+ * Makes `proc` a new processor running the pipeline variant with the fewest 
+ * features that still includes every CONFIG_* bit in `features`
+ * 
+ * @return	0 on success, else -1 if no variant has all of them
+ */
+int new_processor_config(struct processor* proc, struct ememory* memory, unsigned int features);
+
+/**
+ * Switches an existing processor to the variant chosen for `features` by the
+ * same rule as new_processor_config(). The pipeline may be in any state.
+ * 
+ * @return	0 on success, else -1 if no variant has all of them, in which 
+ * 			case the processor is left as it was
+ */
+int set_processor_features(struct processor* proc, unsigned int features);
+
+/**
+ * Named stage tables. classic is the five stage pipeline every processor 
+ * starts with.
+ */
+#define PIPELINE_PRESETS(X)																	\
+	X(classic, 		STAGE_IF, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB)						\
+	X(split_fetch, 	STAGE_IF, STAGE_IF2, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB)			\
+	X(long_execute,	STAGE_IF, STAGE_ID, STAGE_EX, STAGE_EX2, STAGE_MEM, STAGE_WB)			\
+	X(address_gen,	STAGE_IF, STAGE_ID, STAGE_EX, STAGE_AG, STAGE_MEM, STAGE_WB)			\
+	X(deep, 		STAGE_IF, STAGE_IF2, STAGE_ID, STAGE_EX, STAGE_EX2, STAGE_AG, STAGE_MEM, STAGE_WB)
+
+struct pipeline_preset {
+	const char* name;
+	unsigned char stages[MAX_PIPELINE_DEPTH];
+	int depth;
+};
+
+extern const struct pipeline_preset pipeline_presets[];
+extern const int num_pipeline_presets;
+
+/**
+ * Returns the preset called `name`, or NULL if there is none
+ */
+const struct pipeline_preset* find_pipeline_preset(const char* name);
+
+/**
+ * Reduces a table of `depth` STAGE_* kinds to a shape
+ * 
+ * @return	0 on success, else -1 if the table is not laid out as described in
+ * 			stages.h or has more than MAX_EXTRA_STAGES of a kind
+ */
+int compile_pipeline_shape(const unsigned char* stages, int depth, struct pipeline_shape* shape);
+
+/**
+ * Switches the processor to the pipeline described by a stage table. The 
+ * pipeline must be empty.
+ * 
+ * @return	0 on success, else -1 if the table is invalid or the pipeline is
+ * 			not empty
+ */
+int set_pipeline_shape(struct processor* proc, const unsigned char* stages, int depth);
+
+/**
+ * Returns the number of stages in a shape
+ */
+static inline int pipeline_depth(const struct pipeline_shape* shape) {
+	return 5 + shape->if_extra + shape->ex_extra + shape->ag_extra;
+}
+
+/**
+ * Returns the cycles lost to a taken branch, i.e. the number of stages from 
+ * fetch up to where branches resolve, excluding the branch's own
+ */
+static inline int branch_penalty(const struct pipeline_shape* shape) {
+	return 2 + shape->if_extra + shape->ex_extra;
+}
+
+/**
+ * Advances the pipeline by a single cycle
+ * 
+ * Faults are precise. The faulting instruction and everything younger are
+ * dropped, and proc->regs[PC] is set back to the faulting instruction. Once
+ * the older instructions have drained, the registers are as before it, and
+ * the processor can carry on after the cause has been fixed.
+ * 
+ * @return	0 on success, else the pipeline error code of the failing stage
+ */
+int clock_cycle(struct processor* proc);
+
+/**
+ * Returns nonzero if no instruction is in flight in any pipeline latch
+ */
+int pipeline_empty(struct processor* proc);
+
+/**
+ * Stops fetching and advances the pipeline until every in-flight instruction
+ * has retired. Afterwards, proc->regs[PC] holds the address of the next 
+ * instruction to execute.
+ * 
+ * @return	0 on success, else the pipeline error code of the failing stage
+ */
+int drain_pipeline(struct processor* proc);
+
 /**
  * Begins execution of processor, starting at the ememory location loaded into
  * the program counter (proc->regs[PC])
  */
 int run(struct processor* proc);
 
+/**
+ * Clocks the pipeline for at most `cycles` cycles, stopping early when a HALT
+ * retires, on an error, or when a stop condition fires. The pipeline is left 
+ * as it is, so a later call carries on where this one stopped. After
+ * idle_attach(), idle loops are fast-forwarded (see idle.h).
+ */
+struct stop_reason run_for(struct processor* proc, uint64_t cycles);
+
+/**
+ * Like run_for(), but stops once `count` more instructions have retired. 
+ * Registers then hold the result of the last one. Younger instructions stay 
+ * in flight, and may already have stored to memory.
+ */
+struct stop_reason step_instructions(struct processor* proc, uint64_t count);
+
+/**
+ * Registers a stop condition, checked as described for struct stop_condition.
+ * The first check of one with an interval is `interval` cycles from now.
+ * 
+ * @return	An id for remove_stop_condition(), else -1 if all 
+ * 			MAX_STOP_CONDITIONS are in use
+ */
+int add_stop_condition(struct processor* proc, int (*check)(struct processor* proc, void* arg), 
+					   void* arg, uint64_t interval);
+
+void remove_stop_condition(struct processor* proc, int id);
+
+/**
+ * Returns nonzero once a HALT has retired
+ */
+static inline int processor_halted(struct processor* proc) {
+	return proc->pipeline_ctrl.halted;
+}
+
+/**
+ * Lets a halted processor run again from proc->regs[PC], which starts out at
+ * the instruction after the HALT. With SMT, every thread carries on after its
+ * own HALT.
+ */
+void resume_processor(struct processor* proc);
+
 #endif // PROCESSOR
\ No newline at end of file
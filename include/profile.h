@@ -0,0 +1,104 @@
+#ifndef PROFILE
+#define PROFILE
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ *
+ * Host-side profiling of the emulator itself. A processor with a profile
+ * attached runs a clock_cycle() variant built with CONFIG_PROFILE, which
+ * reads host counters around each stage handler and around the whole cycle.
+ * Whatever the cycle spends outside the handlers (hazard and flush control,
+ * latch shifting, the bank swap) is reported as control.
+ *
+ * Counters come from perf_event_open: host cycles, instructions, branch
+ * misses and L1D read misses, read with rdpmc where the kernel allows it. If
+ * perf events are not available at all, host cycles are taken from the time
+ * stamp counter (or a monotonic clock in nanoseconds off x86) and the other
+ * events are not reported.
+ *
+ * Each stage's counts are also attributed to the opcode in the latch it
+ * worked on, or to a bubble, including instructions fetched down a wrong path
+ * that never retire. Intervals are corrected for the measured cost of reading
+ * the counters and of the hooks themselves, so totals are approximate.
+ */
+
+#define PROFILE_STAGES(X)			\
+	X(PROFILE_FETCH, 		0)		\
+	X(PROFILE_DECODE, 		1)		\
+	X(PROFILE_EXECUTE, 		2)		\
+	X(PROFILE_MEMORY, 		3)		\
+	X(PROFILE_WRITE_BACK, 	4)		\
+	X(PROFILE_CONTROL, 		5)
+
+MACRO_TRACK(PROFILE_STAGES)
+MACRO_DISPLAY(PROFILE_STAGES, profile_stage_to_str)
+
+#define PROFILE_EVENTS(X)				\
+	X(EVENT_CYCLES, 		0)			\
+	X(EVENT_INSTRUCTIONS, 	1)			\
+	X(EVENT_BRANCH_MISSES, 	2)			\
+	X(EVENT_L1D_MISSES, 	3)
+
+MACRO_TRACK(PROFILE_EVENTS)
+MACRO_DISPLAY(PROFILE_EVENTS, profile_event_to_str)
+
+#define NUM_PROFILE_STAGES	6
+#define NUM_PROFILE_EVENTS	4
+#define PROFILE_BUBBLE		NUM_OPCODES			// bubbles and undecodable words
+#define PROFILE_OPCODES		(NUM_OPCODES + 1)
+
+struct perf_event_mmap_page;
+
+struct profile_counter {
+	int fd;									// -1 if the event is unavailable
+	struct perf_event_mmap_page* page;		// for rdpmc, NULL if not mapped
+};
+
+struct profile {
+	int perf;								// 0 if using the time stamp fallback
+	struct profile_counter counters[NUM_PROFILE_EVENTS];
+	uint64_t read_cost[NUM_PROFILE_EVENTS];	// subtracted from every interval
+	uint64_t stage_overhead[NUM_PROFILE_EVENTS];	// hook cost per stage, not control
+
+	uint64_t by_stage[NUM_PROFILE_STAGES][NUM_PROFILE_EVENTS];
+	uint64_t by_opcode[PROFILE_OPCODES][NUM_PROFILE_STAGES];	// host cycles
+	uint64_t retired[PROFILE_OPCODES];
+	uint64_t cycles;						// simulated cycles
+
+	// Counter values at the start of the current cycle and stage, and the 
+	// counts spent in stages (including their reads) during the cycle
+	uint64_t cycle_start[NUM_PROFILE_EVENTS];
+	uint64_t stage_start[NUM_PROFILE_EVENTS];
+	uint64_t stage_sum[NUM_PROFILE_EVENTS];
+};
+
+/**
+ * Opens the host counters and switches `proc` to a profiling variant of the
+ * pipeline. The pipeline may be in any state.
+ *
+ * @return	0 on success, else -1
+ */
+int profile_attach(struct profile* profile, struct processor* proc);
+
+/**
+ * Switches `proc` back to its unprofiled variant and closes the counters.
+ * The collected data stays in `profile`.
+ */
+void profile_detach(struct profile* profile, struct processor* proc);
+
+/**
+ * Prints host cost per simulated instruction by stage, then per opcode
+ */
+void print_profile(const struct profile* profile);
+
+/**
+ * Called by the CONFIG_PROFILE pipeline variants
+ */
+void profile_cycle_begin(struct profile* profile);
+void profile_cycle_end(struct profile* profile);
+void profile_stage_begin(struct profile* profile);
+void profile_stage_end(struct profile* profile, int stage, int opcode, int retired);
+
+#endif // PROFILE
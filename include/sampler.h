@@ -0,0 +1,57 @@
+#ifndef SAMPLER
+#define SAMPLER
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ * 
+ * Sampled simulation alternates between two modes:
+ * - Fast-forward: instructions are executed by the functional model only
+ * - Detailed: instructions go through the cycle-accurate pipeline
+ * 
+ * Each detailed window starts with `warmup` instructions whose timing is 
+ * discarded (the pipeline is filling), followed by `detail` measured 
+ * instructions. The pipeline is then drained and control goes back to the 
+ * functional model for another `fast_forward` instructions. The CPI measured
+ * over all windows is used to extrapolate the cycle count of the whole run.
+ */
+
+struct sample_config {
+	uint64_t fast_forward;		// instructions skipped between windows
+	uint64_t warmup;			// unmeasured instructions per window
+	uint64_t detail;			// measured instructions per window
+	word_t pc_marker;			// if nonzero, the first fast-forward ends here
+	uint64_t max_instructions;	// stop after this many (0 for no limit)
+};
+
+struct sample_report {
+	uint64_t total_instructions;
+	uint64_t functional_instructions;
+	uint64_t detailed_instructions;
+	uint64_t detailed_cycles;
+	uint64_t samples;
+	double cpi;
+	uint64_t estimated_cycles;
+	int status;
+};
+
+/**
+ * Runs the program loaded in proc using sampled simulation. The pipeline of 
+ * proc must be empty when this is called.
+ * 
+ * A run that reaches max_instructions stops right after that instruction. If
+ * it does so in the pipeline, younger instructions are left in flight.
+ * 
+ * @return	The status that ended the run (a pipeline error code, HALTED, or
+ * 			0 if max_instructions was reached)
+ */
+int run_sampled(struct processor* proc, const struct sample_config* config, 
+				struct sample_report* report);
+
+/**
+ * Prints a sample report, including the extrapolated CPI
+ */
+void print_sample_report(const struct sample_report* report);
+
+#endif // SAMPLER
@@ -0,0 +1,69 @@
+#ifndef SIMD
+#define SIMD
+
+#include <string.h>
+#include "instructions.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Host implementations of the packed guest instructions. Lanes are packed 
+ * into a single 32-bit register (4 x 8-bit or 2 x 16-bit) and wrap around 
+ * independently. Bitwise operations are lane-independent, so the scalar AND,
+ * OR, and XOR instructions already act as their packed versions.
+ * 
+ * With SSE2 the lanes are computed with packed integer instructions, 
+ * otherwise with a portable SWAR fallback that keeps carries from crossing 
+ * lane boundaries.
+ */
+
+#define LOW_BITS_8		0x7F7F7F7Fu
+#define HIGH_BITS_8		0x80808080u
+#define LOW_BITS_16		0x7FFF7FFFu
+#define HIGH_BITS_16	0x80008000u
+
+#if defined(__SSE2__)
+
+#define PACKED_OP(NAME, INTRINSIC)										\
+	static inline word_t NAME(word_t a, word_t b) {						\
+		__m128i res = INTRINSIC(_mm_cvtsi32_si128((int) a), 				\
+								_mm_cvtsi32_si128((int) b));				\
+		return (word_t) _mm_cvtsi128_si32(res);							\
+	}
+
+PACKED_OP(packed_add8, _mm_add_epi8)
+PACKED_OP(packed_sub8, _mm_sub_epi8)
+PACKED_OP(packed_add16, _mm_add_epi16)
+PACKED_OP(packed_sub16, _mm_sub_epi16)
+
+static inline void vector_copy(void* dest, const void* src) {
+	_mm_storeu_si128((__m128i*) dest, _mm_loadu_si128((const __m128i*) src));
+}
+
+#else
+
+static inline word_t packed_add8(word_t a, word_t b) {
+	return ((a & LOW_BITS_8) + (b & LOW_BITS_8)) ^ ((a ^ b) & HIGH_BITS_8);
+}
+
+static inline word_t packed_sub8(word_t a, word_t b) {
+	return ((a | HIGH_BITS_8) - (b & LOW_BITS_8)) ^ ((a ^ ~b) & HIGH_BITS_8);
+}
+
+static inline word_t packed_add16(word_t a, word_t b) {
+	return ((a & LOW_BITS_16) + (b & LOW_BITS_16)) ^ ((a ^ b) & HIGH_BITS_16);
+}
+
+static inline word_t packed_sub16(word_t a, word_t b) {
+	return ((a | HIGH_BITS_16) - (b & LOW_BITS_16)) ^ ((a ^ ~b) & HIGH_BITS_16);
+}
+
+static inline void vector_copy(void* dest, const void* src) {
+	memcpy(dest, src, VECTOR_WORDS * sizeof(word_t));
+}
+
+#endif
+
+#endif // SIMD
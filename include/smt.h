@@ -0,0 +1,94 @@
+#ifndef SMT
+#define SMT
+
+#include "processor.h"
+
+/**
+ * DETAILS:
+ *
+ * Simultaneous multithreading. A processor with an SMT state attached runs
+ * the CONFIG_SMT variant of the pipeline, in which up to MAX_THREADS hardware
+ * threads, each with its own registers, flag and PC, share every stage. Each
+ * cycle fetch picks one thread by the fetch policy, and the instruction
+ * carries the thread's id through the latches:
+ *
+ * - hazards are only checked against older instructions of the same thread,
+ *   so other threads' instructions fill the cycles one would stall
+ * - a taken branch flushes only its own thread's younger instructions, and
+ *   that thread alone waits for the branch to resolve before fetching again
+ * - a HALT stops fetch for its own thread, and the processor halts once every
+ *   thread has retired its HALT
+ *
+ * Everything else is shared: a stall in decode or a block memory operation
+ * holds the younger stages for all threads, and so does the divider.
+ *
+ * Thread 0 runs on the processor's own registers, flag and scoreboard, so
+ * anything that reads proc->regs sees it, and a processor with one thread
+ * runs cycle for cycle like the plain pipeline. The registers of threads[0]
+ * are unused. proc->stats counts for all threads together.
+ */
+
+#define MAX_THREADS		4
+
+#define FETCH_POLICIES(X)				\
+	X(FETCH_ROUND_ROBIN, 	0)			\
+	X(FETCH_ICOUNT, 		1)
+
+MACRO_TRACK(FETCH_POLICIES)
+MACRO_DISPLAY(FETCH_POLICIES, fetch_policy_to_str)
+
+struct hw_thread {
+	word_t regs[NUM_REGS];
+	uint64_t flag;
+	uint64_t reg_ready[NUM_REGS];		// as in struct muldiv_unit
+
+	unsigned char redirect_wait;		// cycles until a taken branch would resolve
+	unsigned char halt;					// a HALT has decoded, so nothing is fetched
+	unsigned char halted;				// the HALT has retired
+
+	uint64_t retired;
+	uint64_t stalls;					// cycles its instructions were held in decode
+	uint64_t flushes;
+};
+
+struct smt {
+	int num_threads;
+	int policy;							// FETCH_*
+	int last_fetched;					// thread fetched last, for round-robin
+	int flushed;						// thread of the branch flushing this cycle
+	int halted;							// threads whose HALT has retired
+	struct hw_thread threads[MAX_THREADS];
+};
+
+/**
+ * Gives `proc` `num_threads` hardware threads fetched by `policy` (FETCH_*),
+ * and switches it to the SMT variant of the pipeline. The pipeline must be
+ * empty. Thread 0 carries on from the processor's registers; the others start
+ * with every register clear, and their PCs must be set through thread_regs()
+ * before running.
+ *
+ * @return	0 on success, else -1
+ */
+int smt_attach(struct smt* smt, struct processor* proc, int num_threads, int policy);
+
+/**
+ * Switches `proc` back to a single thread, thread 0. The pipeline must be
+ * empty.
+ */
+void smt_detach(struct smt* smt, struct processor* proc);
+
+/**
+ * Returns the registers of `thread`
+ */
+static inline word_t* thread_regs(struct processor* proc, int thread) {
+	return thread ? proc->smt->threads[thread].regs : proc->regs;
+}
+
+/**
+ * Prints retired instructions, IPC, stalls and flushes for each thread and
+ * for the processor as a whole. Every thread's IPC is over all cycles run, so
+ * they add up to the processor's.
+ */
+void print_smt_stats(const struct processor* proc);
+
+#endif // SMT
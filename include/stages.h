@@ -9,7 +9,18 @@
 	X(ALU_SUB, 	2)		\
 	X(ALU_AND, 	3)		\
 	X(ALU_OR, 	4)		\
-	X(ALU_XOR, 	5)		
+	X(ALU_XOR, 	5)		\
+	X(ALU_PADDB, 6)		\
+	X(ALU_PSUBB, 7)		\
+	X(ALU_PADDH, 8)		\
+	X(ALU_PSUBH, 9)		\
+	X(ALU_MUL, 	10)		\
+	X(ALU_MULH, 11)		\
+	X(ALU_DIV, 	12)		\
+	X(ALU_REM, 	13)		\
+	X(ALU_SHL, 	14)		\
+	X(ALU_SHR, 	15)		\
+	X(ALU_SAR, 	16)
 	
 MACRO_TRACK(ALU_OP)
 MACRO_DISPLAY(ALU_OP, op_to_str)
@@ -18,81 +29,176 @@ struct signal {
 	unsigned char reg_write : 1;
 	unsigned char mem_read  : 1;
 	unsigned char mem_write : 1;
-	unsigned char alu_op	: 3;
+	unsigned char alu_op	: 5;
 	unsigned char wb_src    : 1;	  // 0 for register, 1 for memory
 	unsigned char branch	: 1;
+	unsigned char valid		: 1;	  // 0 for bubbles and flushed latches
+	unsigned char vector	: 1;	  // memory op on VECTOR_WORDS registers
+	unsigned char block		: 1;	  // multi-cycle MEMCPY/MEMSET
+	unsigned char halt		: 1;	  // HALT
 };
 
-#define PIPELINE_ERR(CODE, FUNC, DUMP) \
-	(struct err_base) {.err_code = CODE, .function_name = (char*) FUNC, .dump = DUMP}
-
-struct err_base {
+/**
+ * Set by the first stage to fail in a cycle, and cleared when the next cycle
+ * starts. Stage latches carry no error state of their own.
+ */
+struct pipeline_err {
 	int err_code;
-	char* function_name;
-	char* dump;
+	const char* function_name;
 };
 
 /**
- * Used for pipeline debugging ONLY. Debug values will not be used in pipeline
- * control flow
+ * Used for pipeline debugging, and for nothing else in pipeline control flow
+ * but restarting from a faulting instruction
  */
 struct debug_base {
 	struct instr in;
+	word_t pc;
 };
 
+/**
+ * Pipeline latches. A latch holds a bubble when its signal is all zero (or 
+ * valid is clear for IF), in which case the other fields are stale and must 
+ * not be read. vec_data is only filled for vector operations that use it, and
+ * thread is only meaningful in the CONFIG_SMT variant.
+ */
 struct IF_stage {
 	struct instr fetched_instr;
 	word_t prop_pc;
+	unsigned char valid;
+	unsigned char thread;
 	
-	struct err_base err;
 	struct debug_base dbg;
 };
 
 struct ID_stage {
+	struct signal sig;
 	unsigned char write_reg;
 	unsigned char branch_type;
+	unsigned char thread;
 	word_t dest_data;
 	word_t src1_data;
 	word_t src2_data;
 
-	struct signal sig;
-
-	struct err_base err;
 	struct debug_base dbg;
+	word_t vec_data[VECTOR_WORDS];
 };
 
 struct EX_stage {
+	struct signal sig;
 	unsigned char write_reg;
+	unsigned char thread;
 	word_t dest_data;
+	word_t src1_data;
 	int64_t alu_result;
 
-	struct signal sig;
-
-	struct err_base err;
 	struct debug_base dbg;
+	word_t vec_data[VECTOR_WORDS];
 };
 
 struct MEM_stage {
+	struct signal sig;
 	unsigned char write_reg;
-	word_t dest_data;
+	unsigned char thread;
 	word_t mem_result;
 	word_t alu_result;
 
-	struct signal sig;
-
-	struct err_base err;
 	struct debug_base dbg;
+	word_t vec_data[VECTOR_WORDS];
 };
 
-struct WB_stage {
-	struct err_base err;
-	struct debug_base dbg;
+/**
+ * Stage kinds making up a pipeline shape, which must be laid out as
+ * 
+ *   IF IF2* ID EX EX2* AG* MEM WB
+ * 
+ * The five stage handlers do all of the work. IF2 stages lengthen fetch, EX2 
+ * stages lengthen execute, and AG (address generation) stages sit between 
+ * execute and memory access. Each extra stage only carries its group's latch 
+ * one cycle further, so results take longer to reach WB. Branches resolve at 
+ * the end of the last EX2 stage.
+ */
+#define STAGE_KINDS(X)		\
+	X(STAGE_IF, 	0)		\
+	X(STAGE_IF2, 	1)		\
+	X(STAGE_ID, 	2)		\
+	X(STAGE_EX, 	3)		\
+	X(STAGE_EX2, 	4)		\
+	X(STAGE_AG, 	5)		\
+	X(STAGE_MEM, 	6)		\
+	X(STAGE_WB, 	7)
+
+MACRO_TRACK(STAGE_KINDS)
+MACRO_DISPLAY(STAGE_KINDS, stage_kind_to_str)
+
+#define MAX_EXTRA_STAGES	3		// of each of IF2, EX2 and AG
+#define MAX_PIPELINE_DEPTH	(5 + 3 * MAX_EXTRA_STAGES)
+
+/**
+ * A stage table reduced to what the pipeline needs
+ */
+struct pipeline_shape {
+	unsigned char if_extra;			// IF2 stages
+	unsigned char ex_extra;			// EX2 stages
+	unsigned char ag_extra;			// AG stages
+};
+
+/**
+ * One bank of latches. The processor keeps two: stages read the current bank
+ * and fill the next, and the banks are swapped at the end of every cycle.
+ * 
+ * The extra stages of deeper shapes come before the named latch of their 
+ * group: fetch fills if_extra[0] and the last IF2 latch feeds if_stage, and
+ * execute fills ex_extra[0] and the last EX2 or AG latch feeds ex_stage.
+ */
+struct latches {
+	struct IF_stage if_stage;
+	struct ID_stage id_stage;
+	struct EX_stage ex_stage;
+	struct MEM_stage mem_stage;
+
+	struct IF_stage if_extra[MAX_EXTRA_STAGES];
+	struct EX_stage ex_extra[2 * MAX_EXTRA_STAGES];
 };
 
 struct pipeline_ctrl {
 	unsigned char flush: 1;
 	unsigned char stall: 1;
-	unsigned char bubble_next: 1;
+	unsigned char drain: 1;			// stop fetching and let the pipeline empty
+	unsigned char halt: 1;			// a HALT has decoded, so nothing is fetched
+	unsigned char halted: 1;		// the HALT has retired
+	unsigned char redirect_wait;	// cycles until a taken branch would resolve
+	word_t mem_busy;				// cycles left in a block memory operation
+};
+
+/**
+ * Default latencies of the multiply/divide unit, in cycles spent in EX
+ */
+#define MUL_LATENCY		3
+#define DIV_LATENCY		16
+
+/**
+ * Scoreboard for the multi-cycle multiply/divide unit. Results are computed 
+ * in EX as usual, but their consumers cannot decode before the unit would have
+ * produced them. The multiplier is pipelined and accepts a new operation 
+ * every cycle; the divider is not.
+ */
+struct muldiv_unit {
+	unsigned int mul_latency;
+	unsigned int div_latency;
+	uint64_t reg_ready[NUM_REGS];	// first cycle a consumer of the register may decode
+	uint64_t div_free;				// first cycle a divide may decode
+};
+
+/**
+ * Counters maintained by clock_cycle() and write_back(). An instruction is 
+ * counted as retired when it leaves the WB stage.
+ */
+struct pipeline_stats {
+	uint64_t cycles;
+	uint64_t retired;
+	uint64_t stalls;
+	uint64_t flushes;
 };
 
 #endif // STAGES
\ No newline at end of file
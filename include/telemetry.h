@@ -0,0 +1,122 @@
+#ifndef TELEMETRY
+#define TELEMETRY
+
+#include "processor.h"
+#include <stdatomic.h>
+
+/**
+ * DETAILS:
+ *
+ * Live telemetry of a running processor, exported through a POSIX shared
+ * memory segment that any number of other processes can map and read while
+ * the simulation carries on. telemetry_open() registers a stop condition with
+ * the given interval, so the page is updated every `interval` cycles by
+ * run_for() and step_instructions() and never otherwise. Runs without
+ * telemetry are unaffected.
+ *
+ * The page is a seqlock: the writer makes `seq` odd, stores the fields and
+ * makes it even again. It never waits for readers. A reader copies the fields
+ * between two loads of `seq` and retries if the two differ or are odd (see
+ * telemetry_read()). Besides those two stores of `seq`, an update costs one
+ * store per field. The fragmentation fields need a walk of ememory's free
+ * list, which only reads but grows with fragmentation, so they are filled in
+ * only when opened with TELEMETRY_FREE_LIST and are 0 otherwise.
+ *
+ * Segment names follow shm_open(): a leading slash and no others, such as
+ * "/unu". The segment is removed by telemetry_close(), and one left behind
+ * by a crashed writer is reused by the next telemetry_open() of that name.
+ */
+
+#define TELEMETRY_MAGIC			0x756e7574u		// "unut"
+#define TELEMETRY_VERSION		1
+
+// Flags for telemetry_open()
+#define TELEMETRY_FREE_LIST		(1 << 0)	// publish the fragmentation fields
+
+/**
+ * Layout of the shared page. Only `seq` orders anything; the other fields
+ * are atomic only so that reading them mid-update is not undefined.
+ */
+struct telemetry_page {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t interval;					// cycles between updates
+	uint64_t flags;						// as given to telemetry_open()
+	_Atomic uint64_t seq;				// odd while an update is in progress
+
+	_Atomic uint64_t cycles;
+	_Atomic uint64_t pc;
+	_Atomic uint64_t retired;
+	_Atomic uint64_t stalls;
+	_Atomic uint64_t flushes;
+	_Atomic uint64_t halted;
+
+	// Only with TELEMETRY_FREE_LIST
+	_Atomic uint64_t free_head;			// ememory's first free block
+	_Atomic uint64_t free_blocks;		// blocks in the free list
+	_Atomic uint64_t free_bytes;		// their total size, headers included
+	_Atomic uint64_t largest_free;		// the biggest of them
+};
+
+/**
+ * One consistent copy of the page
+ */
+struct telemetry_sample {
+	uint64_t seq;
+	uint64_t cycles;
+	uint64_t pc;
+	uint64_t retired;
+	uint64_t stalls;
+	uint64_t flushes;
+	uint64_t halted;
+	uint64_t free_head;
+	uint64_t free_blocks;
+	uint64_t free_bytes;
+	uint64_t largest_free;
+};
+
+struct telemetry {
+	char name[64];
+	struct telemetry_page* page;
+	int condition;						// id of the stop condition updating it
+	int flags;
+};
+
+/**
+ * Creates the segment `name`, publishes the current state of `proc` to it and
+ * keeps it updated every `interval` cycles from now on. `flags` is a mask of
+ * TELEMETRY_* flags.
+ *
+ * @return	0 on success, else -1 (errno is set if the segment could not be
+ * 			created)
+ */
+int telemetry_open(struct telemetry* tel, struct processor* proc, const char* name, uint64_t interval, int flags);
+
+/**
+ * Stops the updates and removes the segment. Readers that still have it
+ * mapped keep the last update.
+ */
+void telemetry_close(struct telemetry* tel, struct processor* proc);
+
+/**
+ * Publishes the current state right away, e.g. after a run stops
+ */
+void telemetry_update(struct telemetry* tel, struct processor* proc);
+
+/**
+ * Maps the existing segment `name` read-only
+ *
+ * @return	The page, else NULL if there is no such segment or it is not a
+ * 			telemetry page of this version
+ */
+const struct telemetry_page* telemetry_map(const char* name);
+
+void telemetry_unmap(const struct telemetry_page* page);
+
+/**
+ * Copies a consistent sample out of `page`, retrying while an update is in
+ * progress. Never blocks the writer.
+ */
+void telemetry_read(const struct telemetry_page* page, struct telemetry_sample* sample);
+
+#endif // TELEMETRY
@@ -0,0 +1,91 @@
+#ifndef TIMING
+#define TIMING
+
+#include "functional.h"
+
+/**
+ * DETAILS:
+ *
+ * Timing models run behind the functional model instead of inside the
+ * pipeline. timing_run() executes a program once with functional_step_record()
+ * and hands every executed instruction, in order, to each of a list of timing
+ * models, so one execution evaluates any number of designs. A timing model
+ * only computes cycles: it never sees or changes architectural state.
+ *
+ * A timing model is embedded as the first member of its own state struct, so
+ * its callback can cast the struct timing_model* back to that struct.
+ *
+ * The in-order model computes, for each instruction, the cycles it fetches,
+ * decodes and leaves each later stage in, from the shape of the pipeline and
+ * the rules below. With the default rules it reproduces clock_cycle() cycle
+ * for cycle, including its stall and flush counts:
+ *
+ * - IF2 stages hold up to `if_extra` more instructions, and fetch stops while
+ *   decode stalls
+ * - an operand can be read once its producer has written back, and a branch
+ *   can decode once the compare it tests has reached MEM
+ * - consumers of a multiply or divide also wait for the unit's latency, and
+ *   a divide waits for the last one to finish
+ * - a taken branch flushes in EX, and fetch restarts after any EX2 stages
+ * - a block memory operation keeps MEM, and with it everything younger, busy
+ *   for block_cycles() of its length
+ *
+ * With `forwarding` set, results reach their consumers as they leave the last
+ * execute stage (loads as they leave MEM), and branches read the flag the
+ * same way, as in a pipeline with bypass paths.
+ */
+
+struct timing_model {
+	const char* name;
+	struct pipeline_stats stats;		// cycles so far, as clock_cycle() counts them
+
+	/**
+	 * Accounts for the next executed instruction
+	 */
+	void (*retire)(struct timing_model* model, const struct retire_record* record);
+};
+
+#define TIMING_FREEZES		8			// block operations remembered by the model
+
+struct inorder_timing {
+	struct timing_model model;
+	struct pipeline_shape shape;
+	unsigned int mul_latency;
+	unsigned int div_latency;
+	unsigned char forwarding;
+
+	uint64_t last_fetch;
+	uint64_t last_decode;
+	uint64_t fetch_ready;				// first fetch after a redirect or HALT
+	uint64_t reg_ready[NUM_REGS];		// first decode allowed to read the register
+	uint64_t muldiv_ready[NUM_REGS];	// as in struct muldiv_unit
+	uint64_t flag_ready;				// first decode allowed for a BEQ/BNE
+	uint64_t div_free;
+	uint64_t freezes[TIMING_FREEZES][2];	// first and last cycle MEM is busy
+	unsigned int num_freezes;
+};
+
+/**
+ * Initializes an in-order model of a pipeline with `shape`. Multiply and
+ * divide latencies start at MUL_LATENCY and DIV_LATENCY and forwarding is
+ * off; any of them may be changed before the first instruction.
+ */
+void init_inorder_timing(struct inorder_timing* timing, const char* name,
+						 const struct pipeline_shape* shape);
+
+/**
+ * Executes up to `count` instructions like functional_run(), handing each to
+ * every model in `models`. The pipeline must be empty.
+ *
+ * @return	0 on success, HALTED after a HALT, else the pipeline error code
+ * 			describing the fault
+ */
+int timing_run(struct processor* proc, uint64_t count, word_t pc_marker,
+			   struct timing_model* const* models, int num_models, uint64_t* executed);
+
+/**
+ * Prints cycles, CPI, stalls and flushes for each model
+ */
+void print_timing(struct timing_model* const* models, int num_models);
+
+#endif // TIMING
@@ -1,6 +1,11 @@
 #include "pipeline.h"
 #include "processor.h"
+#include "simd.h"
+#include "profile.h"
+#include "guard.h"
+#include "smt.h"
 #include <stdio.h>
+#include <string.h>
 
 // ============================
 //		 HELPER FUNCTIONS
@@ -13,44 +18,94 @@
 		.mem_write = 0, 			\
 		.alu_op = OP, 				\
 		.wb_src = 0, 				\
-		.branch = 0					\
+		.branch = 0,				\
+		.valid = 1					\
 	}
 
-#define ASSIGN_REG_OR_PROP_PC(VAR, REG)		\
-	if (REG == PC) {						\
-		VAR = fetched.prop_pc;				\
-	} else {								\
-		VAR = READ_REG(proc, REG);			\
+#define ASSIGN_REG_OR_PROP_PC(VAR, REG)					\
+	if (REG == PC) {									\
+		VAR = fetched->prop_pc;							\
+	} else {											\
+		VAR = READ_THREAD_REG(fetched->thread, REG);	\
 	}
 
-#define CHECK_STAGE_ERR(STAGE, ERR_CODE)					\
-	if (ERR_CODE) {											\
-		return (STAGE) { 									\
-			.err = PIPELINE_ERR(ERR_CODE, __func__, NULL)	\
-		};													\
-	}						
-	
-static inline char verify_reg(word_t value) {
-	if (value < 0 || value >= NUM_REGS) {
-		return INVALID_REG; 			
-	}
-	return 0;
-}
+/**
+ * State of hardware thread `T`. Thread 0, and every instruction outside the
+ * CONFIG_SMT variant, uses the processor's own registers, flag and scoreboard.
+ */
+#define SMT_THREAD(T)		((config & CONFIG_SMT) && (T))
+#define THREAD_REGS(T)		(SMT_THREAD(T) ? proc->smt->threads[T].regs : proc->regs)
+#define THREAD_FLAG(T)		(*(SMT_THREAD(T) ? &proc->smt->threads[T].flag : &proc->flag))
+#define THREAD_READY(T)		(SMT_THREAD(T) ? proc->smt->threads[T].reg_ready : proc->muldiv.reg_ready)
 
-static inline char verify_in_bounds(word_t value) {
-	if (value < STARTING_OFFSET || value >= MEM_SIZE) {
-		return SEGFAULT;
-	}
-	return 0;
-}	
+#define READ_THREAD_REG(T, REG) 											\
+	(((REG) == FLAG) ? THREAD_FLAG(T) : THREAD_REGS(T)[REG])
+#define WRITE_THREAD_REG(T, REG, VALUE) 									\
+	(((REG) == FLAG) ? (THREAD_FLAG(T) = (int64_t) (VALUE)) 				\
+					 : (THREAD_REGS(T)[(REG)] = (word_t) (VALUE)))
+
+/**
+ * Nonzero if a latch holds an instruction of thread `T`, which outside the
+ * CONFIG_SMT variant they all do
+ */
+#define SAME_THREAD(LATCH, T)	(!(config & CONFIG_SMT) || (LATCH).thread == (T))
+
+/**
+ * Reports an error through the processor's side channel and leaves the stage.
+ * clock_cycle() checks the channel after every stage.
+ */
+#define CHECK_STAGE_ERR(ERR_CODE)							\
+	do {													\
+		int err_code_ = (ERR_CODE);							\
+		if (err_code_) {									\
+			proc->err = (struct pipeline_err) { 			\
+				.err_code = err_code_, 						\
+				.function_name = __func__ 					\
+			};												\
+			return;											\
+		}													\
+	} while (0)
+
+/**
+ * Runs an access to guard memory that faults where a bounds check would have
+ * failed. The barriers keep the stage's earlier stores from sinking past the
+ * access and its later ones from rising above it, so that a fault leaves the
+ * processor as a failed check in this stage would.
+ */
+#define GUARD_ACCESS(ACCESS)								\
+	do {													\
+		proc->guard->stage = __func__;						\
+		__asm__ __volatile__("" ::: "memory");				\
+		ACCESS;												\
+		__asm__ __volatile__("" ::: "memory");				\
+	} while (0)
+
+#define BUBBLE ((struct signal) { 0 })
+
+/**
+ * Stage handlers take the configuration's feature set as a constant and are
+ * always inlined into the clock_cycle_<config>() variants, so feature checks
+ * fold away.
+ */
+#define STAGE_FN static inline __attribute__((always_inline))
+
+#define trace_printf(...)							\
+	do {											\
+		if (config & CONFIG_TRACE) {				\
+			printf(__VA_ARGS__);					\
+		}											\
+	} while (0)
 
 struct instr read_be_instr(char* buf) {
+	// Bytes must be unsigned, otherwise the low byte of src2 is sign-extended
+	// over the high byte
+	unsigned char* bytes = (unsigned char*) buf;
 	struct instr in;
-	in.opcode = (buf[0] >> 1) & 0x7F;
-	in.imm_flag = buf[0] & 0x1;
-	in.dest = (buf[1] >> 4) & 0x0F;
-	in.src1 = buf[1] & 0x0F;
-	in.src2 = ((int16_t) buf[2] << 8) | buf[3];
+	in.opcode = (bytes[0] >> 1) & 0x7F;
+	in.imm_flag = bytes[0] & 0x1;
+	in.dest = (bytes[1] >> 4) & 0x0F;
+	in.src1 = bytes[1] & 0x0F;
+	in.src2 = (int16_t) ((bytes[2] << 8) | bytes[3]);
 
 	return in;
 }
@@ -79,7 +134,8 @@ struct signal instr_to_signal(struct instr* in) {
 				.mem_write = 0, 
 				.alu_op = ALU_ADD, 
 				.wb_src = 1,
-				.branch = 0 
+				.branch = 0,
+				.valid = 1
 			};
 		case STORE:
 			return (struct signal) { 
@@ -88,7 +144,43 @@ struct signal instr_to_signal(struct instr* in) {
 				.mem_write = 1, 
 				.alu_op = ALU_ADD,  
 				.wb_src = 0,
-				.branch = 0
+				.branch = 0,
+				.valid = 1
+			};
+		case VLOAD:
+			return (struct signal) { 
+				.reg_write = 1, 
+				.mem_read = 1, 
+				.mem_write = 0, 
+				.alu_op = ALU_ADD, 
+				.wb_src = 1,
+				.branch = 0,
+				.valid = 1,
+				.vector = 1
+			};
+		case VSTORE:
+			return (struct signal) { 
+				.reg_write = 0, 
+				.mem_read = 0, 
+				.mem_write = 1, 
+				.alu_op = ALU_ADD,  
+				.wb_src = 0,
+				.branch = 0,
+				.valid = 1,
+				.vector = 1
+			};
+		case MEMCPY:
+		case MEMSET:
+			// src2 (the length) passes through the ALU
+			return (struct signal) { 
+				.reg_write = 0, 
+				.mem_read = (in->opcode == MEMCPY), 
+				.mem_write = 1, 
+				.alu_op = ALU_PASS,  
+				.wb_src = 0,
+				.branch = 0,
+				.valid = 1,
+				.block = 1
 			};
 		case ADD:
 			RETURN_ALU_SIGNAL(ALU_ADD);
@@ -104,6 +196,28 @@ struct signal instr_to_signal(struct instr* in) {
 			RETURN_ALU_SIGNAL(ALU_PASS);
 		case CMP:
 			RETURN_ALU_SIGNAL(ALU_SUB);
+		case PADDB:
+			RETURN_ALU_SIGNAL(ALU_PADDB);
+		case PSUBB:
+			RETURN_ALU_SIGNAL(ALU_PSUBB);
+		case PADDH:
+			RETURN_ALU_SIGNAL(ALU_PADDH);
+		case PSUBH:
+			RETURN_ALU_SIGNAL(ALU_PSUBH);
+		case MUL:
+			RETURN_ALU_SIGNAL(ALU_MUL);
+		case MULH:
+			RETURN_ALU_SIGNAL(ALU_MULH);
+		case DIV:
+			RETURN_ALU_SIGNAL(ALU_DIV);
+		case REM:
+			RETURN_ALU_SIGNAL(ALU_REM);
+		case SHL:
+			RETURN_ALU_SIGNAL(ALU_SHL);
+		case SHR:
+			RETURN_ALU_SIGNAL(ALU_SHR);
+		case SAR:
+			RETURN_ALU_SIGNAL(ALU_SAR);
 		case BRN:
 		case BNE:
 		case BEQ:
@@ -113,8 +227,18 @@ struct signal instr_to_signal(struct instr* in) {
 				.mem_write = 0, 
 				.alu_op = ALU_ADD, 
 				.wb_src = 0, 
-				.branch = 1
+				.branch = 1,
+				.valid = 1
 			};
+		case HALT:
+			return (struct signal) { 
+				.alu_op = ALU_PASS, 
+				.valid = 1,
+				.halt = 1
+			};
+		default:
+			// Not an instruction. Callers reject it as INVALID_OPCODE.
+			return BUBBLE;
 	}
 } 
 
@@ -130,134 +254,777 @@ char evaluate_cmp(int64_t flag, unsigned char branch_type) {
 	return 0;
 }
 
+int block_memory_op(char* data, int copy, word_t dest, word_t src, word_t len) {
+	if (verify_range(dest, len) || (copy && verify_range(src, len))) {
+		return SEGFAULT;
+	}
+	if (copy) {
+		memmove(data + dest, data + src, len);
+	} else {
+		memset(data + dest, (unsigned char) src, len);
+	}
+	return 0;
+}
+
+int64_t alu_compute(unsigned char alu_op, word_t src1, word_t src2) {
+	switch (alu_op) {
+		case ALU_PASS:
+			return src2;
+		case ALU_ADD:
+			return (word_t) (src1 + src2);
+		case ALU_SUB:
+			return (word_t) (src1 - src2);
+		case ALU_AND:
+			return src1 & src2;
+		case ALU_OR:
+			return src1 | src2;
+		case ALU_XOR:
+			return src1 ^ src2;
+		case ALU_PADDB:
+			return packed_add8(src1, src2);
+		case ALU_PSUBB:
+			return packed_sub8(src1, src2);
+		case ALU_PADDH:
+			return packed_add16(src1, src2);
+		case ALU_PSUBH:
+			return packed_sub16(src1, src2);
+		case ALU_MUL:
+			return (word_t) (src1 * src2);
+		case ALU_MULH:
+			return (word_t) (((int64_t) (int32_t) src1 * (int32_t) src2) >> 32);
+		case ALU_DIV:
+		case ALU_REM:
+			// Division by zero is rejected by verify_divisor(). INT_MIN / -1 
+			// overflows, so it wraps to INT_MIN with a remainder of 0.
+			if (src2 == 0) {
+				return 0;
+			}
+			if ((int32_t) src1 == INT32_MIN && (int32_t) src2 == -1) {
+				return (alu_op == ALU_DIV) ? src1 : 0;
+			}
+			if (alu_op == ALU_DIV) {
+				return (word_t) ((int32_t) src1 / (int32_t) src2);
+			}
+			return (word_t) ((int32_t) src1 % (int32_t) src2);
+		case ALU_SHL:
+			return (word_t) (src1 << (src2 & 31));
+		case ALU_SHR:
+			return src1 >> (src2 & 31);
+		case ALU_SAR:
+			return (word_t) ((int32_t) src1 >> (src2 & 31));
+	}
+	return 0;
+}
+
+
+/**
+ * Returns nonzero if `reg` will be written by an instruction whose result has
+ * not reached the register file yet. The PC is never considered pending since
+ * reads of it are served from the fetched PC.
+ */
+static inline int latch_writes(struct signal sig, unsigned char write_reg, unsigned char reg) {
+	if (!sig.reg_write) {
+		return 0;
+	}
+	if (sig.vector) {
+		return reg >= write_reg && reg < write_reg + VECTOR_WORDS;
+	}
+	return reg == write_reg;
+}
+
+/**
+ * Returns the number of EX2 and AG latches in use
+ */
+static inline int ex_extra_slots(const struct pipeline_shape* shape) {
+	return shape->ex_extra + shape->ag_extra;
+}
+
+STAGE_FN int pending_write(struct processor* proc, unsigned char thread, unsigned char reg,
+						  const unsigned int config) {
+	if (reg == PC) {
+		return 0;
+	}
+	struct latches* next = next_latches(proc);
+	for (int i = 0; i < ex_extra_slots(&proc->shape); i++) {
+		if (SAME_THREAD(next->ex_extra[i], thread) 
+				&& latch_writes(next->ex_extra[i].sig, next->ex_extra[i].write_reg, reg)) {
+			return 1;
+		}
+	}
+	return proc->stats.cycles < THREAD_READY(thread)[reg]
+		|| (SAME_THREAD(next->ex_stage, thread) 
+			&& latch_writes(next->ex_stage.sig, next->ex_stage.write_reg, reg))
+		|| (SAME_THREAD(next->mem_stage, thread) 
+			&& latch_writes(next->mem_stage.sig, next->mem_stage.write_reg, reg));
+}
+
+/**
+ * Returns nonzero if a branch decoding now would read the flag before an 
+ * older compare has written it back
+ */
+STAGE_FN int pending_flag(struct processor* proc, unsigned char thread, const unsigned int config) {
+	struct latches* next = next_latches(proc);
+	for (int i = 0; i < ex_extra_slots(&proc->shape); i++) {
+		if (SAME_THREAD(next->ex_extra[i], thread) 
+				&& next->ex_extra[i].sig.reg_write && next->ex_extra[i].write_reg == FLAG) {
+			return 1;
+		}
+	}
+	return SAME_THREAD(next->ex_stage, thread) 
+		&& next->ex_stage.sig.reg_write && next->ex_stage.write_reg == FLAG;
+}
+
+/**
+ * Checks the operands of a decoded instruction against the results still in 
+ * flight. EX and MEM have already run this cycle, so the latches they are 
+ * filling hold the producers ahead of it. Registers are read in ID and 
+ * written in WB, so a producer in the EX, EX2, AG or MEM latches has not 
+ * written back yet, and neither has a multiply or divide still marked in the
+ * scoreboard. Branches only read the flag in EX, by which point a producer in
+ * the MEM latch has written back. A divide also waits for the divider to 
+ * become free. With SMT, only producers of the same thread count, though the
+ * divider is shared.
+ * 
+ * Operands must already be reordered by instr_to_signal().
+ */
+STAGE_FN int has_data_hazard(struct processor* proc, struct instr* in, struct signal* sig, 
+							 unsigned char thread, const unsigned int config) {
+	if (sig->halt) {
+		return 0;
+	}
+	if (in->opcode != MOV && pending_write(proc, thread, in->src1, config)) {
+		return 1;
+	}
+	if (!in->imm_flag && pending_write(proc, thread, in->src2, config)) {
+		return 1;
+	}
+	if (sig->mem_write) {
+		int count = sig->vector ? VECTOR_WORDS : 1;
+		for (int i = 0; i < count; i++) {
+			if (pending_write(proc, thread, in->dest + i, config)) {
+				return 1;
+			}
+		}
+	}
+	if ((in->opcode == BEQ || in->opcode == BNE) && pending_flag(proc, thread, config)) {
+		return 1;
+	}
+	if ((sig->alu_op == ALU_DIV || sig->alu_op == ALU_REM) 
+			&& proc->stats.cycles < proc->muldiv.div_free) {
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Marks the destination of an issuing multiply or divide in the scoreboard. 
+ * It spends `latency` cycles in EX from the next cycle, then passes any EX2 
+ * and AG stages, MEM and WB.
+ */
+STAGE_FN void reserve_muldiv(struct processor* proc, struct instr* in, struct signal* sig, 
+						   unsigned char thread, const unsigned int config) {
+	uint64_t now = proc->stats.cycles;
+	int divide = (sig->alu_op == ALU_DIV || sig->alu_op == ALU_REM);
+	unsigned int latency = divide ? proc->muldiv.div_latency : proc->muldiv.mul_latency;
+	if (latency == 0) {
+		latency = 1;
+	}
+	THREAD_READY(thread)[in->dest] = now + 2 + ex_extra_slots(&proc->shape) + latency;
+	if (divide) {
+		proc->muldiv.div_free = now + latency;
+	}
+}
+
+/**
+ * Returns the number of instructions of `thread` in the IF, IF2 and ID 
+ * latches at the start of the cycle
+ */
+static int front_end_count(struct processor* proc, int thread) {
+	struct latches* cur = current_latches(proc);
+	int count = (cur->if_stage.valid && cur->if_stage.thread == thread)
+		+ (cur->id_stage.sig.valid && cur->id_stage.thread == thread);
+	for (int i = 0; i < proc->shape.if_extra; i++) {
+		count += cur->if_extra[i].valid && cur->if_extra[i].thread == thread;
+	}
+	return count;
+}
+
+/**
+ * Picks the thread to fetch from this cycle, skipping threads waiting for a 
+ * branch to resolve or stopped by a HALT. Round-robin takes the first thread
+ * after the last one fetched; ICOUNT takes the thread with the fewest 
+ * instructions ahead of EX, breaking ties the same way.
+ * 
+ * @return	The thread, else -1 if none may fetch
+ */
+static int pick_thread(struct processor* proc) {
+	struct smt* smt = proc->smt;
+	int best = -1;
+	int best_count = 0;
+	for (int i = 1; i <= smt->num_threads; i++) {
+		int thread = (smt->last_fetched + i) % smt->num_threads;
+		if (smt->threads[thread].redirect_wait || smt->threads[thread].halt) {
+			continue;
+		}
+		if (smt->policy == FETCH_ROUND_ROBIN) {
+			best = thread;
+			break;
+		}
+		int count = front_end_count(proc, thread);
+		if (best < 0 || count < best_count) {
+			best = thread;
+			best_count = count;
+		}
+	}
+	if (best >= 0) {
+		smt->last_fetched = best;
+	}
+	return best;
+}
+
+/**
+ * Empties the IF and IF2 latches of `bank` holding instructions of `thread`
+ */
+static void squash_thread(struct latches* bank, const struct pipeline_shape* shape, int thread) {
+	if (bank->if_stage.thread == thread) {
+		bank->if_stage.valid = 0;
+	}
+	for (int i = 0; i < shape->if_extra; i++) {
+		if (bank->if_extra[i].thread == thread) {
+			bank->if_extra[i].valid = 0;
+		}
+	}
+}
+
 
 // =============================
 //		 PIPELINE HANDLERS
 // =============================
 
-struct IF_stage fetch(struct processor* proc) {
-	CHECK_STAGE_ERR(struct IF_stage, verify_in_bounds(proc->regs[PC]));
-	struct instr in = read_be_instr(proc->memory->data + proc->regs[PC]);
-	proc->regs[PC] += sizeof(struct instr);
-	return (struct IF_stage) { 
+STAGE_FN void fetch(struct processor* proc, struct IF_stage* out, const unsigned int config) {
+	int thread = 0;
+	if (config & CONFIG_SMT) {
+		if (proc->pipeline_ctrl.drain || (thread = pick_thread(proc)) < 0) {
+			out->valid = 0;
+			return;
+		}
+	} else if (proc->pipeline_ctrl.redirect_wait) {
+		proc->pipeline_ctrl.redirect_wait--;
+		out->valid = 0;
+		return;
+	} else if (proc->pipeline_ctrl.drain) {
+		out->valid = 0;
+		return;
+	}
+	word_t* regs = THREAD_REGS(thread);
+	struct instr in;
+	if (config & CONFIG_GUARD) {
+		GUARD_ACCESS(in = read_be_instr(guest_ptr(proc->memory->data, regs[PC])));
+	} else {
+		CHECK_STAGE_ERR(verify_in_bounds(regs[PC]));
+		in = read_be_instr(proc->memory->data + regs[PC]);
+	}
+	*out = (struct IF_stage) { 
 		.fetched_instr = in, 
-		.prop_pc = proc->regs[PC] - sizeof(struct instr), 
-		.dbg = (struct debug_base) { in } 
+		.prop_pc = regs[PC], 
+		.valid = 1,
+		.thread = thread,
+		.dbg = (struct debug_base) { 
+			.in = in, 
+			.pc = regs[PC] 
+		} 
 	};
+	regs[PC] += sizeof(struct instr);
 }
 
-struct ID_stage decode(struct processor* proc, struct IF_stage fetched) {
-	struct instr* in = &fetched.fetched_instr;
+STAGE_FN void decode(struct processor* proc, const struct IF_stage* fetched, struct ID_stage* out, 
+					 const unsigned int config) {
+	struct instr in = fetched->fetched_instr;
+	unsigned char thread = fetched->thread;
+	if (!fetched->valid) {
+		out->sig = BUBBLE;
+		return;
+	}
 
-	if (in->opcode < 0 || in->opcode >= NUM_OPCODES) {
-		return (struct ID_stage) { .err = PIPELINE_ERR(INVALID_OPCODE, __func__, NULL)};
+	if (in.opcode >= NUM_OPCODES) {
+		CHECK_STAGE_ERR(INVALID_OPCODE);
 	}
 
-	CHECK_STAGE_ERR(struct ID_stage, verify_reg(in->dest));
-	CHECK_STAGE_ERR(struct ID_stage, verify_reg(in->src1));
+	CHECK_STAGE_ERR(verify_reg(in.dest));
+	CHECK_STAGE_ERR(verify_reg(in.src1));
 
-	struct signal sig = instr_to_signal(in);
+	struct signal sig = instr_to_signal(&in);
+	if (!sig.valid) {
+		CHECK_STAGE_ERR(INVALID_OPCODE);
+	}
 	
+	// Vector operations use the registers dest to dest + VECTOR_WORDS - 1
+	if (sig.vector && in.dest + VECTOR_WORDS > PC) {
+		CHECK_STAGE_ERR(INVALID_REG);
+	}
+
 	word_t dest_data, src1_data, src2_data;
-	ASSIGN_REG_OR_PROP_PC(dest_data, in->dest);
-	ASSIGN_REG_OR_PROP_PC(src1_data, in->src1);
-	if (in->imm_flag) {
-		src2_data = in->src2;
+	ASSIGN_REG_OR_PROP_PC(dest_data, in.dest);
+	ASSIGN_REG_OR_PROP_PC(src1_data, in.src1);
+	if (in.imm_flag) {
+		src2_data = in.src2;
 	} else {
-		CHECK_STAGE_ERR(struct ID_stage, verify_reg(in->src2));
-		ASSIGN_REG_OR_PROP_PC(src2_data, in->src2);
+		CHECK_STAGE_ERR(verify_reg(in.src2));
+		ASSIGN_REG_OR_PROP_PC(src2_data, in.src2);
 	}
 
-	if (in->opcode == CMP) {
-		printf("See CMP!\n");
+	// Hold the instruction in IF and send a bubble down until its operands 
+	// have been written back
+	if (has_data_hazard(proc, &in, &sig, thread, config)) {
+		trace_printf("Data hazard on %s\n", opcode_to_str(in.opcode));
 		proc->pipeline_ctrl.stall = 1;
-		proc->pipeline_ctrl.bubble_next = 1;
+		if (config & CONFIG_SMT) {
+			proc->smt->threads[thread].stalls++;
+		}
+		out->sig = BUBBLE;
+		return;
 	}
 
-	return (struct ID_stage) {
-		.write_reg = in->dest, 
-		.branch_type = in->opcode,
-		.dest_data = dest_data,
-		.src1_data = src1_data,
-		.src2_data = src2_data,
-		.sig = sig,
-		.dbg = fetched.dbg,
-	};
+	if (is_muldiv(sig.alu_op)) {
+		reserve_muldiv(proc, &in, &sig, thread, config);
+	}
+
+	// Any older branch has resolved by now, so nothing younger will run. The
+	// PC is left at the instruction after the HALT.
+	if (sig.halt) {
+		trace_printf("Halting after 0x%04x\n", fetched->prop_pc);
+		if (config & CONFIG_SMT) {
+			proc->smt->threads[thread].halt = 1;
+		} else {
+			proc->pipeline_ctrl.halt = 1;
+		}
+		THREAD_REGS(thread)[PC] = fetched->prop_pc + sizeof(struct instr);
+	}
+
+	out->sig = sig;
+	out->write_reg = in.dest;
+	out->branch_type = in.opcode;
+	out->thread = thread;
+	out->dest_data = dest_data;
+	out->src1_data = src1_data;
+	out->src2_data = src2_data;
+	out->dbg = fetched->dbg;
+	if (sig.vector && sig.mem_write) {
+		memcpy(out->vec_data, &THREAD_REGS(thread)[in.dest], sizeof(out->vec_data));
+	}
 }
 
-struct EX_stage execute(struct processor* proc, struct ID_stage decoded) {
-	int64_t alu_result;
-	switch (decoded.sig.alu_op) {
-		case ALU_PASS:
-			alu_result = decoded.src2_data;
-			break;
-		case ALU_ADD:
-			alu_result = decoded.src1_data + decoded.src2_data;
-			break;
-		case ALU_SUB:
-			alu_result = decoded.src1_data - decoded.src2_data;
-			break;
-		case ALU_AND:
-			alu_result = decoded.src1_data & decoded.src2_data;
-			break;
-		case ALU_OR:
-			alu_result = decoded.src1_data | decoded.src2_data;
-			break;
-		case ALU_XOR:
-			alu_result = decoded.src1_data ^ decoded.src2_data;
-			break;	
+STAGE_FN void execute(struct processor* proc, const struct ID_stage* decoded, struct EX_stage* out, 
+					  const unsigned int config) {
+	if (!decoded->sig.valid) {
+		out->sig = BUBBLE;
+		return;
 	}
+	CHECK_STAGE_ERR(verify_divisor(decoded->sig.alu_op, decoded->src2_data));
+	int64_t alu_result = alu_compute(decoded->sig.alu_op, decoded->src1_data, decoded->src2_data);
 
-	if (decoded.sig.mem_read) {
-		printf("ALU result on load: %lld\n", alu_result);
+	if (decoded->sig.mem_read) {
+		trace_printf("ALU result on load: %lld\n", (long long) alu_result);
 	}
 
-	if (decoded.sig.branch) {
-		printf("Branching to %d (flag = %d)\n", alu_result, proc->flag);
-		if (evaluate_cmp(proc->flag, decoded.branch_type)) {
-			WRITE_REG(proc, PC, alu_result);
+	if (decoded->sig.branch) {
+		unsigned char thread = decoded->thread;
+		int64_t flag = THREAD_FLAG(thread);
+		trace_printf("Branching to %lld (flag = %lld)\n", (long long) alu_result, (long long) flag);
+		// With EX2 stages the branch would resolve at the end of the last one.
+		// Redirecting now and holding fetch back until then costs the same 
+		// cycles, without executing wrong-path instructions. With SMT, the 
+		// other threads carry on fetching meanwhile.
+		if (evaluate_cmp(flag, decoded->branch_type)) {
+			THREAD_REGS(thread)[PC] = alu_result;
 			proc->pipeline_ctrl.flush = 1;
-			proc->pipeline_ctrl.stall = 1;
+			if (config & CONFIG_SMT) {
+				proc->smt->flushed = thread;
+				proc->smt->threads[thread].redirect_wait = proc->shape.ex_extra + 1;
+				proc->smt->threads[thread].flushes++;
+			} else {
+				proc->pipeline_ctrl.stall = 1;
+				proc->pipeline_ctrl.redirect_wait = proc->shape.ex_extra;
+			}
 		}
 	}
 
-	return (struct EX_stage) { 
-		.write_reg = decoded.write_reg, 
-		.dest_data = decoded.dest_data, 
-		.alu_result = alu_result, 
-		.sig = decoded.sig,
-		.dbg = decoded.dbg,
-	};
+	out->sig = decoded->sig;
+	out->write_reg = decoded->write_reg;
+	out->thread = decoded->thread;
+	out->dest_data = decoded->dest_data;
+	out->src1_data = decoded->src1_data;
+	out->alu_result = alu_result;
+	out->dbg = decoded->dbg;
+	if (decoded->sig.vector && decoded->sig.mem_write) {
+		memcpy(out->vec_data, decoded->vec_data, sizeof(out->vec_data));
+	}
 }
 
-struct MEM_stage memory_access(struct processor* proc, struct EX_stage executed) {
-	word_t mem_result = 0;
-	if (executed.sig.mem_read) {
-		CHECK_STAGE_ERR(struct MEM_stage, verify_in_bounds(executed.alu_result));
-		memcpy(&mem_result, &proc->memory->data[executed.alu_result], sizeof(word_t));
-	} else if (executed.sig.mem_write) {
-		CHECK_STAGE_ERR(struct MEM_stage, verify_in_bounds(executed.alu_result));
-		memcpy(&proc->memory->data[executed.alu_result], &executed.dest_data, sizeof(word_t));
-	}
-
-	return (struct MEM_stage) {
-		.write_reg = executed.write_reg, 
-		.dest_data = executed.dest_data, 
-		.mem_result = mem_result, 
-		.alu_result = executed.alu_result,
-		.sig = executed.sig,
-		.dbg = executed.dbg,
-	};
+STAGE_FN void memory_access(struct processor* proc, const struct EX_stage* executed, struct MEM_stage* out,
+							const unsigned int config) {
+	if (!executed->sig.valid) {
+		out->sig = BUBBLE;
+		return;
+	}
+	char* data = proc->memory->data;
+	word_t addr = executed->alu_result;
+	if (executed->sig.block) {
+		// dest_data = destination, src1_data = source (or fill byte), 
+		// alu_result = length
+		CHECK_STAGE_ERR(block_memory_op(data, executed->sig.mem_read, 
+			executed->dest_data, executed->src1_data, addr));
+		proc->pipeline_ctrl.mem_busy = block_cycles(addr) - 1;
+		trace_printf("Block memory operation of %u bytes, busy for %u cycles\n", 
+					 addr, proc->pipeline_ctrl.mem_busy);
+	} else if (executed->sig.vector) {
+		// Both the first and last word of the vector must be in bounds
+		if (config & CONFIG_GUARD) {
+			char* vec = guest_ptr(data, addr);
+			if (executed->sig.mem_read) {
+				GUARD_ACCESS(vector_copy(out->vec_data, vec));
+			} else {
+				GUARD_ACCESS(vector_copy(vec, executed->vec_data));
+			}
+		} else {
+			CHECK_STAGE_ERR(verify_in_bounds(addr));
+			CHECK_STAGE_ERR(verify_in_bounds(addr + (VECTOR_WORDS - 1) * sizeof(word_t)));
+			if (executed->sig.mem_read) {
+				vector_copy(out->vec_data, &data[addr]);
+			} else {
+				vector_copy(&data[addr], executed->vec_data);
+			}
+		}
+	} else if ((config & CONFIG_GUARD) && !proc->devices.count 
+			&& (executed->sig.mem_read || executed->sig.mem_write)) {
+		char* word = guest_ptr(data, addr);
+		if (executed->sig.mem_read) {
+			GUARD_ACCESS(memcpy(&out->mem_result, word, sizeof(word_t)));
+		} else {
+			GUARD_ACCESS(memcpy(word, &executed->dest_data, sizeof(word_t)));
+		}
+	} else if (executed->sig.mem_read) {
+		CHECK_STAGE_ERR(load_word(&proc->devices, data, addr, &out->mem_result));
+	} else if (executed->sig.mem_write) {
+		CHECK_STAGE_ERR(store_word(&proc->devices, data, addr, executed->dest_data));
+	}
+
+	out->sig = executed->sig;
+	out->write_reg = executed->write_reg; 
+	out->thread = executed->thread;
+	out->alu_result = executed->alu_result;
+	out->dbg = executed->dbg;
 }
 
-struct WB_stage write_back(struct processor* proc, struct MEM_stage accessed) {
-	if (accessed.sig.reg_write) {
-		CHECK_STAGE_ERR(struct WB_stage, verify_reg(accessed.write_reg));
-		if (accessed.sig.wb_src) {
-			WRITE_REG(proc, accessed.write_reg, accessed.mem_result);
+STAGE_FN void write_back(struct processor* proc, const struct MEM_stage* accessed, const unsigned int config) {
+	if (!accessed->sig.valid) {
+		return;
+	}
+	unsigned char thread = accessed->thread;
+	proc->stats.retired++;
+	if (config & CONFIG_SMT) {
+		struct smt* smt = proc->smt;
+		smt->threads[thread].retired++;
+		if (accessed->sig.halt) {
+			smt->threads[thread].halted = 1;
+			smt->halted++;
+		}
+		proc->pipeline_ctrl.halted = (smt->halted == smt->num_threads);
+	} else {
+		proc->pipeline_ctrl.halted = accessed->sig.halt;
+	}
+	trace_printf("[%llu] retire 0x%04x %s\n", (unsigned long long) proc->stats.cycles, 
+				 accessed->dbg.pc, opcode_to_str(accessed->dbg.in.opcode));
+	if (accessed->sig.reg_write) {
+		CHECK_STAGE_ERR(verify_reg(accessed->write_reg));
+		if (accessed->sig.vector) {
+			memcpy(&THREAD_REGS(thread)[accessed->write_reg], accessed->vec_data, 
+				   sizeof(accessed->vec_data));
+		} else if (accessed->sig.wb_src) {
+			WRITE_THREAD_REG(thread, accessed->write_reg, accessed->mem_result);
 		} else {
-			WRITE_REG(proc, accessed.write_reg, accessed.alu_result);
+			WRITE_THREAD_REG(thread, accessed->write_reg, accessed->alu_result);
 		}
 	}
-	return (struct WB_stage) { 0 };
 }
+
+
+// =============================
+//		 CLOCK CYCLE
+// =============================
+
+#define CHECK_ERR(PROC) 														\
+	if ((PROC)->err.err_code) { 												\
+		printf("Pipeline error occurred in %s()\n", (PROC)->err.function_name); 	\
+		abandon_cycle(PROC, config);											\
+		return (PROC)->err.err_code; 											\
+	}
+
+/**
+ * Notes that the instruction in a latch is dropped, and that its thread
+ * fetches again from it unless an older one of that thread was dropped too
+ */
+#define DROP(LATCH_VALID, LATCH)											\
+	do {																	\
+		if ((LATCH_VALID) && !restart[(LATCH).thread]) {					\
+			restart[(LATCH).thread] = 1;									\
+			THREAD_REGS((LATCH).thread)[PC] = (LATCH).dbg.pc;				\
+		}																	\
+	} while (0)
+
+/**
+ * Makes a fault precise, so that the processor can carry on once whatever
+ * caused it has been dealt with. Stages run oldest first, so every instruction
+ * older than the faulting one has already gone through its stage this cycle,
+ * into the next bank. The faulting instruction and everything younger are 
+ * dropped, each thread fetches again from its oldest dropped instruction, and
+ * the cycle ends as usual. Multiplies and divides that were dropped may still
+ * hold the scoreboard for a few cycles, which only costs time.
+ */
+static void abandon_cycle(struct processor* proc, const unsigned int config) {
+	struct latches* cur = current_latches(proc);
+	struct latches* next = next_latches(proc);
+	const struct pipeline_shape* shape = &proc->shape;
+	int ex_slots = ex_extra_slots(shape);
+	const char* stage = proc->err.function_name;
+	int in_wb = !strcmp(stage, "write_back");
+	int in_mem = in_wb || !strcmp(stage, "memory_access");
+	int in_ex = in_mem || !strcmp(stage, "execute");
+	int in_id = in_ex || !strcmp(stage, "decode");
+
+	// Oldest first. A fault in fetch drops nothing in flight, and the PC
+	// still points at the instruction it could not fetch.
+	unsigned char restart[MAX_THREADS] = { 0 };
+	if (in_wb && cur->mem_stage.sig.valid) {
+		DROP(1, cur->mem_stage);
+		proc->stats.retired--;
+		if (config & CONFIG_SMT) {
+			proc->smt->threads[cur->mem_stage.thread].retired--;
+		}
+	}
+	if (in_mem) {
+		DROP(cur->ex_stage.sig.valid, cur->ex_stage);
+		for (int i = ex_slots - 1; i >= 0; i--) {
+			DROP(cur->ex_extra[i].sig.valid, cur->ex_extra[i]);
+		}
+	}
+	if (in_ex) {
+		DROP(cur->id_stage.sig.valid, cur->id_stage);
+	}
+	if (in_id) {
+		DROP(cur->if_stage.valid, cur->if_stage);
+		for (int i = shape->if_extra - 1; i >= 0; i--) {
+			DROP(cur->if_extra[i].valid, cur->if_extra[i]);
+		}
+	}
+
+	// Whatever the dropped instructions would have put in the next bank
+	if (in_mem) {
+		next->mem_stage.sig = BUBBLE;
+		next->ex_stage.sig = BUBBLE;
+		for (int i = 0; i < ex_slots; i++) {
+			next->ex_extra[i].sig = BUBBLE;
+		}
+	} else if (in_ex) {
+		if (ex_slots) {
+			next->ex_extra[0].sig = BUBBLE;
+		} else {
+			next->ex_stage.sig = BUBBLE;
+		}
+	}
+	if (in_id) {
+		next->id_stage.sig = BUBBLE;
+		next->if_stage.valid = 0;
+		for (int i = 0; i < shape->if_extra; i++) {
+			next->if_extra[i].valid = 0;
+		}
+	} else if (shape->if_extra) {
+		next->if_extra[0].valid = 0;
+	} else {
+		next->if_stage.valid = 0;
+	}
+
+	// Nothing younger than a HALT is ever in flight, so a thread with dropped
+	// instructions has not decoded one. Fetch restarts without waiting for a
+	// redirect.
+	if (config & CONFIG_SMT) {
+		for (int i = 0; i < proc->smt->num_threads; i++) {
+			if (restart[i]) {
+				proc->smt->threads[i].halt = 0;
+				proc->smt->threads[i].redirect_wait = 0;
+			}
+		}
+	} else if (restart[0]) {
+		proc->pipeline_ctrl.halt = 0;
+		proc->pipeline_ctrl.redirect_wait = 0;
+	}
+	proc->pipeline_ctrl.flush = 0;
+	proc->pipeline_ctrl.stall = 0;
+	proc->bank ^= 1;
+}
+
+/**
+ * Runs a stage handler. When profiling, its host cost is attributed to STAGE
+ * and to the opcode it worked on.
+ */
+#define PROFILED(STAGE, OPCODE, RETIRED, CALL)								\
+	do {																	\
+		if (config & CONFIG_PROFILE) {										\
+			profile_stage_begin(proc->profile);								\
+		}																	\
+		CALL;																\
+		if (config & CONFIG_PROFILE) {										\
+			profile_stage_end(proc->profile, STAGE, OPCODE, RETIRED);		\
+		}																	\
+	} while (0)
+
+#define LATCH_OPCODE(LATCH) 	((LATCH).sig.valid ? (LATCH).dbg.in.opcode : PROFILE_BUBBLE)
+#define IF_OPCODE(LATCH) 		((LATCH).valid ? (LATCH).fetched_instr.opcode : PROFILE_BUBBLE)
+
+STAGE_FN int advance_pipeline(struct processor* proc, const unsigned int config) {
+	struct latches* cur = current_latches(proc);
+	struct latches* next = next_latches(proc);
+	if (proc->pipeline_ctrl.halted) {
+		return HALTED;
+	}
+
+	// Reset ctrl and any error from the last cycle on every cycle
+	proc->err = (struct pipeline_err) { 0 };
+	proc->pipeline_ctrl.flush = 0;
+	proc->pipeline_ctrl.stall = 0;
+	proc->stats.cycles++;
+
+	PROFILED(PROFILE_WRITE_BACK, LATCH_OPCODE(cur->mem_stage), cur->mem_stage.sig.valid,
+			 write_back(proc, &cur->mem_stage, config));
+	CHECK_ERR(proc)
+
+	// A block memory operation keeps MEM busy. Once it has written back, WB
+	// sees bubbles and the younger stages hold their latches, so the current
+	// bank is kept rather than swapped.
+	if (proc->pipeline_ctrl.mem_busy) {
+		proc->pipeline_ctrl.mem_busy--;
+		cur->mem_stage.sig = BUBBLE;
+		proc->stats.stalls++;
+		return 0;
+	}
+
+	PROFILED(PROFILE_MEMORY, LATCH_OPCODE(cur->ex_stage), 0,
+			 memory_access(proc, &cur->ex_stage, &next->mem_stage, config));
+	CHECK_ERR(proc)
+
+	// EX2 and AG stages only pass their latches along
+	const struct pipeline_shape* shape = &proc->shape;
+	int ex_slots = ex_extra_slots(shape);
+	if (ex_slots) {
+		next->ex_stage = cur->ex_extra[ex_slots - 1];
+		for (int i = ex_slots - 1; i > 0; i--) {
+			next->ex_extra[i] = cur->ex_extra[i - 1];
+		}
+	}
+
+	// Branches resolve in EX and flush the younger stages, so the branch itself
+	// is never flushed out of its own latch
+	PROFILED(PROFILE_EXECUTE, LATCH_OPCODE(cur->id_stage), 0,
+			 execute(proc, &cur->id_stage, ex_slots ? &next->ex_extra[0] : &next->ex_stage, config));
+	CHECK_ERR(proc)
+
+	if (proc->pipeline_ctrl.flush && !(config & CONFIG_SMT)) {
+		next->id_stage.sig = BUBBLE;
+		next->if_stage.valid = 0;
+		for (int i = 0; i < shape->if_extra; i++) {
+			next->if_extra[i].valid = 0;
+		}
+	} else {
+		// With SMT, only the branch's own thread is flushed, and the other
+		// threads' instructions move on
+		if (proc->pipeline_ctrl.flush) {
+			squash_thread(cur, shape, proc->smt->flushed);
+		}
+
+		PROFILED(PROFILE_DECODE, IF_OPCODE(cur->if_stage), 0,
+				 decode(proc, &cur->if_stage, &next->id_stage, config));
+		CHECK_ERR(proc)
+
+		// On a data hazard, decode sends a bubble and the IF stages hold their
+		// instructions. Once a HALT has decoded, they are emptied instead.
+		if (proc->pipeline_ctrl.stall) {
+			next->if_stage = cur->if_stage;
+			for (int i = 0; i < shape->if_extra; i++) {
+				next->if_extra[i] = cur->if_extra[i];
+			}
+		} else if (proc->pipeline_ctrl.halt) {
+			next->if_stage.valid = 0;
+			for (int i = 0; i < shape->if_extra; i++) {
+				next->if_extra[i].valid = 0;
+			}
+		} else {
+			struct IF_stage* fetched = &next->if_stage;
+			if (shape->if_extra) {
+				next->if_stage = cur->if_extra[shape->if_extra - 1];
+				for (int i = shape->if_extra - 1; i > 0; i--) {
+					next->if_extra[i] = cur->if_extra[i - 1];
+				}
+				fetched = &next->if_extra[0];
+			}
+			// A thread whose HALT has decoded fetches nothing more
+			if ((config & CONFIG_SMT) && next->id_stage.sig.halt) {
+				squash_thread(next, shape, next->id_stage.thread);
+			}
+			PROFILED(PROFILE_FETCH, IF_OPCODE(*fetched), 0, fetch(proc, fetched, config));
+			CHECK_ERR(proc)
+		}
+	}
+
+	if (config & CONFIG_SMT) {
+		for (int i = 0; i < proc->smt->num_threads; i++) {
+			if (proc->smt->threads[i].redirect_wait) {
+				proc->smt->threads[i].redirect_wait--;
+			}
+		}
+	}
+
+	proc->bank ^= 1;
+	// With SMT as without, a cycle with a flush counts as a stall
+	proc->stats.stalls += proc->pipeline_ctrl.stall | proc->pipeline_ctrl.flush;
+	proc->stats.flushes += proc->pipeline_ctrl.flush;
+	return proc->pipeline_ctrl.halted ? HALTED : 0;
+}
+
+/**
+ * Runs a cycle of a CONFIG_GUARD variant. A fault on guard memory during the
+ * cycle jumps back here and is reported like a failed bounds check. Since it
+ * calls sigsetjmp(), this is never inlined.
+ */
+static int guarded_cycle(struct processor* proc, const unsigned int config) {
+	if (sigsetjmp(proc->guard->env, 0)) {
+		proc->err = (struct pipeline_err) { 
+			.err_code = SEGFAULT, 
+			.function_name = proc->guard->stage 
+		};
+		CHECK_ERR(proc)
+	}
+	running_guard = proc->guard;
+	int status = advance_pipeline(proc, config);
+	running_guard = NULL;
+	return status;
+}
+
+STAGE_FN int pipeline_cycle(struct processor* proc, const unsigned int config) {
+	if (config & CONFIG_GUARD) {
+		return guarded_cycle(proc, config);
+	}
+	if (!(config & CONFIG_PROFILE)) {
+		return advance_pipeline(proc, config);
+	}
+	profile_cycle_begin(proc->profile);
+	int status = advance_pipeline(proc, config);
+	profile_cycle_end(proc->profile);
+	return status;
+}
+
+#define DEFINE_CLOCK_CYCLE(NAME, FEATURES)						\
+	int clock_cycle_##NAME(struct processor* proc) {			\
+		return pipeline_cycle(proc, FEATURES);					\
+	}
+
+PIPELINE_CONFIGS(DEFINE_CLOCK_CYCLE)
@@ -1,64 +1,181 @@
 #include "processor.h"
 #include "pipeline.h"
 #include "debugger.h"
+#include "smt.h"
+#include "idle.h"
 #include <stdio.h>
+#include <string.h>
 
-struct processor new_processor(struct ememory* memory) {
-	return (struct processor) { .memory = memory };
+struct config_entry {
+	unsigned int features;
+	int (*cycle)(struct processor* proc);
+};
+
+#define CONFIG_ENTRY(NAME, FEATURES) { FEATURES, clock_cycle_##NAME },
+
+static const struct config_entry configs[] = { PIPELINE_CONFIGS(CONFIG_ENTRY) };
+
+#define NUM_CONFIGS (sizeof(configs) / sizeof(configs[0]))
+
+static inline int popcount(unsigned int bits) {
+	int count = 0;
+	for (; bits; bits &= bits - 1) {
+		count++;
+	}
+	return count;
 }
 
-#define CHECK_ERR(STAGE) 														\
-	if (STAGE.err.err_code) { 													\
-		printf("Pipeline error occurred in %s()\n", STAGE.err.function_name); 	\
-		return STAGE.err.err_code; 												\
+/**
+ * Returns the variant with the fewest features that has all of `features`,
+ * else NULL if none does
+ */
+static const struct config_entry* select_config(unsigned int features) {
+	const struct config_entry* best = NULL;
+	for (unsigned int i = 0; i < NUM_CONFIGS; i++) {
+		const struct config_entry* entry = &configs[i];
+		if ((entry->features & features) == features 
+				&& (!best || popcount(entry->features) < popcount(best->features))) {
+			best = entry;
+		}
 	}
+	return best;
+}
 
-static inline void flush_stage(void* stage, unsigned int stage_size) {
-	memset(stage, 0, stage_size);
+int new_processor_config(struct processor* proc, struct ememory* memory, unsigned int features) {
+	const struct config_entry* config = select_config(features);
+	if (!config) {
+		return -1;
+	}
+	*proc = (struct processor) { 
+		.memory = memory,
+		.muldiv = { .mul_latency = MUL_LATENCY, .div_latency = DIV_LATENCY },
+		.features = config->features,
+		.cycle = config->cycle,
+	};
+	return 0;
+}
+
+#define PRESET_ENTRY(NAME, ...) \
+	{ #NAME, { __VA_ARGS__ }, sizeof((unsigned char[]) { __VA_ARGS__ }) },
+
+const struct pipeline_preset pipeline_presets[] = { PIPELINE_PRESETS(PRESET_ENTRY) };
+const int num_pipeline_presets = sizeof(pipeline_presets) / sizeof(pipeline_presets[0]);
+
+const struct pipeline_preset* find_pipeline_preset(const char* name) {
+	for (int i = 0; i < num_pipeline_presets; i++) {
+		if (!strcmp(pipeline_presets[i].name, name)) {
+			return &pipeline_presets[i];
+		}
+	}
+	return NULL;
 }
 
 /**
- * This is more macro abuse. This should never be done.
+ * Consumes a run of `kind` stages starting at *i and returns its length
  */
-#define EXECUTE_CTRL(PROC, STAGE, FN_STMT)		\
-	if (!proc->pipeline_ctrl.stall) {			\
-		STAGE = FN_STMT;						\
-	}											\
-	if (proc->pipeline_ctrl.flush) {			\
-		flush_stage(&STAGE, sizeof(STAGE));		\
-	}											\
-	CHECK_ERR(STAGE)					
+static int count_stages(const unsigned char* stages, int depth, int* i, unsigned char kind) {
+	int count = 0;
+	while (*i < depth && stages[*i] == kind) {
+		(*i)++;
+		count++;
+	}
+	return count;
+}
+
+int compile_pipeline_shape(const unsigned char* stages, int depth, struct pipeline_shape* shape) {
+	int i = 0;
+	int fetch = count_stages(stages, depth, &i, STAGE_IF);
+	int if_extra = count_stages(stages, depth, &i, STAGE_IF2);
+	int decode = count_stages(stages, depth, &i, STAGE_ID);
+	int execute = count_stages(stages, depth, &i, STAGE_EX);
+	int ex_extra = count_stages(stages, depth, &i, STAGE_EX2);
+	int ag_extra = count_stages(stages, depth, &i, STAGE_AG);
+	int memory = count_stages(stages, depth, &i, STAGE_MEM);
+	int write_back = count_stages(stages, depth, &i, STAGE_WB);
+
+	if (i != depth || fetch != 1 || decode != 1 || execute != 1 || memory != 1 
+			|| write_back != 1 || if_extra > MAX_EXTRA_STAGES 
+			|| ex_extra > MAX_EXTRA_STAGES || ag_extra > MAX_EXTRA_STAGES) {
+		return -1;
+	}
+	*shape = (struct pipeline_shape) { 
+		.if_extra = if_extra, 
+		.ex_extra = ex_extra, 
+		.ag_extra = ag_extra 
+	};
+	return 0;
+}
+
+int set_pipeline_shape(struct processor* proc, const unsigned char* stages, int depth) {
+	struct pipeline_shape shape;
+	if (!pipeline_empty(proc) || compile_pipeline_shape(stages, depth, &shape)) {
+		return -1;
+	}
+	proc->shape = shape;
+	return 0;
+}
+
+int set_processor_features(struct processor* proc, unsigned int features) {
+	const struct config_entry* config = select_config(features);
+	if (!config) {
+		return -1;
+	}
+	proc->features = config->features;
+	proc->cycle = config->cycle;
+	return 0;
+}
+
+struct processor new_processor(struct ememory* memory) {
+	struct processor proc;
+#ifdef PIPELINE_DEBUG
+	new_processor_config(&proc, memory, CONFIG_TRACE);
+#else
+	new_processor_config(&proc, memory, 0);
+#endif
+	return proc;
+}
 
 int clock_cycle(struct processor* proc) {
+	return proc->cycle(proc);
+}
 
-	// Reset ctrl on every cycle
-	proc->pipeline_ctrl.flush = 0;
-	proc->pipeline_ctrl.stall = 0;
-
-	struct WB_stage wb_stage;
-	EXECUTE_CTRL(proc, wb_stage, write_back(proc, proc->mem_stage));
-	EXECUTE_CTRL(proc, proc->mem_stage, memory_access(proc, proc->ex_stage));
-	EXECUTE_CTRL(proc, proc->ex_stage, execute(proc, proc->id_stage));
-	
-	if (proc->pipeline_ctrl.bubble_next) {
-		flush_stage(&proc->id_stage, sizeof(struct ID_stage));
-		proc->pipeline_ctrl.bubble_next = 0;
-	} else {
-		EXECUTE_CTRL(proc, proc->id_stage, decode(proc, proc->if_stage));
-	}
-	
-	EXECUTE_CTRL(proc, proc->if_stage, fetch(proc));
-
-	char buf[64];
-	// instr_to_str(&proc->if_stage.dbg.in, buf);
-	// printf("\nIF instruction: %s\n", buf);
-	// instr_to_str(&proc->id_stage.dbg.in, buf);
-	// printf("ID instruction: %s\n", buf);
-	// instr_to_str(&proc->ex_stage.dbg.in, buf);
-	// printf("EX instruction: %s\n", buf);
-	// instr_to_str(&proc->mem_stage.dbg.in, buf);
-	// printf("MEM instruction: %s\n", buf);
-	return 0;	
+int pipeline_empty(struct processor* proc) {
+	struct latches* cur = current_latches(proc);
+	for (int i = 0; i < proc->shape.if_extra; i++) {
+		if (cur->if_extra[i].valid) {
+			return 0;
+		}
+	}
+	for (int i = 0; i < proc->shape.ex_extra + proc->shape.ag_extra; i++) {
+		if (cur->ex_extra[i].sig.valid) {
+			return 0;
+		}
+	}
+	if (proc->smt) {
+		for (int i = 0; i < proc->smt->num_threads; i++) {
+			if (proc->smt->threads[i].redirect_wait) {
+				return 0;
+			}
+		}
+	}
+	return !proc->pipeline_ctrl.mem_busy
+		&& !proc->pipeline_ctrl.redirect_wait
+		&& !cur->if_stage.valid 
+		&& !cur->id_stage.sig.valid 
+		&& !cur->ex_stage.sig.valid 
+		&& !cur->mem_stage.sig.valid;
+}
+
+int drain_pipeline(struct processor* proc) {
+	int status = 0;
+	proc->pipeline_ctrl.drain = 1;
+	while (!pipeline_empty(proc)) {
+		if ((status = clock_cycle(proc))) {
+			break;
+		}
+	}
+	proc->pipeline_ctrl.drain = 0;
+	return status;
 }
 
 int run(struct processor* proc) {
@@ -68,3 +185,162 @@ int run(struct processor* proc) {
 		;
 	return status;
 }
+
+void resume_processor(struct processor* proc) {
+	if (proc->pipeline_ctrl.halted) {
+		proc->pipeline_ctrl.halt = 0;
+		proc->pipeline_ctrl.halted = 0;
+		if (proc->smt) {
+			for (int i = 0; i < proc->smt->num_threads; i++) {
+				proc->smt->threads[i].halt = 0;
+				proc->smt->threads[i].halted = 0;
+			}
+			proc->smt->halted = 0;
+		}
+	}
+}
+
+// ==================
+//	 STOP CONDITIONS
+// ==================
+
+static void update_next_check(struct stop_conditions* conds) {
+	conds->next_check = UINT64_MAX;
+	conds->on_branch = 0;
+	for (int i = 0; i < conds->count; i++) {
+		struct stop_condition* cond = &conds->slots[i];
+		if (!cond->check) {
+			continue;
+		}
+		if (!cond->interval) {
+			conds->on_branch++;
+		} else if (cond->next_check < conds->next_check) {
+			conds->next_check = cond->next_check;
+		}
+	}
+}
+
+int add_stop_condition(struct processor* proc, int (*check)(struct processor* proc, void* arg), 
+					   void* arg, uint64_t interval) {
+	struct stop_conditions* conds = &proc->stop_conditions;
+	int id = 0;
+	while (id < conds->count && conds->slots[id].check) {
+		id++;
+	}
+	if (id == MAX_STOP_CONDITIONS) {
+		return -1;
+	}
+	conds->slots[id] = (struct stop_condition) {
+		.check = check,
+		.arg = arg,
+		.interval = interval,
+		.next_check = proc->stats.cycles + interval,
+	};
+	if (id == conds->count) {
+		conds->count++;
+	}
+	update_next_check(conds);
+	return id;
+}
+
+void remove_stop_condition(struct processor* proc, int id) {
+	struct stop_conditions* conds = &proc->stop_conditions;
+	if (id < 0 || id >= conds->count) {
+		return;
+	}
+	conds->slots[id].check = NULL;
+	while (conds->count && !conds->slots[conds->count - 1].check) {
+		conds->count--;
+	}
+	update_next_check(conds);
+}
+
+/**
+ * Checks the conditions that are due, `branched` being nonzero at the end of a
+ * basic block. Every due condition is checked and rescheduled, even after one
+ * has fired.
+ * 
+ * @return	The id of the first condition to fire, else -1
+ */
+static int check_stop_conditions(struct processor* proc, int branched) {
+	struct stop_conditions* conds = &proc->stop_conditions;
+	uint64_t now = proc->stats.cycles;
+	int fired = -1;
+	for (int i = 0; i < conds->count; i++) {
+		struct stop_condition* cond = &conds->slots[i];
+		if (!cond->check || (cond->interval ? now < cond->next_check : !branched)) {
+			continue;
+		}
+		if (cond->interval) {
+			cond->next_check = now + cond->interval;
+		}
+		if (cond->check(proc, cond->arg) && fired < 0) {
+			fired = i;
+		}
+	}
+	update_next_check(conds);
+	return fired;
+}
+
+// ==================
+//	  BOUNDED RUNS
+// ==================
+
+static inline uint64_t saturating_add(uint64_t a, uint64_t b) {
+	return (a + b < a) ? UINT64_MAX : a + b;
+}
+
+/**
+ * Clocks the pipeline until `max_cycles` cycles have passed or `max_retired`
+ * instructions have retired, or something else stops it
+ */
+static struct stop_reason run_bounded(struct processor* proc, uint64_t max_cycles, uint64_t max_retired) {
+	struct stop_conditions* conds = &proc->stop_conditions;
+	uint64_t start_cycles = proc->stats.cycles;
+	uint64_t start_retired = proc->stats.retired;
+	uint64_t end_cycles = saturating_add(start_cycles, max_cycles);
+	uint64_t end_retired = saturating_add(start_retired, max_retired);
+	struct stop_reason stop = { .reason = STOP_BUDGET, .condition = -1 };
+	if (proc->idle) {
+		idle_forget(proc->idle);
+	}
+
+	while (proc->stats.cycles < end_cycles && proc->stats.retired < end_retired) {
+		uint64_t flushes = proc->stats.flushes;
+		int status = clock_cycle(proc);
+		if (status == HALTED) {
+			stop.reason = STOP_HALT;
+			break;
+		} else if (status) {
+			stop.reason = STOP_ERROR;
+			stop.err_code = status;
+			break;
+		}
+
+		int branched = (proc->stats.flushes != flushes);
+		if (conds->count && (proc->stats.cycles >= conds->next_check || (branched && conds->on_branch))) {
+			if (proc->idle) {
+				idle_forget(proc->idle);
+			}
+			if ((stop.condition = check_stop_conditions(proc, branched)) >= 0) {
+				stop.reason = STOP_CONDITION;
+				break;
+			}
+		}
+		if (branched && proc->idle) {
+			idle_fast_forward(proc, end_cycles, end_retired);
+		}
+	}
+
+	stop.cycles = proc->stats.cycles - start_cycles;
+	stop.retired = proc->stats.retired - start_retired;
+	return stop;
+}
+
+struct stop_reason run_for(struct processor* proc, uint64_t cycles) {
+	return run_bounded(proc, cycles, UINT64_MAX);
+}
+
+struct stop_reason step_instructions(struct processor* proc, uint64_t count) {
+	return run_bounded(proc, UINT64_MAX, count);
+}
@@ -0,0 +1,354 @@
+#include "profile.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define CALIBRATION_ROUNDS	1000
+
+// ==================
+//	    COUNTERS
+// ==================
+
+#ifdef __linux__
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} perf_events[NUM_PROFILE_EVENTS] = {
+	[EVENT_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[EVENT_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[EVENT_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	[EVENT_L1D_MISSES] = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+static void open_counter(struct profile_counter* counter, int event) {
+	struct perf_event_attr attr = {
+		.type = perf_events[event].type,
+		.size = sizeof(attr),
+		.config = perf_events[event].config,
+		.exclude_kernel = 1,
+		.exclude_hv = 1,
+	};
+	counter->page = NULL;
+	counter->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (counter->fd < 0) {
+		return;
+	}
+	void* page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, counter->fd, 0);
+	if (page != MAP_FAILED) {
+		counter->page = page;
+	}
+}
+
+static void close_counter(struct profile_counter* counter) {
+	if (counter->page) {
+		munmap(counter->page, sysconf(_SC_PAGESIZE));
+	}
+	if (counter->fd >= 0) {
+		close(counter->fd);
+	}
+	counter->fd = -1;
+	counter->page = NULL;
+}
+
+#ifdef HAVE_TSC
+/**
+ * Reads a counter from user space, following the protocol described for
+ * perf_event_mmap_page. Returns 0 if the kernel does not allow it.
+ */
+static inline int read_rdpmc(struct perf_event_mmap_page* page, uint64_t* value) {
+	uint32_t seq;
+	do {
+		seq = page->lock;
+		__asm__ volatile("" ::: "memory");
+		if (!page->cap_user_rdpmc) {
+			return 0;
+		}
+		uint32_t index = page->index;
+		uint64_t count = page->offset;
+		if (index) {
+			uint64_t pmc = __rdpmc(index - 1);
+			uint16_t width = page->pmc_width;
+			count += (int64_t) (pmc << (64 - width)) >> (64 - width);
+		}
+		*value = count;
+		__asm__ volatile("" ::: "memory");
+	} while (page->lock != seq);
+	return 1;
+}
+#endif
+
+static inline uint64_t read_counter(struct profile_counter* counter) {
+	uint64_t value = 0;
+#ifdef HAVE_TSC
+	if (counter->page && read_rdpmc(counter->page, &value)) {
+		return value;
+	}
+#endif
+	if (read(counter->fd, &value, sizeof(value)) != sizeof(value)) {
+		return 0;
+	}
+	return value;
+}
+#endif // __linux__
+
+static inline uint64_t read_timestamp(void) {
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static inline void read_all(struct profile* profile, uint64_t* values) {
+#ifdef __linux__
+	if (profile->perf) {
+		for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+			values[i] = (profile->counters[i].fd >= 0) ? read_counter(&profile->counters[i]) : 0;
+		}
+		return;
+	}
+#endif
+	values[EVENT_CYCLES] = read_timestamp();
+}
+
+/**
+ * Measures the smallest interval between two back-to-back reads, which every
+ * measured interval includes once
+ */
+static void calibrate_reads(struct profile* profile) {
+	uint64_t a[NUM_PROFILE_EVENTS] = { 0 }, b[NUM_PROFILE_EVENTS] = { 0 };
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		profile->read_cost[i] = UINT64_MAX;
+	}
+	for (int round = 0; round < CALIBRATION_ROUNDS; round++) {
+		read_all(profile, a);
+		read_all(profile, b);
+		for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+			if (b[i] - a[i] < profile->read_cost[i]) {
+				profile->read_cost[i] = b[i] - a[i];
+			}
+		}
+	}
+}
+
+// ==================
+//	    PIPELINE
+// ==================
+
+void profile_cycle_begin(struct profile* profile) {
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		profile->stage_sum[i] = 0;
+	}
+	read_all(profile, profile->cycle_start);
+}
+
+void profile_stage_begin(struct profile* profile) {
+	read_all(profile, profile->stage_start);
+}
+
+/**
+ * Returns end - start, less one counter read
+ */
+static inline uint64_t interval(const struct profile* profile, int event, uint64_t start, uint64_t end) {
+	uint64_t delta = end - start;
+	return (delta > profile->read_cost[event]) ? delta - profile->read_cost[event] : 0;
+}
+
+void profile_stage_end(struct profile* profile, int stage, int opcode, int retired) {
+	uint64_t now[NUM_PROFILE_EVENTS] = { 0 };
+	read_all(profile, now);
+	if (opcode < 0 || opcode >= NUM_OPCODES) {
+		opcode = PROFILE_BUBBLE;
+	}
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		uint64_t delta = interval(profile, i, profile->stage_start[i], now[i]);
+		profile->by_stage[stage][i] += delta;
+		// Everything the hooks cost the cycle, so control is what remains
+		profile->stage_sum[i] += now[i] - profile->stage_start[i] + profile->stage_overhead[i];
+	}
+	profile->by_opcode[opcode][stage] += interval(profile, EVENT_CYCLES,
+		profile->stage_start[EVENT_CYCLES], now[EVENT_CYCLES]);
+	profile->retired[opcode] += retired;
+}
+
+void profile_cycle_end(struct profile* profile) {
+	uint64_t now[NUM_PROFILE_EVENTS] = { 0 };
+	read_all(profile, now);
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		uint64_t total = interval(profile, i, profile->cycle_start[i], now[i]);
+		if (total > profile->stage_sum[i]) {
+			profile->by_stage[PROFILE_CONTROL][i] += total - profile->stage_sum[i];
+		}
+	}
+	profile->cycles++;
+}
+
+/**
+ * Measures what an empty profiled stage costs the cycle beyond its own 
+ * interval: the hook calls and bookkeeping around the two reads
+ */
+static void calibrate_stages(struct profile* profile) {
+	struct profile scratch = *profile;
+	uint64_t a[NUM_PROFILE_EVENTS] = { 0 }, b[NUM_PROFILE_EVENTS] = { 0 };
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		scratch.stage_overhead[i] = 0;
+		profile->stage_overhead[i] = UINT64_MAX;
+	}
+	for (int round = 0; round < CALIBRATION_ROUNDS; round++) {
+		read_all(profile, a);
+		profile_stage_begin(&scratch);
+		profile_stage_end(&scratch, PROFILE_FETCH, PROFILE_BUBBLE, 0);
+		read_all(profile, b);
+		for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+			uint64_t cost = b[i] - a[i] - profile->read_cost[i];
+			if (cost < profile->stage_overhead[i]) {
+				profile->stage_overhead[i] = cost;
+			}
+		}
+	}
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		if (profile->stage_overhead[i] > profile->read_cost[i]) {
+			profile->stage_overhead[i] -= profile->read_cost[i];
+		} else {
+			profile->stage_overhead[i] = 0;
+		}
+	}
+}
+
+// ==================
+//	  ATTACHMENT
+// ==================
+
+static void close_counters(struct profile* profile) {
+#ifdef __linux__
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		close_counter(&profile->counters[i]);
+	}
+#else
+	(void) profile;
+#endif
+}
+
+int profile_attach(struct profile* profile, struct processor* proc) {
+	*profile = (struct profile) { 0 };
+	for (int i = 0; i < NUM_PROFILE_EVENTS; i++) {
+		profile->counters[i].fd = -1;
+	}
+#ifdef __linux__
+	open_counter(&profile->counters[EVENT_CYCLES], EVENT_CYCLES);
+	if (profile->counters[EVENT_CYCLES].fd >= 0) {
+		profile->perf = 1;
+		for (int i = 1; i < NUM_PROFILE_EVENTS; i++) {
+			open_counter(&profile->counters[i], i);
+		}
+	}
+#endif
+	calibrate_reads(profile);
+	calibrate_stages(profile);
+
+	// Only a variant that adds profiling to what is already there will do
+	unsigned int features = proc->features;
+	if (set_processor_features(proc, features | CONFIG_PROFILE)
+			|| proc->features != (features | CONFIG_PROFILE)) {
+		set_processor_features(proc, features);
+		close_counters(profile);
+		return -1;
+	}
+	proc->profile = profile;
+	return 0;
+}
+
+void profile_detach(struct profile* profile, struct processor* proc) {
+	set_processor_features(proc, proc->features & ~CONFIG_PROFILE);
+	proc->profile = NULL;
+	close_counters(profile);
+}
+
+// ==================
+//	    REPORT
+// ==================
+
+static double per(uint64_t count, uint64_t instructions) {
+	return instructions ? (double) count / instructions : 0;
+}
+
+void print_profile(const struct profile* profile) {
+	uint64_t instructions = 0, total = 0;
+	for (int op = 0; op < PROFILE_OPCODES; op++) {
+		instructions += profile->retired[op];
+	}
+	for (int stage = 0; stage < NUM_PROFILE_STAGES; stage++) {
+		total += profile->by_stage[stage][EVENT_CYCLES];
+	}
+	const char* unit = profile->perf ? "cycles" :
+#ifdef HAVE_TSC
+		"TSC ticks";
+#else
+		"ns";
+#endif
+
+	printf("HOST PROFILE: ----------------------------------------------------------\n");
+	printf("    %llu simulated cycles, %llu instructions retired, %s\n",
+		   (unsigned long long) profile->cycles, (unsigned long long) instructions,
+		   profile->perf ? "perf events" : "time stamp fallback (no perf events)");
+	printf("    Host %s per simulated instruction:\n\n", unit);
+
+	printf("    %-12s %10s %7s", "stage", unit, "share");
+	if (profile->perf) {
+		printf(" %10s %10s %10s", "instrs", "br-miss", "l1d-miss");
+	}
+	printf("\n");
+	for (int stage = 0; stage < NUM_PROFILE_STAGES; stage++) {
+		const uint64_t* counts = profile->by_stage[stage];
+		double share = total ? 100.0 * counts[EVENT_CYCLES] / total : 0;
+		printf("    %-12s %10.1f %6.1f%%", profile_stage_to_str(stage) + 8,
+			   per(counts[EVENT_CYCLES], instructions), share);
+		if (profile->perf) {
+			for (int event = EVENT_INSTRUCTIONS; event < NUM_PROFILE_EVENTS; event++) {
+				if (profile->counters[event].fd >= 0 || counts[event]) {
+					printf(" %10.2f", per(counts[event], instructions));
+				} else {
+					printf(" %10s", "n/a");
+				}
+			}
+		}
+		printf("\n");
+	}
+	printf("    %-12s %10.1f\n\n", "TOTAL", per(total, instructions));
+
+	printf("    Host %s per retired instruction of each opcode, by stage (including\n", unit);
+	printf("    wrong-path instructions of that opcode that never retired):\n\n");
+	printf("    %-8s %10s", "opcode", "retired");
+	for (int stage = 0; stage < PROFILE_CONTROL; stage++) {
+		printf(" %10s", profile_stage_to_str(stage) + 8);
+	}
+	printf("\n");
+	for (int op = 0; op < NUM_OPCODES; op++) {
+		if (!profile->retired[op]) {
+			continue;
+		}
+		printf("    %-8s %10llu", opcode_to_str(op), (unsigned long long) profile->retired[op]);
+		for (int stage = 0; stage < PROFILE_CONTROL; stage++) {
+			printf(" %10.1f", per(profile->by_opcode[op][stage], profile->retired[op]));
+		}
+		printf("\n");
+	}
+	printf("    %-8s %10s", "bubbles", "-");
+	for (int stage = 0; stage < PROFILE_CONTROL; stage++) {
+		printf(" %10.1f", per(profile->by_opcode[PROFILE_BUBBLE][stage], instructions));
+	}
+	printf("\n");
+	printf("------------------------------------------------------------------------\n");
+}
@@ -0,0 +1,177 @@
+#include "processor.h"
+#include "functional.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+
+// Counts r1 up to 100, then halts. The words after the HALT are fetched ahead
+// and must never run.
+static const char* program =
+	"\tmov r1, #0\n"				// 16
+	"@loop\n"
+	"\tadd r1, r1, #1\n"			// 20
+	"\tcmp r1, #100\n"				// 24
+	"\tbne loop\n"					// 28
+	"\thalt\n"						// 32
+	"\tmov r2, #1\n"				// 36
+	"\tmov r3, #1\n";				// 40
+
+/* ------------------- Tests ------------------- */
+
+void test_halt() {
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		struct processor proc;
+		assert(load_source(&proc, &memory, program, pipeline_presets[p].name) == 0);
+		struct stop_reason stop = run_for(&proc, 100000);
+		assert(stop.reason == STOP_HALT);
+		assert(stop.retired == 1 + 3 * 100 + 1);
+		assert(stop.cycles == proc.stats.cycles);
+		assert(processor_halted(&proc) && pipeline_empty(&proc));
+		assert(proc.regs[R1] == 100 && proc.regs[R2] == 0 && proc.regs[R3] == 0);
+		assert(proc.regs[PC] == 36);
+
+		// Nothing runs until resumed, then execution carries on after the HALT
+		assert(clock_cycle(&proc) == HALTED);
+		stop = run_for(&proc, 10);
+		assert(stop.reason == STOP_HALT && stop.cycles == 0);
+		resume_processor(&proc);
+		stop = step_instructions(&proc, 2);
+		assert(stop.reason == STOP_BUDGET && stop.retired == 2);
+		assert(proc.regs[R2] == 1 && proc.regs[R3] == 1);
+	}
+}
+
+void test_halt_functional() {
+	struct processor proc;
+	assert(load_source(&proc, &memory, program, "classic") == 0);
+	uint64_t executed;
+	assert(functional_run(&proc, 1000000, 0, &executed) == HALTED);
+	assert(executed == 1 + 3 * 100 + 1);
+	assert(processor_halted(&proc) && proc.regs[PC] == 36);
+	assert(functional_step(&proc) == HALTED);
+	assert(clock_cycle(&proc) == HALTED);
+}
+
+void test_budgets() {
+	struct processor proc;
+	assert(load_source(&proc, &memory, program, "classic") == 0);
+	struct stop_reason stop = run_for(&proc, 50);
+	assert(stop.reason == STOP_BUDGET && stop.cycles == 50);
+	assert(proc.stats.cycles == 50);
+
+	uint64_t retired = proc.stats.retired;
+	stop = step_instructions(&proc, 7);
+	assert(stop.reason == STOP_BUDGET && stop.retired == 7);
+	assert(proc.stats.retired == retired + 7);
+
+	// Slices add up to the same run as one call
+	while ((stop = run_for(&proc, 13)).reason == STOP_BUDGET) {
+		assert(stop.cycles == 13);
+	}
+	assert(stop.reason == STOP_HALT && proc.regs[R1] == 100);
+}
+
+// Loads through r2, which starts out at 0
+static const char* faulting =
+	"\tmov r1, #5\n"				// 16
+	"\tmul r4, r1, r1\n"			// 20
+	"\tload r3, r2, #0\n"			// 24
+	"\tadd r3, r3, r1\n"			// 28
+	"\tdiv r5, r4, r6\n"			// 32
+	"\thalt\n";					// 36
+
+void test_error() {
+	struct processor proc;
+	assert(load_source(&proc, &memory, "\tmov r1, #0\n\tload r2, r1, #0\n", "classic") == 0);
+	struct stop_reason stop = run_for(&proc, 100);
+	assert(stop.reason == STOP_ERROR && stop.err_code == SEGFAULT);
+
+	// The error is not reported again by later cycles
+	uint64_t cycles = proc.stats.cycles;
+	assert(clock_cycle(&proc) == 0 && proc.stats.cycles == cycles + 1);
+}
+
+void test_resume_after_fault() {
+	// Faults are precise: once the older instructions drain, the registers
+	// are as before the faulting one and the PC points at it. Fixing the
+	// cause and running again carries on from there.
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		struct processor proc;
+		assert(load_source(&proc, &memory, faulting, pipeline_presets[p].name) == 0);
+		struct stop_reason stop = run_for(&proc, 100);
+		assert(stop.reason == STOP_ERROR && stop.err_code == SEGFAULT);
+		assert(!strcmp(proc.err.function_name, "memory_access"));
+		assert(drain_pipeline(&proc) == 0 && pipeline_empty(&proc));
+		assert(proc.regs[PC] == 24 && proc.regs[R4] == 25 && proc.regs[R3] == 0);
+		assert(proc.stats.retired == 2);
+
+		// Then a divide by zero, in EX
+		proc.regs[R2] = 0x100;
+		memcpy(data + 0x100, &(word_t) { 7 }, sizeof(word_t));
+		stop = run_for(&proc, 100);
+		assert(stop.reason == STOP_ERROR && stop.err_code == INVALID_OP);
+		assert(drain_pipeline(&proc) == 0);
+		assert(proc.regs[PC] == 32 && proc.regs[R3] == 12 && proc.stats.retired == 4);
+
+		proc.regs[R6] = 5;
+		stop = run_for(&proc, 100);
+		assert(stop.reason == STOP_HALT && proc.regs[R5] == 5 && proc.stats.retired == 6);
+	}
+}
+
+static int r1_reached(struct processor* proc, void* arg) {
+	return proc->regs[R1] >= *(word_t*) arg;
+}
+
+static int count_checks(struct processor* proc, void* arg) {
+	(void) proc;
+	(*(int*) arg)++;
+	return 0;
+}
+
+void test_stop_conditions() {
+	struct processor proc;
+	assert(load_source(&proc, &memory, program, "classic") == 0);
+	word_t target = 40;
+	int branch_checks = 0, interval_checks = 0;
+	int at_branch = add_stop_condition(&proc, count_checks, &branch_checks, 0);
+	int every_64 = add_stop_condition(&proc, count_checks, &interval_checks, 64);
+	int reached = add_stop_condition(&proc, r1_reached, &target, 0);
+	assert(at_branch == 0 && every_64 == 1 && reached == 2);
+
+	// Only checked when the loop branches back, once per iteration
+	struct stop_reason stop = run_for(&proc, 100000);
+	assert(stop.reason == STOP_CONDITION && stop.condition == reached);
+	assert(proc.regs[R1] >= 40 && proc.regs[R1] <= 41);
+	assert(branch_checks == 40);
+	assert(interval_checks == (int) (proc.stats.cycles / 64));
+
+	// A freed slot is reused, and the rest run to the HALT
+	remove_stop_condition(&proc, reached);
+	remove_stop_condition(&proc, at_branch);
+	assert(add_stop_condition(&proc, count_checks, &branch_checks, 0) == at_branch);
+	stop = run_for(&proc, 100000);
+	assert(stop.reason == STOP_HALT);
+	assert(branch_checks == 99);
+	assert(interval_checks == (int) (proc.stats.cycles / 64));
+
+	for (int i = 2; i < MAX_STOP_CONDITIONS; i++) {
+		assert(add_stop_condition(&proc, count_checks, &branch_checks, 0) == i);
+	}
+	assert(add_stop_condition(&proc, count_checks, &branch_checks, 0) == -1);
+}
+
+int main() {
+	test_halt();
+	test_halt_functional();
+	test_budgets();
+	test_error();
+	test_resume_after_fault();
+	test_stop_conditions();
+
+	printf("All tests passed.\n");
+}
@@ -0,0 +1,105 @@
+#include "sampler.h"
+#include "functional.h"
+#include <stdio.h>
+
+/**
+ * Returns the number of instructions that may still be executed before 
+ * max_instructions is reached
+ */
+static uint64_t remaining(const struct sample_config* config, uint64_t executed, uint64_t want) {
+	if (!config->max_instructions) {
+		return want;
+	}
+	if (executed >= config->max_instructions) {
+		return 0;
+	}
+	uint64_t left = config->max_instructions - executed;
+	return (want < left) ? want : left;
+}
+
+/**
+ * Clocks the pipeline until `count` more instructions have retired. The cycles
+ * taken are written to `cycles`.
+ */
+static int detailed_run(struct processor* proc, uint64_t count, uint64_t* cycles) {
+	int status = 0;
+	uint64_t target = proc->stats.retired + count;
+	uint64_t start = proc->stats.cycles;
+	while (proc->stats.retired < target) {
+		if ((status = clock_cycle(proc))) {
+			break;
+		}
+	}
+	*cycles = proc->stats.cycles - start;
+	return status;
+}
+
+int run_sampled(struct processor* proc, const struct sample_config* config, 
+				struct sample_report* report) {
+	int status = 0;
+	uint64_t executed, cycles;
+	word_t marker = config->pc_marker;
+
+	*report = (struct sample_report) { 0 };
+
+	while (1) {
+		// Fast-forward
+		uint64_t count = remaining(config, report->total_instructions, 
+								   marker ? UINT64_MAX : config->fast_forward);
+		status = functional_run(proc, count, marker, &executed);
+		report->functional_instructions += executed;
+		report->total_instructions += executed;
+		marker = 0;
+		if (status || !remaining(config, report->total_instructions, 1)) {
+			break;
+		}
+
+		// Warm up
+		uint64_t retired = proc->stats.retired;
+		status = detailed_run(proc, remaining(config, report->total_instructions, config->warmup), &cycles);
+		report->total_instructions += proc->stats.retired - retired;
+		if (status || !remaining(config, report->total_instructions, 1)) {
+			break;
+		}
+
+		// Detailed window
+		retired = proc->stats.retired;
+		status = detailed_run(proc, remaining(config, report->total_instructions, config->detail), &cycles);
+		report->detailed_instructions += proc->stats.retired - retired;
+		report->detailed_cycles += cycles;
+		report->total_instructions += proc->stats.retired - retired;
+		report->samples++;
+		if (status || !remaining(config, report->total_instructions, 1)) {
+			// Draining would retire more than max_instructions
+			break;
+		}
+
+		// Hand the architectural state back to the functional model
+		retired = proc->stats.retired;
+		status = drain_pipeline(proc);
+		report->total_instructions += proc->stats.retired - retired;
+		if (status || !remaining(config, report->total_instructions, 1)) {
+			break;
+		}
+	}
+
+	if (report->detailed_instructions) {
+		report->cpi = (double) report->detailed_cycles / report->detailed_instructions;
+	}
+	report->estimated_cycles = (uint64_t) (report->cpi * report->total_instructions);
+	report->status = status;
+	return status;
+}
+
+void print_sample_report(const struct sample_report* report) {
+	printf("SAMPLED RUN: ------------------------\n");
+	printf("    instructions:    %llu\n", (unsigned long long) report->total_instructions);
+	printf("    fast-forwarded:  %llu\n", (unsigned long long) report->functional_instructions);
+	printf("    detailed:        %llu (%llu samples)\n", 
+		(unsigned long long) report->detailed_instructions, 
+		(unsigned long long) report->samples);
+	printf("    detailed cycles: %llu\n", (unsigned long long) report->detailed_cycles);
+	printf("    CPI:             %.3f\n", report->cpi);
+	printf("    est. cycles:     %llu\n", (unsigned long long) report->estimated_cycles);
+	printf("-------------------------------------\n");
+}
@@ -0,0 +1,190 @@
+#include "sampler.h"
+#include "functional.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char data[MEM_SIZE];
+static char reference_data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct ememory reference_memory = { .data = reference_data };
+
+#define ITERATIONS		500
+#define KERNEL_LENGTH	(2 + 7 * ITERATIONS + 2)
+
+// Squares r1 into a table at 0x4000 and sums it back, then halts
+static const char* kernel =
+	"\tmov r1, #0\n"				// 16
+	"\tmov r7, #16384\n"			// 20
+	"@loop\n"
+	"\tadd r1, r1, #1\n"			// 24
+	"\tmul r2, r1, r1\n"			// 28
+	"\tstore r2, r7, #0\n"			// 32
+	"\tload r3, r7, #0\n"			// 36
+	"\tadd r4, r4, r3\n"			// 40
+	"\tcmp r1, #500\n"				// 44
+	"\tbne loop\n"					// 48
+	"\tmov r5, #7\n"				// 52
+	"\thalt\n";						// 56
+
+static const struct sample_config windows = {
+	.fast_forward = 300,
+	.warmup = 30,
+	.detail = 200,
+};
+
+/**
+ * Runs the kernel to its HALT under clock_cycle() alone
+ */
+static struct processor run_full() {
+	struct processor proc;
+	assert(load_source(&proc, &reference_memory, kernel, NULL) == 0);
+	int status;
+	while (!(status = clock_cycle(&proc)));
+	assert(status == HALTED && pipeline_empty(&proc));
+	assert(proc.stats.retired == KERNEL_LENGTH);
+	return proc;
+}
+
+/**
+ * Executes the first `count` instructions of the kernel with the functional
+ * model alone
+ */
+static struct processor run_functional(uint64_t count) {
+	struct processor proc;
+	assert(load_source(&proc, &reference_memory, kernel, NULL) == 0);
+	uint64_t executed;
+	assert(functional_run(&proc, count, 0, &executed) == 0 && executed == count);
+	return proc;
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_matches_full_run() {
+	struct processor full = run_full();
+	double full_cpi = (double) full.stats.cycles / full.stats.retired;
+
+	struct processor proc;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	struct sample_report report;
+	assert(run_sampled(&proc, &windows, &report) == HALTED);
+	assert(report.status == HALTED);
+
+	// Same architectural state, whichever model ran each instruction
+	assert(!memcmp(proc.regs, full.regs, sizeof(proc.regs)));
+	assert(proc.flag == full.flag);
+	assert(!memcmp(data, reference_data, MEM_SIZE));
+	assert(proc.regs[R4] == ITERATIONS * (ITERATIONS + 1) * (2 * ITERATIONS + 1) / 6);
+	assert(proc.regs[R5] == 7);
+
+	// Every instruction is counted once, by one of the models
+	assert(report.total_instructions == KERNEL_LENGTH);
+	assert(report.functional_instructions + proc.stats.retired == KERNEL_LENGTH);
+	assert(report.samples > 1 && report.detailed_instructions <= report.samples * windows.detail);
+	assert(report.detailed_instructions > (report.samples - 1) * windows.detail);
+
+	// The loop is uniform, so the windows see its CPI to within 5%
+	assert(report.cpi > full_cpi * 0.95 && report.cpi < full_cpi * 1.05);
+	assert(report.estimated_cycles > full.stats.cycles * 0.95);
+	assert(report.estimated_cycles < full.stats.cycles * 1.05);
+}
+
+void test_max_instructions() {
+	// Ending in the first fast-forward stops after exactly that instruction
+	struct processor reference = run_functional(100);
+	struct sample_config config = windows;
+	config.max_instructions = 100;
+	struct processor proc;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	struct sample_report report;
+	assert(run_sampled(&proc, &config, &report) == 0);
+	assert(report.total_instructions == 100 && report.samples == 0);
+	assert(!memcmp(proc.regs, reference.regs, sizeof(proc.regs)));
+	assert(proc.flag == reference.flag);
+
+	// Ending in a later fast-forward, after the pipeline was drained
+	uint64_t later = 2 * (windows.fast_forward + windows.warmup + windows.detail) + 50;
+	reference = run_functional(later);
+	config.max_instructions = later;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	assert(run_sampled(&proc, &config, &report) == 0);
+	assert(report.total_instructions == later && report.samples == 2);
+	assert(pipeline_empty(&proc));
+	assert(!memcmp(proc.regs, reference.regs, sizeof(proc.regs)));
+	assert(!memcmp(data, reference_data, MEM_SIZE));
+
+	// Ending in a detailed window stops as that instruction retires. Younger
+	// ones are still in flight, so only the registers they write are final.
+	uint64_t detailed = windows.fast_forward + windows.warmup + 50;
+	reference = run_functional(detailed);
+	config.max_instructions = detailed;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	assert(run_sampled(&proc, &config, &report) == 0);
+	assert(report.total_instructions == detailed && report.samples == 1);
+	assert(report.detailed_instructions == 50);
+	assert(!memcmp(proc.regs, reference.regs, PC * sizeof(word_t)));
+
+	// Likewise in a warmup, which then measures nothing
+	uint64_t warming = windows.fast_forward + 10;
+	reference = run_functional(warming);
+	config.max_instructions = warming;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	assert(run_sampled(&proc, &config, &report) == 0);
+	assert(report.total_instructions == warming && report.samples == 0 && report.cpi == 0);
+	assert(!memcmp(proc.regs, reference.regs, PC * sizeof(word_t)));
+}
+
+void test_pc_marker() {
+	// The first fast-forward runs to the marker, however long that takes,
+	// without executing the instruction there
+	struct sample_config config = windows;
+	config.pc_marker = 52;
+	struct processor proc;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	struct sample_report report;
+	assert(run_sampled(&proc, &config, &report) == HALTED);
+	assert(report.functional_instructions == KERNEL_LENGTH - 2);
+	assert(proc.stats.retired == 2 && proc.regs[R5] == 7);
+
+	// However short, and later fast-forwards go back to `fast_forward`
+	struct processor reference = run_functional(2);
+	assert(reference.regs[PC] == 24);
+	config.pc_marker = 24;
+	config.max_instructions = 2;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	assert(run_sampled(&proc, &config, &report) == 0);
+	assert(report.total_instructions == 2 && report.samples == 0);
+	assert(!memcmp(proc.regs, reference.regs, sizeof(proc.regs)));
+
+	struct processor full = run_full();
+	config.max_instructions = 0;
+	assert(load_source(&proc, &memory, kernel, NULL) == 0);
+	assert(run_sampled(&proc, &config, &report) == HALTED);
+	assert(report.samples > 1 && report.total_instructions == KERNEL_LENGTH);
+	assert(!memcmp(proc.regs, full.regs, sizeof(proc.regs)));
+}
+
+void test_error() {
+	// A fault in either model ends the run with its code
+	struct processor proc;
+	assert(load_source(&proc, &memory, "\tmov r1, #0\n\tload r2, r1, #0\n", NULL) == 0);
+	struct sample_report report;
+	assert(run_sampled(&proc, &windows, &report) == SEGFAULT);
+	assert(report.status == SEGFAULT && report.total_instructions == 1);
+
+	struct sample_config config = windows;
+	config.fast_forward = 1;
+	assert(load_source(&proc, &memory, "\tmov r1, #0\n\tload r2, r1, #0\n", NULL) == 0);
+	assert(run_sampled(&proc, &config, &report) == SEGFAULT);
+	assert(report.functional_instructions == 1 && report.total_instructions == 1);
+}
+
+int main() {
+	test_matches_full_run();
+	test_max_instructions();
+	test_pc_marker();
+	test_error();
+
+	printf("All tests passed.\n");
+}
@@ -0,0 +1,59 @@
+#include "smt.h"
+#include <stdio.h>
+
+int smt_attach(struct smt* smt, struct processor* proc, int num_threads, int policy) {
+	if (num_threads < 1 || num_threads > MAX_THREADS || !pipeline_empty(proc)
+			|| (policy != FETCH_ROUND_ROBIN && policy != FETCH_ICOUNT)) {
+		return -1;
+	}
+
+	unsigned int features = proc->features;
+	if (set_processor_features(proc, features | CONFIG_SMT)) {
+		return -1;
+	}
+	if (proc->features != (features | CONFIG_SMT)) {
+		set_processor_features(proc, features);
+		return -1;
+	}
+
+	*smt = (struct smt) {
+		.num_threads = num_threads,
+		.policy = policy,
+		.last_fetched = num_threads - 1,
+	};
+
+	// Thread 0 stays halted, but the processor only while it is the only one
+	int halted = proc->pipeline_ctrl.halted;
+	smt->threads[0].halt = smt->threads[0].halted = halted;
+	smt->halted = halted;
+	proc->pipeline_ctrl.halt = proc->pipeline_ctrl.halted = (halted && num_threads == 1);
+	proc->smt = smt;
+	return 0;
+}
+
+void smt_detach(struct smt* smt, struct processor* proc) {
+	set_processor_features(proc, proc->features & ~CONFIG_SMT);
+	proc->pipeline_ctrl.halt = proc->pipeline_ctrl.halted = smt->threads[0].halted;
+	proc->smt = NULL;
+}
+
+static double ipc(uint64_t retired, uint64_t cycles) {
+	return cycles ? (double) retired / cycles : 0;
+}
+
+void print_smt_stats(const struct processor* proc) {
+	const struct smt* smt = proc->smt;
+	uint64_t cycles = proc->stats.cycles;
+	printf("%d threads, %s fetch, %llu cycles\n", smt->num_threads,
+		   fetch_policy_to_str(smt->policy), (unsigned long long) cycles);
+	printf("%-8s %12s %7s %12s %10s\n", "thread", "retired", "IPC", "stalls", "flushes");
+	for (int i = 0; i < smt->num_threads; i++) {
+		const struct hw_thread* thread = &smt->threads[i];
+		printf("%-8d %12llu %7.3f %12llu %10llu\n", i, (unsigned long long) thread->retired,
+			   ipc(thread->retired, cycles), (unsigned long long) thread->stalls,
+			   (unsigned long long) thread->flushes);
+	}
+	printf("%-8s %12llu %7.3f %12llu %10llu\n", "all", (unsigned long long) proc->stats.retired,
+		   ipc(proc->stats.retired, cycles), (unsigned long long) proc->stats.stalls,
+		   (unsigned long long) proc->stats.flushes);
+}
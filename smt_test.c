@@ -0,0 +1,212 @@
+#include "smt.h"
+#include "functional.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "assembler.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char data[MEM_SIZE];
+static char reference_data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct ememory reference_memory = { .data = reference_data };
+
+#define CODE_SPACING	0x1000		// between the copies of a program
+#define DATA_BASE		0x8000		// r7 of thread 0, each next thread 0x100 up
+
+// Loops over dependent multiplies and divides, a load-use, block operations
+// and taken and untaken branches on the data at r7, r1 times, then halts
+static const char* program =
+	"\tmov r2, #1\n"
+	"@loop\n"
+	"\tmul r2, r2, #3\n"
+	"\tdiv r3, r2, #5\n"
+	"\trem r4, r3, #7\n"
+	"\tstore r4, r7, #0\n"
+	"\tload r5, r7, #0\n"
+	"\tadd r5, r5, r4\n"
+	"\tmov r6, #40\n"
+	"\tadd r0, r7, #64\n"
+	"\tmemcpy r0, r7, r6\n"
+	"\tmemset r7, r5, #12\n"
+	"\tcmp r5, #3\n"
+	"\tbeq skip\n"
+	"\tadd r6, r6, #1\n"
+	"@skip\n"
+	"\tsub r1, r1, #1\n"
+	"\tcmp r1, #0\n"
+	"\tbne loop\n"
+	"\thalt\n";
+
+static struct asm_result image;
+
+/**
+ * Copies the program for every thread into both memories
+ */
+static void load_images(int num_threads) {
+	memset(data, 0, MEM_SIZE);
+	for (int i = 0; i < num_threads; i++) {
+		memcpy(data + STARTING_OFFSET + i * CODE_SPACING, image.image, image.size);
+	}
+	memcpy(reference_data, data, MEM_SIZE);
+}
+
+static void start_thread(word_t* regs, int thread, word_t iterations) {
+	regs[PC] = STARTING_OFFSET + thread * CODE_SPACING;
+	regs[R1] = iterations;
+	regs[R7] = DATA_BASE + thread * 0x100;
+}
+
+/**
+ * Runs thread `thread`'s program alone on the functional model, for the
+ * registers it should end with
+ */
+static struct processor run_reference(int thread, word_t iterations, uint64_t* executed) {
+	struct processor proc = new_processor(&reference_memory);
+	start_thread(proc.regs, thread, iterations);
+	assert(functional_run(&proc, 1000000, 0, executed) == HALTED);
+	return proc;
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_single_thread() {
+	// One thread runs cycle for cycle like the plain pipeline
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const struct pipeline_preset* preset = &pipeline_presets[p];
+		for (int policy = FETCH_ROUND_ROBIN; policy <= FETCH_ICOUNT; policy++) {
+			load_images(1);
+			struct processor plain = new_processor(&reference_memory);
+			assert(set_pipeline_shape(&plain, preset->stages, preset->depth) == 0);
+			start_thread(plain.regs, 0, 20);
+			assert(run_for(&plain, 100000).reason == STOP_HALT);
+
+			struct smt smt;
+			struct processor proc = new_processor(&memory);
+			assert(set_pipeline_shape(&proc, preset->stages, preset->depth) == 0);
+			assert(smt_attach(&smt, &proc, 1, policy) == 0);
+			start_thread(proc.regs, 0, 20);
+			assert(run_for(&proc, 100000).reason == STOP_HALT);
+
+			assert(!memcmp(&plain.stats, &proc.stats, sizeof(proc.stats)));
+			assert(!memcmp(plain.regs, proc.regs, sizeof(proc.regs)));
+			assert(!memcmp(data, reference_data, MEM_SIZE));
+			assert(smt.threads[0].retired == proc.stats.retired);
+		}
+	}
+}
+
+void test_threads() {
+	// Threads run different lengths, each to the result it reaches alone
+	word_t iterations[MAX_THREADS] = { 20, 7, 33, 1 };
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const struct pipeline_preset* preset = &pipeline_presets[p];
+		for (int num_threads = 2; num_threads <= MAX_THREADS; num_threads++) {
+			for (int policy = FETCH_ROUND_ROBIN; policy <= FETCH_ICOUNT; policy++) {
+				load_images(num_threads);
+				struct smt smt;
+				struct processor proc = new_processor(&memory);
+				assert(set_pipeline_shape(&proc, preset->stages, preset->depth) == 0);
+				assert(smt_attach(&smt, &proc, num_threads, policy) == 0);
+				for (int i = 0; i < num_threads; i++) {
+					start_thread(thread_regs(&proc, i), i, iterations[i]);
+				}
+				struct stop_reason stop = run_for(&proc, 1000000);
+				assert(stop.reason == STOP_HALT && pipeline_empty(&proc));
+
+				uint64_t retired = 0, flushes = 0;
+				for (int i = 0; i < num_threads; i++) {
+					uint64_t executed;
+					struct processor reference = run_reference(i, iterations[i], &executed);
+					assert(!memcmp(reference.regs, thread_regs(&proc, i), sizeof(reference.regs)));
+					assert(smt.threads[i].retired == executed && smt.threads[i].halted);
+					retired += smt.threads[i].retired;
+					flushes += smt.threads[i].flushes;
+				}
+				assert(retired == proc.stats.retired && flushes == proc.stats.flushes);
+				assert(!memcmp(data, reference_data, MEM_SIZE));
+			}
+		}
+	}
+}
+
+void test_latency_hiding() {
+	// Two copies of a thread finish sooner together than one after the other
+	uint64_t alone = 0;
+	for (int num_threads = 1; num_threads <= 2; num_threads++) {
+		load_images(num_threads);
+		struct smt smt;
+		struct processor proc = new_processor(&memory);
+		assert(smt_attach(&smt, &proc, num_threads, FETCH_ICOUNT) == 0);
+		for (int i = 0; i < num_threads; i++) {
+			start_thread(thread_regs(&proc, i), i, 50);
+		}
+		assert(run_for(&proc, 1000000).reason == STOP_HALT);
+		if (num_threads == 1) {
+			alone = proc.stats.cycles;
+		} else {
+			assert(proc.stats.cycles < 2 * alone);
+			assert(smt.threads[0].retired == smt.threads[1].retired);
+		}
+	}
+}
+
+void test_halt_and_resume() {
+	// The processor halts once every thread has, and each then carries on
+	// after its own HALT
+	load_images(2);
+	struct smt smt;
+	struct processor proc = new_processor(&memory);
+	assert(smt_attach(&smt, &proc, 2, FETCH_ROUND_ROBIN) == 0);
+	start_thread(thread_regs(&proc, 0), 0, 1);
+	start_thread(thread_regs(&proc, 1), 1, 10);
+	while (!smt.threads[0].halted) {
+		assert(clock_cycle(&proc) == 0);
+	}
+	assert(!processor_halted(&proc) && !smt.threads[1].halted);
+	assert(run_for(&proc, 100000).reason == STOP_HALT);
+	assert(processor_halted(&proc) && pipeline_empty(&proc));
+	assert(proc.regs[PC] == STARTING_OFFSET + image.size);
+	assert(thread_regs(&proc, 1)[PC] == STARTING_OFFSET + CODE_SPACING + image.size);
+
+	resume_processor(&proc);
+	assert(!smt.threads[0].halt && !smt.threads[1].halt);
+	smt_detach(&smt, &proc);
+	assert(!(proc.features & CONFIG_SMT) && !proc.smt && !processor_halted(&proc));
+}
+
+void test_attach() {
+	struct smt smt;
+	struct processor proc = new_processor(&memory);
+	assert(smt_attach(&smt, &proc, 0, FETCH_ROUND_ROBIN) == -1);
+	assert(smt_attach(&smt, &proc, MAX_THREADS + 1, FETCH_ROUND_ROBIN) == -1);
+	assert(smt_attach(&smt, &proc, 2, FETCH_ICOUNT + 1) == -1);
+
+	// The other threads would be lost
+	assert(smt_attach(&smt, &proc, 2, FETCH_ROUND_ROBIN) == 0);
+	assert(save_checkpoint(&proc, "smt_test.ckpt", 0) == CHECKPOINT_UNSUPPORTED);
+
+	// No variant runs threads and profiles
+	struct profile profile;
+	assert(profile_attach(&profile, &proc) == -1);
+	assert(proc.features == CONFIG_SMT && proc.smt && !proc.profile);
+	smt_detach(&smt, &proc);
+
+	// No traced variant runs threads
+	assert(new_processor_config(&proc, &memory, CONFIG_TRACE) == 0);
+	assert(smt_attach(&smt, &proc, 2, FETCH_ROUND_ROBIN) == -1);
+	assert(proc.features == CONFIG_TRACE && !proc.smt);
+}
+
+int main() {
+	assert(assemble(program, &image) == 0);
+	test_single_thread();
+	test_threads();
+	test_latency_hiding();
+	test_halt_and_resume();
+	test_attach();
+	free_asm_result(&image);
+
+	printf("All tests passed.\n");
+}
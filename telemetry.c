@@ -0,0 +1,146 @@
+#include "telemetry.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STORE(page, field, value) \
+	atomic_store_explicit(&(page)->field, (value), memory_order_relaxed)
+#define LOAD(page, field) \
+	atomic_load_explicit(&(page)->field, memory_order_relaxed)
+
+static void publish(struct telemetry* tel, struct processor* proc) {
+	struct telemetry_page* page = tel->page;
+	struct free_stats free_stats = { 0 };
+	uint16_t free_head = 0;
+	if (tel->flags & TELEMETRY_FREE_LIST) {
+		free_list_stats(proc->memory, &free_stats);
+		free_head = proc->memory->free_head;
+	}
+
+	// Odd while the fields are being written, which a writer that died in
+	// the middle of an update may have left it. The fence keeps the stores
+	// of the fields from moving above it.
+	uint64_t seq = LOAD(page, seq) | 1;
+	STORE(page, seq, seq);
+	atomic_thread_fence(memory_order_release);
+
+	STORE(page, cycles, proc->stats.cycles);
+	STORE(page, pc, proc->regs[PC]);
+	STORE(page, retired, proc->stats.retired);
+	STORE(page, stalls, proc->stats.stalls);
+	STORE(page, flushes, proc->stats.flushes);
+	STORE(page, halted, proc->pipeline_ctrl.halted);
+	STORE(page, free_head, free_head);
+	STORE(page, free_blocks, free_stats.blocks);
+	STORE(page, free_bytes, free_stats.bytes);
+	STORE(page, largest_free, free_stats.largest);
+
+	atomic_store_explicit(&page->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * Stop condition that only publishes, so it never stops the run
+ */
+static int update_check(struct processor* proc, void* arg) {
+	publish(arg, proc);
+	return 0;
+}
+
+int telemetry_open(struct telemetry* tel, struct processor* proc, const char* name, uint64_t interval, int flags) {
+	if (!interval || strlen(name) >= sizeof(tel->name)) {
+		return -1;
+	}
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	void* page = MAP_FAILED;
+	if (ftruncate(fd, sizeof(struct telemetry_page)) == 0) {
+		page = mmap(NULL, sizeof(struct telemetry_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (page == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+
+	*tel = (struct telemetry) { .page = page, .flags = flags };
+	strcpy(tel->name, name);
+	tel->condition = add_stop_condition(proc, update_check, tel, interval);
+	if (tel->condition < 0) {
+		munmap(page, sizeof(struct telemetry_page));
+		shm_unlink(name);
+		return -1;
+	}
+
+	// Readers check the magic, so it goes in once there is something to read.
+	// `seq` carries on from any earlier writer, for readers still mapping it.
+	tel->page->magic = 0;
+	tel->page->version = TELEMETRY_VERSION;
+	tel->page->interval = interval;
+	tel->page->flags = flags;
+	publish(tel, proc);
+	atomic_thread_fence(memory_order_release);
+	tel->page->magic = TELEMETRY_MAGIC;
+	return 0;
+}
+
+void telemetry_close(struct telemetry* tel, struct processor* proc) {
+	remove_stop_condition(proc, tel->condition);
+	munmap(tel->page, sizeof(struct telemetry_page));
+	shm_unlink(tel->name);
+	tel->page = NULL;
+}
+
+void telemetry_update(struct telemetry* tel, struct processor* proc) {
+	publish(tel, proc);
+}
+
+const struct telemetry_page* telemetry_map(const char* name) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	// A segment still being created, or not ours, may be too small to read
+	struct stat st;
+	void* page = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(struct telemetry_page)) {
+		page = mmap(NULL, sizeof(struct telemetry_page), PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (page == MAP_FAILED) {
+		return NULL;
+	}
+	const struct telemetry_page* tel = page;
+	if (tel->magic != TELEMETRY_MAGIC || tel->version != TELEMETRY_VERSION) {
+		munmap(page, sizeof(struct telemetry_page));
+		return NULL;
+	}
+	return tel;
+}
+
+void telemetry_unmap(const struct telemetry_page* page) {
+	munmap((void*) page, sizeof(struct telemetry_page));
+}
+
+void telemetry_read(const struct telemetry_page* page, struct telemetry_sample* sample) {
+	struct telemetry_page* p = (struct telemetry_page*) page;
+	uint64_t seq;
+	do {
+		seq = atomic_load_explicit(&p->seq, memory_order_acquire);
+		sample->seq = seq;
+		sample->cycles = LOAD(p, cycles);
+		sample->pc = LOAD(p, pc);
+		sample->retired = LOAD(p, retired);
+		sample->stalls = LOAD(p, stalls);
+		sample->flushes = LOAD(p, flushes);
+		sample->halted = LOAD(p, halted);
+		sample->free_head = LOAD(p, free_head);
+		sample->free_blocks = LOAD(p, free_blocks);
+		sample->free_bytes = LOAD(p, free_bytes);
+		sample->largest_free = LOAD(p, largest_free);
+		atomic_thread_fence(memory_order_acquire);
+	} while ((seq & 1) || seq != LOAD(p, seq));
+}
@@ -0,0 +1,164 @@
+#include "telemetry.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+static char data[MEM_SIZE];
+static char reference_data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct ememory reference_memory = { .data = reference_data };
+
+#define SEGMENT		"/unu_telemetry_test"
+#define UPDATES		2000000
+
+// Counts to 1000 with a multiply and a store each time, then halts
+static const char* program =
+	"\tmov r1, #0\n"
+	"@loop\n"
+	"\tadd r1, r1, #1\n"
+	"\tmul r2, r1, r1\n"
+	"\tstore r2, r1, #20000\n"
+	"\tcmp r1, #1000\n"
+	"\tbne loop\n"
+	"\thalt\n";
+
+/**
+ * Publishes UPDATES times with every counter set to the same value, so that
+ * a torn read shows as counters that differ
+ */
+static void* writer(void* arg) {
+	struct telemetry* tel = arg;
+	struct processor proc = new_processor(&memory);
+	for (uint64_t i = 1; i <= UPDATES; i++) {
+		proc.stats = (struct pipeline_stats) { .cycles = i, .retired = i, .stalls = i, .flushes = i };
+		proc.regs[PC] = i;
+		telemetry_update(tel, &proc);
+	}
+	return NULL;
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_run() {
+	// Updates come every interval and leave the run as it was
+	struct processor reference;
+	assert(load_source(&reference, &reference_memory, program, NULL) == 0);
+	assert(run_for(&reference, 100000).reason == STOP_HALT);
+
+	struct processor proc;
+	assert(load_source(&proc, &memory, program, NULL) == 0);
+	struct telemetry tel;
+	assert(telemetry_open(&tel, &proc, SEGMENT, 100, 0) == 0);
+	const struct telemetry_page* page = telemetry_map(SEGMENT);
+	assert(page && page->interval == 100);
+
+	struct telemetry_sample sample;
+	telemetry_read(page, &sample);
+	assert(sample.cycles == 0 && sample.pc == STARTING_OFFSET && !sample.halted);
+
+	uint64_t seq = sample.seq;
+	struct stop_reason stop = run_for(&proc, 1234);
+	assert(stop.reason == STOP_BUDGET);
+	telemetry_read(page, &sample);
+	assert(sample.cycles == 1200 && sample.seq == seq + 2 * 12);
+	assert(sample.retired <= sample.cycles && sample.stalls < sample.cycles && sample.flushes);
+
+	assert(run_for(&proc, 100000).reason == STOP_HALT);
+	telemetry_update(&tel, &proc);
+	telemetry_read(page, &sample);
+	assert(sample.halted && sample.cycles == proc.stats.cycles && sample.retired == proc.stats.retired);
+	assert(!memcmp(&reference.stats, &proc.stats, sizeof(proc.stats)));
+	assert(!memcmp(reference.regs, proc.regs, sizeof(proc.regs)));
+
+	// Removed, but still readable where mapped
+	telemetry_close(&tel, &proc);
+	assert(!telemetry_map(SEGMENT) && proc.stop_conditions.next_check == UINT64_MAX);
+	telemetry_read(page, &sample);
+	assert(sample.halted);
+	telemetry_unmap(page);
+}
+
+void test_free_list() {
+	init_ememory(&memory, MEM_SIZE);
+	struct eptr a = emalloc(&memory, 100);
+	struct eptr b = emalloc(&memory, 200);
+	emalloc(&memory, 300);
+	efree(&memory, a);
+	efree(&memory, b);
+
+	struct processor proc = new_processor(&memory);
+	struct telemetry tel;
+	// Walked only when asked for
+	assert(telemetry_open(&tel, &proc, SEGMENT, 1000, 0) == 0);
+	const struct telemetry_page* page = telemetry_map(SEGMENT);
+	struct telemetry_sample sample;
+	telemetry_read(page, &sample);
+	assert(!page->flags && !sample.free_head && !sample.free_blocks && !sample.largest_free);
+	telemetry_unmap(page);
+	telemetry_close(&tel, &proc);
+
+	assert(telemetry_open(&tel, &proc, SEGMENT, 1000, TELEMETRY_FREE_LIST) == 0);
+	page = telemetry_map(SEGMENT);
+	telemetry_read(page, &sample);
+	assert(page->flags == TELEMETRY_FREE_LIST);
+	assert(sample.free_head == STARTING_OFFSET && sample.free_blocks == 2);
+	assert(sample.free_bytes == MEM_SIZE - STARTING_OFFSET - 300);
+	assert(sample.largest_free == MEM_SIZE - STARTING_OFFSET - 600);
+	telemetry_unmap(page);
+	telemetry_close(&tel, &proc);
+}
+
+void test_concurrent() {
+	// Readers never see half an update, and the writer never waits for them
+	struct processor proc = new_processor(&memory);
+	struct telemetry tel;
+	assert(telemetry_open(&tel, &proc, SEGMENT, 1000, 0) == 0);
+	const struct telemetry_page* page = telemetry_map(SEGMENT);
+
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, writer, &tel) == 0);
+	struct telemetry_sample sample;
+	uint64_t last = 0;
+	do {
+		telemetry_read(page, &sample);
+		assert(!(sample.seq & 1) && sample.cycles >= last);
+		assert(sample.retired == sample.cycles && sample.stalls == sample.cycles);
+		assert(sample.flushes == sample.cycles && sample.pc == sample.cycles);
+		last = sample.cycles;
+	} while (last < UPDATES);
+	pthread_join(thread, NULL);
+
+	telemetry_unmap(page);
+	telemetry_close(&tel, &proc);
+}
+
+void test_open() {
+	struct processor proc = new_processor(&memory);
+	struct telemetry tel;
+	assert(telemetry_open(&tel, &proc, SEGMENT, 0, 0) == -1);
+	assert(telemetry_open(&tel, &proc, "/a/b", 100, 0) == -1);
+	assert(!telemetry_map("/unu_telemetry_missing"));
+	assert(proc.stop_conditions.count == 0);
+
+	// A writer that died mid-update does not leave readers spinning
+	assert(telemetry_open(&tel, &proc, SEGMENT, 100, 0) == 0);
+	atomic_store(&tel.page->seq, 7);
+	telemetry_update(&tel, &proc);
+	const struct telemetry_page* page = telemetry_map(SEGMENT);
+	struct telemetry_sample sample;
+	telemetry_read(page, &sample);
+	assert(sample.seq == 8);
+	telemetry_unmap(page);
+	telemetry_close(&tel, &proc);
+}
+
+int main() {
+	test_run();
+	test_free_list();
+	test_concurrent();
+	test_open();
+
+	printf("All tests passed.\n");
+}
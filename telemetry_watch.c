@@ -0,0 +1,103 @@
+/**
+ * Watches a running simulation through its telemetry segment (see
+ * telemetry.h), printing a sample every `-i` milliseconds, 1000 by default.
+ * Rates are over the time since the previous sample. Stops after `-n`
+ * samples, once the processor halts, or with -n 1 prints a single sample.
+ * The free list columns are shown if the writer publishes them.
+ *
+ * Usage: telemetry_watch [-i interval ms] [-n samples] name
+ */
+
+#include "telemetry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleep_ms(long ms) {
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+	nanosleep(&ts, NULL);
+}
+
+static double ratio(uint64_t num, uint64_t den) {
+	return den ? (double) num / den : 0;
+}
+
+int main(int argc, char** argv) {
+	const char* usage = "usage: %s [-i interval ms] [-n samples] name\n";
+	long interval = 1000;
+	long samples = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+		switch (opt) {
+			case 'i':
+				interval = strtol(optarg, NULL, 0);
+				break;
+			case 'n':
+				samples = strtol(optarg, NULL, 0);
+				break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				return 2;
+		}
+	}
+	if (optind != argc - 1 || interval <= 0) {
+		fprintf(stderr, usage, argv[0]);
+		return 2;
+	}
+
+	const char* name = argv[optind];
+	const struct telemetry_page* page = telemetry_map(name);
+	if (!page) {
+		fprintf(stderr, "%s: no telemetry segment\n", name);
+		return 1;
+	}
+	int free_list = page->flags & TELEMETRY_FREE_LIST;
+	printf("updated every %llu cycles\n", (unsigned long long) page->interval);
+	printf("%14s %8s %14s %6s %8s %8s %10s", "cycles", "pc", "retired", "IPC",
+		   "stall%", "flush%", "Mcycles/s");
+	if (free_list) {
+		printf(" %6s %6s %6s", "free", "bytes", "max");
+	}
+	printf("\n");
+
+	// The first sample is against zero, so it covers the whole run so far
+	struct telemetry_sample last = { 0 }, sample;
+	double last_time = 0;
+	for (long i = 0; !samples || i < samples; i++) {
+		if (i) {
+			sleep_ms(interval);
+		}
+		telemetry_read(page, &sample);
+		double time = now_seconds();
+		uint64_t cycles = sample.cycles - last.cycles;
+		uint64_t retired = sample.retired - last.retired;
+		uint64_t stalls = sample.stalls - last.stalls;
+		uint64_t flushes = sample.flushes - last.flushes;
+		printf("%14llu %8llx %14llu %6.3f %8.2f %8.2f %10.2f",
+			   (unsigned long long) sample.cycles, (unsigned long long) sample.pc,
+			   (unsigned long long) sample.retired, ratio(retired, cycles),
+			   100 * ratio(stalls, cycles), 100 * ratio(flushes, cycles),
+			   i ? cycles / (time - last_time) / 1e6 : 0.0);
+		if (free_list) {
+			printf(" %6llu %6llu %6llu", (unsigned long long) sample.free_blocks,
+				   (unsigned long long) sample.free_bytes, (unsigned long long) sample.largest_free);
+		}
+		printf("\n");
+		fflush(stdout);
+		if (sample.halted) {
+			printf("halted\n");
+			break;
+		}
+		last = sample;
+		last_time = time;
+	}
+	telemetry_unmap(page);
+	return 0;
+}
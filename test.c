@@ -1,7 +1,10 @@
 #include "processor.h"
 #include "ememory.h"
+#include "ememory_cache.h"
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #define TEST_MEM_SIZE 128
 
@@ -144,6 +147,362 @@ void test_alloc_after_free() {
     assert(p2.ptr == p1.ptr);
 }
 
+/* ------------------- Batch tests ------------------- */
+
+void test_batch_alloc() {
+    char data[TEST_MEM_SIZE];
+    struct ememory mem = make_mem(data);
+
+    uint16_t sizes[] = { 16, 8, 32 };
+    struct eptr out[3];
+    assert(emalloc_batch(&mem, sizes, 3, out) == 0);
+    assert(out[0].ptr == STARTING_OFFSET);
+    assert(out[1].ptr == STARTING_OFFSET + 16);
+    assert(out[2].ptr == STARTING_OFFSET + 24);
+
+    // Too large as a whole: nothing stays allocated
+    uint16_t big[] = { 16, 64 };
+    uint16_t head = mem.free_head;
+    assert(emalloc_batch(&mem, big, 2, out) == -1);
+    assert(mem.free_head == head);
+    assert(emalloc(&mem, TEST_MEM_SIZE - STARTING_OFFSET - 56).ptr == head);
+}
+
+/* ------------------- Arena tests ------------------- */
+
+static struct ememory make_arena(char *data) {
+    struct ememory mem = {};
+    mem.data = data;
+    init_arena(&mem, TEST_MEM_SIZE);
+    return mem;
+}
+
+void test_arena_bump_and_align() {
+    char data[TEST_MEM_SIZE];
+    struct ememory mem = make_arena(data);
+
+    struct eptr p1 = emalloc(&mem, 3);
+    struct eptr p2 = arena_alloc(&mem, 8, 8);
+    assert(p1.ptr == STARTING_OFFSET && p1.size == 3);
+    assert(p2.ptr == STARTING_OFFSET + 8 && p2.size == 8);
+    assert(mem.free_head == STARTING_OFFSET + 16);
+
+    // Padding between the blocks stays allocated
+    assert(is_allocated(&mem, STARTING_OFFSET, 16));
+    assert(!is_allocated(&mem, STARTING_OFFSET + 16, 1));
+
+    // efree() is a no-op
+    assert(efree(&mem, p2) == 0);
+    assert(mem.free_head == STARTING_OFFSET + 16);
+}
+
+void test_arena_exhaustion() {
+    char data[TEST_MEM_SIZE];
+    struct ememory mem = make_arena(data);
+
+    // Leaves 2 bytes, too few for a header, so they go with the block
+    struct eptr p = emalloc(&mem, TEST_MEM_SIZE - STARTING_OFFSET - 2);
+    assert(p.size == TEST_MEM_SIZE - STARTING_OFFSET);
+    assert(mem.free_head == 0);
+    assert(is_null(emalloc(&mem, 1)));
+    assert(arena_mark(&mem) == TEST_MEM_SIZE);
+}
+
+void test_arena_mark_release() {
+    char data[TEST_MEM_SIZE];
+    struct ememory mem = make_arena(data);
+
+    emalloc(&mem, 16);
+    arena_mark_t mark = arena_mark(&mem);
+    emalloc(&mem, 32);
+    emalloc(&mem, 8);
+    assert(arena_release(&mem, mark) == 0);
+    assert(emalloc(&mem, 4).ptr == STARTING_OFFSET + 16);
+
+    // Cannot release forward
+    assert(arena_release(&mem, TEST_MEM_SIZE - 8) == -1);
+
+    // A failed batch leaves the arena where it was
+    uint16_t sizes[] = { 8, 200 };
+    struct eptr out[2];
+    mark = arena_mark(&mem);
+    assert(emalloc_batch(&mem, sizes, 2, out) == -1);
+    assert(arena_mark(&mem) == mark);
+}
+
+void test_arena_reset() {
+    char data[TEST_MEM_SIZE];
+    char expected[TEST_MEM_SIZE];
+    struct ememory fresh = make_mem(expected);
+    struct ememory mem = make_arena(data);
+
+    emalloc(&mem, 40);
+    emalloc(&mem, TEST_MEM_SIZE);
+    arena_reset(&mem);
+    assert(mem.free_head == fresh.free_head);
+    assert(memcmp(data + STARTING_OFFSET, expected + STARTING_OFFSET, 4) == 0);
+}
+
+void test_arena_reinit() {
+    char data[TEST_MEM_SIZE];
+    struct ememory mem = make_arena(data);
+
+    // Back to a free list, so blocks are freed again
+    init_ememory(&mem, TEST_MEM_SIZE);
+    struct eptr p = emalloc(&mem, 16);
+    assert(efree(&mem, p) == 0);
+    assert(mem.free_head == STARTING_OFFSET);
+    assert(emalloc(&mem, TEST_MEM_SIZE - STARTING_OFFSET).ptr == STARTING_OFFSET);
+}
+
+/* ------------------- Thread cache tests ------------------- */
+
+#define CACHE_MEM_SIZE      4096
+#define CACHE_THREADS       4
+#define CACHE_LIVE          32
+#define CACHE_ROUNDS        20000
+
+static char cache_data[MEM_SIZE];
+
+// Checks that the free list is back to the single block init_ememory() made
+static void assert_all_free(struct ememory *mem, uint32_t size) {
+    struct free_stats stats;
+    free_list_stats(mem, &stats);
+    assert(mem->free_head == STARTING_OFFSET);
+    assert(stats.blocks == 1 && stats.bytes == size - STARTING_OFFSET);
+}
+
+void test_cache_refill_and_drain() {
+    struct ememory mem = { .data = cache_data };
+    init_ememory(&mem, CACHE_MEM_SIZE);
+    struct shared_ememory shared;
+    init_shared_ememory(&shared, &mem);
+    struct ememory_cache a, b;
+    init_ememory_cache(&a, &shared);
+    init_ememory_cache(&b, &shared);
+
+    // An empty bin takes a batch, and hands out the last one taken
+    struct eptr held[EMEMORY_CACHE_DEPTH];
+    held[0] = emalloc_cached(&a, 10);
+    assert(held[0].ptr == STARTING_OFFSET + 3 * 16 && held[0].size == 16);
+    assert(a.counts[0] == EMEMORY_CACHE_BATCH - 1);
+    assert(mem.free_head == STARTING_OFFSET + EMEMORY_CACHE_BATCH * 16);
+
+    // Only once the bin is empty again does it go back for more
+    for (int i = 1; i < EMEMORY_CACHE_BATCH; i++) {
+        held[i] = emalloc_cached(&a, 16);
+    }
+    assert(a.counts[0] == 0);
+    assert(mem.free_head == STARTING_OFFSET + EMEMORY_CACHE_BATCH * 16);
+    for (int i = EMEMORY_CACHE_BATCH; i < EMEMORY_CACHE_DEPTH; i++) {
+        held[i] = emalloc_cached(&a, 16);
+    }
+    assert(a.counts[0] == 2 * EMEMORY_CACHE_BATCH - EMEMORY_CACHE_DEPTH);
+    assert(mem.free_head == STARTING_OFFSET + 2 * EMEMORY_CACHE_BATCH * 16);
+
+    // Frees fill the bin without touching the central list
+    for (int i = 0; i < EMEMORY_CACHE_DEPTH; i++) {
+        assert(efree_cached(&a, held[i]) == 0);
+    }
+    assert(a.counts[0] == EMEMORY_CACHE_DEPTH);
+    assert(mem.free_head == STARTING_OFFSET + 2 * EMEMORY_CACHE_BATCH * 16);
+
+    // A full bin returns its oldest half, which here is the first batch, so
+    // the central list gets it back as one block at the start
+    struct eptr other = emalloc_cached(&b, 16);
+    assert(efree_cached(&a, other) == 0);
+    assert(a.counts[0] == EMEMORY_CACHE_DEPTH / 2 + 1);
+    assert(mem.free_head == STARTING_OFFSET);
+    struct free_stats stats;
+    free_list_stats(&mem, &stats);
+    assert(stats.blocks == 2 && stats.largest > EMEMORY_CACHE_BATCH * 16);
+
+    // The block freed last comes out first, whichever cache it came from
+    struct eptr p = emalloc_cached(&a, 16);
+    assert(p.ptr == other.ptr && p.size == other.size);
+    assert(efree_cached(&a, p) == 0);
+
+    flush_ememory_cache(&a);
+    flush_ememory_cache(&b);
+    assert_all_free(&mem, CACHE_MEM_SIZE);
+    destroy_shared_ememory(&shared);
+}
+
+void test_cache_uncached_blocks() {
+    struct ememory mem = { .data = cache_data };
+    init_ememory(&mem, CACHE_MEM_SIZE);
+    struct shared_ememory shared;
+    init_shared_ememory(&shared, &mem);
+    struct ememory_cache cache;
+    init_ememory_cache(&cache, &shared);
+
+    assert(is_null(emalloc_cached(&cache, 0)));
+
+    // Larger than every class: straight to and from the central list
+    struct eptr big = emalloc_cached(&cache, EMEMORY_CACHE_MAX + 1);
+    assert(big.ptr == STARTING_OFFSET && big.size == EMEMORY_CACHE_MAX + 1);
+    for (int class = 0; class < EMEMORY_CACHE_CLASSES; class++) {
+        assert(cache.counts[class] == 0);
+    }
+    assert(efree_cached(&cache, big) == 0);
+    assert_all_free(&mem, CACHE_MEM_SIZE);
+
+    // An 18 byte hole is handed out whole for 16 bytes, since what is left
+    // over could not hold a header. It is not a class size, so it is not
+    // cached when freed.
+    struct eptr hole = emalloc(&mem, 18);
+    struct eptr after = emalloc(&mem, 16);
+    efree(&mem, hole);
+    struct eptr held[EMEMORY_CACHE_BATCH];
+    for (int i = 0; i < EMEMORY_CACHE_BATCH; i++) {
+        held[i] = emalloc_cached(&cache, 16);
+    }
+    struct eptr odd = held[EMEMORY_CACHE_BATCH - 1];
+    assert(odd.ptr == STARTING_OFFSET && odd.size == 18);
+    assert(efree_cached(&cache, odd) == 0);
+    assert(cache.counts[0] == 0 && mem.free_head == STARTING_OFFSET);
+
+    for (int i = 0; i < EMEMORY_CACHE_BATCH - 1; i++) {
+        assert(efree_cached(&cache, held[i]) == 0);
+    }
+    assert(cache.counts[0] == EMEMORY_CACHE_BATCH - 1);
+    efree(&mem, after);
+    flush_ememory_cache(&cache);
+    assert_all_free(&mem, CACHE_MEM_SIZE);
+    destroy_shared_ememory(&shared);
+}
+
+void test_cache_flush() {
+    char expected[CACHE_MEM_SIZE];
+    struct ememory fresh = { .data = expected };
+    init_ememory(&fresh, CACHE_MEM_SIZE);
+    struct ememory mem = { .data = cache_data };
+    init_ememory(&mem, CACHE_MEM_SIZE);
+    struct shared_ememory shared;
+    init_shared_ememory(&shared, &mem);
+    struct ememory_cache a, b;
+    init_ememory_cache(&a, &shared);
+    init_ememory_cache(&b, &shared);
+
+    // Every class, partly filled bins in both caches, some blocks freed by
+    // the other cache
+    uint16_t sizes[] = { 1, 16, 17, 33, 64, 100, 128, 129, 300, 5, 60, 120 };
+    int n = sizeof(sizes) / sizeof(sizes[0]);
+    struct eptr held[2 * sizeof(sizes) / sizeof(sizes[0])];
+    for (int i = 0; i < n; i++) {
+        held[2 * i] = emalloc_cached(&a, sizes[i]);
+        held[2 * i + 1] = emalloc_cached(&b, sizes[i]);
+        assert(!is_null(held[2 * i]) && !is_null(held[2 * i + 1]));
+    }
+    for (int i = 0; i < 2 * n; i++) {
+        assert(efree_cached(i % 3 ? &a : &b, held[i]) == 0);
+    }
+
+    flush_ememory_cache(&a);
+    flush_ememory_cache(&b);
+    for (int class = 0; class < EMEMORY_CACHE_CLASSES; class++) {
+        assert(a.counts[class] == 0 && b.counts[class] == 0);
+    }
+    assert_all_free(&mem, CACHE_MEM_SIZE);
+    assert(memcmp(cache_data + STARTING_OFFSET, expected + STARTING_OFFSET, 4) == 0);
+    destroy_shared_ememory(&shared);
+}
+
+struct cache_thread {
+    struct ememory_cache cache;
+    struct eptr live[CACHE_LIVE];
+    unsigned int seed;
+    char tag;
+};
+
+static struct ememory thread_mem = { .data = cache_data };
+
+static void fill(struct eptr ptr, char tag) {
+    memset(thread_mem.data + ptr.ptr, tag, ptr.size);
+}
+
+static void check(struct eptr ptr, char tag) {
+    for (int i = 0; i < ptr.size; i++) {
+        assert(thread_mem.data[ptr.ptr + i] == tag);
+    }
+}
+
+/**
+ * Allocates and frees blocks of random sizes, each filled with the thread's
+ * tag, checking on every free that no other thread wrote over it. Ends with
+ * every slot of `live` allocated.
+ */
+static void* churn(void* arg) {
+    struct cache_thread* thread = arg;
+    for (int round = 0; round < CACHE_ROUNDS; round++) {
+        int slot = rand_r(&thread->seed) % CACHE_LIVE;
+        struct eptr* ptr = &thread->live[slot];
+        if (!is_null(*ptr)) {
+            check(*ptr, thread->tag);
+            assert(efree_cached(&thread->cache, *ptr) == 0);
+        }
+        *ptr = emalloc_cached(&thread->cache, 1 + rand_r(&thread->seed) % 200);
+        assert(!is_null(*ptr));
+        fill(*ptr, thread->tag);
+    }
+    for (int slot = 0; slot < CACHE_LIVE; slot++) {
+        if (is_null(thread->live[slot])) {
+            thread->live[slot] = emalloc_cached(&thread->cache, 24);
+            fill(thread->live[slot], thread->tag);
+        }
+    }
+    return NULL;
+}
+
+static int compare_eptr(const void* a, const void* b) {
+    return ((const struct eptr*) a)->ptr - ((const struct eptr*) b)->ptr;
+}
+
+void test_cache_threads() {
+    init_ememory(&thread_mem, MEM_SIZE);
+    struct shared_ememory shared;
+    init_shared_ememory(&shared, &thread_mem);
+    struct cache_thread threads[CACHE_THREADS] = { 0 };
+    pthread_t ids[CACHE_THREADS];
+    for (int t = 0; t < CACHE_THREADS; t++) {
+        init_ememory_cache(&threads[t].cache, &shared);
+        threads[t].seed = t + 1;
+        threads[t].tag = 'a' + t;
+        assert(pthread_create(&ids[t], NULL, churn, &threads[t]) == 0);
+    }
+    for (int t = 0; t < CACHE_THREADS; t++) {
+        pthread_join(ids[t], NULL);
+    }
+
+    // What is still live is disjoint, untouched and outside the free list
+    struct eptr all[CACHE_THREADS * CACHE_LIVE];
+    for (int t = 0; t < CACHE_THREADS; t++) {
+        for (int slot = 0; slot < CACHE_LIVE; slot++) {
+            struct eptr ptr = threads[t].live[slot];
+            check(ptr, threads[t].tag);
+            assert(is_allocated(&thread_mem, ptr.ptr, ptr.size));
+            all[t * CACHE_LIVE + slot] = ptr;
+        }
+    }
+    qsort(all, CACHE_THREADS * CACHE_LIVE, sizeof(struct eptr), compare_eptr);
+    for (int i = 1; i < CACHE_THREADS * CACHE_LIVE; i++) {
+        assert(all[i - 1].ptr + all[i - 1].size <= all[i].ptr);
+    }
+
+    // Freed through the other threads' caches, then everything comes back
+    for (int t = 0; t < CACHE_THREADS; t++) {
+        struct ememory_cache* cache = &threads[(t + 1) % CACHE_THREADS].cache;
+        for (int slot = 0; slot < CACHE_LIVE; slot++) {
+            assert(efree_cached(cache, threads[t].live[slot]) == 0);
+        }
+    }
+    for (int t = 0; t < CACHE_THREADS; t++) {
+        flush_ememory_cache(&threads[t].cache);
+    }
+    assert_all_free(&thread_mem, MEM_SIZE);
+    destroy_shared_ememory(&shared);
+}
+
 /* ------------------- Main ------------------- */
 
 int main() {
@@ -158,6 +517,16 @@ int main() {
     test_free_at_tail_merge();
     test_free_at_tail_append();
     test_alloc_after_free();
+    test_batch_alloc();
+    test_arena_bump_and_align();
+    test_arena_exhaustion();
+    test_arena_mark_release();
+    test_arena_reset();
+    test_arena_reinit();
+    test_cache_refill_and_drain();
+    test_cache_uncached_blocks();
+    test_cache_flush();
+    test_cache_threads();
 
     printf("All tests passed.\n");
 }
@@ -0,0 +1,63 @@
+#ifndef TEST_FIXTURE
+#define TEST_FIXTURE
+
+#include "assembler.h"
+#include "processor.h"
+
+/**
+ * Setup shared by the *_test.c programs. Not part of libprocessor.
+ */
+
+#define LOAD_SLACK		32		// zeroed bytes after a loaded program, 8 instructions
+
+/**
+ * Copies `size` bytes of encoded instructions into freshly zeroed and 
+ * initialized `memory`, which holds MEM_SIZE bytes, at STARTING_OFFSET, and
+ * makes `proc` a new processor about to run them, with the shape of the 
+ * pipeline preset called `preset` unless it is NULL.
+ *
+ * The program is allocated in `memory`, along with a few zeroed words after
+ * it (decoded as no-ops) for the pipeline to fetch ahead into, so later
+ * emalloc() calls cannot overlap it.
+ *
+ * @return	0 on success, else -1 if the program does not fit or there is no 
+ * 			such preset
+ */
+static inline int load_image(struct processor* proc, struct ememory* memory, const unsigned char* image, size_t size, const char* preset) {
+	const struct pipeline_preset* shape = NULL;
+	if (preset && !(shape = find_pipeline_preset(preset))) {
+		return -1;
+	}
+	memset(memory->data, 0, MEM_SIZE);
+	init_ememory(memory, MEM_SIZE);
+	if (size + LOAD_SLACK > UINT16_MAX || emalloc(memory, size + LOAD_SLACK).ptr != STARTING_OFFSET) {
+		return -1;
+	}
+	memcpy(memory->data + STARTING_OFFSET, image, size);
+
+	*proc = new_processor(memory);
+	if (shape && set_pipeline_shape(proc, shape->stages, shape->depth)) {
+		return -1;
+	}
+	proc->regs[PC] = STARTING_OFFSET;
+	return 0;
+}
+
+/**
+ * Assembles `source` and loads it as load_image() does
+ *
+ * @return	0 on success, else -1 if the source does not assemble or cannot be
+ * 			loaded
+ */
+static inline int load_source(struct processor* proc, struct ememory* memory, const char* source, const char* preset) {
+	struct asm_result result;
+	if (assemble(source, &result)) {
+		free_asm_result(&result);
+		return -1;
+	}
+	int res = load_image(proc, memory, result.image, result.size, preset);
+	free_asm_result(&result);
+	return res;
+}
+
+#endif // TEST_FIXTURE
@@ -0,0 +1,199 @@
+#include "timing.h"
+#include <stdio.h>
+
+static inline uint64_t max_cycle(uint64_t a, uint64_t b) {
+	return (a > b) ? a : b;
+}
+
+// ====================
+//	  FROZEN CYCLES
+// ====================
+
+/**
+ * Returns the first cycle from `cycle` on in which MEM is not busy with a
+ * block operation
+ */
+static uint64_t next_active(const struct inorder_timing* timing, uint64_t cycle) {
+	unsigned int count = (timing->num_freezes < TIMING_FREEZES) ? timing->num_freezes : TIMING_FREEZES;
+	int moved = 1;
+	while (moved) {
+		moved = 0;
+		for (unsigned int i = 0; i < count; i++) {
+			const uint64_t* freeze = timing->freezes[i];
+			if (cycle >= freeze[0] && cycle <= freeze[1]) {
+				cycle = freeze[1] + 1;
+				moved = 1;
+			}
+		}
+	}
+	return cycle;
+}
+
+/**
+ * Returns the cycle `n` cycles after `cycle` in which the pipeline moves
+ */
+static uint64_t advance(const struct inorder_timing* timing, uint64_t cycle, int n) {
+	for (int i = 0; i < n; i++) {
+		cycle = next_active(timing, cycle + 1);
+	}
+	return cycle;
+}
+
+/**
+ * Returns the number of cycles in [from, to) in which the pipeline moves
+ */
+static uint64_t active_cycles(const struct inorder_timing* timing, uint64_t from, uint64_t to) {
+	unsigned int count = (timing->num_freezes < TIMING_FREEZES) ? timing->num_freezes : TIMING_FREEZES;
+	uint64_t cycles = to - from;
+	for (unsigned int i = 0; i < count; i++) {
+		uint64_t start = max_cycle(from, timing->freezes[i][0]);
+		uint64_t end = timing->freezes[i][1] + 1;
+		if (end > to) {
+			end = to;
+		}
+		if (end > start) {
+			cycles -= end - start;
+		}
+	}
+	return cycles;
+}
+
+// =====================
+//	  IN-ORDER MODEL
+// =====================
+
+static void inorder_retire(struct timing_model* model, const struct retire_record* record) {
+	struct inorder_timing* timing = (struct inorder_timing*) model;
+	struct pipeline_stats* stats = &model->stats;
+	const struct signal* sig = &record->sig;
+	int if_extra = timing->shape.if_extra;
+	int ex_slots = timing->shape.ex_extra + timing->shape.ag_extra;
+
+	// Fetch also stops while decode stalls, but an instruction fetched early
+	// only waits longer behind the one ahead of it, so that is left out
+	uint64_t fetch = max_cycle(advance(timing, timing->last_fetch, 1), timing->fetch_ready);
+	fetch = next_active(timing, fetch);
+
+	// Stalls in decode until every operand can be read
+	uint64_t arrive = max_cycle(advance(timing, fetch, if_extra + 1),
+								advance(timing, timing->last_decode, 1));
+	uint64_t decode = arrive;
+	if (!sig->halt) {
+		for (int i = 0; i < record->num_srcs; i++) {
+			unsigned char reg = record->srcs[i];
+			decode = max_cycle(decode, max_cycle(timing->reg_ready[reg], timing->muldiv_ready[reg]));
+		}
+		if (record->in.opcode == BEQ || record->in.opcode == BNE) {
+			decode = max_cycle(decode, timing->flag_ready);
+		}
+		if (sig->alu_op == ALU_DIV || sig->alu_op == ALU_REM) {
+			decode = max_cycle(decode, timing->div_free);
+		}
+	}
+	decode = next_active(timing, decode);
+	stats->stalls += active_cycles(timing, arrive, decode);
+
+	if (is_muldiv(sig->alu_op)) {
+		int divide = (sig->alu_op == ALU_DIV || sig->alu_op == ALU_REM);
+		unsigned int latency = divide ? timing->div_latency : timing->mul_latency;
+		if (latency == 0) {
+			latency = 1;
+		}
+		timing->muldiv_ready[record->in.dest] = decode + 2 + ex_slots + latency;
+		if (divide) {
+			timing->div_free = decode + latency;
+		}
+	}
+
+	uint64_t executed = advance(timing, decode, 1 + ex_slots);
+	uint64_t memory = advance(timing, executed, 1);
+	uint64_t write_back = advance(timing, memory, 1);
+
+	// Writes back as MEM becomes busy
+	if (sig->block) {
+		write_back = memory + 1;
+		word_t busy = block_cycles(record->len) - 1;
+		if (busy) {
+			uint64_t* freeze = timing->freezes[timing->num_freezes++ % TIMING_FREEZES];
+			freeze[0] = memory + 1;
+			freeze[1] = memory + busy;
+			stats->stalls += busy;
+		}
+	}
+
+	for (int i = 0; i < record->num_dests; i++) {
+		if (timing->forwarding) {
+			timing->reg_ready[record->dest + i] = sig->mem_read ? memory : executed;
+		} else {
+			timing->reg_ready[record->dest + i] = memory + 1;
+		}
+	}
+	if (sig->reg_write && record->dest == FLAG) {
+		timing->flag_ready = timing->forwarding ? executed : memory;
+	}
+
+	if (sig->branch && record->taken) {
+		uint64_t resolved = advance(timing, decode, 1);
+		timing->fetch_ready = advance(timing, resolved, 1 + timing->shape.ex_extra);
+		stats->stalls++;
+		stats->flushes++;
+	}
+	if (sig->halt) {
+		timing->fetch_ready = write_back + 1;
+	}
+
+	timing->last_fetch = fetch;
+	timing->last_decode = decode;
+	stats->retired++;
+	stats->cycles = max_cycle(stats->cycles, write_back);
+}
+
+void init_inorder_timing(struct inorder_timing* timing, const char* name,
+						 const struct pipeline_shape* shape) {
+	*timing = (struct inorder_timing) {
+		.model = { .name = name, .retire = inorder_retire },
+		.shape = *shape,
+		.mul_latency = MUL_LATENCY,
+		.div_latency = DIV_LATENCY,
+	};
+}
+
+// ===============
+//		 API
+// ===============
+
+int timing_run(struct processor* proc, uint64_t count, word_t pc_marker,
+			   struct timing_model* const* models, int num_models, uint64_t* executed) {
+	struct retire_record record;
+	int status = 0;
+	uint64_t i = 0;
+	while (i < count) {
+		if (pc_marker && proc->regs[PC] == pc_marker) {
+			break;
+		}
+		status = functional_step_record(proc, &record);
+		if (status && status != HALTED) {
+			break;
+		}
+		for (int m = 0; m < num_models; m++) {
+			models[m]->retire(models[m], &record);
+		}
+		i++;
+		if (status) {
+			break;
+		}
+	}
+	*executed = i;
+	return status;
+}
+
+void print_timing(struct timing_model* const* models, int num_models) {
+	printf("%-16s %12s %12s %7s %12s %10s\n", "model", "cycles", "retired", "CPI", "stalls", "flushes");
+	for (int m = 0; m < num_models; m++) {
+		const struct pipeline_stats* stats = &models[m]->stats;
+		printf("%-16s %12llu %12llu %7.3f %12llu %10llu\n", models[m]->name,
+			   (unsigned long long) stats->cycles, (unsigned long long) stats->retired,
+			   stats->retired ? (double) stats->cycles / stats->retired : 0.0,
+			   (unsigned long long) stats->stalls, (unsigned long long) stats->flushes);
+	}
+}
@@ -0,0 +1,117 @@
+#include "timing.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static char data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+
+// Dependent multiplies and divides, a load-use, block operations and taken
+// and untaken branches, then a HALT
+static const char* program =
+	"\tmov r7, #4096\n"
+	"\tmov r1, #0\n"
+	"\tmov r2, #1\n"
+	"@loop\n"
+	"\tmul r2, r2, #3\n"
+	"\tdiv r3, r2, #5\n"
+	"\trem r4, r3, #7\n"
+	"\tstore r4, r7, #0\n"
+	"\tload r5, r7, #0\n"
+	"\tadd r5, r5, r4\n"
+	"\tmov r6, #40\n"
+	"\tmemcpy r7, r7, r6\n"
+	"\tmemset r7, r5, #12\n"
+	"\tcmp r5, #3\n"
+	"\tbeq skip\n"
+	"\tadd r1, r1, #0\n"
+	"@skip\n"
+	"\tadd r1, r1, #1\n"
+	"\tcmp r1, #50\n"
+	"\tbne loop\n"
+	"\thalt\n";
+
+/* ------------------- Tests ------------------- */
+
+void test_matches_pipeline() {
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		const struct pipeline_preset* preset = &pipeline_presets[p];
+		struct processor proc;
+		assert(load_source(&proc, &memory, program, NULL) == 0);
+		assert(set_pipeline_shape(&proc, preset->stages, preset->depth) == 0);
+		struct stop_reason stop = run_for(&proc, 1000000);
+		assert(stop.reason == STOP_HALT);
+
+		struct processor replay;
+		assert(load_source(&replay, &memory, program, NULL) == 0);
+		struct inorder_timing timing;
+		init_inorder_timing(&timing, preset->name, &proc.shape);
+		struct timing_model* models[] = { &timing.model };
+		uint64_t executed;
+		assert(timing_run(&replay, 1000000, 0, models, 1, &executed) == HALTED);
+		assert(executed == proc.stats.retired);
+		assert(!memcmp(&proc.stats, &timing.model.stats, sizeof(proc.stats)));
+		assert(!memcmp(proc.regs, replay.regs, sizeof(proc.regs)));
+	}
+}
+
+void test_many_models() {
+	// One run drives every preset, with and without forwarding
+	struct inorder_timing timings[16];
+	struct timing_model* models[16];
+	int num_models = 0;
+	assert(2 * num_pipeline_presets <= 16);
+	for (int p = 0; p < num_pipeline_presets; p++) {
+		struct processor shaped = new_processor(&memory);
+		const struct pipeline_preset* preset = &pipeline_presets[p];
+		assert(set_pipeline_shape(&shaped, preset->stages, preset->depth) == 0);
+		for (int forwarding = 0; forwarding < 2; forwarding++) {
+			init_inorder_timing(&timings[num_models], preset->name, &shaped.shape);
+			timings[num_models].forwarding = forwarding;
+			models[num_models] = &timings[num_models].model;
+			num_models++;
+		}
+	}
+
+	struct processor proc;
+	assert(load_source(&proc, &memory, program, NULL) == 0);
+	uint64_t executed;
+	assert(timing_run(&proc, 1000000, 0, models, num_models, &executed) == HALTED);
+	for (int m = 0; m < num_models; m += 2) {
+		const struct pipeline_stats* plain = &models[m]->stats;
+		const struct pipeline_stats* forwarded = &models[m + 1]->stats;
+		assert(plain->retired == executed && forwarded->retired == executed);
+		assert(forwarded->cycles < plain->cycles);
+		assert(forwarded->stalls < plain->stalls);
+		assert(forwarded->flushes == plain->flushes);
+	}
+}
+
+void test_stops() {
+	// Stops at the marker and on the budget, and picks up where it left off
+	struct processor proc;
+	assert(load_source(&proc, &memory, program, NULL) == 0);
+	struct inorder_timing timing;
+	init_inorder_timing(&timing, "classic", &proc.shape);
+	struct timing_model* models[] = { &timing.model };
+	uint64_t executed;
+	assert(timing_run(&proc, 1000000, STARTING_OFFSET + 12, models, 1, &executed) == 0);
+	assert(executed == 3 && proc.regs[PC] == STARTING_OFFSET + 12);
+	assert(timing_run(&proc, 5, 0, models, 1, &executed) == 0);
+	assert(executed == 5 && timing.model.stats.retired == 8);
+
+	// A fault stops the run without handing the instruction to the models
+	assert(load_source(&proc, &memory, "\tmov r1, #0\n\tload r2, r1, #0\n\thalt\n", NULL) == 0);
+	init_inorder_timing(&timing, "classic", &proc.shape);
+	assert(timing_run(&proc, 10, 0, models, 1, &executed) == SEGFAULT);
+	assert(executed == 1 && timing.model.stats.retired == 1);
+}
+
+int main() {
+	test_matches_pipeline();
+	test_many_models();
+	test_stops();
+
+	printf("All tests passed.\n");
+}
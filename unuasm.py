@@ -13,6 +13,16 @@ INSTRUCTION_SIZE = 4
 MACRO_KEYWORD = '.macro'
 DELIMTER_SPLIT = '(\s+|,)'
 COMMENT_SYMBOL = ';'
+FLAG = "flag"
+MEMORY = "memory"
+BRANCHES = ("beq", "bne", "brn")
+VECTOR_WORDS = 4
+
+# Guest memory as laid out by the simulator (ememory.h). The console and DMA
+# controller are mapped outside [STARTING_OFFSET, MEM_SIZE).
+STARTING_OFFSET = 0x10
+MEM_SIZE = 0x10000
+
 OPCODES = {
 	"mov": 0,
 	"load": 1,
@@ -26,6 +36,22 @@ OPCODES = {
 	"beq": 9,
 	"bne": 10,
 	"brn": 11,
+	"paddb": 12,
+	"psubb": 13,
+	"paddh": 14,
+	"psubh": 15,
+	"vload": 16,
+	"vstore": 17,
+	"memcpy": 18,
+	"memset": 19,
+	"mul": 20,
+	"mulh": 21,
+	"div": 22,
+	"rem": 23,
+	"shl": 24,
+	"shr": 25,
+	"sar": 26,
+	"halt": 27,
 }
 REGS = {
     f"r{i}": i for i in range(8)
@@ -40,6 +66,11 @@ REGS["pc"] = 8
 parser = argparse.ArgumentParser()
 parser.add_argument("input", help="Input source filename")
 parser.add_argument("-o", help="Output binary filename", default="a.u", metavar="<file>")
+parser.add_argument("-s", "--schedule", action="store_true", 
+					help="Reorder instructions within basic blocks to avoid pipeline stalls")
+parser.add_argument("-O", dest="optimize", action="store_true", 
+					help="Run peephole optimizations before assembly. Programs must "
+						 "address code only through labels.")
 
 args = parser.parse_args()
 
@@ -137,6 +168,438 @@ def resolve_loops(loops: dict, instrs: list[str]):
 		instrs[i] = "".join(parts)
 	
 
+# ==================================
+#		INSTRUCTION SCHEDULING
+# ==================================
+
+# Pipeline timing used by the scheduler. Registers are read in ID and written
+# in WB, so a consumer must decode at least 3 cycles after its producer. 
+# BEQ/BNE read the flag in EX, so they only need to trail a CMP by 2 cycles.
+# Multiplies and divides spend MUL_LATENCY/DIV_LATENCY cycles in EX instead
+# of one (the defaults of the simulator's multiply/divide unit).
+REG_LATENCY = 3
+FLAG_LATENCY = 2
+MUL_LATENCY = 3
+DIV_LATENCY = 16
+
+def result_latency(instr: str) -> int:
+	"""
+	Returns the number of cycles between decoding an instruction and decoding
+	a consumer of its register result.
+	"""
+	op = instr.split()[0] if instr.split() else ""
+	if op in ("mul", "mulh"):
+		return REG_LATENCY + MUL_LATENCY - 1
+	if op in ("div", "rem"):
+		return REG_LATENCY + DIV_LATENCY - 1
+	return REG_LATENCY
+
+def instr_effects(instr: str):
+	"""
+	Returns the (defs, uses, memory_access) of an instruction, where 
+	memory_access is None, "load" or "store". Returns None if the instruction
+	must not be moved, either because it reads or writes the PC (its value
+	depends on the instruction's address) or because it cannot be parsed.
+	"""
+	parts = instr.replace(",", " ").split()
+	if len(parts) < 2 or parts[0] not in OPCODES:
+		return None
+	op, operands = parts[0], parts[1:]
+	regs = [t for t in operands if t in REGS]
+
+	if op in BRANCHES:
+		# Branch targets are still label names at this point
+		return set(), set(regs) | ({FLAG} if op != "brn" else set()), None
+	if any(t not in REGS for t in operands if not t.startswith("#")) or "pc" in regs:
+		return None
+	if op == "cmp":
+		return {FLAG}, set(regs), None
+	if op == "mov":
+		return {operands[0]}, set(regs[1:]), None
+	if len(operands) == 2:
+		# A missing third operand encodes src1 = r0 and src2 = #0
+		regs = [operands[0], "r0"]
+	if op in ("vload", "vstore"):
+		# Vector operations use VECTOR_WORDS consecutive registers
+		first = REGS[operands[0]]
+		vector = {f"r{first + i}" for i in range(VECTOR_WORDS)}
+		if op == "vstore":
+			return set(), vector | set(regs[1:]), "store"
+		return vector, set(regs[1:]), "load"
+	if op in ("store", "memcpy", "memset"):
+		return set(), set(regs), "store"
+	return {operands[0]}, set(regs[1:]), "load" if op == "load" else None
+
+def find_blocks(loops: dict, instrs: list[str]) -> list[tuple[int, int]]:
+	"""
+	Splits instructions into basic blocks. Blocks start at labels and end after
+	branches. Returns a list of (start, end) index pairs, end exclusive.
+	"""
+	leaders = {0, len(instrs)} | {addr // INSTRUCTION_SIZE for addr in loops.values()}
+	for (i, instr) in enumerate(instrs):
+		if instr.split() and instr.split()[0] in BRANCHES:
+			leaders.add(i + 1)
+	leaders = sorted(l for l in leaders if l <= len(instrs))
+	return [(a, b) for (a, b) in zip(leaders, leaders[1:]) if a < b]
+
+def estimate_cycles(effects: list, latencies: list[int]) -> int:
+	"""
+	Estimates the number of cycles taken to decode a sequence of instructions, 
+	assuming no results are in flight when the sequence starts. `latencies` 
+	holds the result_latency() of each instruction.
+	"""
+	ready = {}
+	cycle = 0
+	for ((defs, uses, _), latency) in zip(effects, latencies):
+		cycle = max([cycle + 1] + [ready.get(u, 0) for u in uses])
+		for d in defs:
+			ready[d] = cycle + (FLAG_LATENCY if d == FLAG else latency)
+	return cycle
+
+def schedule_region(effects: list, latencies: list[int]) -> list[int]:
+	"""
+	List-schedules a region of movable instructions, keeping every register, 
+	flag, and memory dependence. Returns the new order as a list of indices.
+	"""
+	n = len(effects)
+	preds = [set() for _ in range(n)]
+	for j in range(n):
+		defs_j, uses_j, mem_j = effects[j]
+		for i in range(j):
+			defs_i, uses_i, mem_i = effects[i]
+			if (defs_i & uses_j) or (uses_i & defs_j) or (defs_i & defs_j):
+				preds[j].add(i)
+			elif "store" in (mem_i, mem_j) and mem_i and mem_j:
+				preds[j].add(i)
+
+	# Critical path length from each instruction to the end of the region. The
+	# flag is assumed to be read by the branch that ends the block.
+	height = [0] * n
+	for i in reversed(range(n)):
+		defs_i = effects[i][0]
+		height[i] = FLAG_LATENCY if FLAG in defs_i else 0
+		for j in range(i + 1, n):
+			if i in preds[j]:
+				latency = latencies[i] if defs_i & effects[j][1] else 1
+				height[i] = max(height[i], latency + height[j])
+
+	order, ready, done = [], {}, set()
+	cycle = 0
+	while len(order) < n:
+		candidates = [j for j in range(n) if j not in done and preds[j] <= done]
+		def issue_cycle(j):
+			return max([cycle + 1] + [ready.get(u, 0) for u in effects[j][1]])
+		# Earliest issue first, then longest critical path, then source order
+		best = min(candidates, key=lambda j: (issue_cycle(j), -height[j], j))
+		cycle = issue_cycle(best)
+		for d in effects[best][0]:
+			ready[d] = cycle + (FLAG_LATENCY if d == FLAG else latencies[best])
+		order.append(best)
+		done.add(best)
+	return order
+
+def schedule_instructions(loops: dict, instrs: list[str], line_numbers: list[int]):
+	"""
+	Reorders instructions within each basic block to fill the stall cycles 
+	between dependent instructions. Branches stay at the end of their block and
+	instructions that cannot be moved split the block into separate regions, 
+	so label addresses are unchanged.
+	Note: This function modifies the `instrs` and `line_numbers` arguments
+	"""
+	names = {addr // INSTRUCTION_SIZE: name for (name, addr) in loops.items()}
+	for (start, end) in find_blocks(loops, instrs):
+		effects = [instr_effects(instr) for instr in instrs[start:end]]
+		latencies = [result_latency(instr) for instr in instrs[start:end]]
+		movable = [e is not None and instrs[start + k].split()[0] not in BRANCHES 
+				   for (k, e) in enumerate(effects)]
+		
+		new_order = []
+		k = 0
+		while k < len(effects):
+			if not movable[k]:
+				new_order.append(k)
+				k += 1
+				continue
+			region_end = k
+			while region_end < len(effects) and movable[region_end]:
+				region_end += 1
+			new_order += [k + j for j in schedule_region(effects[k:region_end], latencies[k:region_end])]
+			k = region_end
+
+		def cost(order):
+			timed = [effects[j] or (set(), set(), None) for j in order]
+			return estimate_cycles(timed, [latencies[j] for j in order])
+		before, after = cost(range(len(effects))), cost(new_order)
+		if after >= before:
+			continue
+
+		instrs[start:end] = [instrs[start + j] for j in new_order]
+		line_numbers[start:end] = [line_numbers[start + j] for j in new_order]
+		label = f" (@{names[start]})" if start in names else ""
+		print(f"block 0x{start * INSTRUCTION_SIZE:04x}{label}: {end - start} instructions, "
+			  f"{before} -> {after} cycles (saved {before - after})")
+
+
+# ====================================
+#		PEEPHOLE OPTIMIZATION
+# ====================================
+
+ALU_FOLDS = {
+	"add": lambda a, b: a + b,
+	"sub": lambda a, b: a - b,
+	"and": lambda a, b: a & b,
+	"or": lambda a, b: a | b,
+	"xor": lambda a, b: a ^ b,
+	"mul": lambda a, b: a * b,
+	"shl": lambda a, b: a << (b & 31),
+}
+IDENTITY_OPS = ("add", "sub", "or", "xor")
+
+def to_word(value: int) -> int:
+	return value & 0xFFFFFFFF
+
+def imm_value(token: str) -> int:
+	"""
+	Returns the register value produced by an immediate operand. Immediates
+	are encoded in 16 bits and sign-extended by the processor.
+	"""
+	value = int(token[1:]) & 0xFFFF
+	return to_word(value - 0x10000 if value & 0x8000 else value)
+
+def fits_imm(value: int) -> bool:
+	return imm_value(f"#{value & 0xFFFF}") == value
+
+def as_signed_imm(value: int) -> int:
+	return value - 0x100000000 if value & 0x80000000 else value
+
+def is_label(line: str) -> bool:
+	return re.match(r'\s*@(\w+)', line) is not None
+
+def operands(line: str) -> list[str]:
+	return line.replace(",", " ").split()
+
+def is_instr(line: str) -> bool:
+	parts = line.split()
+	return bool(parts) and parts[0] in OPCODES
+
+def ends_block(line: str) -> bool:
+	return is_label(line) or (is_instr(line) and line.split()[0] in BRANCHES)
+
+def simplify(line: str) -> str | None:
+	"""
+	Rewrites a single instruction into a cheaper equivalent. Returns None if
+	the instruction has no effect.
+	"""
+	parts = operands(line)
+	if instr_effects(line) is None:
+		return line
+	if len(parts) == 3 and parts[0] == "mov" and parts[1] == parts[2]:
+		return None
+	if len(parts) == 4 and parts[0] in IDENTITY_OPS and parts[3].startswith("#") \
+			and imm_value(parts[3]) == 0:
+		return None if parts[1] == parts[2] else f"mov {parts[1]}, {parts[2]}"
+	return line
+
+def fold_constants(block: list[str]) -> list[str]:
+	"""
+	Replaces ALU operations and moves whose operands are known constants with 
+	a single immediate move.
+	"""
+	known = {}
+	result = []
+	for line in block:
+		if line is None:
+			result.append(line)
+			continue
+		effects = instr_effects(line)
+		parts = operands(line)
+		if effects is None:
+			known.clear()
+			result.append(line)
+			continue
+		
+		def value(token):
+			return imm_value(token) if token.startswith("#") else known.get(token)
+
+		folded = None
+		if parts[0] == "mov" and len(parts) == 3:
+			folded = value(parts[2])
+		elif parts[0] in ALU_FOLDS and len(parts) == 4:
+			a, b = value(parts[2]), value(parts[3])
+			if a is not None and b is not None:
+				folded = to_word(ALU_FOLDS[parts[0]](a, b))
+
+		defs = effects[0]
+		for d in defs:
+			known.pop(d, None)
+		if folded is not None and fits_imm(folded):
+			known[parts[1]] = folded
+			line = f"mov {parts[1]}, #{as_signed_imm(folded)}"
+		result.append(line)
+	return result
+
+def eliminate_redundant_loads(block: list[str]) -> list[str]:
+	"""
+	Replaces a load of an address that was already loaded into a register, 
+	with no store or redefinition in between, by a move (or nothing).
+
+	Only loads from constant addresses inside guest memory are merged. Any
+	other load may read a device register, whose value can change between
+	reads (a status polled in a loop, say), so it is never merged and forgets
+	all loaded values: a device read is also how a program learns that a DMA
+	transfer has rewritten memory.
+	"""
+	known = {}			# register -> constant value
+	available = {}		# address -> registers holding the word there
+	result = []
+	for line in block:
+		if line is None:
+			result.append(line)
+			continue
+		effects = instr_effects(line)
+		parts = operands(line)
+		if effects is None:
+			known.clear()
+			available.clear()
+			result.append(line)
+			continue
+
+		address = None
+		if parts[0] == "load" and len(parts) == 4:
+			base = known.get(parts[2])
+			offset = imm_value(parts[3]) if parts[3].startswith("#") else known.get(parts[3])
+			if base is not None and offset is not None:
+				address = to_word(base + offset)
+			if address is not None and not STARTING_OFFSET <= address <= MEM_SIZE - 4:
+				address = None
+			if address in available:
+				holders = available[address]
+				if parts[1] in holders:
+					result.append(None)
+					continue
+				line = f"mov {parts[1]}, {min(holders)}"
+
+		if effects[2] == "store" or (effects[2] == "load" and address is None):
+			available.clear()
+		for d in effects[0]:
+			known.pop(d, None)
+			available = {a: h - {d} for (a, h) in available.items() if h - {d}}
+		if parts[0] == "mov" and len(parts) == 3 and parts[2].startswith("#"):
+			known[parts[1]] = imm_value(parts[2])
+		if address is not None:
+			available.setdefault(address, set()).add(parts[1])
+		result.append(line)
+	return result
+
+def eliminate_dead_moves(block: list[str]) -> list[str]:
+	"""
+	Removes moves and ALU operations whose result is overwritten later in the 
+	same block before being read. Results still live at the end of the block 
+	are always kept.
+	"""
+	result = []
+	for (i, line) in enumerate(block):
+		effects = line and instr_effects(line)
+		parts = line and operands(line)
+		if not effects or (parts[0] != "mov" and parts[0] not in ALU_FOLDS):
+			result.append(line)
+			continue
+		dest = parts[1]
+		dead = False
+		for later in block[i + 1:]:
+			if later is None:
+				continue
+			later_effects = instr_effects(later)
+			if later_effects is None or dest in later_effects[1]:
+				break
+			if dest in later_effects[0]:
+				dead = True
+				break
+		result.append(None if dead else line)
+	return result
+
+def remove_branches_to_next(lines: list[str]) -> list[str]:
+	"""
+	Removes branches whose target label directly follows them
+	"""
+	result = list(lines)
+	for (i, line) in enumerate(lines):
+		parts = operands(line)
+		if is_instr(line) and parts[0] in BRANCHES and len(parts) == 2:
+			following = []
+			for later in lines[i + 1:]:
+				if is_instr(later):
+					break
+				if m := re.match(r'\s*@(\w+)', later):
+					following.append(m.group(1))
+			if parts[1] in following:
+				result[i] = ""
+	return result
+
+def pc_relative_lines(lines: list[str]) -> list[int]:
+	"""
+	Returns the indices of macro-resolved lines that address code other than
+	through a label: instructions with the PC as an operand, and branches to a
+	register or an offset. Their targets depend on the instructions in between,
+	so optimize() must not run on programs containing them.
+	"""
+	result = []
+	for (i, line) in enumerate(lines):
+		if not is_instr(line):
+			continue
+		parts = operands(line)
+		if "pc" in parts[1:] or (parts[0] in BRANCHES and (len(parts) != 2 or parts[1] in REGS)):
+			result.append(i)
+	return result
+
+def optimize(lines: list[str]) -> int:
+	"""
+	Runs peephole optimizations over macro-resolved source lines until nothing
+	changes. Removed instructions are replaced by empty lines, so labels keep
+	pointing at the same instruction (their offsets are computed afterwards by 
+	gather_loops_and_instrs()) and line numbers in error messages are 
+	unchanged. Instructions that read or write the PC are never touched and act
+	as barriers, but the caller must still reject programs listed by 
+	pc_relative_lines(), whose targets would move.
+	Note: This function modifies the `lines` argument
+
+	Returns:
+		The number of removed instructions
+	"""
+	original = sum(1 for line in lines if is_instr(line))
+	while True:
+		before = list(lines)
+
+		# Gather blocks as lists of line indices. Labels and branches end a 
+		# block; other non-instruction lines are skipped.
+		blocks, block = [], []
+		for (i, line) in enumerate(lines):
+			if is_label(line):
+				blocks.append(block)
+				block = []
+			elif is_instr(line):
+				block.append(i)
+				if ends_block(line):
+					blocks.append(block)
+					block = []
+		blocks.append(block)
+
+		for indices in blocks:
+			# Each pass keeps one entry per instruction, using None for removed
+			# instructions
+			code = [simplify(lines[i]) for i in indices]
+			code = fold_constants(code)
+			code = eliminate_redundant_loads(code)
+			code = eliminate_dead_moves(code)
+			for (i, line) in zip(indices, code):
+				lines[i] = "" if line is None else line
+
+		lines[:] = remove_branches_to_next(lines)
+		if lines == before:
+			break
+	return original - sum(1 for line in lines if is_instr(line))
+
+
 # ================================
 #		INSTRUCTION ASSEMBLY
 # ================================
@@ -185,13 +648,19 @@ def assemble_instruction(instr: str) -> int:
 	dest, src1, src2 = 0, 0, 0
 
 	opcode = get_opcode(parts[0])
-	dest = get_reg(parts[1])
 
+	# halt has no operands
+	if parts[0] == "halt":
+		if len(parts) != 1:
+			raise AssemblyError(f"invalid number of arguments for {parts[0]}")
+		imm_flag = 1
+		
 	# Handle mov as a special case
-	if parts[0] in ("mov", "brn", "bne", "beq", "cmp"):
+	elif parts[0] in ("mov", "brn", "bne", "beq", "cmp"):
 		if len(parts) != 3:
 			raise AssemblyError(f"invalid number of arguments for {parts[0]}")
-		elif parts[2][0] == "#":
+		dest = get_reg(parts[1])
+		if parts[2][0] == "#":
 			src2 = get_imm(parts[2])
 			imm_flag = 1
 		else:
@@ -202,7 +671,8 @@ def assemble_instruction(instr: str) -> int:
 		if len(parts) not in (3, 4):
 			# Only print error if our opcode is valid
 			raise AssemblyError(f"invalid number of arguments for {parts[0]}")
-		elif len(parts) == 4:
+		dest = get_reg(parts[1])
+		if len(parts) == 4:
 			src1 = get_reg(parts[2])
 			if parts[3][0] == "#":
 				src2 = get_imm(parts[3])
@@ -262,7 +732,17 @@ def assemble_all_instructions(instrs: list[str], line_numbers: list[int]) -> lis
 # ================
 
 resolve_macros(lines)
+if args.optimize:
+	pinned = pc_relative_lines(lines)
+	for i in pinned:
+		print(f"{RED_ERROR} {filename}:{i + 1}: -O needs code addressed only through labels: \"{lines[i]}\"")
+	if pinned:
+		exit(1)
+	removed = optimize(lines)
+	print(f"optimizer: removed {removed} instructions")
 loops, instrs, line_numbers = gather_loops_and_instrs(lines)
+if args.schedule:
+	schedule_instructions(loops, instrs, line_numbers)
 resolve_loops(loops, instrs)
 
 result = assemble_all_instructions(instrs, line_numbers)
@@ -0,0 +1,507 @@
+/**
+ * Tests of unuasm.py's -s scheduler and -O optimizer. Run from the directory holding unuasm.py,
+ * or build with -DUNUASM=<path>.
+ */
+
+#include "functional.h"
+#include "test_fixture.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef UNUASM
+#define UNUASM "./unuasm.py"
+#endif
+
+#define RANDOM_PROGRAMS		40
+#define MAX_SOURCE			4096
+
+// Programs keep their data at 0x4000 (16384), well past themselves and the
+// allocator's bookkeeping, which both move when -O shortens a program
+#define DATA_START			0x4000
+
+static char data[MEM_SIZE];
+static char reference_data[MEM_SIZE];
+static struct ememory memory = { .data = data };
+static struct ememory reference_memory = { .data = reference_data };
+
+static char source_path[64], image_path[64];
+
+/**
+ * Assembles `source` with unuasm.py and `flags`, reading back the image
+ *
+ * @return	unuasm.py's exit status
+ */
+static int unuasm(const char* source, const char* flags, struct asm_result* result) {
+	*result = (struct asm_result) { 0 };
+	FILE* file = fopen(source_path, "w");
+	assert(file);
+	fputs(source, file);
+	fclose(file);
+	unlink(image_path);
+
+	char command[256];
+	snprintf(command, sizeof(command), "python3 %s %s -o %s %s > /dev/null", UNUASM, flags,
+			 image_path, source_path);
+	int status = system(command);
+	if (status) {
+		return status;
+	}
+	file = fopen(image_path, "rb");
+	assert(file);
+	result->image = malloc(MEM_SIZE);
+	result->size = fread(result->image, 1, MEM_SIZE, file);
+	fclose(file);
+	return 0;
+}
+
+/**
+ * Assembles `source` in process, for the image unuasm.py should produce
+ */
+static struct asm_result expect(const char* source) {
+	struct asm_result result;
+	assert(assemble(source, &result) == 0);
+	return result;
+}
+
+static int same_image(const struct asm_result* a, const struct asm_result* b) {
+	return a->size == b->size && !memcmp(a->image, b->image, a->size);
+}
+
+/**
+ * Runs an image to its HALT with the functional model
+ */
+static struct processor run_functional(const struct asm_result* image, struct ememory* mem) {
+	struct processor proc;
+	assert(load_image(&proc, mem, image->image, image->size, NULL) == 0);
+	uint64_t executed;
+	assert(functional_run(&proc, 1000000, 0, &executed) == HALTED);
+	return proc;
+}
+
+static uint64_t run_cycles(const struct asm_result* image) {
+	struct processor proc;
+	assert(load_image(&proc, &memory, image->image, image->size, NULL) == 0);
+	assert(run_for(&proc, 1000000).reason == STOP_HALT);
+	return proc.stats.cycles;
+}
+
+/**
+ * Checks that `source` computes the same with and without `flags`, and
+ * returns the image assembled with them, which must be no longer. The image
+ * assembled without them goes in `unchanged` unless it is NULL.
+ */
+static struct asm_result check_same_result(const char* source, const char* flags,
+											struct asm_result* unchanged) {
+	struct asm_result plain, changed;
+	assert(unuasm(source, "", &plain) == 0);
+	assert(unuasm(source, flags, &changed) == 0 && changed.size <= plain.size);
+	struct processor a = run_functional(&plain, &reference_memory);
+	struct processor b = run_functional(&changed, &memory);
+	// The PC of the HALT moves with the instructions -O removes
+	assert(!memcmp(a.regs, b.regs, PC * sizeof(word_t)) && a.flag == b.flag);
+	assert(!memcmp(data + DATA_START, reference_data + DATA_START, MEM_SIZE - DATA_START));
+	if (unchanged) {
+		*unchanged = plain;
+	} else {
+		free_asm_result(&plain);
+	}
+	return changed;
+}
+
+/**
+ * Checks that `source` is assembled with `flags` into exactly `output`
+ */
+static void check_output(const char* flags, const char* source, const char* output) {
+	struct asm_result result = check_same_result(source, flags, NULL);
+	struct asm_result expected = expect(output);
+	assert(same_image(&result, &expected));
+	free_asm_result(&result);
+	free_asm_result(&expected);
+}
+
+/* ------------------- Tests ------------------- */
+
+void test_fills_stall() {
+	// The independent moves go between the MOV and the MUL reading it
+	const char* source =
+		"\tmov r1, #3\n"
+		"\tmul r2, r1, r1\n"
+		"\tadd r3, r2, #1\n"
+		"\tmov r4, #5\n"
+		"\tmov r5, #6\n"
+		"\thalt\n";
+	struct asm_result plain;
+	struct asm_result scheduled = check_same_result(source, "-s", &plain);
+	struct asm_result expected = expect(
+		"\tmov r1, #3\n"
+		"\tmov r4, #5\n"
+		"\tmov r5, #6\n"
+		"\tmul r2, r1, r1\n"
+		"\tadd r3, r2, #1\n"
+		"\thalt\n");
+	assert(same_image(&scheduled, &expected));
+	assert(run_cycles(&scheduled) < run_cycles(&plain));
+	free_asm_result(&plain);
+	free_asm_result(&scheduled);
+	free_asm_result(&expected);
+}
+
+void test_latencies() {
+	// A DIV takes long enough to hide a MOV after it as well
+	check_output("-s",
+		"\tmov r1, #3\n"
+		"\tdiv r2, r1, #3\n"
+		"\tadd r3, r2, #1\n"
+		"\tmov r4, #5\n"
+		"\tmov r5, #6\n"
+		"\tmov r6, #7\n"
+		"\thalt\n",
+		"\tmov r1, #3\n"
+		"\tmov r4, #5\n"
+		"\tmov r5, #6\n"
+		"\tdiv r2, r1, #3\n"
+		"\tmov r6, #7\n"
+		"\tadd r3, r2, #1\n"
+		"\thalt\n");
+}
+
+void test_register_dependences() {
+	// r1 may be overwritten once the MUL has read it (WAR), and must be before
+	// the MOV reading it (RAW)
+	check_output("-s",
+		"\tmov r1, #3\n"
+		"\tmul r2, r1, r1\n"
+		"\tadd r3, r2, #1\n"
+		"\tmov r1, #9\n"
+		"\tmov r4, r1\n"
+		"\thalt\n",
+		"\tmov r1, #3\n"
+		"\tmul r2, r1, r1\n"
+		"\tmov r1, #9\n"
+		"\tmov r4, r1\n"
+		"\tadd r3, r2, #1\n"
+		"\thalt\n");
+
+	// The second write of r2 stays last (WAW)
+	const char* waw =
+		"\tmov r1, #3\n"
+		"\tmul r2, r1, r1\n"
+		"\tmov r2, #4\n"
+		"\tadd r3, r2, #1\n"
+		"\thalt\n";
+	check_output("-s", waw, waw);
+}
+
+void test_memory_order() {
+	// Independent work fills the load's shadow, but the store stays after the
+	// load of the same word
+	check_output("-s",
+		"\tmov r7, #16384\n"
+		"\tmov r1, #3\n"
+		"\tload r2, r7, #0\n"
+		"\tadd r3, r2, #1\n"
+		"\tstore r1, r7, #0\n"
+		"\tmov r4, #1\n"
+		"\thalt\n",
+		"\tmov r7, #16384\n"
+		"\tmov r1, #3\n"
+		"\tmov r4, #1\n"
+		"\tload r2, r7, #0\n"
+		"\tstore r1, r7, #0\n"
+		"\tadd r3, r2, #1\n"
+		"\thalt\n");
+}
+
+void test_flag_and_branches() {
+	// Each CMP stays between the flag's previous reader and next writer
+	check_output("-s",
+		"\tmov r1, #3\n"
+		"\tmul r2, r1, r1\n"
+		"\tcmp r2, #9\n"
+		"\tmov r4, #2\n"
+		"\tmov r5, #3\n"
+		"\tbeq skip\n"
+		"\tmov r6, #1\n"
+		"@skip\n"
+		"\tcmp r4, #2\n"
+		"\tbne skip\n"
+		"\thalt\n",
+		"\tmov r1, #3\n"
+		"\tmov r4, #2\n"
+		"\tmov r5, #3\n"
+		"\tmul r2, r1, r1\n"
+		"\tcmp r2, #9\n"
+		"\tbeq skip\n"
+		"\tmov r6, #1\n"
+		"@skip\n"
+		"\tcmp r4, #2\n"
+		"\tbne skip\n"
+		"\thalt\n");
+
+	// Nothing moves up across a label, even to fill a stall
+	const char* label =
+		"\tmov r1, #3\n"
+		"\tmul r2, r1, r1\n"
+		"@here\n"
+		"\tadd r3, r2, #1\n"
+		"\tmov r4, #5\n"
+		"\thalt\n";
+	check_output("-s", label, label);
+}
+
+void test_simplify_and_fold() {
+	// Constants are folded into moves, and no-op moves and additions vanish
+	check_output("-O",
+		"\tmov r1, #3\n"
+		"\tadd r2, r1, #4\n"
+		"\tadd r3, r3, #0\n"
+		"\tmov r4, r4\n"
+		"\tsub r5, r3, #0\n"
+		"\thalt\n",
+		"\tmov r1, #3\n"
+		"\tmov r2, #7\n"
+		"\tmov r5, r3\n"
+		"\thalt\n");
+}
+
+void test_redundant_loads() {
+	// A word of memory read twice is read once, and again after a store
+	check_output("-O",
+		"\tmov r7, #16384\n"
+		"\tmov r2, #5\n"
+		"\tstore r2, r7, #4\n"
+		"\tload r1, r7, #4\n"
+		"\tload r3, r7, #4\n"
+		"\tload r1, r7, #4\n"
+		"\tstore r3, r7, #8\n"
+		"\tload r4, r7, #4\n"
+		"\thalt\n",
+		"\tmov r7, #16384\n"
+		"\tmov r2, #5\n"
+		"\tstore r2, r7, #4\n"
+		"\tload r1, r7, #4\n"
+		"\tmov r3, r1\n"
+		"\tstore r3, r7, #8\n"
+		"\tload r4, r7, #4\n"
+		"\thalt\n");
+
+	// Unless the address is unknown, so it may be a device
+	const char* unknown =
+		"\tmov r7, #16384\n"
+		"\tstore r7, r7, #0\n"
+		"\tload r6, r7, #0\n"
+		"\tload r1, r6, #4\n"
+		"\tload r3, r6, #4\n"
+		"\thalt\n";
+	check_output("-O", unknown, unknown);
+}
+
+void test_device_loads() {
+	// Polling the console's status reads it every time
+	const char* poll =
+		"@poll\n"
+		"\tmov r2, #0\n"
+		"\tload r1, r2, #4\n"
+		"\tload r1, r2, #4\n"
+		"\tload r3, r2, #4\n"
+		"\tcmp r1, #0\n"
+		"\tbeq poll\n"
+		"\thalt\n";
+	struct asm_result result, expected = expect(poll);
+	assert(unuasm(poll, "-O", &result) == 0);
+	assert(same_image(&result, &expected));
+	free_asm_result(&result);
+	free_asm_result(&expected);
+
+	// Memory read again after polling a DMA transfer may have changed
+	const char* dma =
+		"\tmov r7, #16384\n"
+		"\tload r1, r7, #0\n"
+		"\tmov r6, #1\n"
+		"\tshl r6, r6, #16\n"
+		"\tload r2, r6, #20\n"
+		"\tload r3, r7, #0\n"
+		"\thalt\n";
+	expected = expect(dma);
+	assert(unuasm(dma, "-O", &result) == 0);
+	assert(same_image(&result, &expected));
+	free_asm_result(&result);
+	free_asm_result(&expected);
+}
+
+void test_dead_moves() {
+	// Results overwritten before being read are not computed
+	check_output("-O",
+		"\tmov r1, #3\n"
+		"\tmov r1, #4\n"
+		"\tadd r2, r1, r5\n"
+		"\tmov r2, #9\n"
+		"\thalt\n",
+		"\tmov r1, #4\n"
+		"\tmov r2, #9\n"
+		"\thalt\n");
+}
+
+void test_branches_to_next() {
+	// Branching to the next instruction is not branching at all
+	check_output("-O",
+		"\tmov r1, #1\n"
+		"\tcmp r1, #1\n"
+		"\tbeq next\n"
+		"@next\n"
+		"\tmov r2, #2\n"
+		"\thalt\n",
+		"\tmov r1, #1\n"
+		"\tcmp r1, #1\n"
+		"\tmov r2, #2\n"
+		"\thalt\n");
+}
+
+void test_pc_relative() {
+	// Removing the second move would shift the targets, so -O gives up
+	const char* programs[] = {
+		"\tmov r1, #3\n"
+		"\tmov r1, #3\n"
+		"\tadd r2, pc, #8\n"
+		"\tbrn r2, #0\n"
+		"\thalt\n",
+
+		"\tmov r5, #8\n"
+		"\tmov r1, #3\n"
+		"\tmov r1, #3\n"
+		"\tbrn pc, r5\n"
+		"\thalt\n",
+	};
+	for (int i = 0; i < 2; i++) {
+		struct asm_result result;
+		assert(unuasm(programs[i], "-O", &result) != 0);
+		assert(unuasm(programs[i], "-s", &result) == 0);
+		free_asm_result(&result);
+	}
+}
+
+/**
+ * Appends a random instruction that leaves r6 and r7 alone to `source`
+ */
+static void random_instr(char* source, unsigned int* seed) {
+	static const char* alu[] = { "add", "sub", "and", "or", "xor", "mul", "shl", "div", "rem" };
+	char line[64];
+	int dest = 1 + rand_r(seed) % 5, a = rand_r(seed) % 6, b = rand_r(seed) % 6;
+	int imm = rand_r(seed) % 100 - 50;
+	const char* op = alu[rand_r(seed) % 9];
+	switch (rand_r(seed) % 6) {
+		case 0:
+			snprintf(line, sizeof(line), "\tmov r%d, #%d\n", dest, imm);
+			break;
+		case 1:
+			snprintf(line, sizeof(line), "\tload r%d, r7, #%d\n", dest, 4 * (rand_r(seed) % 4));
+			break;
+		case 2:
+			snprintf(line, sizeof(line), "\tstore r%d, r7, #%d\n", a, 4 * (rand_r(seed) % 4));
+			break;
+		case 3:
+			snprintf(line, sizeof(line), "\tcmp r%d, r%d\n", a, b);
+			break;
+		default:
+			// Divisors are nonzero immediates, so nothing faults
+			if (op[0] == 'd' || op[0] == 'r') {
+				snprintf(line, sizeof(line), "\t%s r%d, r%d, #%d\n", op, dest, a, 1 + rand_r(seed) % 7);
+			} else if (rand_r(seed) % 2) {
+				snprintf(line, sizeof(line), "\t%s r%d, r%d, r%d\n", op, dest, a, b);
+			} else {
+				snprintf(line, sizeof(line), "\t%s r%d, r%d, #%d\n", op, dest, a, imm & 15);
+			}
+	}
+	strcat(source, line);
+}
+
+/**
+ * Writes a random program of loops whose bodies may skip ahead, and records
+ * the index of the first instruction of every basic block in `leaders`
+ */
+static int random_program(char* source, unsigned int* seed, int* leaders) {
+	int n = 0, count = 0;
+	source[0] = '\0';
+	strcat(source, "\tmov r7, #16384\n");
+	count++;
+	for (int loop = 0; loop < 3; loop++) {
+		char line[64];
+		snprintf(line, sizeof(line), "\tmov r6, #%d\n@loop%d\n", 1 + rand_r(seed) % 4, loop);
+		strcat(source, line);
+		count++;
+		leaders[n++] = count;
+		for (int i = rand_r(seed) % 10; i > 0; i--, count++) {
+			random_instr(source, seed);
+		}
+		if (rand_r(seed) % 2) {
+			snprintf(line, sizeof(line), "\tbeq skip%d\n", loop);
+			strcat(source, line);
+			leaders[n++] = ++count;
+			for (int i = rand_r(seed) % 4; i > 0; i--, count++) {
+				random_instr(source, seed);
+			}
+			snprintf(line, sizeof(line), "@skip%d\n", loop);
+			strcat(source, line);
+			leaders[n++] = count;
+		}
+		snprintf(line, sizeof(line), "\tsub r6, r6, #1\n\tcmp r6, #0\n\tbne loop%d\n", loop);
+		strcat(source, line);
+		count += 3;
+		leaders[n++] = count;
+	}
+	strcat(source, "\thalt\n");
+	leaders[n++] = count + 1;
+	return n;
+}
+
+static int compare_words(const void* a, const void* b) {
+	return memcmp(a, b, 4);
+}
+
+void test_random_programs() {
+	// Same results, and every block holds the same instructions in some order
+	unsigned int seed = 1;
+	char source[MAX_SOURCE];
+	int leaders[16];
+	for (int p = 0; p < RANDOM_PROGRAMS; p++) {
+		int num_leaders = random_program(source, &seed, leaders);
+		struct asm_result plain, scheduled;
+		scheduled = check_same_result(source, "-s", &plain);
+		assert(scheduled.size == plain.size);
+
+		int start = 0;
+		for (int l = 0; l < num_leaders; l++) {
+			int end = leaders[l];
+			qsort(plain.image + 4 * start, end - start, 4, compare_words);
+			qsort(scheduled.image + 4 * start, end - start, 4, compare_words);
+			start = end;
+		}
+		assert(same_image(&plain, &scheduled));
+		free_asm_result(&plain);
+		free_asm_result(&scheduled);
+	}
+}
+
+int main() {
+	snprintf(source_path, sizeof(source_path), "/tmp/unuasm_test_%d.s", getpid());
+	snprintf(image_path, sizeof(image_path), "/tmp/unuasm_test_%d.u", getpid());
+	test_fills_stall();
+	test_latencies();
+	test_register_dependences();
+	test_memory_order();
+	test_flag_and_branches();
+	test_random_programs();
+	test_simplify_and_fold();
+	test_redundant_loads();
+	test_device_loads();
+	test_dead_moves();
+	test_branches_to_next();
+	test_pc_relative();
+	unlink(source_path);
+	unlink(image_path);
+
+	printf("All tests passed.\n");
+}